@@ -244,7 +244,7 @@ bool ESP32_TCP_Client::isInitialized()
 
 int ESP32_TCP_Client::hostByName(const char *name, IPAddress &ip)
 {
-    return WiFi.hostByName(name, ip);
+    return esp_mail_host_by_name(name, ip);
 }
 
 bool ESP32_TCP_Client::begin(const char *host, uint16_t port)
@@ -52,6 +52,7 @@
 #ifdef ESP32
 
 #include "ESP32_WCS.h"
+#include <WiFi.h>
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
 #include <errno.h>
@@ -60,6 +61,11 @@
 #undef write
 #undef read
 
+__attribute__((weak)) int esp_mail_host_by_name(const char *name, IPAddress &ip)
+{
+    return WiFi.hostByName(name, ip);
+}
+
 ESP32_WCS::ESP32_WCS()
 {
     _ssl = new ssl_ctx;
@@ -179,7 +185,11 @@ int ESP32_WCS::_connect(const char *host, uint16_t port)
     else
         _ssl->client->connect(host, port);
 #else
-    _ssl->client->connect(host, port);
+    IPAddress ip;
+    if (esp_mail_host_by_name(host, ip) == 1)
+        _ssl->client->connect(ip, port);
+    else
+        _ssl->client->connect(host, port);
 #endif
 
     if (!_ssl->client->connected())
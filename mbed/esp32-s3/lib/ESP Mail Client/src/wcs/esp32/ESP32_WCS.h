@@ -60,6 +60,10 @@
 
 typedef void (*DebugMsgCallback)(PGM_P msg, bool newLine);
 
+// Resolves the server host name before the TCP connect. Weak default uses
+// WiFi.hostByName, the application may override it to share a DNS cache.
+int esp_mail_host_by_name(const char *name, IPAddress &ip);
+
 #define ESP_Mail_WCS_CLASS ESP32_SSL_Client
 #define ESP_Mail_WC_CLASS ESP32_SSL_Client
 
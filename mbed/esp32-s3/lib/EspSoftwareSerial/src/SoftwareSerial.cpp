@@ -193,6 +193,7 @@ void SoftwareSerial::end()
         m_buffer.reset();
     }
     m_parityBuffer.reset();
+    m_rxTimes.reset();
     if (m_isrBuffer) {
         m_isrBuffer.reset();
     }
@@ -267,6 +268,7 @@ int SoftwareSerial::read() {
         if (!m_buffer->available()) { return -1; }
     }
     auto val = m_buffer->pop();
+    if (m_rxTimes) m_rxTimes->pop();
     if (m_parityBuffer)
     {
         m_lastReadParity = m_parityBuffer->peek() & m_parityOutPos;
@@ -281,6 +283,25 @@ int SoftwareSerial::read() {
 }
 
 int SoftwareSerial::read(uint8_t* buffer, size_t size) {
+    return readBuffered(buffer, nullptr, size);
+}
+
+int SoftwareSerial::read(uint8_t* buffer, uint32_t* times, size_t size) {
+    return readBuffered(buffer, times, size);
+}
+
+void SoftwareSerial::enableRxTimestamps(bool on) {
+    if (!on || !m_buffer) {
+        m_rxTimes.reset();
+        return;
+    }
+    if (m_rxTimes) return;
+    m_rxTimes.reset(new circular_queue<uint32_t>(m_buffer->capacity()));
+    // Bytes already buffered have no recorded time
+    for (int i = m_buffer->available(); i > 0; --i) m_rxTimes->push(0);
+}
+
+int SoftwareSerial::readBuffered(uint8_t* buffer, uint32_t* times, size_t size) {
     if (!m_rxValid) { return 0; }
     int avail;
     if (0 == (avail = m_buffer->pop_n(buffer, size))) {
@@ -288,6 +309,7 @@ int SoftwareSerial::read(uint8_t* buffer, size_t size) {
         avail = m_buffer->pop_n(buffer, size);
     }
     if (!avail) return 0;
+    if (m_rxTimes) m_rxTimes->pop_n(times, avail);
     if (m_parityBuffer) {
         uint32_t parityBits = avail;
         while (m_parityOutPos >>= 1) ++parityBits;
@@ -499,6 +521,7 @@ size_t IRAM_ATTR SoftwareSerial::write(const uint8_t* buffer, size_t size, Softw
 void SoftwareSerial::flush() {
     if (!m_rxValid) { return; }
     m_buffer->flush();
+    if (m_rxTimes) m_rxTimes->flush();
     if (m_parityBuffer)
     {
         m_parityInPos = m_parityOutPos = 1;
@@ -566,6 +589,8 @@ void SoftwareSerial::rxBits(const uint32_t isrTick) {
             // leading edge of start bit?
             if (level) break;
             m_rxLastBit = -1;
+            // the start bit began at the previous edge
+            m_rxCurStart = isrTick - ticks;
             --bits;
             continue;
         }
@@ -594,6 +619,7 @@ void SoftwareSerial::rxBits(const uint32_t isrTick) {
                 m_overflow = true;
             }
             else {
+                if (m_rxTimes) m_rxTimes->push(m_rxCurStart);
                 if (m_parityBuffer)
                 {
                     if (m_rxCurParity) {
@@ -169,6 +169,13 @@ public:
     int read(char* buffer, size_t size) {
         return read(reinterpret_cast<uint8_t*>(buffer), size);
     }
+    /// Keep the start bit time, in ticks, of every received byte, so frames can be split on line idle gaps.
+    /// Ticks wrap around the full 32 bits, compare them with microsToTicks(micros()).
+    /// Call after begin(), allocates one uint32_t per rx buffer slot.
+    void enableRxTimestamps(bool on);
+    /// Same as read(buffer, size), also stores the start bit time of each byte into times.
+    /// times is left untouched if timestamps are not enabled.
+    int read(uint8_t* buffer, uint32_t* times, size_t size);
     /// @returns The number of bytes read into buffer, up to size. Times out if the limit set through
     ///          Stream::setTimeout() is reached.
     size_t readBytes(uint8_t* buffer, size_t size) override;
@@ -213,6 +220,13 @@ public:
 
     using Print::write;
 
+    static inline uint32_t microsToTicks(uint32_t micros) {
+        return micros << 1;
+    }
+    static inline uint32_t ticksToMicros(uint32_t ticks) {
+        return ticks >> 1;
+    }
+
 private:
     // It's legal to exceed the deadline, for instance,
     // by enabling interrupts.
@@ -239,15 +253,11 @@ private:
     static void disableInterrupts();
     static void restoreInterrupts();
 
+    int readBuffered(uint8_t* buffer, uint32_t* times, size_t size);
+
     static void rxBitISR(SoftwareSerial* self);
     static void rxBitSyncISR(SoftwareSerial* self);
 
-    static inline uint32_t microsToTicks(uint32_t micros) {
-        return micros << 1;
-    }
-    static inline uint32_t ticksToMicros(uint32_t ticks) {
-        return ticks >> 1;
-    }
 
     // Member variables
     int8_t m_rxPin = -1;
@@ -296,6 +306,8 @@ private:
     std::atomic<bool> m_isrOverflow;
     uint32_t m_isrLastTick;
     bool m_rxCurParity = false;
+    std::unique_ptr<circular_queue<uint32_t> > m_rxTimes;
+    uint32_t m_rxCurStart = 0;
     Delegate<void(), void*> m_rxHandler;
 };
 
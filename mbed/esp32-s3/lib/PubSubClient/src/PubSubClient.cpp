@@ -0,0 +1,2012 @@
+/*
+
+  PubSubClient.cpp - A simple client for MQTT.
+  Nick O'Leary
+  http://knolleary.net
+*/
+
+#include "PubSubClient.h"
+#include "Arduino.h"
+
+// Variable byte integer as used for lengths, returns the bytes written
+static uint8_t encodeVarint(uint8_t* buf, uint32_t value) {
+    uint8_t n = 0;
+    do {
+        uint8_t digit = value & 127;
+        value >>= 7;
+        if (value > 0) {
+            digit |= 0x80;
+        }
+        buf[n++] = digit;
+    } while (value > 0);
+    return n;
+}
+
+// Returns the bytes used, 0 when the integer is malformed or not complete in length
+static uint8_t decodeVarint(const uint8_t* buf, uint32_t length, uint32_t* value) {
+    uint32_t multiplier = 1;
+    *value = 0;
+    for (uint8_t n = 0;n<4 && n<length;n++) {
+        *value += (buf[n] & 127) * multiplier;
+        multiplier <<= 7;
+        if ((buf[n] & 128) == 0) {
+            return n+1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t writeProperty(uint8_t* buf, uint32_t pos, uint8_t id, const void* data, uint16_t length) {
+    buf[pos++] = id;
+    buf[pos++] = (length >> 8);
+    buf[pos++] = (length & 0xFF);
+    memcpy(buf+pos, data, length);
+    return pos+length;
+}
+
+PubSubClient::PubSubClient() {
+    this->_state = MQTT_DISCONNECTED;
+    this->_client = NULL;
+    this->stream = NULL;
+    setCallback(NULL);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+
+PubSubClient::PubSubClient(Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+
+PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(addr, port);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(IPAddress addr, uint16_t port, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(addr,port);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(addr, port);
+    setCallback(callback);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(IPAddress addr, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(addr,port);
+    setCallback(callback);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+
+PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(ip, port);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(ip,port);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(ip, port);
+    setCallback(callback);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(uint8_t *ip, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(ip,port);
+    setCallback(callback);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+
+PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(domain,port);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(const char* domain, uint16_t port, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(domain,port);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(domain,port);
+    setCallback(callback);
+    setClient(client);
+    this->stream = NULL;
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+PubSubClient::PubSubClient(const char* domain, uint16_t port, MQTT_CALLBACK_SIGNATURE, Client& client, Stream& stream) {
+    this->_state = MQTT_DISCONNECTED;
+    setServer(domain,port);
+    setCallback(callback);
+    setClient(client);
+    setStream(stream);
+    this->bufferSize = 0;
+    setBufferSize(MQTT_MAX_PACKET_SIZE);
+    setKeepAlive(MQTT_KEEPALIVE);
+    setSocketTimeout(MQTT_SOCKET_TIMEOUT);
+    initState();
+}
+
+PubSubClient::~PubSubClient() {
+  free(this->buffer);
+  free(this->rxBuffer);
+  free(this->corkBuffer);
+  free(this->inflightPool);
+}
+
+void PubSubClient::initState() {
+    setPublishCallback(NULL);
+    for (uint8_t i = 0;i<MQTT_MAX_INFLIGHT;i++) {
+        this->inflight[i].packet = NULL;
+    }
+    this->inflightPool = NULL;
+    this->inflightWindow = MQTT_MAX_INFLIGHT;
+    this->inflightCount = 0;
+    this->retryTimeout = MQTT_RETRY_TIMEOUT;
+    this->lastMsgId = 0;
+    this->nextMsgId = 1;
+    setChunkCallback(NULL, NULL, NULL);
+    setSubscribeCallback(NULL);
+    setConnectCallback(NULL);
+    setMessageHandler(NULL, NULL);
+#if MQTT_QUEUE_SLOTS > 0
+    for (uint32_t i = 0;i<MQTT_QUEUE_SLOTS;i++) {
+        this->queue[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    this->queueTail.store(0, std::memory_order_relaxed);
+    this->queueHead = 0;
+#endif
+    for (uint8_t i = 0;i<MQTT_MAX_PENDING;i++) {
+        this->pending[i].msgId = 0;
+    }
+    this->pendingCount = 0;
+    this->rxChunked = false;
+    this->rxPaused = false;
+    resetParser();
+    this->corkBuffer = NULL;
+    this->corkSize = 0;
+    this->corkLength = 0;
+    this->protocol = MQTT_VERSION;
+    resetSession();
+}
+
+// Aliases and limits only last for one connection
+void PubSubClient::resetSession() {
+    this->receiveMaximum = 0xFFFF;
+    this->sessionKeepAlive = this->keepAlive;
+    this->maximumPacketSize = 0;
+    this->maximumQos = 1;
+    this->aliasMaximum = 0;
+    this->aliasCount = 0;
+    this->aliasPending = false;
+    for (uint8_t i = 0;i<MQTT_TOPIC_ALIAS_MAX;i++) {
+        this->aliasIn[i][0] = 0;
+    }
+    this->rxAlias = 0;
+    memset(&this->rxProperties, 0, sizeof(this->rxProperties));
+}
+
+boolean PubSubClient::connect(const char *id) {
+    return connect(id,NULL,NULL,0,0,0,0,1);
+}
+
+boolean PubSubClient::connect(const char *id, const char *user, const char *pass) {
+    return connect(id,user,pass,0,0,0,0,1);
+}
+
+boolean PubSubClient::connect(const char *id, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage) {
+    return connect(id,NULL,NULL,willTopic,willQos,willRetain,willMessage,1);
+}
+
+boolean PubSubClient::connect(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage) {
+    return connect(id,user,pass,willTopic,willQos,willRetain,willMessage,1);
+}
+
+boolean PubSubClient::connect(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession) {
+    if (!connected()) {
+        uint8_t protocol = this->protocol;
+        if (!connectAsync(id,user,pass,willTopic,willQos,willRetain,willMessage,cleanSession)) {
+            return false;
+        }
+        while (this->_state == MQTT_CONNECTING) {
+            handshake();
+            yield();
+        }
+        if (this->protocol != protocol) {
+            // The broker only speaks 3.1.1
+            return connect(id,user,pass,willTopic,willQos,willRetain,willMessage,cleanSession);
+        }
+        return this->_state == MQTT_CONNECTED;
+    }
+    return true;
+}
+
+boolean PubSubClient::connectAsync(const char *id) {
+    return connectAsync(id,NULL,NULL,0,0,0,0,1);
+}
+
+boolean PubSubClient::connectAsync(const char *id, const char *user, const char *pass) {
+    return connectAsync(id,user,pass,0,0,0,0,1);
+}
+
+// Opens the connection and sends CONNECT, loop() then waits for the CONNACK and the connect
+// callback gets the outcome. Returns false when the connection could not be opened, the TCP
+// connect itself blocks for as long as the Client takes
+boolean PubSubClient::connectAsync(const char *id, const char *user, const char *pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession) {
+    if (this->_state == MQTT_CONNECTING) {
+        return true;
+    }
+    if (!connected()) {
+        int result = 0;
+
+
+        if(_client->connected()) {
+            result = 1;
+        } else {
+            if (domain != NULL) {
+                result = _client->connect(this->domain, this->port);
+            } else {
+                result = _client->connect(this->ip, this->port);
+            }
+        }
+
+        if (result == 1) {
+            // Subscriptions are not carried over
+            expirePending(true);
+            // Ids of unacknowledged publishes stay reserved across the reconnect
+            if (this->inflightCount == 0) {
+                nextMsgId = 1;
+            }
+            // Leave room in the buffer for header and variable length field
+            uint16_t length = MQTT_MAX_HEADER_SIZE;
+            unsigned int j;
+
+#if MQTT_VERSION == MQTT_VERSION_3_1
+            uint8_t d[9] = {0x00,0x06,'M','Q','I','s','d','p', MQTT_VERSION};
+#define MQTT_HEADER_VERSION_LENGTH 9
+#elif MQTT_VERSION == MQTT_VERSION_3_1_1
+            uint8_t d[7] = {0x00,0x04,'M','Q','T','T',this->protocol};
+#define MQTT_HEADER_VERSION_LENGTH 7
+#endif
+            for (j = 0;j<MQTT_HEADER_VERSION_LENGTH;j++) {
+                this->buffer[length++] = d[j];
+            }
+
+            uint8_t v;
+            if (willTopic) {
+                v = 0x04|(willQos<<3)|(willRetain<<5);
+            } else {
+                v = 0x00;
+            }
+            if (cleanSession) {
+                v = v|0x02;
+            }
+
+            if(user != NULL) {
+                v = v|0x80;
+
+                if(pass != NULL) {
+                    v = v|(0x80>>1);
+                }
+            }
+            this->buffer[length++] = v;
+
+            this->buffer[length++] = ((this->keepAlive) >> 8);
+            this->buffer[length++] = ((this->keepAlive) & 0xFF);
+
+            if (this->protocol == MQTT_VERSION_5) {
+                // Properties, the aliases the broker may use towards this client
+                this->buffer[length++] = 3;
+                this->buffer[length++] = MQTTPROP_TOPIC_ALIAS_MAXIMUM;
+                this->buffer[length++] = (MQTT_TOPIC_ALIAS_MAX >> 8);
+                this->buffer[length++] = (MQTT_TOPIC_ALIAS_MAX & 0xFF);
+            }
+
+            CHECK_STRING_LENGTH(length,id)
+            length = writeString(id,this->buffer,length);
+            if (willTopic) {
+                if (this->protocol == MQTT_VERSION_5) {
+                    // No will properties
+                    this->buffer[length++] = 0;
+                }
+                CHECK_STRING_LENGTH(length,willTopic)
+                length = writeString(willTopic,this->buffer,length);
+                CHECK_STRING_LENGTH(length,willMessage)
+                length = writeString(willMessage,this->buffer,length);
+            }
+
+            if(user != NULL) {
+                CHECK_STRING_LENGTH(length,user)
+                length = writeString(user,this->buffer,length);
+                if(pass != NULL) {
+                    CHECK_STRING_LENGTH(length,pass)
+                    length = writeString(pass,this->buffer,length);
+                }
+            }
+
+            // Whatever the last connection left corked is dropped
+            this->corkLength = 0;
+            write(MQTTCONNECT,this->buffer,length-MQTT_MAX_HEADER_SIZE);
+            sendCorked();
+
+            lastInActivity = lastOutActivity = millis();
+
+            this->rxPaused = false;
+            resetParser();
+            resetSession();
+            _state = MQTT_CONNECTING;
+            return true;
+        } else {
+            _state = MQTT_CONNECT_FAILED;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Waits for the CONNACK without blocking
+void PubSubClient::handshake() {
+    uint8_t llen;
+    uint32_t len = readPacket(&llen);
+    if (len == 0) {
+        if (this->_state == MQTT_CONNECTING) {
+            if (_client->connected() && millis()-lastInActivity < this->socketTimeout*1000UL) {
+                return;
+            }
+            _state = MQTT_CONNECTION_TIMEOUT;
+            _client->stop();
+        }
+        // Otherwise readPacket has closed the connection
+        if (connectCallback) {
+            connectCallback(_state);
+        }
+        return;
+    }
+
+    // Acknowledge flags and return code, MQTT 5 adds properties
+    uint8_t* body = this->rxBuffer+llen+1;
+    if ((this->rxBuffer[0]&0xF0) == MQTTCONNACK && len >= llen+3u && body[1] == 0) {
+        if (this->protocol == MQTT_VERSION_5) {
+            decodeProperties(body+2, len-llen-3, NULL);
+        }
+        lastInActivity = millis();
+        pingOutstanding = false;
+        _state = MQTT_CONNECTED;
+        retransmit(true);
+    } else {
+        _state = MQTT_CONNECT_FAILED;
+        if ((this->rxBuffer[0]&0xF0) == MQTTCONNACK && len >= llen+3u) {
+            _state = body[1];
+            if (this->protocol == MQTT_VERSION_5 && (body[1] == MQTT_CONNECT_BAD_PROTOCOL || body[1] == MQTT_REASON_UNSUPPORTED_VERSION)) {
+                // The broker only speaks 3.1.1, the next attempt uses that
+                this->protocol = MQTT_VERSION_3_1_1;
+            }
+        }
+        _client->stop();
+    }
+    if (connectCallback) {
+        connectCallback(_state);
+    }
+}
+
+void PubSubClient::resetParser() {
+    if (this->rxChunked && chunkEnd) {
+        // The connection went away half way through
+        chunkEnd(false);
+    }
+    this->rxChunked = false;
+    this->rxPos = 0;
+    this->rxHeaderLength = 0;
+    this->rxLength = 0;
+    this->rxMultiplier = 1;
+    this->rxRead = 0;
+    this->rxPayload = 0;
+}
+
+// Parses whatever has arrived and returns, a packet is completed over as many calls as it
+// takes to arrive. The fixed header is read a byte at a time so nothing of the next packet
+// is consumed, the body in bulk straight into rxBuffer. Bytes past bufferSize are only
+// passed to the stream. Returns the length kept in rxBuffer once a packet is complete,
+// 0 otherwise
+uint32_t PubSubClient::readPacket(uint8_t* lengthLength) {
+    unsigned long t = millis();
+    if (this->rxPaused) {
+        // Unread data stays in the socket and the TCP window closes on the sender
+        this->rxActivity = t;
+        return 0;
+    }
+
+    int available = _client->available();
+    if (available > 0) {
+        this->rxActivity = t;
+    } else if ((this->rxPos > 0 || this->rxRead > 0) && t - this->rxActivity >= this->socketTimeout*1000UL) {
+        // A packet stalled half way, the stream cannot be resynchronised. rxPos goes back to
+        // 0 after every chunk of a large publish, rxRead counts the whole packet
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        resetParser();
+        return 0;
+    }
+
+    while (this->rxHeaderLength == 0) {
+        if (available <= 0) {
+            return 0;
+        }
+        int digit = _client->read();
+        if (digit < 0) {
+            return 0;
+        }
+        available--;
+        if (this->rxPos == 5) {
+            // Invalid remaining length encoding - kill the connection
+            _state = MQTT_DISCONNECTED;
+            _client->stop();
+            resetParser();
+            return 0;
+        }
+        this->rxBuffer[this->rxPos++] = digit;
+        if (this->rxPos > 1) {
+            this->rxLength += (digit & 127) * this->rxMultiplier;
+            this->rxMultiplier <<= 7; //multiplier *= 128
+            if ((digit & 128) == 0) {
+                this->rxHeaderLength = this->rxPos;
+            }
+        }
+    }
+
+    bool isPublish = (this->rxBuffer[0]&0xF0) == MQTTPUBLISH;
+
+    if (isPublish && chunkData && this->rxRead == 0 && this->rxHeaderLength + this->rxLength > this->bufferSize) {
+        this->rxChunked = true;
+    }
+    if (this->rxChunked) {
+        readChunked(&available);
+        if (this->rxChunked || this->rxHeaderLength == 0) {
+            return 0;
+        }
+    }
+    uint8_t discard[32];
+
+    while (this->rxRead < this->rxLength && available > 0) {
+        uint32_t n = this->rxLength - this->rxRead;
+        if (n > (uint32_t)available) {
+            n = available;
+        }
+        uint8_t* dest = discard;
+        if (this->rxPos < this->bufferSize) {
+            dest = this->rxBuffer + this->rxPos;
+            if (n > (uint32_t)(this->bufferSize - this->rxPos)) {
+                n = this->bufferSize - this->rxPos;
+            }
+        } else if (n > sizeof(discard)) {
+            n = sizeof(discard);
+        }
+        int rc = _client->read(dest, n);
+        if (rc <= 0) {
+            break;
+        }
+        available -= rc;
+        if (dest != discard) {
+            this->rxPos += rc;
+        }
+        uint32_t offset = this->rxRead;
+        this->rxRead += rc;
+
+        if (this->stream && isPublish) {
+            if (this->rxPayload == 0) {
+                this->rxPayload = publishPrefix(this->rxBuffer+this->rxHeaderLength, this->rxPos-this->rxHeaderLength);
+            }
+            if (this->rxPayload > 0 && this->rxRead > this->rxPayload) {
+                uint32_t from = offset > this->rxPayload ? offset : this->rxPayload;
+                this->stream->write(dest+(from-offset), this->rxRead-from);
+            }
+        }
+    }
+
+    if (this->rxRead < this->rxLength) {
+        return 0;
+    }
+
+    *lengthLength = this->rxHeaderLength-1;
+    uint32_t len = this->rxPos;
+    bool overflow = this->rxHeaderLength + this->rxLength > this->bufferSize;
+    resetParser();
+
+    if (!this->stream && overflow) {
+        return 0; // This will cause the packet to be ignored.
+    }
+    return len;
+}
+
+// A publish larger than the buffer is handed to the chunk callbacks as it arrives. The
+// topic and message id are collected first, then every read goes to the start of rxBuffer
+// and is passed on from there. Falls back to dropping the packet when the topic alone does
+// not fit the buffer
+void PubSubClient::readChunked(int* available) {
+    uint8_t* body = this->rxBuffer+this->rxHeaderLength;
+
+    while (this->rxRead < this->rxLength && *available > 0 && !this->rxPaused) {
+        uint32_t n = this->rxLength - this->rxRead;
+        if (n > (uint32_t)*available) {
+            n = *available;
+        }
+        if (n > (uint32_t)(this->bufferSize - this->rxPos)) {
+            n = this->bufferSize - this->rxPos;
+        }
+        int rc = _client->read(this->rxBuffer+this->rxPos, n);
+        if (rc <= 0) {
+            return;
+        }
+        *available -= rc;
+        this->rxPos += rc;
+        this->rxRead += rc;
+        // A publish can take longer than the keepalive to arrive, and a PINGRESP queued
+        // behind it cannot be read before the end. Its bytes show the broker is there
+        lastInActivity = this->rxActivity = millis();
+
+        if (this->rxPayload > 0) {
+            chunkData(this->rxBuffer, this->rxPos);
+            this->rxPos = 0;
+            continue;
+        }
+        uint32_t prefix = publishPrefix(body, this->rxRead);
+        if (prefix == 0 && this->rxPos < this->bufferSize) {
+            continue;
+        }
+        if (prefix == 0 || this->rxHeaderLength + prefix > this->bufferSize) {
+            this->rxChunked = false;
+            return;
+        }
+        if (this->rxRead < prefix) {
+            continue;
+        }
+        char* topic = publishTopic(body, prefix, &this->rxPayload, &this->rxMsgId);
+        if (topic == NULL) {
+            // Malformed, or an alias that is not known
+            this->rxPayload = 0;
+            this->rxChunked = false;
+            return;
+        }
+        if (chunkBegin) {
+            chunkBegin(topic, this->rxLength-prefix);
+        }
+        if (this->rxRead > prefix) {
+            chunkData(this->rxBuffer+this->rxPos-(this->rxRead-prefix), this->rxRead-prefix);
+        }
+        this->rxPos = 0;
+    }
+
+    if (this->rxRead < this->rxLength) {
+        return;
+    }
+    this->rxChunked = false;
+    resetParser();
+    lastInActivity = millis();
+    if (chunkEnd) {
+        chunkEnd(true);
+    }
+    // The fixed header has been overwritten by now, only QoS 1 has a message id
+    if (this->rxMsgId != 0) {
+        this->buffer[0] = MQTTPUBACK;
+        this->buffer[1] = 2;
+        this->buffer[2] = (this->rxMsgId >> 8);
+        this->buffer[3] = (this->rxMsgId & 0xFF);
+        send(this->buffer,4);
+        lastOutActivity = lastInActivity;
+    }
+}
+
+boolean PubSubClient::loop() {
+    if (this->_state == MQTT_CONNECTING) {
+        handshake();
+        return connected();
+    }
+    if (connected()) {
+        unsigned long t = millis();
+        unsigned long keepAlive = this->sessionKeepAlive*1000UL;
+        if (keepAlive > 0 && (t - lastInActivity > keepAlive || t - lastOutActivity > keepAlive)) {
+            if (pingOutstanding && t - lastInActivity > keepAlive) {
+                this->_state = MQTT_CONNECTION_TIMEOUT;
+                _client->stop();
+                return false;
+            } else {
+                // Still receiving while a PINGRESP is outstanding: ping again, the broker
+                // expects a packet from us every keepalive too
+                this->buffer[0] = MQTTPINGREQ;
+                this->buffer[1] = 0;
+                send(this->buffer,2);
+                lastOutActivity = t;
+                if (!pingOutstanding) {
+                    lastInActivity = t;
+                }
+                pingOutstanding = true;
+            }
+        }
+        if (this->inflightCount > 0) {
+            retransmit(false);
+        }
+        if (this->pendingCount > 0) {
+            expirePending(false);
+        }
+#if MQTT_QUEUE_SLOTS > 0
+        drainQueue();
+#endif
+        uint8_t llen;
+        uint16_t len = readPacket(&llen);
+        uint16_t msgId = 0;
+        uint8_t *payload;
+        if (len > 0) {
+            lastInActivity = t;
+            uint8_t type = this->rxBuffer[0]&0xF0;
+            if (type == MQTTPUBLISH) {
+                uint8_t* body = this->rxBuffer+llen+1;
+                if (messageHandler) {
+                    MqttMessage message;
+                    if (parsePublish(body, len-llen-1, &message)) {
+                        messageHandler(messageContext, message);
+                    }
+                    msgId = message.msgId;
+                } else if (callback) {
+                    uint32_t start;
+                    char *topic = publishTopic(body, len-llen-1, &start, &msgId);
+                    if (topic != NULL) {
+                        payload = body+start;
+                        callback(topic,payload,len-llen-1-start);
+                    }
+                }
+                if (msgId != 0) {
+                    this->buffer[0] = MQTTPUBACK;
+                    this->buffer[1] = 2;
+                    this->buffer[2] = (msgId >> 8);
+                    this->buffer[3] = (msgId & 0xFF);
+                    send(this->buffer,4);
+                    lastOutActivity = t;
+                }
+            } else if (type == MQTTPINGREQ) {
+                this->buffer[0] = MQTTPINGRESP;
+                this->buffer[1] = 0;
+                send(this->buffer,2);
+            } else if (type == MQTTPINGRESP) {
+                pingOutstanding = false;
+            } else if (type == MQTTPUBACK) {
+                if (len >= 4) {
+                    // MQTT 5 may add a reason code
+                    acknowledge((this->rxBuffer[2]<<8)+this->rxBuffer[3], len >= 5 ? this->rxBuffer[4] : 0);
+                }
+            } else if (type == MQTTSUBACK || type == MQTTUNSUBACK) {
+                // Packet id, with MQTT 5 properties, then a code per topic
+                uint8_t* body = this->rxBuffer+llen+1;
+                uint32_t pos = 2;
+                if (len >= llen+3u) {
+                    if (this->protocol == MQTT_VERSION_5 && len > llen+3u) {
+                        uint32_t used = decodeProperties(body+2, len-llen-3, NULL);
+                        pos = used > 0 ? pos+used : len-llen-1;
+                    }
+                    settle(type == MQTTSUBACK ? MQTTSUBSCRIBE : MQTTUNSUBSCRIBE, (body[0]<<8)+body[1], body+pos, len-llen-1-pos);
+                }
+            } else if (type == MQTTDISCONNECT) {
+                // Sent by MQTT 5 brokers before they close the connection
+                this->_state = MQTT_DISCONNECTED;
+                _client->stop();
+                return false;
+            }
+        } else if (this->_state != MQTT_CONNECTED) {
+            // readPacket has closed the connection
+            return false;
+        }
+        sendCorked();
+        return true;
+    }
+    return false;
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload) {
+    return publish(topic,(const uint8_t*)payload, payload ? strlen(payload) : 0,false);
+}
+
+boolean PubSubClient::publish(const char* topic, const char* payload, boolean retained) {
+    return publish(topic,(const uint8_t*)payload, payload ? strlen(payload) : 0,retained);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+    return publish(topic, payload, plength, false);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    return publish(topic, payload, plength, retained, 0, NULL);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos) {
+    return publish(topic, payload, plength, retained, qos, NULL);
+}
+
+boolean PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained, uint8_t qos, const MqttProperties* properties) {
+    MqttSegment segment = {payload, plength};
+    return publish(topic, &segment, 1, retained, qos, properties);
+}
+
+boolean PubSubClient::publish(const char* topic, const MqttSegment* segments, uint8_t count, boolean retained) {
+    return publish(topic, segments, count, retained, 0, NULL);
+}
+
+// The variable header is encoded into the buffer. Packets that fit the buffer are still
+// copied and sent with one write, that is cheaper than a write per segment. Larger ones are
+// written as segments: the header from the buffer, then each payload segment from where it
+// is. QoS 1 packets are copied whole and kept until acknowledged
+boolean PubSubClient::publish(const char* topic, const MqttSegment* segments, uint8_t count, boolean retained, uint8_t qos, const MqttProperties* properties) {
+    if (qos > 1 || !connected()) {
+        return false;
+    }
+    if (qos > this->maximumQos) {
+        // The broker would disconnect us for it
+        qos = this->maximumQos;
+    }
+    if (qos == 1 && (this->inflightCount >= this->inflightWindow || this->inflightCount >= this->receiveMaximum)) {
+        return false;
+    }
+    uint32_t plength = 0;
+    for (uint8_t i = 0;i<count;i++) {
+        plength += segments[i].length;
+    }
+    uint8_t header = MQTTPUBLISH;
+    if (qos == 1) {
+        header |= MQTTQOS1;
+    }
+    if (retained) {
+        header |= 1;
+    }
+    uint16_t msgId = qos == 1 ? nextMessageId() : 0;
+    uint32_t length = writePublishHeader(0, topic, msgId, properties);
+    if (length == 0) {
+        return false;
+    }
+    uint32_t remaining = length-MQTT_MAX_HEADER_SIZE+plength;
+    if (!packetFits(remaining)) {
+        return false;
+    }
+
+    if (qos == 1) {
+        size_t hlen = buildHeader(header, this->buffer, remaining);
+        if (hlen+remaining > MQTT_INFLIGHT_SIZE) {
+            return false;
+        }
+        if (this->inflightPool == NULL) {
+            // Allocated once for the window and kept, QoS 1 does not churn the heap
+            this->inflightPool = (uint8_t*)malloc(this->inflightWindow*MQTT_INFLIGHT_SIZE);
+            if (this->inflightPool == NULL) {
+                return false;
+            }
+        }
+        uint8_t slot = 0;
+        while (this->inflight[slot].packet != NULL) {
+            slot++;
+        }
+        uint8_t* packet = this->inflightPool+slot*MQTT_INFLIGHT_SIZE;
+        uint32_t pos = hlen+length-MQTT_MAX_HEADER_SIZE;
+        memcpy(packet, this->buffer+(MQTT_MAX_HEADER_SIZE-hlen), pos);
+        for (uint8_t i = 0;i<count;i++) {
+            memcpy(packet+pos, segments[i].data, segments[i].length);
+            pos += segments[i].length;
+        }
+
+        MqttInflight* message = &this->inflight[slot];
+        message->msgId = msgId;
+        message->retries = 0;
+        message->protocol = this->protocol;
+        message->packet = packet;
+        message->length = pos;
+        message->sentAt = millis();
+        this->inflightCount++;
+        this->lastMsgId = msgId;
+
+        // A failed write is not an error here, the message is sent again after the reconnect
+        send(packet, message->length);
+        lastOutActivity = message->sentAt;
+        return true;
+    }
+
+    boolean rc;
+    if (length+plength <= this->bufferSize) {
+        for (uint8_t i = 0;i<count;i++) {
+            memcpy(this->buffer+length, segments[i].data, segments[i].length);
+            length += segments[i].length;
+        }
+        rc = write(header,this->buffer,length-MQTT_MAX_HEADER_SIZE);
+    } else {
+        size_t hlen = buildHeader(header, this->buffer, remaining);
+        rc = send(this->buffer+(MQTT_MAX_HEADER_SIZE-hlen), length-(MQTT_MAX_HEADER_SIZE-hlen));
+        for (uint8_t i = 0;rc && i<count;i++) {
+            rc = send(segments[i].data, segments[i].length);
+        }
+        lastOutActivity = millis();
+    }
+    if (rc) {
+        commitAlias();
+    }
+    return rc;
+}
+
+// Topic, message id and with MQTT 5 the properties, after the room for the fixed header that
+// starts at start. Returns where they end, 0 when they do not fit the buffer
+uint32_t PubSubClient::writePublishHeader(uint32_t start, const char* topic, uint16_t msgId, const MqttProperties* properties) {
+    size_t tlen = strlen(topic);
+    if (start + MQTT_MAX_HEADER_SIZE + 2 + tlen + 2 > this->bufferSize) {
+        return 0;
+    }
+    uint16_t alias = 0;
+    boolean known = false;
+    this->aliasPending = false;
+    if (this->protocol == MQTT_VERSION_5 && msgId == 0) {
+        // A retransmission could follow a reconnect, so no aliases for QoS 1
+        alias = topicAlias(topic, tlen, &known);
+    }
+    uint32_t length = start + MQTT_MAX_HEADER_SIZE;
+    if (known) {
+        this->buffer[length++] = 0;
+        this->buffer[length++] = 0;
+    } else {
+        length = writeString(topic,this->buffer,length);
+    }
+    if (msgId != 0) {
+        this->buffer[length++] = (msgId >> 8);
+        this->buffer[length++] = (msgId & 0xFF);
+    }
+    if (this->protocol == MQTT_VERSION_5) {
+        length = encodeProperties(this->buffer, length, properties, alias);
+        if (length > 0 && alias > 0 && !known) {
+            // Past aliasCount, so unused until committed
+            memcpy(this->aliasOut[alias-1], topic, tlen+1);
+            this->aliasPending = true;
+        }
+    }
+    return length;
+}
+
+// The alias the last header introduced is in use from now on
+void PubSubClient::commitAlias() {
+    if (this->aliasPending) {
+        this->aliasCount++;
+        this->aliasPending = false;
+    }
+}
+
+// The alias of a topic sent before, otherwise the next free one, 0 once they are used up
+uint16_t PubSubClient::topicAlias(const char* topic, size_t tlen, boolean* known) {
+    *known = false;
+    for (uint8_t i = 0;i<this->aliasCount;i++) {
+        if (strcmp(this->aliasOut[i], topic) == 0) {
+            *known = true;
+            return i+1;
+        }
+    }
+    if (tlen >= MQTT_TOPIC_ALIAS_LENGTH || this->aliasCount >= MQTT_TOPIC_ALIAS_MAX || this->aliasCount >= this->aliasMaximum) {
+        return 0;
+    }
+    return this->aliasCount+1;
+}
+
+// Property length and the properties that are set, returns where they end or 0 when they
+// do not fit the buffer
+uint32_t PubSubClient::encodeProperties(uint8_t* buf, uint32_t pos, const MqttProperties* properties, uint16_t alias) {
+    uint32_t length = 0;
+    if (alias > 0) {
+        length += 3;
+    }
+    if (properties) {
+        if (properties->messageExpiry) {
+            length += 5;
+        }
+        if (properties->payloadFormat) {
+            length += 2;
+        }
+        if (properties->contentType) {
+            length += 3 + properties->contentTypeLength;
+        }
+        if (properties->responseTopic) {
+            length += 3 + properties->responseTopicLength;
+        }
+        if (properties->correlationData) {
+            length += 3 + properties->correlationLength;
+        }
+    }
+    uint8_t lenBuf[4];
+    uint8_t llen = encodeVarint(lenBuf, length);
+    if (pos + llen + length > this->bufferSize) {
+        return 0;
+    }
+    memcpy(buf+pos, lenBuf, llen);
+    pos += llen;
+
+    if (alias > 0) {
+        buf[pos++] = MQTTPROP_TOPIC_ALIAS;
+        buf[pos++] = (alias >> 8);
+        buf[pos++] = (alias & 0xFF);
+    }
+    if (properties) {
+        if (properties->messageExpiry) {
+            buf[pos++] = MQTTPROP_MESSAGE_EXPIRY;
+            buf[pos++] = (properties->messageExpiry >> 24);
+            buf[pos++] = (properties->messageExpiry >> 16);
+            buf[pos++] = (properties->messageExpiry >> 8);
+            buf[pos++] = (properties->messageExpiry & 0xFF);
+        }
+        if (properties->payloadFormat) {
+            buf[pos++] = MQTTPROP_PAYLOAD_FORMAT;
+            buf[pos++] = properties->payloadFormat;
+        }
+        if (properties->contentType) {
+            pos = writeProperty(buf, pos, MQTTPROP_CONTENT_TYPE, properties->contentType, properties->contentTypeLength);
+        }
+        if (properties->responseTopic) {
+            pos = writeProperty(buf, pos, MQTTPROP_RESPONSE_TOPIC, properties->responseTopic, properties->responseTopicLength);
+        }
+        if (properties->correlationData) {
+            pos = writeProperty(buf, pos, MQTTPROP_CORRELATION_DATA, properties->correlationData, properties->correlationLength);
+        }
+    }
+    return pos;
+}
+
+// Reads a property length and the properties. The limits from the broker and the topic
+// alias are kept, the publish properties go to properties when given, pointing into buf.
+// Returns the bytes used, 0 when the properties are malformed
+uint32_t PubSubClient::decodeProperties(const uint8_t* buf, uint32_t length, MqttProperties* properties) {
+    uint32_t total;
+    uint8_t n = decodeVarint(buf, length, &total);
+    if (n == 0 || total > length-n) {
+        return 0;
+    }
+    uint32_t pos = n;
+    uint32_t end = n+total;
+    while (pos < end) {
+        uint8_t id = buf[pos++];
+        uint32_t value = 0;
+        const uint8_t* data = NULL;
+        uint16_t dataLength = 0;
+        switch (id) {
+        case MQTTPROP_PAYLOAD_FORMAT:
+        case MQTTPROP_REQUEST_PROBLEM:
+        case MQTTPROP_REQUEST_RESPONSE:
+        case MQTTPROP_MAXIMUM_QOS:
+        case MQTTPROP_RETAIN_AVAILABLE:
+        case MQTTPROP_WILDCARD_AVAILABLE:
+        case MQTTPROP_SUBSCRIPTION_ID_AVAILABLE:
+        case MQTTPROP_SHARED_AVAILABLE:
+            if (end-pos < 1) {
+                return 0;
+            }
+            value = buf[pos++];
+            break;
+        case MQTTPROP_SERVER_KEEPALIVE:
+        case MQTTPROP_RECEIVE_MAXIMUM:
+        case MQTTPROP_TOPIC_ALIAS_MAXIMUM:
+        case MQTTPROP_TOPIC_ALIAS:
+            if (end-pos < 2) {
+                return 0;
+            }
+            value = (buf[pos]<<8)+buf[pos+1];
+            pos += 2;
+            break;
+        case MQTTPROP_MESSAGE_EXPIRY:
+        case MQTTPROP_SESSION_EXPIRY:
+        case MQTTPROP_WILL_DELAY:
+        case MQTTPROP_MAXIMUM_PACKET_SIZE:
+            if (end-pos < 4) {
+                return 0;
+            }
+            value = ((uint32_t)buf[pos]<<24)+((uint32_t)buf[pos+1]<<16)+(buf[pos+2]<<8)+buf[pos+3];
+            pos += 4;
+            break;
+        case MQTTPROP_SUBSCRIPTION_ID:
+            n = decodeVarint(buf+pos, end-pos, &value);
+            if (n == 0) {
+                return 0;
+            }
+            pos += n;
+            break;
+        case MQTTPROP_USER_PROPERTY:
+            // A name and a value
+            if (end-pos < 2 || end-pos-2 < (uint32_t)(buf[pos]<<8)+buf[pos+1]) {
+                return 0;
+            }
+            pos += 2+(buf[pos]<<8)+buf[pos+1];
+            // fall through
+        case MQTTPROP_CONTENT_TYPE:
+        case MQTTPROP_RESPONSE_TOPIC:
+        case MQTTPROP_CORRELATION_DATA:
+        case MQTTPROP_CLIENT_ID:
+        case MQTTPROP_AUTH_METHOD:
+        case MQTTPROP_AUTH_DATA:
+        case MQTTPROP_RESPONSE_INFO:
+        case MQTTPROP_SERVER_REFERENCE:
+        case MQTTPROP_REASON_STRING:
+            if (end-pos < 2) {
+                return 0;
+            }
+            dataLength = (buf[pos]<<8)+buf[pos+1];
+            pos += 2;
+            if (end-pos < dataLength) {
+                return 0;
+            }
+            data = buf+pos;
+            pos += dataLength;
+            break;
+        default:
+            return 0;
+        }
+
+        if (id == MQTTPROP_RECEIVE_MAXIMUM && value > 0) {
+            this->receiveMaximum = value;
+        } else if (id == MQTTPROP_SERVER_KEEPALIVE) {
+            // Replaces ours for this connection, 0 turns keepalive off
+            this->sessionKeepAlive = value;
+        } else if (id == MQTTPROP_MAXIMUM_PACKET_SIZE && value > 0) {
+            this->maximumPacketSize = value;
+        } else if (id == MQTTPROP_MAXIMUM_QOS) {
+            this->maximumQos = value;
+        } else if (id == MQTTPROP_TOPIC_ALIAS_MAXIMUM) {
+            this->aliasMaximum = value;
+        } else if (id == MQTTPROP_TOPIC_ALIAS) {
+            this->rxAlias = value;
+        } else if (properties) {
+            if (id == MQTTPROP_MESSAGE_EXPIRY) {
+                properties->messageExpiry = value;
+            } else if (id == MQTTPROP_PAYLOAD_FORMAT) {
+                properties->payloadFormat = value;
+            } else if (id == MQTTPROP_CONTENT_TYPE) {
+                properties->contentType = (const char*)data;
+                properties->contentTypeLength = dataLength;
+            } else if (id == MQTTPROP_RESPONSE_TOPIC) {
+                properties->responseTopic = (const char*)data;
+                properties->responseTopicLength = dataLength;
+            } else if (id == MQTTPROP_CORRELATION_DATA) {
+                properties->correlationData = data;
+                properties->correlationLength = dataLength;
+            }
+        }
+    }
+    return end;
+}
+
+// Length of the topic, message id and MQTT 5 properties in front of a publish payload, 0
+// while too little of the body has arrived to tell
+uint32_t PubSubClient::publishPrefix(const uint8_t* body, uint32_t length) {
+    if (length < 2) {
+        return 0;
+    }
+    uint32_t prefix = 2 + (body[0]<<8) + body[1];
+    if ((this->rxBuffer[0]&0x06) == MQTTQOS1) {
+        prefix += 2;
+    }
+    if (this->protocol == MQTT_VERSION_5) {
+        uint32_t properties;
+        if (length <= prefix) {
+            return 0;
+        }
+        uint8_t n = decodeVarint(body+prefix, length-prefix, &properties);
+        if (n == 0) {
+            return 0;
+        }
+        prefix += n + properties;
+    }
+    return prefix;
+}
+
+// Finds topic, message id and payload of a received publish without moving anything. With
+// MQTT 5 the properties go to rxProperties and topic aliases are applied. Returns false when
+// the packet is malformed or uses an alias that is not known
+boolean PubSubClient::parsePublish(uint8_t* body, uint32_t length, MqttMessage* message) {
+    uint8_t header = this->rxBuffer[0];
+    message->qos = (header&0x06) >> 1;
+    message->retain = (header&1) != 0;
+    message->dup = (header&MQTTDUP) != 0;
+    message->msgId = 0;
+    if (length < 2) {
+        return false;
+    }
+    uint16_t tl = (body[0]<<8)+body[1]; /* topic length in bytes */
+    uint32_t pos = 2+tl;
+    // msgId only present for QOS>0
+    if ((header&0x06) == MQTTQOS1) {
+        if (pos+2 > length) {
+            return false;
+        }
+        message->msgId = (body[pos]<<8)+body[pos+1];
+        pos += 2;
+    }
+    if (pos > length) {
+        return false;
+    }
+    message->topic = (const char*)body+2;
+    message->topicLength = tl;
+
+    if (this->protocol == MQTT_VERSION_5) {
+        memset(&this->rxProperties, 0, sizeof(this->rxProperties));
+        this->rxAlias = 0;
+        uint32_t used = decodeProperties(body+pos, length-pos, &this->rxProperties);
+        if (used == 0) {
+            return false;
+        }
+        pos += used;
+        if (this->rxAlias > MQTT_TOPIC_ALIAS_MAX) {
+            return false;
+        }
+        if (this->rxAlias > 0) {
+            char* alias = this->aliasIn[this->rxAlias-1];
+            if (tl == 0) {
+                if (alias[0] == 0) {
+                    return false;
+                }
+                message->topic = alias;
+                message->topicLength = strlen(alias);
+            } else if (tl < MQTT_TOPIC_ALIAS_LENGTH) {
+                memcpy(alias, body+2, tl);
+                alias[tl] = 0;
+            } else {
+                alias[0] = 0;
+            }
+        }
+    }
+    message->payload = body+pos;
+    message->length = length-pos;
+    return true;
+}
+
+// As parsePublish, with the topic moved one byte to the front so it can be ended with a NUL
+char* PubSubClient::publishTopic(uint8_t* body, uint32_t length, uint32_t* payload, uint16_t* msgId) {
+    MqttMessage message;
+    boolean valid = parsePublish(body, length, &message);
+    *msgId = message.msgId;
+    if (!valid) {
+        return NULL;
+    }
+    *payload = message.payload-body;
+    if (message.topic != (const char*)body+2) {
+        // An alias, already ended
+        return (char*)message.topic;
+    }
+    memmove(body+1,body+2,message.topicLength); /* move topic inside buffer 1 byte to front */
+    body[1+message.topicLength] = 0; /* end the topic as a 'C' string with \x00 */
+    return (char*)body+1;
+}
+
+#if MQTT_QUEUE_SLOTS > 0
+static_assert((MQTT_QUEUE_SLOTS & (MQTT_QUEUE_SLOTS-1)) == 0, "MQTT_QUEUE_SLOTS must be a power of two");
+
+// A bounded queue where every slot carries a sequence number: a producer claims the tail
+// position with a compare and swap, fills the slot and publishes it by advancing its
+// sequence. loop() is the only consumer. No locks, so it is safe from interrupts too
+boolean PubSubClient::enqueue(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    size_t tlen = strlen(topic);
+    if (tlen + 1 + plength > MQTT_QUEUE_SLOT_SIZE) {
+        return false;
+    }
+    uint32_t pos = this->queueTail.load(std::memory_order_relaxed);
+    MqttQueued* slot;
+    for (;;) {
+        slot = &this->queue[pos & (MQTT_QUEUE_SLOTS-1)];
+        int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (this->queueTail.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // Full, the slot still holds a message from one lap ago
+            return false;
+        } else {
+            pos = this->queueTail.load(std::memory_order_relaxed);
+        }
+    }
+    memcpy(slot->data, topic, tlen+1);
+    memcpy(slot->data+tlen+1, payload, plength);
+    slot->topicLength = tlen;
+    slot->length = plength;
+    slot->retained = retained;
+    slot->sequence.store(pos+1, std::memory_order_release);
+    return true;
+}
+
+// Publishes what was queued. The packets are packed back to back into the buffer and go
+// out with one write per buffer full. Slots are freed once their write reached the socket,
+// so the packed writes bypass the cork, behind what it held. After a failed write the rest
+// waits for the next loop()
+void PubSubClient::drainQueue() {
+    uint32_t pos = 0;
+    uint32_t next = this->queueHead;
+    // Aliases introduced by what is packed and not yet written
+    uint8_t aliases = this->aliasCount;
+    for (;;) {
+        MqttQueued* slot = &this->queue[next & (MQTT_QUEUE_SLOTS-1)];
+        boolean ready = slot->sequence.load(std::memory_order_acquire) == next+1;
+        // Worst case, with an MQTT 5 alias
+        uint32_t size = 0;
+        boolean fits = true;
+        if (ready) {
+            size = MQTT_MAX_HEADER_SIZE + 2 + slot->topicLength + 4 + slot->length;
+            fits = packetFits(2 + slot->topicLength + (this->protocol == MQTT_VERSION_5 ? 4 : 0) + slot->length);
+        }
+        if (pos > 0 && (!ready || !fits || pos + size > this->bufferSize)) {
+            if (!sendCorked() || !writeSegment(this->buffer, pos)) {
+                this->aliasCount = aliases;
+                break;
+            }
+            lastOutActivity = millis();
+            releaseQueued(next);
+            aliases = this->aliasCount;
+            pos = 0;
+        }
+        if (!ready) {
+            break;
+        }
+        const char* topic = (const char*)slot->data;
+        const uint8_t* payload = slot->data+slot->topicLength+1;
+        if (!fits) {
+            // Too large for the broker with an alias, dropped
+        } else if (size > this->bufferSize) {
+            if (!publish(topic, payload, slot->length, slot->retained) || !sendCorked()) {
+                break;
+            }
+            aliases = this->aliasCount;
+        } else {
+            uint8_t header = MQTTPUBLISH;
+            if (slot->retained) {
+                header |= 1;
+            }
+            uint32_t end = writePublishHeader(pos, topic, 0, NULL);
+            memcpy(this->buffer+end, payload, slot->length);
+            end += slot->length;
+            // Close the gap the variable length header leaves in front
+            size_t gap = MQTT_MAX_HEADER_SIZE - buildHeader(header, this->buffer+pos, end-pos-MQTT_MAX_HEADER_SIZE);
+            memmove(this->buffer+pos, this->buffer+pos+gap, end-pos-gap);
+            pos = end-gap;
+            // Later packets of this write may use it already
+            commitAlias();
+            next++;
+            continue;
+        }
+        next++;
+        releaseQueued(next);
+    }
+}
+
+// Hands the slots up to end back to the producers
+void PubSubClient::releaseQueued(uint32_t end) {
+    while (this->queueHead != end) {
+        MqttQueued* slot = &this->queue[this->queueHead & (MQTT_QUEUE_SLOTS-1)];
+        slot->sequence.store(this->queueHead+MQTT_QUEUE_SLOTS, std::memory_order_release);
+        this->queueHead++;
+    }
+}
+#endif
+
+// Corked, data is copied behind what is waiting and the buffer is sent first when it would
+// overflow. Data that does not fit an empty buffer is written as it is
+boolean PubSubClient::send(const uint8_t* data, size_t length) {
+    if (this->corkSize == 0) {
+        return writeSegment(data, length);
+    }
+    if (this->corkLength + length > this->corkSize && !sendCorked()) {
+        return false;
+    }
+    if (length > this->corkSize) {
+        return writeSegment(data, length);
+    }
+    memcpy(this->corkBuffer+this->corkLength, data, length);
+    this->corkLength += length;
+    return true;
+}
+
+boolean PubSubClient::sendCorked() {
+    if (this->corkLength == 0) {
+        return true;
+    }
+    uint16_t length = this->corkLength;
+    this->corkLength = 0;
+    if (!writeSegment(this->corkBuffer, length)) {
+        // Packets already reported as sent are lost or cut short, the stream cannot go on.
+        // QoS 1 ones are sent again after the reconnect
+        if (this->_state == MQTT_CONNECTED) {
+            this->_state = MQTT_CONNECTION_LOST;
+        }
+        _client->stop();
+        return false;
+    }
+    return true;
+}
+
+void PubSubClient::flush() {
+    sendCorked();
+}
+
+boolean PubSubClient::writeSegment(const uint8_t* data, size_t length) {
+#ifdef MQTT_MAX_TRANSFER_SIZE
+    while (length > 0) {
+        size_t bytesToWrite = (length > MQTT_MAX_TRANSFER_SIZE)?MQTT_MAX_TRANSFER_SIZE:length;
+        if (_client->write(data,bytesToWrite) != bytesToWrite) {
+            return false;
+        }
+        data += bytesToWrite;
+        length -= bytesToWrite;
+    }
+    return true;
+#else
+    return length == 0 || _client->write(data,length) == length;
+#endif
+}
+
+void PubSubClient::acknowledge(uint16_t msgId, uint8_t reason) {
+    for (uint8_t i = 0;i<MQTT_MAX_INFLIGHT;i++) {
+        MqttInflight* message = &this->inflight[i];
+        if (message->packet != NULL && message->msgId == msgId) {
+            message->packet = NULL;
+            this->inflightCount--;
+            if (publishCallback) {
+                publishCallback(msgId, reason < 0x80);
+            }
+            return;
+        }
+    }
+}
+
+// Sends unacknowledged publishes again with the DUP flag: all of them after a reconnect,
+// otherwise those older than retryTimeout. Only timeouts count towards MQTT_MAX_RETRIES
+void PubSubClient::retransmit(boolean all) {
+    unsigned long t = millis();
+    for (uint8_t i = 0;i<MQTT_MAX_INFLIGHT;i++) {
+        MqttInflight* message = &this->inflight[i];
+        if (message->packet == NULL) {
+            continue;
+        }
+        if (!all) {
+            if (t - message->sentAt < this->retryTimeout*1000UL) {
+                continue;
+            }
+            if (MQTT_MAX_RETRIES > 0 && message->retries >= MQTT_MAX_RETRIES) {
+                uint16_t msgId = message->msgId;
+                message->packet = NULL;
+                this->inflightCount--;
+                if (publishCallback) {
+                    publishCallback(msgId, false);
+                }
+                continue;
+            }
+            message->retries++;
+        } else if (message->protocol != this->protocol && !reencode(message)) {
+            uint16_t msgId = message->msgId;
+            message->packet = NULL;
+            this->inflightCount--;
+            if (publishCallback) {
+                publishCallback(msgId, false);
+            }
+            continue;
+        }
+        message->packet[0] |= MQTTDUP;
+        message->sentAt = t;
+        send(message->packet, message->length);
+        lastOutActivity = t;
+    }
+}
+
+// Rewrites a kept publish for the protocol the connection fell back to, or moved up to: MQTT 5
+// has a property block after the message id, 3.1.1 has none. QoS 1 publishes carry no alias,
+// so only the block changes. Returns false when the packet no longer fits its slot
+boolean PubSubClient::reencode(MqttInflight* message) {
+    uint8_t* packet = message->packet;
+    uint32_t remaining;
+    uint8_t llen = decodeVarint(packet+1, message->length-1, &remaining);
+    if (llen == 0) {
+        return false;
+    }
+    uint32_t hlen = 1+llen;
+    uint32_t prefix = 2+((packet[hlen]<<8)|packet[hlen+1])+2;
+    uint32_t skip = 0;
+    if (message->protocol == MQTT_VERSION_5) {
+        uint32_t properties;
+        uint8_t n = decodeVarint(packet+hlen+prefix, remaining-prefix, &properties);
+        if (n == 0) {
+            return false;
+        }
+        skip = n+properties;
+    }
+    uint32_t insert = this->protocol == MQTT_VERSION_5 ? 1 : 0;
+    uint32_t plength = remaining-prefix-skip;
+    uint8_t header[MQTT_MAX_HEADER_SIZE];
+    uint32_t newHlen = buildHeader(packet[0], header, prefix+insert+plength);
+    if (newHlen+prefix+insert+plength > MQTT_INFLIGHT_SIZE) {
+        return false;
+    }
+    // Whichever piece moves right goes first, so neither overwrites the other
+    uint8_t* payload = packet+hlen+prefix+skip;
+    uint8_t* newPayload = packet+newHlen+prefix+insert;
+    if (newPayload > payload) {
+        memmove(newPayload, payload, plength);
+        memmove(packet+newHlen, packet+hlen, prefix);
+    } else {
+        memmove(packet+newHlen, packet+hlen, prefix);
+        memmove(newPayload, payload, plength);
+    }
+    memcpy(packet, header+MQTT_MAX_HEADER_SIZE-newHlen, newHlen);
+    if (insert) {
+        packet[newHlen+prefix] = 0;
+    }
+    message->length = newHlen+prefix+insert+plength;
+    message->protocol = this->protocol;
+    return true;
+}
+
+// Skips 0 and the ids still in flight
+uint16_t PubSubClient::nextMessageId() {
+    boolean used;
+    do {
+        nextMsgId++;
+        if (nextMsgId == 0) {
+            nextMsgId = 1;
+        }
+        used = false;
+        for (uint8_t i = 0;i<MQTT_MAX_INFLIGHT;i++) {
+            if (this->inflight[i].packet != NULL && this->inflight[i].msgId == nextMsgId) {
+                used = true;
+            }
+        }
+        for (uint8_t i = 0;i<MQTT_MAX_PENDING;i++) {
+            if (this->pending[i].msgId == nextMsgId) {
+                used = true;
+            }
+        }
+    } while (used);
+    return nextMsgId;
+}
+
+boolean PubSubClient::publish_P(const char* topic, const char* payload, boolean retained) {
+    return publish_P(topic, (const uint8_t*)payload, payload ? strnlen(payload, this->bufferSize) : 0, retained);
+}
+
+boolean PubSubClient::publish_P(const char* topic, const uint8_t* payload, unsigned int plength, boolean retained) {
+    uint8_t llen = 0;
+    uint8_t digit;
+    unsigned int rc = 0;
+    uint16_t tlen;
+    unsigned int pos = 0;
+    unsigned int i;
+    uint8_t header;
+    unsigned int len;
+    int expectedLength;
+
+    if (!connected()) {
+        return false;
+    }
+
+    tlen = strnlen(topic, this->bufferSize);
+    if (!packetFits(plength + 2 + tlen + (this->protocol == MQTT_VERSION_5 ? 1 : 0))) {
+        return false;
+    }
+
+    header = MQTTPUBLISH;
+    if (retained) {
+        header |= 1;
+    }
+    this->buffer[pos++] = header;
+    // An empty property length with MQTT 5
+    uint8_t plen = this->protocol == MQTT_VERSION_5 ? 1 : 0;
+    len = plength + 2 + tlen + plen;
+    do {
+        digit = len  & 127; //digit = len %128
+        len >>= 7; //len = len / 128
+        if (len > 0) {
+            digit |= 0x80;
+        }
+        this->buffer[pos++] = digit;
+        llen++;
+    } while(len>0);
+
+    pos = writeString(topic,this->buffer,pos);
+    if (plen > 0) {
+        this->buffer[pos++] = 0;
+    }
+
+    if (send(this->buffer,pos)) {
+        rc += pos;
+    }
+
+    for (i=0;i<plength;i++) {
+        uint8_t c = pgm_read_byte_near(payload + i);
+        if (send(&c,1)) {
+            rc++;
+        }
+    }
+
+    lastOutActivity = millis();
+
+    expectedLength = 1 + llen + 2 + tlen + plen + plength;
+
+    return (rc == expectedLength);
+}
+
+boolean PubSubClient::beginPublish(const char* topic, unsigned int plength, boolean retained) {
+    if (connected()) {
+        // Send the header and variable length field
+        uint16_t length = MQTT_MAX_HEADER_SIZE;
+        length = writeString(topic,this->buffer,length);
+        if (this->protocol == MQTT_VERSION_5) {
+            // No properties
+            this->buffer[length++] = 0;
+        }
+        uint8_t header = MQTTPUBLISH;
+        if (retained) {
+            header |= 1;
+        }
+        if (!packetFits(plength+length-MQTT_MAX_HEADER_SIZE)) {
+            return false;
+        }
+        size_t hlen = buildHeader(header, this->buffer, plength+length-MQTT_MAX_HEADER_SIZE);
+        boolean rc = send(this->buffer+(MQTT_MAX_HEADER_SIZE-hlen),length-(MQTT_MAX_HEADER_SIZE-hlen));
+        lastOutActivity = millis();
+        return rc;
+    }
+    return false;
+}
+
+int PubSubClient::endPublish() {
+ return 1;
+}
+
+size_t PubSubClient::write(uint8_t data) {
+    lastOutActivity = millis();
+    return send(&data,1) ? 1 : 0;
+}
+
+size_t PubSubClient::write(const uint8_t *buffer, size_t size) {
+    lastOutActivity = millis();
+    return send(buffer,size) ? size : 0;
+}
+
+// Whether a packet with this remaining length is within the broker's Maximum Packet Size
+boolean PubSubClient::packetFits(uint32_t remaining) {
+    if (this->maximumPacketSize == 0) {
+        return true;
+    }
+    uint32_t size = 2 + remaining;
+    for (uint32_t len = remaining >> 7;len > 0;len >>= 7) {
+        size++;
+    }
+    return size <= this->maximumPacketSize;
+}
+
+size_t PubSubClient::buildHeader(uint8_t header, uint8_t* buf, uint32_t length) {
+    uint8_t lenBuf[4];
+    uint8_t llen = 0;
+    uint8_t digit;
+    uint8_t pos = 0;
+    uint32_t len = length;
+    do {
+
+        digit = len  & 127; //digit = len %128
+        len >>= 7; //len = len / 128
+        if (len > 0) {
+            digit |= 0x80;
+        }
+        lenBuf[pos++] = digit;
+        llen++;
+    } while(len>0);
+
+    buf[4-llen] = header;
+    for (int i=0;i<llen;i++) {
+        buf[MQTT_MAX_HEADER_SIZE-llen+i] = lenBuf[i];
+    }
+    return llen+1; // Full header size is variable length bit plus the 1-byte fixed header
+}
+
+boolean PubSubClient::write(uint8_t header, uint8_t* buf, uint16_t length) {
+    uint8_t hlen = buildHeader(header, buf, length);
+    boolean rc = send(buf+(MQTT_MAX_HEADER_SIZE-hlen),length+hlen);
+    lastOutActivity = millis();
+    return rc;
+}
+
+boolean PubSubClient::subscribe(const char* topic) {
+    return subscribe(topic, 0);
+}
+
+boolean PubSubClient::subscribe(const char* topic, uint8_t qos) {
+    return subscribe(&topic, &qos, 1) != 0;
+}
+
+boolean PubSubClient::unsubscribe(const char* topic) {
+    return unsubscribe(&topic, 1) != 0;
+}
+
+uint16_t PubSubClient::subscribe(const char* const* topics, const uint8_t* qos, uint8_t count) {
+    return sendSubscribe(MQTTSUBSCRIBE, topics, qos, count);
+}
+
+uint16_t PubSubClient::unsubscribe(const char* const* topics, uint8_t count) {
+    return sendSubscribe(MQTTUNSUBSCRIBE, topics, NULL, count);
+}
+
+// Unsubscribe has no QoS byte after each filter
+uint16_t PubSubClient::sendSubscribe(uint8_t type, const char* const* topics, const uint8_t* qos, uint8_t count) {
+    if (count == 0 || !connected()) {
+        return 0;
+    }
+    size_t length = MQTT_MAX_HEADER_SIZE + 2;
+    if (this->protocol == MQTT_VERSION_5) {
+        length++;
+    }
+    for (uint8_t i = 0;i<count;i++) {
+        if (topics[i] == NULL || (qos && qos[i] > 1)) {
+            return 0;
+        }
+        length += 2 + strnlen(topics[i], this->bufferSize) + (qos ? 1 : 0);
+    }
+    if (length > this->bufferSize) {
+        // Too long
+        return 0;
+    }
+    MqttPending* slot = NULL;
+    if (subscribeCallback) {
+        for (uint8_t i = 0;i<MQTT_MAX_PENDING && slot == NULL;i++) {
+            if (this->pending[i].msgId == 0) {
+                slot = &this->pending[i];
+            }
+        }
+        if (slot == NULL) {
+            return 0;
+        }
+    }
+
+    // Leave room in the buffer for header and variable length field
+    uint16_t msgId = nextMessageId();
+    length = MQTT_MAX_HEADER_SIZE;
+    this->buffer[length++] = (msgId >> 8);
+    this->buffer[length++] = (msgId & 0xFF);
+    if (this->protocol == MQTT_VERSION_5) {
+        this->buffer[length++] = 0;
+    }
+    for (uint8_t i = 0;i<count;i++) {
+        length = writeString(topics[i], this->buffer, length);
+        if (qos) {
+            this->buffer[length++] = qos[i];
+        }
+    }
+    if (!write(type|MQTTQOS1,this->buffer,length-MQTT_MAX_HEADER_SIZE) || !sendCorked()) {
+        return 0;
+    }
+    if (slot) {
+        slot->msgId = msgId;
+        slot->type = type;
+        slot->count = count;
+        slot->sentAt = millis();
+        this->pendingCount++;
+    }
+    return msgId;
+}
+
+void PubSubClient::settle(uint8_t type, uint16_t msgId, uint8_t* codes, uint8_t count) {
+    for (uint8_t i = 0;i<MQTT_MAX_PENDING;i++) {
+        MqttPending* request = &this->pending[i];
+        if (request->msgId == msgId && request->type == type) {
+            request->msgId = 0;
+            this->pendingCount--;
+            if (subscribeCallback) {
+                subscribeCallback(msgId, codes, count);
+            }
+            return;
+        }
+    }
+}
+
+// Gives up on requests older than the socket timeout, or on all of them when the
+// connection is gone
+void PubSubClient::expirePending(boolean all) {
+    unsigned long t = millis();
+    for (uint8_t i = 0;i<MQTT_MAX_PENDING;i++) {
+        MqttPending* request = &this->pending[i];
+        if (request->msgId == 0 || (!all && t - request->sentAt < this->socketTimeout*1000UL)) {
+            continue;
+        }
+        uint16_t msgId = request->msgId;
+        request->msgId = 0;
+        this->pendingCount--;
+        if (subscribeCallback) {
+            subscribeCallback(msgId, NULL, request->count);
+        }
+    }
+}
+
+void PubSubClient::disconnect() {
+    this->buffer[0] = MQTTDISCONNECT;
+    this->buffer[1] = 0;
+    send(this->buffer,2);
+    sendCorked();
+    _state = MQTT_DISCONNECTED;
+    _client->flush();
+    _client->stop();
+    lastInActivity = lastOutActivity = millis();
+}
+
+uint16_t PubSubClient::writeString(const char* string, uint8_t* buf, uint16_t pos) {
+    const char* idp = string;
+    uint16_t i = 0;
+    pos += 2;
+    while (*idp) {
+        buf[pos++] = *idp++;
+        i++;
+    }
+    buf[pos-i-2] = (i >> 8);
+    buf[pos-i-1] = (i & 0xFF);
+    return pos;
+}
+
+
+boolean PubSubClient::connected() {
+    boolean rc;
+    if (_client == NULL ) {
+        rc = false;
+    } else {
+        rc = (int)_client->connected();
+        if (!rc) {
+            if (this->_state == MQTT_CONNECTED) {
+                this->_state = MQTT_CONNECTION_LOST;
+                _client->flush();
+                _client->stop();
+            }
+        } else {
+            return this->_state == MQTT_CONNECTED;
+        }
+    }
+    return rc;
+}
+
+PubSubClient& PubSubClient::setServer(uint8_t * ip, uint16_t port) {
+    IPAddress addr(ip[0],ip[1],ip[2],ip[3]);
+    return setServer(addr,port);
+}
+
+PubSubClient& PubSubClient::setServer(IPAddress ip, uint16_t port) {
+    this->ip = ip;
+    this->port = port;
+    this->domain = NULL;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setServer(const char * domain, uint16_t port) {
+    this->domain = domain;
+    this->port = port;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+    this->callback = callback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setClient(Client& client){
+    this->_client = &client;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setStream(Stream& stream){
+    this->stream = &stream;
+    return *this;
+}
+
+int PubSubClient::state() {
+    return this->_state;
+}
+
+boolean PubSubClient::setBufferSize(uint16_t size) {
+    if (size == 0) {
+        // Cannot set it back to 0
+        return false;
+    }
+    if (this->bufferSize == 0) {
+        this->buffer = (uint8_t*)malloc(size);
+        this->rxBuffer = (uint8_t*)malloc(size);
+    } else {
+        uint8_t* newBuffer = (uint8_t*)realloc(this->buffer, size);
+        if (newBuffer != NULL) {
+            this->buffer = newBuffer;
+        } else {
+            return false;
+        }
+        newBuffer = (uint8_t*)realloc(this->rxBuffer, size);
+        if (newBuffer != NULL) {
+            this->rxBuffer = newBuffer;
+        } else {
+            return false;
+        }
+        // A packet being received does not survive the resize
+        resetParser();
+    }
+    this->bufferSize = size;
+    return (this->buffer != NULL && this->rxBuffer != NULL);
+}
+
+uint16_t PubSubClient::getBufferSize() {
+    return this->bufferSize;
+}
+
+boolean PubSubClient::setCork(uint16_t size) {
+    sendCorked();
+    if (size == 0) {
+        free(this->corkBuffer);
+        this->corkBuffer = NULL;
+        this->corkSize = 0;
+        return true;
+    }
+    uint8_t* newBuffer = (uint8_t*)realloc(this->corkBuffer, size);
+    if (newBuffer == NULL) {
+        return false;
+    }
+    this->corkBuffer = newBuffer;
+    this->corkSize = size;
+    return true;
+}
+PubSubClient& PubSubClient::setKeepAlive(uint16_t keepAlive) {
+    this->keepAlive = keepAlive;
+    this->sessionKeepAlive = keepAlive;
+    return *this;
+}
+PubSubClient& PubSubClient::setSocketTimeout(uint16_t timeout) {
+    this->socketTimeout = timeout;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setPublishCallback(MQTT_PUBLISH_CALLBACK_SIGNATURE) {
+    this->publishCallback = publishCallback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setRetryTimeout(uint16_t timeout) {
+    this->retryTimeout = timeout;
+    return *this;
+}
+
+boolean PubSubClient::setInflightWindow(uint8_t size) {
+    if (size == 0 || size > MQTT_MAX_INFLIGHT) {
+        return false;
+    }
+    if (size != this->inflightWindow) {
+        if (this->inflightCount > 0) {
+            return false;
+        }
+        // The next QoS 1 publish allocates the pool for the new window
+        free(this->inflightPool);
+        this->inflightPool = NULL;
+        this->inflightWindow = size;
+    }
+    return true;
+}
+
+PubSubClient& PubSubClient::setChunkCallback(MQTT_CHUNK_BEGIN_SIGNATURE, MQTT_CHUNK_SIGNATURE, MQTT_CHUNK_END_SIGNATURE) {
+    this->chunkBegin = chunkBegin;
+    this->chunkData = chunkData;
+    this->chunkEnd = chunkEnd;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setMessageHandler(MqttMessageHandler handler, void* context) {
+    this->messageHandler = handler;
+    this->messageContext = context;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setConnectCallback(MQTT_CONNECT_CALLBACK_SIGNATURE) {
+    this->connectCallback = connectCallback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setSubscribeCallback(MQTT_SUBSCRIBE_CALLBACK_SIGNATURE) {
+    this->subscribeCallback = subscribeCallback;
+    return *this;
+}
+
+void PubSubClient::pauseReceive(boolean paused) {
+    this->rxPaused = paused;
+}
+
+uint8_t PubSubClient::getInflight() {
+    return this->inflightCount;
+}
+
+uint16_t PubSubClient::getLastMsgId() {
+    return this->lastMsgId;
+}
+
+PubSubClient& PubSubClient::setProtocolVersion(uint8_t version) {
+#if MQTT_VERSION == MQTT_VERSION_3_1_1
+    if (version == MQTT_VERSION_3_1_1 || version == MQTT_VERSION_5) {
+        this->protocol = version;
+    }
+#endif
+    return *this;
+}
+
+uint8_t PubSubClient::getProtocolVersion() {
+    return this->protocol;
+}
+
+const MqttProperties* PubSubClient::getProperties() {
+    return this->protocol == MQTT_VERSION_5 ? &this->rxProperties : NULL;
+}
@@ -0,0 +1,515 @@
+/*
+ PubSubClient.h - A simple client for MQTT.
+  Nick O'Leary
+  http://knolleary.net
+*/
+
+#ifndef PubSubClient_h
+#define PubSubClient_h
+
+#include <Arduino.h>
+#include "IPAddress.h"
+#include "Client.h"
+#include "Stream.h"
+
+#define MQTT_VERSION_3_1      3
+#define MQTT_VERSION_3_1_1    4
+#define MQTT_VERSION_5        5
+
+// MQTT_VERSION : Pick the version
+//#define MQTT_VERSION MQTT_VERSION_3_1
+#ifndef MQTT_VERSION
+#define MQTT_VERSION MQTT_VERSION_3_1_1
+#endif
+
+// MQTT_MAX_PACKET_SIZE : Maximum packet size. Override with setBufferSize().
+#ifndef MQTT_MAX_PACKET_SIZE
+#define MQTT_MAX_PACKET_SIZE 256
+#endif
+
+// MQTT_KEEPALIVE : keepAlive interval in Seconds. Override with setKeepAlive()
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+
+// MQTT_SOCKET_TIMEOUT: socket timeout interval in Seconds. Override with setSocketTimeout()
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15
+#endif
+
+// MQTT_MAX_INFLIGHT : Maximum number of QoS 1 publishes awaiting a PUBACK. Lower the
+//  window with setInflightWindow()
+#ifndef MQTT_MAX_INFLIGHT
+#define MQTT_MAX_INFLIGHT 8
+#endif
+
+// MQTT_INFLIGHT_SIZE : Bytes kept for each in-flight QoS 1 publish. The slots come from one
+//  pool allocated for the window, a QoS 1 packet larger than a slot is refused
+#ifndef MQTT_INFLIGHT_SIZE
+#define MQTT_INFLIGHT_SIZE MQTT_MAX_PACKET_SIZE
+#endif
+
+// MQTT_RETRY_TIMEOUT : Seconds before an unacknowledged QoS 1 publish is sent again with
+//  the DUP flag. Override with setRetryTimeout()
+#ifndef MQTT_RETRY_TIMEOUT
+#define MQTT_RETRY_TIMEOUT 10
+#endif
+
+// MQTT_MAX_RETRIES : Retransmissions before a QoS 1 publish is given up and reported as
+//  not delivered. 0 retries forever
+#ifndef MQTT_MAX_RETRIES
+#define MQTT_MAX_RETRIES 5
+#endif
+
+// MQTT_MAX_PENDING : Subscribe and unsubscribe packets tracked until acknowledged, only
+//  when a subscribe callback is set
+#ifndef MQTT_MAX_PENDING
+#define MQTT_MAX_PENDING 4
+#endif
+
+// MQTT_QUEUE_SLOTS : Messages other tasks can queue with enqueue(), a power of two. Each
+//  slot holds MQTT_QUEUE_SLOT_SIZE bytes of topic and payload. 0 leaves the queue out
+#ifndef MQTT_QUEUE_SLOTS
+#if defined(ESP32)
+#define MQTT_QUEUE_SLOTS 8
+#else
+#define MQTT_QUEUE_SLOTS 0
+#endif
+#endif
+#ifndef MQTT_QUEUE_SLOT_SIZE
+#define MQTT_QUEUE_SLOT_SIZE 128
+#endif
+
+// MQTT_TOPIC_ALIAS_MAX : Topic aliases kept in each direction with MQTT 5. A topic
+//  needs to be shorter than MQTT_TOPIC_ALIAS_LENGTH to get an alias
+#ifndef MQTT_TOPIC_ALIAS_MAX
+#define MQTT_TOPIC_ALIAS_MAX 4
+#endif
+#ifndef MQTT_TOPIC_ALIAS_LENGTH
+#define MQTT_TOPIC_ALIAS_LENGTH 48
+#endif
+
+// MQTT_MAX_TRANSFER_SIZE : limit how much data is passed to the network client
+//  in each write call. Needed for the Arduino Wifi Shield. Leave undefined to
+//  pass the entire MQTT packet in each write call.
+//#define MQTT_MAX_TRANSFER_SIZE 80
+
+// Possible values for client.state()
+#define MQTT_CONNECTING             -5
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+#define MQTT_CONNECT_BAD_PROTOCOL    1
+#define MQTT_CONNECT_BAD_CLIENT_ID   2
+#define MQTT_CONNECT_UNAVAILABLE     3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED    5
+
+#define MQTTCONNECT     1 << 4  // Client request to connect to Server
+#define MQTTCONNACK     2 << 4  // Connect Acknowledgment
+#define MQTTPUBLISH     3 << 4  // Publish message
+#define MQTTPUBACK      4 << 4  // Publish Acknowledgment
+#define MQTTPUBREC      5 << 4  // Publish Received (assured delivery part 1)
+#define MQTTPUBREL      6 << 4  // Publish Release (assured delivery part 2)
+#define MQTTPUBCOMP     7 << 4  // Publish Complete (assured delivery part 3)
+#define MQTTSUBSCRIBE   8 << 4  // Client Subscribe request
+#define MQTTSUBACK      9 << 4  // Subscribe Acknowledgment
+#define MQTTUNSUBSCRIBE 10 << 4 // Client Unsubscribe request
+#define MQTTUNSUBACK    11 << 4 // Unsubscribe Acknowledgment
+#define MQTTPINGREQ     12 << 4 // PING Request
+#define MQTTPINGRESP    13 << 4 // PING Response
+#define MQTTDISCONNECT  14 << 4 // Client is Disconnecting
+#define MQTTReserved    15 << 4 // Reserved
+
+#define MQTTQOS0        (0 << 1)
+#define MQTTQOS1        (1 << 1)
+#define MQTTQOS2        (2 << 1)
+#define MQTTDUP         (1 << 3)
+
+// MQTT 5 property identifiers
+#define MQTTPROP_PAYLOAD_FORMAT       0x01
+#define MQTTPROP_MESSAGE_EXPIRY       0x02
+#define MQTTPROP_CONTENT_TYPE         0x03
+#define MQTTPROP_RESPONSE_TOPIC       0x08
+#define MQTTPROP_CORRELATION_DATA     0x09
+#define MQTTPROP_SUBSCRIPTION_ID      0x0B
+#define MQTTPROP_SESSION_EXPIRY       0x11
+#define MQTTPROP_CLIENT_ID            0x12
+#define MQTTPROP_SERVER_KEEPALIVE     0x13
+#define MQTTPROP_AUTH_METHOD          0x15
+#define MQTTPROP_AUTH_DATA            0x16
+#define MQTTPROP_REQUEST_PROBLEM      0x17
+#define MQTTPROP_WILL_DELAY           0x18
+#define MQTTPROP_REQUEST_RESPONSE     0x19
+#define MQTTPROP_RESPONSE_INFO        0x1A
+#define MQTTPROP_SERVER_REFERENCE     0x1C
+#define MQTTPROP_REASON_STRING        0x1F
+#define MQTTPROP_RECEIVE_MAXIMUM      0x21
+#define MQTTPROP_TOPIC_ALIAS_MAXIMUM  0x22
+#define MQTTPROP_TOPIC_ALIAS          0x23
+#define MQTTPROP_MAXIMUM_QOS          0x24
+#define MQTTPROP_RETAIN_AVAILABLE     0x25
+#define MQTTPROP_USER_PROPERTY        0x26
+#define MQTTPROP_MAXIMUM_PACKET_SIZE  0x27
+#define MQTTPROP_WILDCARD_AVAILABLE   0x28
+#define MQTTPROP_SUBSCRIPTION_ID_AVAILABLE 0x29
+#define MQTTPROP_SHARED_AVAILABLE     0x2A
+
+// MQTT 5 reason codes, 0x80 and above are failures
+#define MQTT_REASON_UNSUPPORTED_VERSION 0x84
+
+// Maximum size of fixed header and variable length size header
+#define MQTT_MAX_HEADER_SIZE 5
+
+#if defined(ESP8266) || defined(ESP32)
+#include <functional>
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+#define MQTT_PUBLISH_CALLBACK_SIGNATURE std::function<void(uint16_t, boolean)> publishCallback
+#define MQTT_CHUNK_BEGIN_SIGNATURE std::function<void(char*, uint32_t)> chunkBegin
+#define MQTT_CHUNK_SIGNATURE std::function<void(uint8_t*, unsigned int)> chunkData
+#define MQTT_CHUNK_END_SIGNATURE std::function<void(boolean)> chunkEnd
+#define MQTT_SUBSCRIBE_CALLBACK_SIGNATURE std::function<void(uint16_t, uint8_t*, uint8_t)> subscribeCallback
+#define MQTT_CONNECT_CALLBACK_SIGNATURE std::function<void(int)> connectCallback
+#else
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+#define MQTT_PUBLISH_CALLBACK_SIGNATURE void (*publishCallback)(uint16_t, boolean)
+#define MQTT_CHUNK_BEGIN_SIGNATURE void (*chunkBegin)(char*, uint32_t)
+#define MQTT_CHUNK_SIGNATURE void (*chunkData)(uint8_t*, unsigned int)
+#define MQTT_CHUNK_END_SIGNATURE void (*chunkEnd)(boolean)
+#define MQTT_SUBSCRIBE_CALLBACK_SIGNATURE void (*subscribeCallback)(uint16_t, uint8_t*, uint8_t)
+#define MQTT_CONNECT_CALLBACK_SIGNATURE void (*connectCallback)(int)
+#endif
+
+#if MQTT_QUEUE_SLOTS > 0
+#include <atomic>
+#endif
+
+#define CHECK_STRING_LENGTH(l,s) if (l+2+strnlen(s, this->bufferSize) > this->bufferSize) {_client->stop();return false;}
+
+// A piece of a publish payload, written from where it is
+struct MqttSegment {
+   const uint8_t* data;
+   size_t length;
+};
+
+// A received publish as it sits in the receive buffer, only valid during the handler. The
+// topic is not NUL terminated
+struct MqttMessage {
+   const char* topic;
+   uint16_t topicLength;
+   uint8_t* payload;
+   unsigned int length;
+   uint8_t qos;
+   boolean retain;
+   boolean dup;
+   uint16_t msgId;
+};
+
+// A plain function and its context, nothing is allocated or copied to call it
+typedef void (*MqttMessageHandler)(void* context, const MqttMessage& message);
+
+// A subscribe or unsubscribe awaiting its acknowledgement
+struct MqttPending {
+   uint16_t msgId;
+   uint8_t type;
+   uint8_t count;
+   unsigned long sentAt;
+};
+
+#if MQTT_QUEUE_SLOTS > 0
+// A queued QoS 0 publish, the topic is NUL terminated and followed by the payload
+struct MqttQueued {
+   std::atomic<uint32_t> sequence;
+   uint16_t topicLength;
+   uint16_t length;
+   boolean retained;
+   uint8_t data[MQTT_QUEUE_SLOT_SIZE];
+};
+#endif
+
+// MQTT 5 publish properties. Outgoing, fields left 0 or NULL are not sent. Incoming,
+// the pointers are into the receive buffer and only valid during the callback
+struct MqttProperties {
+   uint32_t messageExpiry;
+   uint8_t payloadFormat;
+   const char* contentType;
+   uint16_t contentTypeLength;
+   const char* responseTopic;
+   uint16_t responseTopicLength;
+   const uint8_t* correlationData;
+   uint16_t correlationLength;
+};
+
+// A QoS 1 publish kept, fully encoded, until its PUBACK arrives. packet points into the
+// retransmit pool
+struct MqttInflight {
+   uint16_t msgId;
+   uint8_t retries;
+   uint8_t protocol;
+   uint8_t* packet;
+   uint32_t length;
+   unsigned long sentAt;
+};
+
+class PubSubClient : public Print {
+private:
+   Client* _client;
+   uint8_t* buffer;
+   uint16_t bufferSize;
+   uint16_t keepAlive;
+   uint16_t socketTimeout;
+   uint16_t nextMsgId;
+   unsigned long lastOutActivity;
+   unsigned long lastInActivity;
+   bool pingOutstanding;
+   MQTT_CALLBACK_SIGNATURE;
+   MQTT_PUBLISH_CALLBACK_SIGNATURE;
+   MqttInflight inflight[MQTT_MAX_INFLIGHT];
+   uint8_t* inflightPool;
+   uint8_t inflightWindow;
+   uint8_t inflightCount;
+   uint16_t retryTimeout;
+   uint16_t lastMsgId;
+   uint16_t nextMessageId();
+   void initState();
+   void acknowledge(uint16_t msgId, uint8_t reason);
+   void retransmit(boolean all);
+   boolean reencode(MqttInflight* message);
+   MQTT_SUBSCRIBE_CALLBACK_SIGNATURE;
+   MQTT_CONNECT_CALLBACK_SIGNATURE;
+   void handshake();
+   MqttPending pending[MQTT_MAX_PENDING];
+   uint8_t pendingCount;
+   uint16_t sendSubscribe(uint8_t type, const char* const* topics, const uint8_t* qos, uint8_t count);
+   void settle(uint8_t type, uint16_t msgId, uint8_t* codes, uint8_t count);
+   void expirePending(boolean all);
+   // Receive side, a packet is parsed across loop() calls into its own buffer so publishing
+   // in between does not clobber it
+   uint8_t* rxBuffer;
+   uint16_t rxPos;
+   uint8_t rxHeaderLength;
+   uint32_t rxLength;
+   uint32_t rxMultiplier;
+   uint32_t rxRead;
+   uint32_t rxPayload;
+   unsigned long rxActivity;
+   boolean rxChunked;
+   boolean rxPaused;
+   uint16_t rxMsgId;
+   MQTT_CHUNK_BEGIN_SIGNATURE;
+   MQTT_CHUNK_SIGNATURE;
+   MQTT_CHUNK_END_SIGNATURE;
+   void resetParser();
+   uint32_t readPacket(uint8_t*);
+   void readChunked(int* available);
+   boolean write(uint8_t header, uint8_t* buf, uint16_t length);
+   boolean writeSegment(const uint8_t* data, size_t length);
+   // All packets go out through send(), which collects them in corkBuffer while corked
+   uint8_t* corkBuffer;
+   uint16_t corkSize;
+   uint16_t corkLength;
+   boolean send(const uint8_t* data, size_t length);
+   boolean sendCorked();
+   uint16_t writeString(const char* string, uint8_t* buf, uint16_t pos);
+   // MQTT 5 state, the aliases are in effect for one connection
+   uint8_t protocol;
+   uint16_t receiveMaximum;
+   // Limits from the CONNACK: keepAlive unless the broker set its own, 0 for no packet size
+   // limit, the highest QoS the broker takes
+   uint16_t sessionKeepAlive;
+   uint32_t maximumPacketSize;
+   uint8_t maximumQos;
+   boolean packetFits(uint32_t remaining);
+   uint16_t aliasMaximum;
+   uint8_t aliasCount;
+   // A new alias is written into aliasOut by writePublishHeader and only counted once
+   // commitAlias() is called after the packet went out
+   boolean aliasPending;
+   void commitAlias();
+   char aliasOut[MQTT_TOPIC_ALIAS_MAX][MQTT_TOPIC_ALIAS_LENGTH];
+   char aliasIn[MQTT_TOPIC_ALIAS_MAX][MQTT_TOPIC_ALIAS_LENGTH];
+   uint16_t rxAlias;
+   MqttProperties rxProperties;
+   void resetSession();
+   uint16_t topicAlias(const char* topic, size_t tlen, boolean* known);
+   uint32_t writePublishHeader(uint32_t start, const char* topic, uint16_t msgId, const MqttProperties* properties);
+   uint32_t encodeProperties(uint8_t* buf, uint32_t pos, const MqttProperties* properties, uint16_t alias);
+   uint32_t decodeProperties(const uint8_t* buf, uint32_t length, MqttProperties* properties);
+#if MQTT_QUEUE_SLOTS > 0
+   MqttQueued queue[MQTT_QUEUE_SLOTS];
+   std::atomic<uint32_t> queueTail;
+   uint32_t queueHead;
+   void drainQueue();
+   void releaseQueued(uint32_t end);
+#endif
+   MqttMessageHandler messageHandler;
+   void* messageContext;
+   boolean parsePublish(uint8_t* body, uint32_t length, MqttMessage* message);
+   char* publishTopic(uint8_t* body, uint32_t length, uint32_t* payload, uint16_t* msgId);
+   uint32_t publishPrefix(const uint8_t* body, uint32_t length);
+   // Build up the header ready to send
+   // Returns the size of the header
+   // Note: the header is built at the end of the first MQTT_MAX_HEADER_SIZE bytes, so will start
+   //       (MQTT_MAX_HEADER_SIZE - <returned size>) bytes into the buffer
+   size_t buildHeader(uint8_t header, uint8_t* buf, uint32_t length);
+   IPAddress ip;
+   const char* domain;
+   uint16_t port;
+   Stream* stream;
+   int _state;
+   template<typename T, void (T::*Method)(const MqttMessage&)>
+   static void callMember(void* object, const MqttMessage& message) {
+      (static_cast<T*>(object)->*Method)(message);
+   }
+public:
+   PubSubClient();
+   PubSubClient(Client& client);
+   PubSubClient(IPAddress, uint16_t, Client& client);
+   PubSubClient(IPAddress, uint16_t, Client& client, Stream&);
+   PubSubClient(IPAddress, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client);
+   PubSubClient(IPAddress, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client, Stream&);
+   PubSubClient(uint8_t *, uint16_t, Client& client);
+   PubSubClient(uint8_t *, uint16_t, Client& client, Stream&);
+   PubSubClient(uint8_t *, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client);
+   PubSubClient(uint8_t *, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client, Stream&);
+   PubSubClient(const char*, uint16_t, Client& client);
+   PubSubClient(const char*, uint16_t, Client& client, Stream&);
+   PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client);
+   PubSubClient(const char*, uint16_t, MQTT_CALLBACK_SIGNATURE,Client& client, Stream&);
+
+   ~PubSubClient();
+
+   PubSubClient& setServer(IPAddress ip, uint16_t port);
+   PubSubClient& setServer(uint8_t * ip, uint16_t port);
+   PubSubClient& setServer(const char * domain, uint16_t port);
+   PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+   // Replaces the callback: messages are handed over where they are, with the QoS, retain
+   // and dup flags, without moving the topic or going through std::function
+   PubSubClient& setMessageHandler(MqttMessageHandler handler, void* context);
+   // Binds a member function, the object is the context
+   template<typename T, void (T::*Method)(const MqttMessage&)>
+   PubSubClient& setMessageHandler(T* object) {
+      return setMessageHandler(&PubSubClient::callMember<T, Method>, object);
+   }
+   PubSubClient& setClient(Client& client);
+   PubSubClient& setStream(Stream& stream);
+   PubSubClient& setKeepAlive(uint16_t keepAlive);
+   PubSubClient& setSocketTimeout(uint16_t timeout);
+   // Called with the message id and true once a QoS 1 publish is acknowledged, or false
+   // when it is given up after MQTT_MAX_RETRIES retransmissions
+   PubSubClient& setPublishCallback(MQTT_PUBLISH_CALLBACK_SIGNATURE);
+   PubSubClient& setRetryTimeout(uint16_t timeout);
+   // Fails while publishes are in flight, the retransmit pool is sized to the window
+   boolean setInflightWindow(uint8_t size);
+   // Publishes larger than the buffer are delivered in pieces instead of dropped: begin
+   // gets the topic and payload length, then the payload arrives in slices of up to
+   // bufferSize bytes, end gets false if the connection was lost before the last one.
+   // The slices point into the receive buffer and are only valid during the call
+   PubSubClient& setChunkCallback(MQTT_CHUNK_BEGIN_SIGNATURE, MQTT_CHUNK_SIGNATURE, MQTT_CHUNK_END_SIGNATURE);
+   // Called with state() once a connectAsync() handshake has finished: MQTT_CONNECTED or
+   // why it failed
+   PubSubClient& setConnectCallback(MQTT_CONNECT_CALLBACK_SIGNATURE);
+   // Called for each tracked SUBACK or UNSUBACK with the packet id and the return codes, one
+   // per topic in the order given: the granted QoS, or 0x80 and above when refused. An MQTT
+   // 3.1.1 UNSUBACK has no codes. Codes are NULL when no acknowledgement came within the
+   // socket timeout or the connection was lost
+   PubSubClient& setSubscribeCallback(MQTT_SUBSCRIBE_CALLBACK_SIGNATURE);
+   // Stops reading from the socket until called with false, for a consumer that cannot
+   // keep up. Keepalive still runs, pause for less than the keepalive interval
+   void pauseReceive(boolean paused);
+   // Number of QoS 1 publishes awaiting a PUBACK
+   uint8_t getInflight();
+   // Message id of the last QoS 1 publish accepted
+   uint16_t getLastMsgId();
+
+   // MQTT_VERSION_3_1_1 or MQTT_VERSION_5, takes effect on the next connect. A broker
+   // that refuses MQTT 5 is connected to again with 3.1.1
+   PubSubClient& setProtocolVersion(uint8_t version);
+   uint8_t getProtocolVersion();
+   // Properties of the message being delivered to the callback, NULL unless MQTT 5
+   const MqttProperties* getProperties();
+
+   boolean setBufferSize(uint16_t size);
+   uint16_t getBufferSize();
+   // Corks the connection: packets collect in a send buffer of size bytes and go out
+   // together once it is full, on flush() or at the end of loop(), so a burst of publishes
+   // and acknowledgements costs one segment. Connect, subscribe, unsubscribe and disconnect
+   // are always sent at once. There is no per publish option: call flush() after a publish
+   // that must not wait. 0 uncorks
+   boolean setCork(uint16_t size);
+   // Sends what is corked. A failed write closes the connection, as packets already reported
+   // as sent would be lost or cut short
+   virtual void flush();
+
+   boolean connect(const char* id);
+   boolean connect(const char* id, const char* user, const char* pass);
+   boolean connect(const char* id, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage);
+   boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage);
+   boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession);
+   // Start the connection and return, loop() completes it. state() is MQTT_CONNECTING
+   // until the CONNACK arrives
+   boolean connectAsync(const char* id);
+   boolean connectAsync(const char* id, const char* user, const char* pass);
+   boolean connectAsync(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession);
+   void disconnect();
+   boolean publish(const char* topic, const char* payload);
+   boolean publish(const char* topic, const char* payload, boolean retained);
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength);
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   // QoS 1 publishes are copied and kept until acknowledged, up to the in-flight window.
+   // Returns false while the window is full; loop() frees it as PUBACKs arrive
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained, uint8_t qos);
+   // Publishes the segments as one payload. Not limited by the buffer size: a packet that
+   // does not fit is written segment by segment without being copied
+   boolean publish(const char* topic, const MqttSegment* segments, uint8_t count, boolean retained);
+   // With MQTT 5 QoS 0 topics get an alias, after the first publish only the alias is sent.
+   // Properties are ignored with 3.1.1. The CONNACK limits hold for every publish: QoS 1 is
+   // sent as QoS 0 to a broker with Maximum QoS 0, and a packet over its Maximum Packet Size
+   // is refused
+   boolean publish(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained, uint8_t qos, const MqttProperties* properties);
+   boolean publish(const char* topic, const MqttSegment* segments, uint8_t count, boolean retained, uint8_t qos, const MqttProperties* properties);
+#if MQTT_QUEUE_SLOTS > 0
+   // QoS 0 publish that is safe from any task or interrupt: the message is copied into a
+   // free slot and sent by the next loop(). A slot is only freed once its message was
+   // written to the socket, also when corked; messages queued while disconnected wait for
+   // the connection. Returns false when
+   // the queue is full or the message larger than a slot
+   boolean enqueue(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+#endif
+   boolean publish_P(const char* topic, const char* payload, boolean retained);
+   boolean publish_P(const char* topic, const uint8_t * payload, unsigned int plength, boolean retained);
+   // Start to publish a message.
+   // This API:
+   //   beginPublish(...)
+   //   one or more calls to write(...)
+   //   endPublish()
+   // Allows for arbitrarily large payloads to be sent without them having to be copied into
+   // a new buffer and held in memory at one time
+   // Returns 1 if the message was started successfully, 0 if there was an error
+   boolean beginPublish(const char* topic, unsigned int plength, boolean retained);
+   // Finish off this publish message (started with beginPublish)
+   // Returns 1 if the packet was sent successfully, 0 if there was an error
+   int endPublish();
+   // Write a single byte of payload (only to be used with beginPublish/endPublish)
+   virtual size_t write(uint8_t);
+   // Write size bytes from buffer into the payload (only to be used with beginPublish/endPublish)
+   // Returns the number of bytes written
+   virtual size_t write(const uint8_t *buffer, size_t size);
+   boolean subscribe(const char* topic);
+   boolean subscribe(const char* topic, uint8_t qos);
+   boolean unsubscribe(const char* topic);
+   // All filters go in one packet, which has to fit the buffer. Returns the packet id to
+   // match with the subscribe callback, 0 when the packet does not fit or MQTT_MAX_PENDING
+   // acknowledgements are outstanding
+   uint16_t subscribe(const char* const* topics, const uint8_t* qos, uint8_t count);
+   uint16_t unsubscribe(const char* const* topics, uint8_t count);
+   boolean loop();
+   boolean connected();
+   int state();
+
+};
+
+
+#endif
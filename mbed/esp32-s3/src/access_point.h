@@ -1,4 +1,7 @@
 #include <WiFi.h>
+#include <WebServer.h>
+
+extern WebServer server;
 
 void accesPointInit(void);
 void accesPointLoop(void);
@@ -0,0 +1,368 @@
+#include <string.h>
+#include <math.h>
+#include "aggregate.h"
+
+void aggStats::clear(void)
+{
+    this->count = 0;
+    this->min = 0;
+    this->max = 0;
+    this->mean = 0;
+    this->m2 = 0;
+}
+
+// Welford update
+void aggStats::add(float value)
+{
+    if (this->count == 0)
+    {
+        this->min = value;
+        this->max = value;
+    }
+    else if (value < this->min)
+    {
+        this->min = value;
+    }
+    else if (value > this->max)
+    {
+        this->max = value;
+    }
+
+    this->count++;
+
+    float delta = value - this->mean;
+
+    this->mean += delta / this->count;
+    this->m2 += delta * (value - this->mean);
+}
+
+// Chan et al. pairwise combination
+void aggStats::merge(const aggStats &other)
+{
+    if (other.count == 0)
+    {
+        return;
+    }
+
+    if (this->count == 0)
+    {
+        *this = other;
+        return;
+    }
+
+    float total = (float)this->count + other.count;
+    float delta = other.mean - this->mean;
+
+    this->mean += delta * other.count / total;
+    this->m2 += other.m2 + delta * delta * this->count * other.count / total;
+    this->count += other.count;
+
+    if (other.min < this->min)
+    {
+        this->min = other.min;
+    }
+
+    if (other.max > this->max)
+    {
+        this->max = other.max;
+    }
+}
+
+float aggStats::variance(void) const
+{
+    return this->count > 1 ? this->m2 / (this->count - 1) : 0;
+}
+
+aggDigest::aggDigest()
+{
+    this->clear();
+}
+
+void aggDigest::clear(void)
+{
+    this->count = 0;
+    this->buffered = 0;
+    this->total = 0;
+    this->min = 0;
+    this->max = 0;
+}
+
+void aggDigest::add(float value, float weight)
+{
+    if (this->buffered == AGG_DIGEST_BUFFER)
+    {
+        this->compress();
+    }
+
+    if (this->total == 0)
+    {
+        this->min = value;
+        this->max = value;
+    }
+    else if (value < this->min)
+    {
+        this->min = value;
+    }
+    else if (value > this->max)
+    {
+        this->max = value;
+    }
+
+    this->buffer[this->buffered].mean = value;
+    this->buffer[this->buffered].weight = weight;
+    this->buffered++;
+    this->total += weight;
+}
+
+void aggDigest::merge(aggDigest &other)
+{
+    other.compress();
+
+    for (int i = 0; i < other.count; i++)
+    {
+        this->add(other.centroids[i].mean, other.centroids[i].weight);
+    }
+
+    if (other.total > 0)
+    {
+        if (other.min < this->min)
+        {
+            this->min = other.min;
+        }
+
+        if (other.max > this->max)
+        {
+            this->max = other.max;
+        }
+    }
+}
+
+// Scale function k1 of the t-digest paper and its inverse. A centroid may
+// span at most one unit of k, which keeps the tails in small centroids and
+// bounds the count by AGG_COMPRESSION.
+static float aggScale(float q)
+{
+    return AGG_COMPRESSION / (2 * (float)M_PI) * asinf(2 * q - 1);
+}
+
+static float aggScaleInverse(float k)
+{
+    if (k >= AGG_COMPRESSION / 4.0f)
+    {
+        return 1;
+    }
+
+    return (sinf(k * 2 * (float)M_PI / AGG_COMPRESSION) + 1) / 2;
+}
+
+// Sorts the buffer, merges it with the sorted centroids and folds neighbours
+// together while they stay within one unit of k.
+void aggDigest::compress(void)
+{
+    if (this->buffered == 0)
+    {
+        return;
+    }
+
+    for (int i = 1; i < this->buffered; i++)
+    {
+        aggCentroid item = this->buffer[i];
+        int j = i - 1;
+
+        while (j >= 0 && this->buffer[j].mean > item.mean)
+        {
+            this->buffer[j + 1] = this->buffer[j];
+            j--;
+        }
+
+        this->buffer[j + 1] = item;
+    }
+
+    aggCentroid sorted[AGG_DIGEST_SIZE + AGG_DIGEST_BUFFER];
+    int length = 0;
+    int a = 0;
+    int b = 0;
+
+    while (a < this->count || b < this->buffered)
+    {
+        if (b == this->buffered || (a < this->count && this->centroids[a].mean <= this->buffer[b].mean))
+        {
+            sorted[length++] = this->centroids[a++];
+        }
+        else
+        {
+            sorted[length++] = this->buffer[b++];
+        }
+    }
+
+    aggCentroid current = sorted[0];
+    float before = 0;
+    float limit = this->total * aggScaleInverse(aggScale(0) + 1);
+
+    this->count = 0;
+
+    for (int i = 1; i < length; i++)
+    {
+        float weight = current.weight + sorted[i].weight;
+
+        // The last slot absorbs everything left, memory stays fixed
+        if (before + weight <= limit || this->count == AGG_DIGEST_SIZE - 1)
+        {
+            current.mean += (sorted[i].mean - current.mean) * sorted[i].weight / weight;
+            current.weight = weight;
+        }
+        else
+        {
+            this->centroids[this->count++] = current;
+            before += current.weight;
+            limit = this->total * aggScaleInverse(aggScale(before / this->total) + 1);
+            current = sorted[i];
+        }
+    }
+
+    this->centroids[this->count++] = current;
+    this->buffered = 0;
+}
+
+float aggDigest::quantile(float q)
+{
+    this->compress();
+
+    if (this->count == 0)
+    {
+        return 0;
+    }
+
+    float target = q * this->total;
+    float cumulative = 0;
+
+    // Each centroid sits at the middle of its weight, interpolate between
+    // neighbouring centres and towards min / max at the ends
+    for (int i = 0; i < this->count; i++)
+    {
+        float center = cumulative + this->centroids[i].weight / 2;
+
+        if (target < center)
+        {
+            float leftValue = i == 0 ? this->min : this->centroids[i - 1].mean;
+            float leftCenter = i == 0 ? 0 : cumulative - this->centroids[i - 1].weight / 2;
+
+            return leftValue + (this->centroids[i].mean - leftValue) * (target - leftCenter) / (center - leftCenter);
+        }
+
+        cumulative += this->centroids[i].weight;
+    }
+
+    float lastCenter = this->total - this->centroids[this->count - 1].weight / 2;
+    float lastValue = this->centroids[this->count - 1].mean;
+
+    if (target >= this->total)
+    {
+        return this->max;
+    }
+
+    return lastValue + (this->max - lastValue) * (target - lastCenter) / (this->total - lastCenter);
+}
+
+aggWindow::aggWindow()
+{
+    this->configure(0, 0);
+}
+
+bool aggWindow::configure(unsigned long length, unsigned long slide)
+{
+    if (slide == 0)
+    {
+        slide = length;
+    }
+
+    if (length > 0 && (length % slide != 0 || length / slide > AGG_MAX_PANES))
+    {
+        return false;
+    }
+
+    this->length = length;
+    this->slide = slide;
+    this->panes = length > 0 ? length / slide : 0;
+    this->current = 0;
+    this->started = false;
+    this->paneEnd = 0;
+
+    for (int i = 0; i < AGG_MAX_PANES; i++)
+    {
+        this->stats[i].clear();
+        this->digests[i].clear();
+    }
+
+    return true;
+}
+
+bool aggWindow::active(void)
+{
+    return this->panes > 0;
+}
+
+void aggWindow::summarize(aggSummary &summary)
+{
+    aggDigest digest;
+
+    summary.end = this->paneEnd;
+    summary.stats.clear();
+
+    for (int i = 0; i < this->panes; i++)
+    {
+        summary.stats.merge(this->stats[i]);
+        digest.merge(this->digests[i]);
+    }
+
+    summary.p50 = digest.quantile(0.5f);
+    summary.p90 = digest.quantile(0.9f);
+    summary.p99 = digest.quantile(0.99f);
+}
+
+void aggWindow::roll(unsigned long now, aggEmitFn emit, void *ctx)
+{
+    if (!this->active())
+    {
+        return;
+    }
+
+    if (!this->started)
+    {
+        this->started = true;
+        this->paneEnd = (now / this->slide + 1) * this->slide;
+        return;
+    }
+
+    while ((long)(now - this->paneEnd) >= 0)
+    {
+        aggSummary summary;
+
+        this->summarize(summary);
+
+        // Every pane is empty after a gap, jump to the pane holding now
+        if (summary.stats.count == 0)
+        {
+            this->paneEnd = (now / this->slide + 1) * this->slide;
+            break;
+        }
+
+        emit(summary, ctx);
+
+        this->current = (this->current + 1) % this->panes;
+        this->stats[this->current].clear();
+        this->digests[this->current].clear();
+        this->paneEnd += this->slide;
+    }
+}
+
+void aggWindow::add(float value)
+{
+    if (!this->active())
+    {
+        return;
+    }
+
+    this->stats[this->current].add(value);
+    this->digests[this->current].add(value, 1);
+}
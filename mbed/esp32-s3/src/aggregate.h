@@ -0,0 +1,100 @@
+#pragma once
+
+// Streaming window aggregation. Portable, no Arduino code, time is passed in.
+// A window is split in panes of one slide each; a tumbling window is a single
+// pane. Every pane keeps exact count/min/max/mean/variance and a t-digest,
+// when a pane closes the last length / slide panes are merged into a summary.
+// Memory is fixed: AGG_MAX_PANES panes per window, no allocation.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define AGG_DIGEST_SIZE 32
+#define AGG_DIGEST_BUFFER 32
+#define AGG_COMPRESSION 24
+#define AGG_MAX_PANES 4
+
+struct aggCentroid
+{
+    float mean;
+    float weight;
+};
+
+struct aggStats
+{
+    uint32_t count;
+    float min;
+    float max;
+    float mean;
+    float m2;
+
+    void clear(void);
+    void add(float value);
+    void merge(const aggStats &other);
+    float variance(void) const;
+};
+
+// Merging t-digest with a fixed number of centroids. Values are buffered and
+// folded into the centroids when the buffer is full or a quantile is read.
+class aggDigest
+{
+
+public:
+    aggDigest();
+
+    void clear(void);
+    void add(float value, float weight);
+    void merge(aggDigest &other);
+    float quantile(float q);
+
+private:
+    aggCentroid centroids[AGG_DIGEST_SIZE];
+    aggCentroid buffer[AGG_DIGEST_BUFFER];
+    int count;
+    int buffered;
+    float total;
+    float min;
+    float max;
+
+    void compress(void);
+};
+
+struct aggSummary
+{
+    unsigned long end;
+    aggStats stats;
+    float p50;
+    float p90;
+    float p99;
+};
+
+typedef void (*aggEmitFn)(const aggSummary &summary, void *ctx);
+
+class aggWindow
+{
+
+public:
+    aggWindow();
+
+    // slide 0 makes a tumbling window, length must be a multiple of slide
+    // with at most AGG_MAX_PANES panes. length 0 turns the window off.
+    bool configure(unsigned long length, unsigned long slide);
+    bool active(void);
+
+    unsigned long length;
+    unsigned long slide;
+
+    // Closes the panes that ended before now and emits their windows
+    void roll(unsigned long now, aggEmitFn emit, void *ctx);
+    void add(float value);
+
+private:
+    int panes;
+    int current;
+    bool started;
+    unsigned long paneEnd;
+    aggStats stats[AGG_MAX_PANES];
+    aggDigest digests[AGG_MAX_PANES];
+
+    void summarize(aggSummary &summary);
+};
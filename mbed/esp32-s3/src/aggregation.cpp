@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include "aggregate.h"
+#include "aggregation.h"
+#include "myMqtt.h"
+
+class aggSeries
+{
+
+public:
+    const char *name;
+    aggWindow window;
+
+    aggSeries(const char *name)
+    {
+        this->name = name;
+    }
+};
+
+aggSeries aggregates[] = {aggSeries("heap"), aggSeries("rssi"), aggSeries("samples")};
+const int aggregateCount = sizeof(aggregates) / sizeof(aggregates[0]);
+
+unsigned long lastTelemetrySample = 0;
+
+aggSeries *findAggregate(const char *name)
+{
+    for (int i = 0; i < aggregateCount; i++)
+    {
+        if (strcmp(aggregates[i].name, name) == 0)
+        {
+            return &aggregates[i];
+        }
+    }
+
+    return NULL;
+}
+
+void publishSummary(const aggSummary &summary, void *ctx)
+{
+    char state[RESPONSE_MAX_LENGTH];
+
+    snprintf(state, sizeof(state), "%s/%lu/%lu/%g/%g/%g/%g/%g/%g/%g", ((aggSeries *)ctx)->name, summary.end,
+             (unsigned long)summary.stats.count, summary.stats.min, summary.stats.max, summary.stats.mean,
+             summary.stats.variance(), summary.p50, summary.p90, summary.p99);
+
+    MqttResponse.send("AGG", state);
+}
+
+void aggregateAdd(const char *name, float value)
+{
+    aggSeries *series = findAggregate(name);
+
+    if (series != NULL && series->window.active())
+    {
+        series->window.roll(millis(), publishSummary, series);
+        series->window.add(value);
+    }
+}
+
+bool aggregateActive(const char *name)
+{
+    aggSeries *series = findAggregate(name);
+
+    return series != NULL && series->window.active();
+}
+
+bool aggregateConfigure(const char *name, unsigned long length, unsigned long slide)
+{
+    aggSeries *series = findAggregate(name);
+
+    return series != NULL && series->window.configure(length, slide);
+}
+
+void aggregateLoop(void)
+{
+    if (millis() - lastTelemetrySample >= AGG_TELEMETRY_PERIOD)
+    {
+        lastTelemetrySample = millis();
+
+        aggregateAdd("heap", ESP.getFreeHeap());
+        aggregateAdd("rssi", WiFi.RSSI());
+    }
+
+    // Windows also close when no sample arrives
+    for (int i = 0; i < aggregateCount; i++)
+    {
+        aggregates[i].window.roll(millis(), publishSummary, &aggregates[i]);
+    }
+}
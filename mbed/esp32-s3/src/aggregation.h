@@ -0,0 +1,13 @@
+#include <Arduino.h>
+
+// Per metric windows on top of aggregate.h. Only the summaries go out, as
+// mac/AGG/<series>/<end>/<count>/<min>/<max>/<mean>/<variance>/<p50>/<p90>/<p99>
+// Windows are set with CMD_AGG/<series>/<length ms>[/<slide ms>], length 0
+// turns the series off. heap and rssi are sampled here, samples is fed by
+// the sampling pipeline instead of publishing raw frames.
+#define AGG_TELEMETRY_PERIOD 1000
+
+void aggregateAdd(const char *name, float value);
+bool aggregateActive(const char *name);
+bool aggregateConfigure(const char *name, unsigned long length, unsigned long slide);
+void aggregateLoop(void);
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <LittleFS.h>
+#include "rules.h"
+#include "automation.h"
+#include "process.h"
+#include "myMqtt.h"
+
+enum
+{
+    VAR_HEAP,
+    VAR_RSSI,
+    VAR_UPTIME,
+    VAR_BUSY,
+    VAR_SAMPLE,
+    VAR_COUNT
+};
+
+const char *const ruleVariables[VAR_COUNT] = {"heap", "rssi", "uptime", "busy", "sample"};
+
+ruleSet Rules;
+
+float ruleValues[VAR_COUNT];
+
+unsigned long lastRuleRun = 0;
+
+uint64_t ruleOutputs = 0;
+
+void fireRule(const rule &fired, void *ctx)
+{
+    char state[16];
+
+    if (fired.action != RULE_ACTION_PUBLISH)
+    {
+        if ((ruleOutputs & (1ULL << fired.pin)) == 0)
+        {
+            ruleOutputs |= 1ULL << fired.pin;
+            pinMode(fired.pin, OUTPUT);
+        }
+
+        int level = fired.action == RULE_ACTION_GPIO_ON ? HIGH : fired.action == RULE_ACTION_GPIO_OFF ? LOW : !digitalRead(fired.pin);
+
+        digitalWrite(fired.pin, level);
+    }
+
+    snprintf(state, sizeof(state), "%d", fired.id);
+
+    MqttResponse.send("RULE", state);
+}
+
+bool saveRules(void)
+{
+    fs::File file = LittleFS.open(RULE_FILE, FILE_WRITE);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        if (Rules.rules[i].used)
+        {
+            file.printf("%d %s\n", Rules.rules[i].id, Rules.rules[i].source);
+        }
+    }
+
+    file.close();
+
+    return true;
+}
+
+bool setRule(int id, const char *source, const char **error)
+{
+    bool ok = source[0] != 0 ? Rules.compile(id, source) : Rules.remove(id);
+
+    *error = ok ? "OK" : source[0] != 0 ? Rules.error : "FAIL";
+
+    return ok && saveRules();
+}
+
+void rulesInit(void)
+{
+    Rules.setVariables(ruleVariables, VAR_COUNT);
+    Rules.setOutputs(RULE_OUTPUT_PINS);
+
+    // LittleFS is mounted by timeseriesInit()
+    fs::File file = LittleFS.open(RULE_FILE, FILE_READ);
+
+    if (!file)
+    {
+        return;
+    }
+
+    while (file.available())
+    {
+        String line = file.readStringUntil('\n');
+        int space = line.indexOf(' ');
+
+        if (space > 0)
+        {
+            Rules.compile(line.substring(0, space).toInt(), line.substring(space + 1).c_str());
+        }
+    }
+
+    file.close();
+}
+
+void rulesLoop(void)
+{
+    if (millis() - lastRuleRun < RULE_PERIOD)
+    {
+        return;
+    }
+
+    lastRuleRun = millis();
+
+    ruleValues[VAR_HEAP] = ESP.getFreeHeap();
+    ruleValues[VAR_RSSI] = WiFi.RSSI();
+    ruleValues[VAR_UPTIME] = millis() / 1000;
+    ruleValues[VAR_BUSY] = PROCESS_FLAG;
+
+    Rules.evaluate(ruleValues, millis(), fireRule, NULL);
+}
+
+void rulesSample(float value)
+{
+    ruleValues[VAR_SAMPLE] = value;
+
+    Rules.evaluate(ruleValues, millis(), fireRule, NULL);
+}
@@ -0,0 +1,23 @@
+#include <Arduino.h>
+
+// Local rules (rules.h) over heap, rssi, uptime, busy and sample.
+// CMD_RULE/<id>/<rule> adds or replaces a rule, CMD_RULE/<id> removes it.
+// The rule text cannot contain '/', it is the command field separator.
+// Rules are kept in RULE_FILE and evaluated every RULE_PERIOD and on each
+// decimated sample.
+#define RULE_FILE "/rules"
+#define RULE_PERIOD 100
+
+// GPIOs a rule may drive, bit n is pin n: 7-18, 21, 38-42, 47 and 48. Left
+// out are the strapping pins 0, 3, 45 and 46, USB 19/20, flash and PSRAM
+// 26-37, UART0 43/44, 22-25 which the S3 does not have, and the pins the
+// firmware uses itself: 1 button, 2 LED, 4 ADC, 5/6 serial bridge. Saved
+// rules on any other pin no longer compile. Override with -DRULE_OUTPUT_PINS
+#ifndef RULE_OUTPUT_PINS
+#define RULE_OUTPUT_PINS (0x7FF80ULL | 1ULL << 21 | 0x1FULL << 38 | 3ULL << 47)
+#endif
+
+void rulesInit(void);
+void rulesLoop(void);
+void rulesSample(float value);
+bool setRule(int id, const char *source, const char **error);
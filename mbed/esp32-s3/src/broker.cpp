@@ -0,0 +1,1009 @@
+#include <string.h>
+#include "broker.h"
+
+#define PACKET_CONNECT 0x10
+#define PACKET_CONNACK 0x20
+#define PACKET_PUBLISH 0x30
+#define PACKET_PUBACK 0x40
+#define PACKET_SUBSCRIBE 0x80
+#define PACKET_SUBACK 0x90
+#define PACKET_UNSUBSCRIBE 0xA0
+#define PACKET_UNSUBACK 0xB0
+#define PACKET_PINGREQ 0xC0
+#define PACKET_PINGRESP 0xD0
+#define PACKET_DISCONNECT 0xE0
+
+static uint16_t readUint16(const uint8_t *data)
+{
+    return (data[0] << 8) | data[1];
+}
+
+static size_t writeLength(uint8_t *buf, size_t length)
+{
+    size_t pos = 0;
+
+    do
+    {
+        uint8_t digit = length & 127;
+        length >>= 7;
+        if (length > 0)
+        {
+            digit |= 0x80;
+        }
+        buf[pos++] = digit;
+    } while (length > 0);
+
+    return pos;
+}
+
+static bool validFilter(const char *filter, size_t length)
+{
+    size_t levelStart = 0;
+
+    for (size_t i = 0; i <= length; i++)
+    {
+        if (i == length || filter[i] == '/')
+        {
+            size_t levelLength = i - levelStart;
+
+            if (levelLength >= BROKER_LEVEL_LENGTH)
+            {
+                return false;
+            }
+
+            for (size_t j = levelStart; j < i; j++)
+            {
+                if ((filter[j] == '+' || filter[j] == '#') && levelLength != 1)
+                {
+                    return false;
+                }
+            }
+
+            if (levelLength == 1 && filter[levelStart] == '#' && i != length)
+            {
+                return false;
+            }
+
+            levelStart = i + 1;
+        }
+    }
+
+    return length > 0;
+}
+
+miniBroker::miniBroker()
+{
+    memset(this->connections, 0, sizeof(this->connections));
+    memset(this->nodes, 0, sizeof(this->nodes));
+
+    // Node 0 is the root, it has no level of its own
+    this->nodes[0].used = true;
+    this->nodes[0].child = -1;
+    this->nodes[0].next = -1;
+
+    this->send = NULL;
+    this->close = NULL;
+    this->transportCtx = NULL;
+    this->tap = NULL;
+    this->tapCtx = NULL;
+
+    this->messagesIn = 0;
+    this->messagesOut = 0;
+    this->dropped = 0;
+}
+
+void miniBroker::setTransport(brokerSendFn send, brokerCloseFn close, void *ctx)
+{
+    this->send = send;
+    this->close = close;
+    this->transportCtx = ctx;
+}
+
+void miniBroker::setPublishTap(brokerPublishFn tap, void *ctx)
+{
+    this->tap = tap;
+    this->tapCtx = ctx;
+}
+
+int miniBroker::open(unsigned long now)
+{
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++)
+    {
+        if (!this->connections[i].used)
+        {
+            brokerConnection &connection = this->connections[i];
+
+            connection.used = true;
+            connection.connected = false;
+            connection.keepAlive = 0;
+            connection.nextPacketId = 1;
+            connection.lastIn = now;
+            connection.clientId[0] = 0;
+            connection.rxLength = 0;
+
+            for (int j = 0; j < BROKER_INFLIGHT; j++)
+            {
+                connection.inflight[j].packetId = 0;
+            }
+
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int miniBroker::clients(void)
+{
+    int count = 0;
+
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++)
+    {
+        if (this->connections[i].connected)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void miniBroker::sendPacket(int conn, const uint8_t *data, size_t length)
+{
+    if (this->send != NULL)
+    {
+        this->send(conn, data, length, this->transportCtx);
+    }
+}
+
+// Connection went away on the transport side
+void miniBroker::closed(int conn)
+{
+    if (conn < 0 || conn >= BROKER_MAX_CLIENTS || !this->connections[conn].used)
+    {
+        return;
+    }
+
+    uint32_t mask = ~(1UL << (conn % 32));
+
+    for (int i = 0; i < BROKER_TRIE_NODES; i++)
+    {
+        this->nodes[i].subs[conn / 32] &= mask;
+        this->nodes[i].qos1[conn / 32] &= mask;
+    }
+
+    this->prune(0);
+
+    this->connections[conn].used = false;
+    this->connections[conn].connected = false;
+}
+
+// Broker side close, protocol error or keepalive expiry
+void miniBroker::drop(int conn)
+{
+    this->closed(conn);
+
+    if (this->close != NULL)
+    {
+        this->close(conn, this->transportCtx);
+    }
+}
+
+void miniBroker::received(int conn, const uint8_t *data, size_t length, unsigned long now)
+{
+    if (conn < 0 || conn >= BROKER_MAX_CLIENTS || !this->connections[conn].used)
+    {
+        return;
+    }
+
+    brokerConnection &connection = this->connections[conn];
+
+    connection.lastIn = now;
+
+    while (length > 0)
+    {
+        size_t copy = BROKER_MAX_PACKET - connection.rxLength;
+
+        if (copy > length)
+        {
+            copy = length;
+        }
+
+        memcpy(connection.rx + connection.rxLength, data, copy);
+        connection.rxLength += copy;
+        data += copy;
+        length -= copy;
+
+        size_t offset = 0;
+
+        while (connection.used && connection.rxLength - offset >= 2)
+        {
+            const uint8_t *packet = connection.rx + offset;
+            size_t available = connection.rxLength - offset;
+            size_t remaining = 0;
+            size_t header = 1;
+            uint32_t multiplier = 1;
+            bool complete = false;
+
+            while (header < available && header <= 4)
+            {
+                uint8_t digit = packet[header++];
+                remaining += (digit & 127) * multiplier;
+                multiplier <<= 7;
+
+                if ((digit & 128) == 0)
+                {
+                    complete = true;
+                    break;
+                }
+            }
+
+            if (!complete)
+            {
+                if (header > 4)
+                {
+                    this->drop(conn);
+                    return;
+                }
+                break;
+            }
+
+            if (header + remaining > BROKER_MAX_PACKET)
+            {
+                // Larger than a receive slot, the gateway does not accept it
+                this->drop(conn);
+                return;
+            }
+
+            if (available < header + remaining)
+            {
+                break;
+            }
+
+            this->handlePacket(conn, packet, header + remaining, header, now);
+            offset += header + remaining;
+        }
+
+        if (!connection.used)
+        {
+            return;
+        }
+
+        if (offset > 0)
+        {
+            memmove(connection.rx, connection.rx + offset, connection.rxLength - offset);
+            connection.rxLength -= offset;
+        }
+    }
+}
+
+void miniBroker::handlePacket(int conn, const uint8_t *packet, size_t length, size_t header, unsigned long now)
+{
+    uint8_t type = packet[0] & 0xF0;
+    const uint8_t *data = packet + header;
+    size_t dataLength = length - header;
+
+    if (type != PACKET_CONNECT && !this->connections[conn].connected)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    switch (type)
+    {
+    case PACKET_CONNECT:
+        this->handleConnect(conn, data, dataLength, now);
+        break;
+    case PACKET_PUBLISH:
+        this->handlePublish(conn, packet[0] & 0x0F, data, dataLength, now);
+        break;
+    case PACKET_PUBACK:
+        this->handlePuback(conn, data, dataLength);
+        break;
+    case PACKET_SUBSCRIBE:
+        this->handleSubscribe(conn, data, dataLength);
+        break;
+    case PACKET_UNSUBSCRIBE:
+        this->handleUnsubscribe(conn, data, dataLength);
+        break;
+    case PACKET_PINGREQ:
+    {
+        uint8_t pong[2] = {PACKET_PINGRESP, 0};
+        this->sendPacket(conn, pong, 2);
+        break;
+    }
+    case PACKET_DISCONNECT:
+        this->drop(conn);
+        break;
+    default:
+        this->drop(conn);
+        break;
+    }
+}
+
+void miniBroker::handleConnect(int conn, const uint8_t *data, size_t length, unsigned long now)
+{
+    brokerConnection &connection = this->connections[conn];
+    uint8_t ack[4] = {PACKET_CONNACK, 2, 0, 0};
+
+    if (connection.connected || length < 10)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    size_t nameLength = readUint16(data);
+    size_t pos = 2 + nameLength;
+
+    if (pos + 6 > length)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    uint8_t level = data[pos];
+    uint8_t flags = data[pos + 1];
+
+    connection.keepAlive = readUint16(data + pos + 2);
+    pos += 4;
+
+    size_t idLength = readUint16(data + pos);
+    pos += 2;
+
+    if (pos + idLength > length)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    if (level != 3 && level != 4)
+    {
+        ack[3] = 1;
+    }
+    else if (idLength >= BROKER_CLIENT_ID_LENGTH || (idLength == 0 && (flags & 0x02) == 0))
+    {
+        ack[3] = 2;
+    }
+
+    if (ack[3] != 0)
+    {
+        this->sendPacket(conn, ack, 4);
+        this->drop(conn);
+        return;
+    }
+
+    // Will, user name and password are accepted but not used
+    memcpy(connection.clientId, data + pos, idLength);
+    connection.clientId[idLength] = 0;
+
+    // Session present
+    ack[2] = this->takeOver(conn, (flags & 0x02) != 0, now) ? 1 : 0;
+
+    this->sendPacket(conn, ack, 4);
+
+    connection.connected = true;
+    connection.lastIn = now;
+}
+
+// A CONNECT with a client id that is already connected takes the session
+// over: the old connection is dropped, and without clean session its
+// subscriptions and unacknowledged messages move to conn. Returns true when
+// a session was taken over.
+bool miniBroker::takeOver(int conn, bool clean, unsigned long now)
+{
+    brokerConnection &connection = this->connections[conn];
+
+    if (connection.clientId[0] == 0)
+    {
+        return false;
+    }
+
+    for (int old = 0; old < BROKER_MAX_CLIENTS; old++)
+    {
+        brokerConnection &previous = this->connections[old];
+
+        if (old == conn || !previous.connected || strcmp(previous.clientId, connection.clientId) != 0)
+        {
+            continue;
+        }
+
+        if (!clean)
+        {
+            uint32_t oldBit = 1UL << (old % 32);
+            uint32_t bit = 1UL << (conn % 32);
+
+            for (int i = 0; i < BROKER_TRIE_NODES; i++)
+            {
+                if (this->nodes[i].subs[old / 32] & oldBit)
+                {
+                    this->nodes[i].subs[conn / 32] |= bit;
+                }
+
+                if (this->nodes[i].qos1[old / 32] & oldBit)
+                {
+                    this->nodes[i].qos1[conn / 32] |= bit;
+                }
+            }
+
+            // Sent again with DUP on the next tick
+            for (int i = 0; i < BROKER_INFLIGHT; i++)
+            {
+                connection.inflight[i] = previous.inflight[i];
+                connection.inflight[i].sent = now - BROKER_RETRY_TIMEOUT - 1;
+            }
+
+            connection.nextPacketId = previous.nextPacketId;
+        }
+
+        this->drop(old);
+
+        return !clean;
+    }
+
+    return false;
+}
+
+void miniBroker::handlePublish(int conn, uint8_t flags, const uint8_t *data, size_t length, unsigned long now)
+{
+    uint8_t qos = (flags >> 1) & 0x03;
+
+    if (length < 2 || qos > 1)
+    {
+        // QoS 2 is not supported by the gateway
+        this->drop(conn);
+        return;
+    }
+
+    size_t topicLength = readUint16(data);
+    size_t pos = 2 + topicLength;
+
+    if (pos + (qos ? 2 : 0) > length || topicLength == 0)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    const char *topic = (const char *)(data + 2);
+
+    if (qos == 1)
+    {
+        uint8_t ack[4] = {PACKET_PUBACK, 2, data[pos], data[pos + 1]};
+        this->sendPacket(conn, ack, 4);
+        pos += 2;
+    }
+
+    this->messagesIn++;
+
+    this->route(topic, topicLength, data + pos, length - pos, qos, now);
+
+    if (this->tap != NULL)
+    {
+        this->tap(topic, topicLength, data + pos, length - pos, qos, this->tapCtx);
+    }
+}
+
+void miniBroker::handlePuback(int conn, const uint8_t *data, size_t length)
+{
+    if (length < 2)
+    {
+        return;
+    }
+
+    uint16_t packetId = readUint16(data);
+    brokerConnection &connection = this->connections[conn];
+
+    for (int i = 0; i < BROKER_INFLIGHT; i++)
+    {
+        if (connection.inflight[i].packetId == packetId)
+        {
+            connection.inflight[i].packetId = 0;
+            break;
+        }
+    }
+}
+
+void miniBroker::handleSubscribe(int conn, const uint8_t *data, size_t length)
+{
+    if (length < 2)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    uint8_t ack[BROKER_MAX_PACKET];
+    size_t count = 0;
+    size_t pos = 2;
+
+    // Reserve room for the fixed header and packet id
+    uint8_t *codes = ack + 8;
+
+    while (pos + 2 < length && count < BROKER_MAX_PACKET - 8)
+    {
+        size_t filterLength = readUint16(data + pos);
+        pos += 2;
+
+        if (pos + filterLength >= length)
+        {
+            this->drop(conn);
+            return;
+        }
+
+        const char *filter = (const char *)(data + pos);
+        uint8_t qos = data[pos + filterLength] & 0x03;
+        pos += filterLength + 1;
+
+        if (qos > 1)
+        {
+            qos = 1;
+        }
+
+        codes[count++] = this->subscribe(conn, filter, filterLength, qos) ? qos : 0x80;
+    }
+
+    if (count == 0)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    uint8_t head[5];
+    head[0] = PACKET_SUBACK;
+    size_t headLength = 1 + writeLength(head + 1, count + 2);
+
+    uint8_t *start = codes - 2 - headLength;
+    memcpy(start, head, headLength);
+    start[headLength] = data[0];
+    start[headLength + 1] = data[1];
+
+    this->sendPacket(conn, start, headLength + 2 + count);
+}
+
+void miniBroker::handleUnsubscribe(int conn, const uint8_t *data, size_t length)
+{
+    if (length < 2)
+    {
+        this->drop(conn);
+        return;
+    }
+
+    size_t pos = 2;
+
+    while (pos + 2 <= length)
+    {
+        size_t filterLength = readUint16(data + pos);
+        pos += 2;
+
+        if (pos + filterLength > length)
+        {
+            this->drop(conn);
+            return;
+        }
+
+        this->unsubscribe(conn, (const char *)(data + pos), filterLength);
+        pos += filterLength;
+    }
+
+    this->prune(0);
+
+    uint8_t ack[4] = {PACKET_UNSUBACK, 2, data[0], data[1]};
+    this->sendPacket(conn, ack, 4);
+}
+
+int miniBroker::findChild(int node, const char *level, size_t length, bool create)
+{
+    int last = -1;
+
+    for (int child = this->nodes[node].child; child >= 0; child = this->nodes[child].next)
+    {
+        if (strlen(this->nodes[child].level) == length && memcmp(this->nodes[child].level, level, length) == 0)
+        {
+            return child;
+        }
+        last = child;
+    }
+
+    if (!create)
+    {
+        return -1;
+    }
+
+    for (int i = 1; i < BROKER_TRIE_NODES; i++)
+    {
+        if (!this->nodes[i].used)
+        {
+            brokerNode &created = this->nodes[i];
+
+            memset(&created, 0, sizeof(brokerNode));
+            created.used = true;
+            created.child = -1;
+            created.next = -1;
+            memcpy(created.level, level, length);
+            created.level[length] = 0;
+
+            if (last < 0)
+            {
+                this->nodes[node].child = i;
+            }
+            else
+            {
+                this->nodes[last].next = i;
+            }
+
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool miniBroker::subscribe(int conn, const char *filter, size_t length, uint8_t qos)
+{
+    if (!validFilter(filter, length))
+    {
+        return false;
+    }
+
+    int node = 0;
+    size_t levelStart = 0;
+
+    for (size_t i = 0; i <= length; i++)
+    {
+        if (i == length || filter[i] == '/')
+        {
+            node = this->findChild(node, filter + levelStart, i - levelStart, true);
+
+            if (node < 0)
+            {
+                this->prune(0);
+                return false;
+            }
+
+            levelStart = i + 1;
+        }
+    }
+
+    uint32_t bit = 1UL << (conn % 32);
+
+    this->nodes[node].subs[conn / 32] |= bit;
+
+    if (qos == 1)
+    {
+        this->nodes[node].qos1[conn / 32] |= bit;
+    }
+    else
+    {
+        this->nodes[node].qos1[conn / 32] &= ~bit;
+    }
+
+    return true;
+}
+
+void miniBroker::unsubscribe(int conn, const char *filter, size_t length)
+{
+    int node = 0;
+    size_t levelStart = 0;
+
+    for (size_t i = 0; i <= length && node >= 0; i++)
+    {
+        if (i == length || filter[i] == '/')
+        {
+            node = this->findChild(node, filter + levelStart, i - levelStart, false);
+            levelStart = i + 1;
+        }
+    }
+
+    if (node > 0)
+    {
+        this->nodes[node].subs[conn / 32] &= ~(1UL << (conn % 32));
+        this->nodes[node].qos1[conn / 32] &= ~(1UL << (conn % 32));
+    }
+}
+
+// Frees nodes with no subscribers and no children, returns true when node is empty
+bool miniBroker::prune(int node)
+{
+    brokerNode &current = this->nodes[node];
+    int previous = -1;
+    int child = current.child;
+
+    while (child >= 0)
+    {
+        int next = this->nodes[child].next;
+
+        if (this->prune(child))
+        {
+            this->nodes[child].used = false;
+
+            if (previous < 0)
+            {
+                current.child = next;
+            }
+            else
+            {
+                this->nodes[previous].next = next;
+            }
+        }
+        else
+        {
+            previous = child;
+        }
+
+        child = next;
+    }
+
+    if (current.child >= 0)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < BROKER_BITMAP_WORDS; i++)
+    {
+        if (current.subs[i] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void mergeBits(uint32_t *subs, uint32_t *qos1, const brokerNode &node)
+{
+    for (int i = 0; i < BROKER_BITMAP_WORDS; i++)
+    {
+        subs[i] |= node.subs[i];
+        qos1[i] |= node.qos1[i];
+    }
+}
+
+// topic points at the start of the level that is matched against node's children
+void miniBroker::match(int node, const char *topic, size_t length, bool first, uint32_t *subs, uint32_t *qos1)
+{
+    size_t levelLength = 0;
+
+    while (levelLength < length && topic[levelLength] != '/')
+    {
+        levelLength++;
+    }
+
+    bool last = levelLength == length;
+    bool wildcards = !(first && levelLength > 0 && topic[0] == '$');
+
+    for (int child = this->nodes[node].child; child >= 0; child = this->nodes[child].next)
+    {
+        const brokerNode &current = this->nodes[child];
+
+        if (current.level[0] == '#' && current.level[1] == 0)
+        {
+            if (wildcards)
+            {
+                mergeBits(subs, qos1, current);
+            }
+            continue;
+        }
+
+        bool plus = current.level[0] == '+' && current.level[1] == 0;
+
+        if ((plus && wildcards) || (strlen(current.level) == levelLength && memcmp(current.level, topic, levelLength) == 0))
+        {
+            if (last)
+            {
+                mergeBits(subs, qos1, current);
+
+                // "a/#" also matches "a"
+                int multi = this->findChild(child, "#", 1, false);
+
+                if (multi >= 0)
+                {
+                    mergeBits(subs, qos1, this->nodes[multi]);
+                }
+            }
+            else
+            {
+                this->match(child, topic + levelLength + 1, length - levelLength - 1, false, subs, qos1);
+            }
+        }
+    }
+}
+
+void miniBroker::route(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, uint8_t qos, unsigned long now)
+{
+    uint32_t subs[BROKER_BITMAP_WORDS];
+    uint32_t qos1[BROKER_BITMAP_WORDS];
+
+    memset(subs, 0, sizeof(subs));
+    memset(qos1, 0, sizeof(qos1));
+
+    this->match(0, topic, topicLength, true, subs, qos1);
+
+    // The QoS 0 packet is built once and shared; QoS 1 deliveries are copied
+    // into an in-flight slot with their own packet id for retransmission.
+    size_t remaining = 2 + topicLength + length;
+    size_t header = 1 + writeLength(this->tx + 1, remaining);
+
+    if (header + remaining + 2 > BROKER_MAX_PACKET)
+    {
+        this->dropped++;
+        return;
+    }
+
+    this->tx[0] = PACKET_PUBLISH;
+    this->tx[header] = topicLength >> 8;
+    this->tx[header + 1] = topicLength & 0xFF;
+    memcpy(this->tx + header + 2, topic, topicLength);
+    memcpy(this->tx + header + 2 + topicLength, payload, length);
+
+    for (int conn = 0; conn < BROKER_MAX_CLIENTS; conn++)
+    {
+        uint32_t bit = 1UL << (conn % 32);
+
+        if ((subs[conn / 32] & bit) == 0 || !this->connections[conn].connected)
+        {
+            continue;
+        }
+
+        if (qos == 0 || (qos1[conn / 32] & bit) == 0)
+        {
+            this->sendPacket(conn, this->tx, header + remaining);
+            this->messagesOut++;
+            continue;
+        }
+
+        brokerConnection &connection = this->connections[conn];
+        brokerInflight *slot = NULL;
+
+        for (int i = 0; i < BROKER_INFLIGHT; i++)
+        {
+            if (connection.inflight[i].packetId == 0)
+            {
+                slot = &connection.inflight[i];
+                break;
+            }
+        }
+
+        if (slot == NULL)
+        {
+            this->dropped++;
+            continue;
+        }
+
+        slot->packetId = connection.nextPacketId++;
+
+        if (connection.nextPacketId == 0)
+        {
+            connection.nextPacketId = 1;
+        }
+
+        uint8_t *packet = slot->packet;
+        size_t pos = 1 + writeLength(packet + 1, remaining + 2);
+
+        packet[0] = PACKET_PUBLISH | (1 << 1);
+        memcpy(packet + pos, this->tx + header, 2 + topicLength);
+        pos += 2 + topicLength;
+        packet[pos++] = slot->packetId >> 8;
+        packet[pos++] = slot->packetId & 0xFF;
+        memcpy(packet + pos, payload, length);
+
+        slot->length = pos + length;
+        slot->sent = now;
+
+        this->sendPacket(conn, packet, slot->length);
+        this->messagesOut++;
+    }
+}
+
+void miniBroker::tick(unsigned long now)
+{
+    for (int conn = 0; conn < BROKER_MAX_CLIENTS; conn++)
+    {
+        brokerConnection &connection = this->connections[conn];
+
+        if (!connection.used)
+        {
+            continue;
+        }
+
+        // 1.5 x keepalive as the spec asks, unconnected sockets get 10 s
+        unsigned long limit = connection.connected ? connection.keepAlive * 1500UL : 10000UL;
+
+        if (limit > 0 && now - connection.lastIn > limit)
+        {
+            this->drop(conn);
+            continue;
+        }
+
+        for (int i = 0; i < BROKER_INFLIGHT; i++)
+        {
+            brokerInflight &slot = connection.inflight[i];
+
+            if (slot.packetId != 0 && now - slot.sent > BROKER_RETRY_TIMEOUT)
+            {
+                slot.packet[0] |= 0x08;
+                slot.sent = now;
+                this->sendPacket(conn, slot.packet, slot.length);
+            }
+        }
+    }
+}
+
+brokerBridge::brokerBridge()
+{
+    this->length = 0;
+    this->count = 0;
+    this->first = 0;
+    this->batches = 0;
+    this->dropped = 0;
+    this->flushFn = NULL;
+    this->flushCtx = NULL;
+}
+
+void brokerBridge::setFlush(bridgeFlushFn flush, void *ctx)
+{
+    this->flushFn = flush;
+    this->flushCtx = ctx;
+}
+
+bool brokerBridge::add(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, unsigned long now)
+{
+    size_t record = 4 + topicLength + length;
+
+    if (record > BRIDGE_BATCH_SIZE)
+    {
+        this->dropped++;
+        return false;
+    }
+
+    if (this->length + record > BRIDGE_BATCH_SIZE && !this->flush())
+    {
+        // Uplink is not taking batches, newest messages are the ones lost
+        this->dropped++;
+        return false;
+    }
+
+    if (this->count == 0)
+    {
+        this->first = now;
+    }
+
+    uint8_t *pos = this->batch + this->length;
+
+    pos[0] = topicLength >> 8;
+    pos[1] = topicLength & 0xFF;
+    memcpy(pos + 2, topic, topicLength);
+    pos += 2 + topicLength;
+    pos[0] = length >> 8;
+    pos[1] = length & 0xFF;
+    memcpy(pos + 2, payload, length);
+
+    this->length += record;
+    this->count++;
+
+    return true;
+}
+
+void brokerBridge::tick(unsigned long now)
+{
+    if (this->count > 0 && now - this->first >= BRIDGE_BATCH_INTERVAL)
+    {
+        this->flush();
+    }
+}
+
+bool brokerBridge::flush(void)
+{
+    if (this->count == 0)
+    {
+        return true;
+    }
+
+    if (this->flushFn == NULL || !this->flushFn(this->batch, this->length, this->count, this->flushCtx))
+    {
+        return false;
+    }
+
+    this->batches++;
+    this->length = 0;
+    this->count = 0;
+
+    return true;
+}
@@ -0,0 +1,155 @@
+#pragma once
+
+// Portable MQTT 3.1.1 broker core for the site gateway mode.
+// No Arduino or socket code in here: the transport feeds received bytes in
+// and gets outgoing packets through callbacks, and time is passed in, so the
+// same core can be driven by a native build with simulated clients.
+// All memory is static, sized by the macros below.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef BROKER_MAX_CLIENTS
+#define BROKER_MAX_CLIENTS 8
+#endif
+
+#ifndef BROKER_MAX_PACKET
+#define BROKER_MAX_PACKET 512
+#endif
+
+#ifndef BROKER_TRIE_NODES
+#define BROKER_TRIE_NODES 64
+#endif
+
+#ifndef BROKER_INFLIGHT
+#define BROKER_INFLIGHT 4
+#endif
+
+#define BROKER_LEVEL_LENGTH 24
+#define BROKER_CLIENT_ID_LENGTH 24
+#define BROKER_RETRY_TIMEOUT 5000
+#define BROKER_BITMAP_WORDS ((BROKER_MAX_CLIENTS + 31) / 32)
+
+#ifndef BRIDGE_BATCH_SIZE
+#define BRIDGE_BATCH_SIZE 1024
+#endif
+
+#define BRIDGE_BATCH_INTERVAL 1000
+
+typedef void (*brokerSendFn)(int conn, const uint8_t *data, size_t length, void *ctx);
+typedef void (*brokerCloseFn)(int conn, void *ctx);
+typedef void (*brokerPublishFn)(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, uint8_t qos, void *ctx);
+typedef bool (*bridgeFlushFn)(const uint8_t *batch, size_t length, uint16_t count, void *ctx);
+
+struct brokerInflight
+{
+    uint16_t packetId;
+    uint16_t length;
+    unsigned long sent;
+    uint8_t packet[BROKER_MAX_PACKET];
+};
+
+struct brokerConnection
+{
+    bool used;
+    bool connected;
+    uint16_t keepAlive;
+    uint16_t nextPacketId;
+    unsigned long lastIn;
+    char clientId[BROKER_CLIENT_ID_LENGTH];
+    size_t rxLength;
+    uint8_t rx[BROKER_MAX_PACKET];
+    brokerInflight inflight[BROKER_INFLIGHT];
+};
+
+struct brokerNode
+{
+    bool used;
+    int16_t child;
+    int16_t next;
+    char level[BROKER_LEVEL_LENGTH];
+    uint32_t subs[BROKER_BITMAP_WORDS];
+    uint32_t qos1[BROKER_BITMAP_WORDS];
+};
+
+class miniBroker
+{
+
+public:
+    unsigned long messagesIn;
+    unsigned long messagesOut;
+    unsigned long dropped;
+
+    miniBroker();
+
+    void setTransport(brokerSendFn send, brokerCloseFn close, void *ctx);
+    void setPublishTap(brokerPublishFn tap, void *ctx);
+
+    int open(unsigned long now);
+    void received(int conn, const uint8_t *data, size_t length, unsigned long now);
+    void closed(int conn);
+    void tick(unsigned long now);
+
+    int clients(void);
+
+    // The slot is taken, from open() until closed() or a broker side drop
+    bool used(int conn)
+    {
+        return conn >= 0 && conn < BROKER_MAX_CLIENTS && this->connections[conn].used;
+    }
+
+private:
+    brokerConnection connections[BROKER_MAX_CLIENTS];
+    brokerNode nodes[BROKER_TRIE_NODES];
+    uint8_t tx[BROKER_MAX_PACKET];
+
+    brokerSendFn send;
+    brokerCloseFn close;
+    void *transportCtx;
+    brokerPublishFn tap;
+    void *tapCtx;
+
+    void drop(int conn);
+    void sendPacket(int conn, const uint8_t *data, size_t length);
+    void handlePacket(int conn, const uint8_t *packet, size_t length, size_t header, unsigned long now);
+    void handleConnect(int conn, const uint8_t *data, size_t length, unsigned long now);
+    bool takeOver(int conn, bool clean, unsigned long now);
+    void handlePublish(int conn, uint8_t flags, const uint8_t *data, size_t length, unsigned long now);
+    void handleSubscribe(int conn, const uint8_t *data, size_t length);
+    void handleUnsubscribe(int conn, const uint8_t *data, size_t length);
+    void handlePuback(int conn, const uint8_t *data, size_t length);
+    void route(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, uint8_t qos, unsigned long now);
+
+    int findChild(int node, const char *level, size_t length, bool create);
+    bool subscribe(int conn, const char *filter, size_t length, uint8_t qos);
+    void unsubscribe(int conn, const char *filter, size_t length);
+    void match(int node, const char *topic, size_t length, bool first, uint32_t *subs, uint32_t *qos1);
+    bool prune(int node);
+};
+
+// Uplink bridge: collects locally published messages into one batch of
+// [topic length][topic][payload length][payload] records and hands the
+// batch to the flush callback when it is full or BRIDGE_BATCH_INTERVAL old.
+class brokerBridge
+{
+
+public:
+    unsigned long batches;
+    unsigned long dropped;
+
+    brokerBridge();
+
+    void setFlush(bridgeFlushFn flush, void *ctx);
+    bool add(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, unsigned long now);
+    void tick(unsigned long now);
+    bool flush(void);
+
+private:
+    uint8_t batch[BRIDGE_BATCH_SIZE];
+    size_t length;
+    uint16_t count;
+    unsigned long first;
+
+    bridgeFlushFn flushFn;
+    void *flushCtx;
+};
@@ -0,0 +1,149 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include "broker.h"
+#include "brokerMode.h"
+#include "myMqtt.h"
+
+// Arduino side of the gateway: sockets for the broker core and the uplink
+// that publishes bridge batches to the cloud broker through PubSubClient.
+
+WiFiServer brokerServer(BROKER_PORT);
+WiFiClient brokerClients[BROKER_MAX_CLIENTS];
+
+miniBroker Broker;
+brokerBridge Bridge;
+
+unsigned long lastUplinkTry = 0;
+
+String bridgeTopic = "/gtsField1/" + String((uint64_t)ESP.getEfuseMac()) + "/BRIDGE";
+
+void brokerSend(int conn, const uint8_t *data, size_t length, void *ctx)
+{
+  brokerClients[conn].write(data, length);
+}
+
+void brokerClose(int conn, void *ctx)
+{
+  brokerClients[conn].stop();
+}
+
+void brokerTap(const char *topic, size_t topicLength, const uint8_t *payload, size_t length, uint8_t qos, void *ctx)
+{
+  Bridge.add(topic, topicLength, payload, length, millis());
+}
+
+// beginPublish streams the batch, it is not limited by the PubSubClient buffer.
+// The batch stays in the bridge until it went out whole.
+bool bridgeFlush(const uint8_t *batch, size_t length, uint16_t count, void *ctx)
+{
+  if (!mqttClient->connected())
+  {
+    return false;
+  }
+
+  if (!mqttClient->beginPublish(bridgeTopic.c_str(), length, false))
+  {
+    return false;
+  }
+
+  if (mqttClient->write(batch, length) != length)
+  {
+    // The broker would read whatever comes next as the rest of this publish
+    mqttClient->disconnect();
+    return false;
+  }
+
+  return mqttClient->endPublish() == 1;
+}
+
+void brokerInit(void)
+{
+  if (BROKER_MODE == 0)
+  {
+    return;
+  }
+
+  Broker.setTransport(brokerSend, brokerClose, NULL);
+  Broker.setPublishTap(brokerTap, NULL);
+  Bridge.setFlush(bridgeFlush, NULL);
+
+  brokerServer.begin();
+  brokerServer.setNoDelay(true);
+}
+
+void brokerLoop(void)
+{
+  if (BROKER_MODE == 0)
+  {
+    return;
+  }
+
+  unsigned long now = millis();
+
+  if (brokerServer.hasClient())
+  {
+    WiFiClient client = brokerServer.available();
+    int conn = Broker.open(now);
+
+    if (conn < 0)
+    {
+      client.stop();
+    }
+    else
+    {
+      brokerClients[conn] = client;
+      brokerClients[conn].setNoDelay(true);
+    }
+  }
+
+  for (int conn = 0; conn < BROKER_MAX_CLIENTS; conn++)
+  {
+    WiFiClient &client = brokerClients[conn];
+
+    // Not client's bool: that is false once the peer has gone, and the
+    // slot still has to be closed below
+    if (!Broker.used(conn))
+    {
+      continue;
+    }
+
+    if (!client.connected())
+    {
+      Broker.closed(conn);
+      client.stop();
+      continue;
+    }
+
+    int available = client.available();
+
+    if (available > 0)
+    {
+      uint8_t buffer[256];
+
+      int length = client.read(buffer, min(available, (int)sizeof(buffer)));
+
+      if (length > 0)
+      {
+        Broker.received(conn, buffer, length, now);
+      }
+    }
+  }
+
+  Broker.tick(now);
+  Bridge.tick(now);
+}
+
+// The gateway keeps serving local clients while the uplink is down, so it
+// tries the cloud broker once per BROKER_UPLINK_RETRY instead of blocking.
+void brokerReconnect(void)
+{
+  if (mqttClient->state() == MQTT_CONNECTING)
+  {
+    reconnectTry();
+  }
+  else if (millis() - lastUplinkTry >= BROKER_UPLINK_RETRY)
+  {
+    lastUplinkTry = millis();
+    reconnectTry();
+  }
+}
@@ -0,0 +1,14 @@
+#include <Arduino.h>
+
+// Site gateway: run the embedded broker next to the PubSubClient uplink.
+// Enable with -DBROKER_MODE=1
+#ifndef BROKER_MODE
+#define BROKER_MODE 0
+#endif
+
+#define BROKER_PORT 1883
+#define BROKER_UPLINK_RETRY 5000
+
+void brokerInit(void);
+void brokerLoop(void);
+void brokerReconnect(void);
@@ -0,0 +1,271 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "commands.h"
+#include "tasks.h"
+
+mqttRequest MqttRequest;
+mqttResponse MqttResponse;
+
+bool PROCESS_FLAG = false;
+
+const commandHandler *deviceCommands = NULL;
+int deviceCommandCount = 0;
+
+// Batch lines are parsed back into MqttRequest, so they are read from a copy
+char batchLines[REQUEST_MAX_LENGTH];
+char batchResults[REPLY_MAX_LENGTH];
+
+mqttResponse::mqttResponse()
+{
+    this->mac[0] = 0;
+    this->capturing = false;
+    this->captured[0] = 0;
+    this->capturedLength = 0;
+    this->sink = NULL;
+    this->ctx = NULL;
+}
+
+void mqttResponse::begin(const char *mac, replySinkFn sink, void *ctx)
+{
+    snprintf(this->mac, sizeof(this->mac), "%s", mac);
+    this->sink = sink;
+    this->ctx = ctx;
+}
+
+void mqttResponse::sendMqttData(const char *data)
+{
+    size_t macLength = strlen(this->mac);
+
+    if (this->capturing)
+    {
+        const char *reply = strncmp(data, this->mac, macLength) == 0 && data[macLength] == '/' ? data + macLength + 1 : data;
+        size_t room = sizeof(this->captured) - this->capturedLength;
+        int length = snprintf(this->captured + this->capturedLength, room, "%s%s", this->capturedLength > 0 ? "|" : "", reply);
+
+        this->capturedLength += (size_t)length < room ? length : room - 1;
+        return;
+    }
+
+    if (this->sink != NULL)
+    {
+        this->sink(data, strlen(data), this->ctx);
+    }
+}
+
+void mqttResponse::beginCapture(void)
+{
+    this->capturing = true;
+    this->captured[0] = 0;
+    this->capturedLength = 0;
+}
+
+const char *mqttResponse::endCapture(void)
+{
+    this->capturing = false;
+    return this->captured;
+}
+
+void mqttResponse::send(const char *cmd, const char *state)
+{
+    this->sendf(cmd, "%s", state);
+}
+
+void mqttResponse::sendf(const char *cmd, const char *format, ...)
+{
+    va_list args;
+    int length = snprintf(this->reply, sizeof(this->reply), "%s/%s/", this->mac, cmd);
+
+    if (length < (int)sizeof(this->reply))
+    {
+        va_start(args, format);
+        vsnprintf(this->reply + length, sizeof(this->reply) - length, format, args);
+        va_end(args);
+    }
+
+    this->sendMqttData(this->reply);
+}
+
+void mqttResponse::sendPing(bool processFlag)
+{
+    this->send("CMD_PING", processFlag ? "BUSY" : "NOT_BUSY");
+}
+
+void mqttResponse::sendUpdateInfo(const char *state)
+{
+    this->send("CMD_UPDATE_FIRMWARE", state);
+}
+
+void mqttResponse::sendBootTimeline(const char *timeline)
+{
+    this->send("CMD_BOOT", timeline);
+}
+
+void mqttResponse::sendStatus(const char *state)
+{
+    this->send("CMD_STATUS", state);
+}
+
+void mqttResponse::sendCancelInfo(int count)
+{
+    this->sendf("CMD_CANCEL", "%d", count);
+}
+
+void mqttResponse::sendTimeseries(const char *series, const char *seq, const char *data)
+{
+    this->sendf("CMD_TS_QUERY", "%s/%s/%s", series, seq, data);
+}
+
+void mqttResponse::sendGroupInfo(const char *state)
+{
+    this->send("CMD_GROUP", state);
+}
+
+bool commandPing(void)
+{
+    MqttResponse.sendPing(PROCESS_FLAG);
+    return true;
+}
+
+// <cmd>:<progress> of each running task, or IDLE
+bool commandStatus(void)
+{
+    char state[RESPONSE_MAX_LENGTH] = "";
+    int length = 0;
+
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        if (commandTasks[i].active() && length < (int)sizeof(state))
+        {
+            length += snprintf(state + length, sizeof(state) - length, "%s%s:%d", length > 0 ? "," : "",
+                               commandTasks[i].cmd, commandTasks[i].progress);
+        }
+    }
+
+    MqttResponse.sendStatus(length > 0 ? state : "IDLE");
+    return true;
+}
+
+bool commandCancel(void)
+{
+    MqttResponse.sendCancelInfo(cancelTasks(MqttRequest.field(1)));
+    return true;
+}
+
+const commandHandler builtinCommands[] = {
+    {"CMD_PING", commandPing},
+    {"CMD_STATUS", commandStatus},
+    {"CMD_CANCEL", commandCancel},
+};
+
+void setCommands(const commandHandler *table, int count)
+{
+    deviceCommands = table;
+    deviceCommandCount = count;
+}
+
+void receiveCommand(const uint8_t *payload, size_t length)
+{
+    if (!MqttRequest.payloadParser(payload, length))
+    {
+        MqttResponse.send("CMD_REQUEST", length > REQUEST_MAX_LENGTH - 1 ? "TOO_LONG" : "TOO_MANY");
+    }
+}
+
+bool executeCommand(void)
+{
+    for (size_t i = 0; i < sizeof(builtinCommands) / sizeof(builtinCommands[0]); i++)
+    {
+        if (MqttRequest.is(builtinCommands[i].name))
+        {
+            return builtinCommands[i].run();
+        }
+    }
+
+    for (int i = 0; i < deviceCommandCount; i++)
+    {
+        if (MqttRequest.is(deviceCommands[i].name))
+        {
+            return deviceCommands[i].run();
+        }
+    }
+
+    return false;
+}
+
+void executeBatch(void)
+{
+    const char *batch[BATCH_MAX_COMMANDS];
+    int batchCount = MqttRequest.batchCount;
+    bool stopOnError = strcmp(MqttRequest.field(1), "STOP") == 0;
+    bool stopped = false;
+    int okCount = 0;
+    size_t length = 0;
+
+    memcpy(batchLines, MqttRequest.buffer, sizeof(batchLines));
+
+    for (int i = 0; i < batchCount; i++)
+    {
+        batch[i] = batchLines + (MqttRequest.batch[i] - MqttRequest.buffer);
+    }
+
+    batchResults[0] = 0;
+
+    for (int i = 0; i < batchCount; i++)
+    {
+        const char *state = "SKIP";
+        const char *reply = "";
+
+        if (!stopped)
+        {
+            MqttRequest.payloadParser((const uint8_t *)batch[i], strlen(batch[i]));
+
+            MqttResponse.beginCapture();
+
+            bool ok = executeCommand();
+
+            reply = MqttResponse.endCapture();
+
+            if (ok)
+            {
+                state = "OK";
+                okCount++;
+            }
+            else
+            {
+                state = "FAIL";
+                stopped = stopOnError;
+            }
+        }
+
+        // A reply that does not fit is cut, the count in front stays right
+        if (length < sizeof(batchResults) - 1)
+        {
+            int written = snprintf(batchResults + length, sizeof(batchResults) - length, "\n%d/%s/%s", i, state, reply);
+
+            length += (size_t)written < sizeof(batchResults) - length ? written : sizeof(batchResults) - length - 1;
+        }
+    }
+
+    MqttResponse.sendf("CMD_BATCH", "%d/%d%s", okCount, batchCount, batchResults);
+}
+
+void processCommand(void)
+{
+    if (MqttRequest.empty())
+    {
+        return;
+    }
+
+    if (MqttRequest.is(BATCH_COMMAND))
+    {
+        executeBatch();
+    }
+    else
+    {
+        executeCommand();
+    }
+
+    MqttRequest.clear();
+}
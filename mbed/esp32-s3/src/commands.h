@@ -0,0 +1,98 @@
+#pragma once
+
+// Command dispatch and replies. The request held in MqttRequest is looked up
+// in the built-in commands, then in the table the firmware registers with
+// setCommands(), and batches run line by line. Replies are formatted in
+// fixed buffers and handed to a sink, so the path from a parsed request to
+// its reply does not touch the heap. Portable, no Arduino code, the commands
+// that need the hardware live in process.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "request.h"
+
+#define RESPONSE_MAX_LENGTH 256
+
+// A whole reply with the MAC and command in front, a longer one is cut
+#define REPLY_MAX_LENGTH 1024
+
+#define MAC_LENGTH 24
+
+// Gets every reply, the firmware publishes it to the backend and the local API
+typedef void (*replySinkFn)(const char *data, size_t length, void *ctx);
+
+class mqttResponse
+{
+
+public:
+    char mac[MAC_LENGTH];
+    bool capturing;
+    char captured[RESPONSE_MAX_LENGTH];
+    size_t capturedLength;
+    char reply[REPLY_MAX_LENGTH];
+
+    mqttResponse();
+
+    void begin(const char *mac, replySinkFn sink, void *ctx);
+
+    void sendMqttData(const char *data);
+
+    // While capturing, replies are collected instead of sent, without the MAC
+    // and joined with |
+    void beginCapture(void);
+    const char *endCapture(void);
+
+    // mac/<cmd>/<state>
+    void send(const char *cmd, const char *state);
+    // mac/<cmd>/ followed by the formatted state
+    void sendf(const char *cmd, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    void sendPing(bool processFlag);
+    void sendUpdateInfo(const char *state);
+    void sendBootTimeline(const char *timeline);
+    void sendStatus(const char *state);
+    void sendCancelInfo(int count);
+    void sendTimeseries(const char *series, const char *seq, const char *data);
+    void sendGroupInfo(const char *state);
+
+private:
+    replySinkFn sink;
+    void *ctx;
+};
+
+extern mqttRequest MqttRequest;
+extern mqttResponse MqttResponse;
+
+// Set while a long running command is active, CMD_PING answers BUSY
+extern bool PROCESS_FLAG;
+
+// Runs the command held in MqttRequest and replies, returns false when it
+// was rejected
+typedef bool (*commandFn)(void);
+
+struct commandHandler
+{
+    const char *name;
+    commandFn run;
+};
+
+// The firmware's commands, searched after CMD_PING, CMD_STATUS and CMD_CANCEL
+void setCommands(const commandHandler *table, int count);
+
+// A request from the device topic, held in MqttRequest until
+// processCommand(). One too long for the buffer is answered with
+// CMD_REQUEST/TOO_LONG, a batch of too many lines with CMD_REQUEST/TOO_MANY
+void receiveCommand(const uint8_t *payload, size_t length);
+
+// Runs the command held in MqttRequest, false when it is unknown or was
+// rejected
+bool executeCommand(void);
+
+// CMD_BATCH[/STOP] followed by one command per line. The commands run in
+// order, their replies are collected and sent back as one
+// mac/CMD_BATCH/<ok>/<total> message with a <index>/<OK|FAIL|SKIP>/<reply>
+// line per command. STOP skips the rest after the first failure.
+void executeBatch(void);
+
+// Runs what MqttRequest holds, a batch or a single command, and empties it
+void processCommand(void);
@@ -0,0 +1,117 @@
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include "lz.h"
+#include "compression.h"
+
+// The mqtt-service keeps the same bytes in src/protocols/lz.ts, the id sent
+// with each payload is derived from them. Common tokens go last, they are the
+// closest to the payload and get the shortest distances.
+const char compressDictionary[] =
+    "CMD_UPDATE_FIRMWARE/CMD_BOOT/init:0,config:wifi_begin:wifi:mqtt:CMD_GROUP/CMD_AGG/samples/CMD_CANCEL/CMD_BATCH/"
+    "/OK/CMD_STATUS/FAIL/SKIP/BUSY/IDLE/CMD_TS_QUERY/heap/rssi/END/CMD_PING/NOT_BUSY/";
+
+int compressMode = 0;
+
+lzEncoder Encoder;
+
+uint8_t compressBuffer[COMPRESS_BUFFER_SIZE];
+size_t compressLength;
+
+bool setCompressMode(int mode)
+{
+    if (mode < 0 || mode > 2)
+    {
+        return false;
+    }
+
+    compressMode = mode;
+
+    if (mode == 2)
+    {
+        Encoder.setDictionary((const uint8_t *)compressDictionary, sizeof(compressDictionary) - 1);
+    }
+    else
+    {
+        Encoder.setDictionary(NULL, 0);
+    }
+
+    return true;
+}
+
+// Where compressSink() streams to, failed once the client took less than
+// it was given
+struct compressTarget
+{
+    PubSubClient *client;
+    bool failed;
+};
+
+void compressSink(const uint8_t *data, size_t length, void *ctx)
+{
+    compressTarget *target = (compressTarget *)ctx;
+
+    if (!target->failed && target->client->write(data, length) != length)
+    {
+        target->failed = true;
+    }
+}
+
+void bufferSink(const uint8_t *data, size_t length, void *ctx)
+{
+    memcpy(compressBuffer + compressLength, data, length);
+    compressLength += length;
+}
+
+// beginPublish needs the length up front: the first pass only counts, the
+// second streams into the client. Nothing is buffered besides the encoder.
+// beginPublish only does QoS 0, a QoS 1 reply goes through the buffer.
+bool publishCompressed(PubSubClient *client, const char *topic, const uint8_t *data, size_t length, uint8_t qos)
+{
+    size_t size = Encoder.compress(data, length, NULL, NULL);
+
+    if (size >= length)
+    {
+        return false;
+    }
+
+    if (qos > 0)
+    {
+        if (size > sizeof(compressBuffer))
+        {
+            return false;
+        }
+
+        compressLength = 0;
+        Encoder.compress(data, length, bufferSink, NULL);
+
+        return client->publish(topic, compressBuffer, compressLength, false, qos);
+    }
+
+    if (!client->beginPublish(topic, size, false))
+    {
+        return false;
+    }
+
+    compressTarget target = {client, false};
+
+    Encoder.compress(data, length, compressSink, &target);
+
+    if (target.failed)
+    {
+        // The broker would read whatever comes next as the rest of this publish
+        client->disconnect();
+        return false;
+    }
+
+    return client->endPublish() > 0;
+}
+
+bool publishReply(PubSubClient *client, const char *topic, const uint8_t *data, size_t length, uint8_t qos)
+{
+    if (compressMode != 0 && length >= COMPRESS_MIN_LENGTH && publishCompressed(client, topic, data, length, qos))
+    {
+        return true;
+    }
+
+    return client->publish(topic, data, length, false, qos);
+}
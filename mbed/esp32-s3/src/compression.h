@@ -0,0 +1,21 @@
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+// Reply compression, off until the backend asks for it with
+// CMD_COMPRESS/<mode>: 0 off, 1 LZSS, 2 LZSS with the shared dictionary.
+// Compressed payloads start with LZ_MAGIC (0xC5) then the dictionary id,
+// plain replies start with the MAC digits, so both can arrive on one topic.
+#define COMPRESS_MIN_LENGTH 96
+
+// A QoS 1 reply is kept in an in-flight slot until acknowledged, so it is
+// compressed into this buffer first and has to fit a slot anyway
+#define COMPRESS_BUFFER_SIZE MQTT_INFLIGHT_SIZE
+
+extern int compressMode;
+
+bool setCompressMode(int mode);
+// False when compressing does not pay or the reply could not be sent, the
+// caller then publishes it plain
+bool publishCompressed(PubSubClient *client, const char *topic, const uint8_t *data, size_t length, uint8_t qos);
+// Compressed when the mode is on and it pays, plain otherwise
+bool publishReply(PubSubClient *client, const char *topic, const uint8_t *data, size_t length, uint8_t qos);
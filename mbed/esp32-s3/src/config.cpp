@@ -7,6 +7,14 @@
 #include "eprom.h"
 #include "process.h"
 #include "config.h"
+#include "timeline.h"
+#include "localApi.h"
+#include "brokerMode.h"
+#include "timeseries.h"
+#include "groups.h"
+#include "sampling.h"
+#include "automation.h"
+#include "serialBridge.h"
 #include <sstream>
 #include <iostream>
 
@@ -14,23 +22,14 @@ using namespace std;
 
 void esp32Init(void)
 {
+  bootMark("init");
+
   pinMode(1, INPUT); // BTN
 
   initEprom();
 
-  delay(1000);
-
-  bool axcessPoint = false;
-
-  if (digitalRead(1) == 0)
-  {
-    delay(2000);
-
-    if (digitalRead(1) == 0)
-    {
-      axcessPoint = true;
-    }
-  }
+  // The AP override button is only logged, the 2 s hold check result was never used
+  bool axcessPoint = digitalRead(1) == 0;
 
   int ssidLen = EEPROM.read(0);
   int passLen = EEPROM.read(1);
@@ -40,16 +39,23 @@ void esp32Init(void)
 
   axcessPoint = false;
 
+  bootMark("config");
+
+  // Callback and DNS prefetch are registered before the station starts
+  setupMQTT();
+  processInit();
+
   if (ssidLen > 0 && ssidLen < 50 && passLen > 0 && passLen < 50 && axcessPoint == false)
   {
 
     String ssid = readEpromString(2, ssidLen);
     String pass = readEpromString(3 + ssidLen, passLen);
 
-    if (!connectToWiFi(ssid.c_str(), pass.c_str()))
-    {
-      esp_restart();
-    }
+    // The Wi-Fi task associates while the local init below runs, loop()
+    // takes over from wifiLoop() and only MQTT waits for the link
+    beginWiFi(ssid.c_str(), pass.c_str());
+
+    bootMark("wifi_begin");
   }
   else
   {
@@ -59,7 +65,14 @@ void esp32Init(void)
     sendEmailMac();
   }
 
-  setupMQTT();
+  timeseriesInit();
+  groupsInit();
+  rulesInit();
+
+  localApiInit();
+  brokerInit();
+  samplingInit();
+  serialBridgeInit();
 
-  delay(2000);
-}
\ No newline at end of file
+  bootMark("ready");
+}
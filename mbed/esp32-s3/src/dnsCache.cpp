@@ -0,0 +1,181 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include "lwip/dns.h"
+#include "dnsCache.h"
+#include "timeline.h"
+
+// Process wide host name cache shared by the MQTT and mail clients.
+// lwIP does not hand the record TTL to the found callback, so entries live
+// DNS_CACHE_TTL and are refreshed in the background DNS_CACHE_REFRESH before
+// they expire. A failed refresh keeps the last known good address.
+
+struct dnsEntry
+{
+    char host[DNS_CACHE_HOST_LENGTH];
+    IPAddress ip;
+    bool valid;
+    bool pending;
+    unsigned long expires;
+    unsigned long retry;
+    unsigned long lastUsed;
+};
+
+dnsEntry dnsEntries[DNS_CACHE_SIZE];
+
+portMUX_TYPE dnsMux = portMUX_INITIALIZER_UNLOCKED;
+
+void dnsFound(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    dnsEntry *entry = (dnsEntry *)arg;
+    unsigned long now = millis();
+
+    portENTER_CRITICAL(&dnsMux);
+
+    if (ipaddr != NULL && IP_IS_V4(ipaddr))
+    {
+        entry->ip = IPAddress(ip_2_ip4(ipaddr)->addr);
+        entry->valid = true;
+        entry->expires = now + DNS_CACHE_TTL;
+    }
+
+    entry->retry = now + DNS_CACHE_RETRY;
+    entry->pending = false;
+
+    portEXIT_CRITICAL(&dnsMux);
+
+    bootMark("dns");
+}
+
+// Claims the entry for host, or recycles the least recently used one, and
+// marks it used. lastUsed is read here by both the loop and the mail task.
+dnsEntry *dnsFind(const char *host)
+{
+    dnsEntry *entry = NULL;
+    dnsEntry *oldest = &dnsEntries[0];
+
+    if (strlen(host) >= DNS_CACHE_HOST_LENGTH)
+    {
+        return NULL;
+    }
+
+    portENTER_CRITICAL(&dnsMux);
+
+    for (int i = 0; i < DNS_CACHE_SIZE && entry == NULL; i++)
+    {
+        if (strcmp(dnsEntries[i].host, host) == 0)
+        {
+            entry = &dnsEntries[i];
+        }
+        else if (dnsEntries[i].host[0] == 0 || dnsEntries[i].lastUsed < oldest->lastUsed)
+        {
+            oldest = &dnsEntries[i];
+        }
+    }
+
+    if (entry == NULL && !oldest->pending)
+    {
+        *oldest = dnsEntry();
+        strcpy(oldest->host, host);
+        entry = oldest;
+    }
+
+    if (entry != NULL)
+    {
+        entry->lastUsed = millis();
+    }
+
+    portEXIT_CRITICAL(&dnsMux);
+
+    return entry;
+}
+
+void dnsResolve(dnsEntry *entry)
+{
+    ip_addr_t addr;
+
+    portENTER_CRITICAL(&dnsMux);
+    entry->pending = true;
+    portEXIT_CRITICAL(&dnsMux);
+
+    err_t err = dns_gethostbyname(entry->host, &addr, dnsFound, entry);
+
+    if (err == ERR_OK)
+    {
+        dnsFound(entry->host, &addr, entry);
+    }
+    else if (err != ERR_INPROGRESS)
+    {
+        portENTER_CRITICAL(&dnsMux);
+        entry->pending = false;
+        entry->retry = millis() + DNS_CACHE_RETRY;
+        portEXIT_CRITICAL(&dnsMux);
+    }
+}
+
+// Returns the cached address without blocking. Only the very first lookup
+// of a host waits for the resolver.
+bool dnsLookup(const char *host, IPAddress &ip)
+{
+    dnsEntry *entry = dnsFind(host);
+
+    if (entry == NULL)
+    {
+        return WiFi.hostByName(host, ip) == 1;
+    }
+
+    if (!entry->valid && !entry->pending)
+    {
+        IPAddress resolved;
+
+        if (WiFi.hostByName(host, resolved) == 1)
+        {
+            portENTER_CRITICAL(&dnsMux);
+            entry->ip = resolved;
+            entry->valid = true;
+            entry->expires = millis() + DNS_CACHE_TTL;
+            portEXIT_CRITICAL(&dnsMux);
+        }
+    }
+
+    portENTER_CRITICAL(&dnsMux);
+    bool valid = entry->valid;
+    ip = entry->ip;
+    portEXIT_CRITICAL(&dnsMux);
+
+    return valid;
+}
+
+void dnsPrefetch(const char *host)
+{
+    dnsEntry *entry = dnsFind(host);
+
+    if (entry != NULL && !entry->pending)
+    {
+        dnsResolve(entry);
+    }
+}
+
+void dnsCacheLoop(void)
+{
+    if (WiFi.status() != WL_CONNECTED)
+    {
+        return;
+    }
+
+    unsigned long now = millis();
+
+    for (int i = 0; i < DNS_CACHE_SIZE; i++)
+    {
+        dnsEntry *entry = &dnsEntries[i];
+
+        if (entry->host[0] == 0 || entry->pending || (long)(now - entry->retry) < 0)
+        {
+            continue;
+        }
+
+        if (!entry->valid || (long)(entry->expires - now) < DNS_CACHE_REFRESH)
+        {
+            dnsResolve(entry);
+        }
+    }
+}
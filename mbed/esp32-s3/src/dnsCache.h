@@ -0,0 +1,12 @@
+#include <Arduino.h>
+#include <WiFi.h>
+
+#define DNS_CACHE_SIZE 4
+#define DNS_CACHE_HOST_LENGTH 64
+#define DNS_CACHE_TTL 300000
+#define DNS_CACHE_REFRESH 60000
+#define DNS_CACHE_RETRY 10000
+
+bool dnsLookup(const char *host, IPAddress &ip);
+void dnsPrefetch(const char *host);
+void dnsCacheLoop(void);
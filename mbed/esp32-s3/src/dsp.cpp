@@ -0,0 +1,263 @@
+#include <string.h>
+#include <math.h>
+#include "dsp.h"
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+static int16_t saturate16(int32_t value)
+{
+    if (value > 32767)
+    {
+        return 32767;
+    }
+
+    if (value < -32768)
+    {
+        return -32768;
+    }
+
+    return (int16_t)value;
+}
+
+int16_t dspDot16Reference(const int16_t *a, const int16_t *b, int length)
+{
+    int64_t sum = 0;
+
+    for (int i = 0; i < length; i++)
+    {
+        sum += (int32_t)a[i] * b[i];
+    }
+
+    return saturate16((int32_t)((sum + (1 << 14)) >> 15));
+}
+
+// Four independent accumulators keep the multiplier busy. They are 64 bits
+// wide so any input gives the reference result, not only taps with
+// sum(|taps|) close to 1.0
+static int64_t dotScalar(const int16_t *a, const int16_t *b, int length)
+{
+    int64_t sum0 = 0;
+    int64_t sum1 = 0;
+    int64_t sum2 = 0;
+    int64_t sum3 = 0;
+    int i = 0;
+
+    for (; i + 4 <= length; i += 4)
+    {
+        sum0 += (int32_t)a[i] * b[i];
+        sum1 += (int32_t)a[i + 1] * b[i + 1];
+        sum2 += (int32_t)a[i + 2] * b[i + 2];
+        sum3 += (int32_t)a[i + 3] * b[i + 3];
+    }
+
+    for (; i < length; i++)
+    {
+        sum0 += (int32_t)a[i] * b[i];
+    }
+
+    return sum0 + sum1 + sum2 + sum3;
+}
+
+// esp-dsp's dsps_dotprod_s16 is not used: it rounds with 0x7fff and does
+// not saturate, so it does not match the reference.
+
+#if CONFIG_IDF_TARGET_ESP32S3
+
+// Eight products per EE.VMULAS.S16.ACCX into the 40 bit ACCX, which is read
+// back whole so the rounding and saturation are the reference's. blocks is
+// length / 8, at least 1.
+static int64_t dotPie(const int16_t *a, const int16_t *b, int blocks)
+{
+    // The PIE loads 128 bits from an address rounded down to 16, an operand
+    // that is not aligned is copied first
+    int16_t alignedA[DSP_PIE_MAX] __attribute__((aligned(16)));
+    int16_t alignedB[DSP_PIE_MAX] __attribute__((aligned(16)));
+    uint32_t low;
+    uint32_t high;
+
+    if (((uintptr_t)a & 15) != 0)
+    {
+        a = (const int16_t *)memcpy(alignedA, a, blocks * 8 * sizeof(int16_t));
+    }
+
+    if (((uintptr_t)b & 15) != 0)
+    {
+        b = (const int16_t *)memcpy(alignedB, b, blocks * 8 * sizeof(int16_t));
+    }
+
+    asm volatile(
+        "ee.zero.accx\n"
+        "1:\n"
+        "ee.vld.128.ip q0, %[a], 16\n"
+        "ee.vld.128.ip q1, %[b], 16\n"
+        "addi %[blocks], %[blocks], -1\n"
+        "ee.vmulas.s16.accx q0, q1\n"
+        "bnez %[blocks], 1b\n"
+        "rur.accx_0 %[low]\n"
+        "rur.accx_1 %[high]\n"
+        : [a] "+r"(a), [b] "+r"(b), [blocks] "+r"(blocks), [low] "=&r"(low), [high] "=&r"(high)
+        :
+        : "memory");
+
+    // ACCX_1 holds bits 39..32
+    return (int64_t)((uint64_t)(int64_t)(int8_t)high << 32 | low);
+}
+
+// The PIE takes the multiples of 8 up to DSP_PIE_MAX, the rest runs scalar
+int16_t dspDot16(const int16_t *a, const int16_t *b, int length)
+{
+    int blocks = length <= DSP_PIE_MAX ? length / 8 : 0;
+    int64_t sum = blocks > 0 ? dotPie(a, b, blocks) : 0;
+
+    sum += dotScalar(a + blocks * 8, b + blocks * 8, length - blocks * 8);
+
+    return saturate16((int32_t)((sum + (1 << 14)) >> 15));
+}
+
+#else
+
+int16_t dspDot16(const int16_t *a, const int16_t *b, int length)
+{
+    return saturate16((int32_t)((dotScalar(a, b, length) + (1 << 14)) >> 15));
+}
+
+#endif
+
+void dspLowPass(int16_t *taps, int count, int factor)
+{
+    // Cut off at 80% of the output Nyquist, Hamming window, unity DC gain
+    float cutoff = 0.4f / factor;
+    float weights[DSP_FIR_TAPS];
+    float total = 0;
+
+    if (count > DSP_FIR_TAPS)
+    {
+        count = DSP_FIR_TAPS;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        float n = i - (count - 1) / 2.0f;
+        float sinc = n == 0 ? 2 * cutoff : sinf(2 * (float)M_PI * cutoff * n) / ((float)M_PI * n);
+        float window = 0.54f - 0.46f * cosf(2 * (float)M_PI * i / (count - 1));
+
+        weights[i] = sinc * window;
+        total += weights[i];
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        taps[i] = saturate16((int32_t)lroundf(weights[i] / total * 32767));
+    }
+}
+
+cicDecimator::cicDecimator()
+{
+    this->begin(1, 16);
+}
+
+void cicDecimator::begin(int factor, int inputBits)
+{
+    this->factor = factor;
+    this->phase = 0;
+
+    // Gain is factor^order, shift it out and scale the input up to Q15
+    int growth = 0;
+
+    while ((1 << growth) < factor)
+    {
+        growth++;
+    }
+
+    this->shift = growth * DSP_CIC_ORDER - (16 - inputBits);
+
+    memset(this->integrator, 0, sizeof(this->integrator));
+    memset(this->comb, 0, sizeof(this->comb));
+}
+
+// Integrators and combs run in wrapping unsigned arithmetic, the output is
+// exact as long as it fits in 32 bits.
+size_t cicDecimator::process(const int16_t *in, size_t count, int16_t *out)
+{
+    size_t written = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t value = (uint32_t)(int32_t)in[i];
+
+        for (int k = 0; k < DSP_CIC_ORDER; k++)
+        {
+            this->integrator[k] += value;
+            value = this->integrator[k];
+        }
+
+        if (++this->phase < this->factor)
+        {
+            continue;
+        }
+
+        this->phase = 0;
+
+        for (int k = 0; k < DSP_CIC_ORDER; k++)
+        {
+            uint32_t previous = this->comb[k];
+
+            this->comb[k] = value;
+            value -= previous;
+        }
+
+        int32_t result = (int32_t)value;
+
+        out[written++] = saturate16(this->shift >= 0 ? result >> this->shift : result << -this->shift);
+    }
+
+    return written;
+}
+
+firDecimator::firDecimator()
+{
+    this->begin(1);
+}
+
+void firDecimator::begin(int factor)
+{
+    this->factor = factor;
+    this->phase = 0;
+
+    dspLowPass(this->taps, DSP_FIR_TAPS, factor);
+
+    memset(this->history, 0, sizeof(this->history));
+}
+
+// The newest DSP_FIR_TAPS - 1 inputs are kept in front of the block, so
+// every output is one contiguous dot product.
+size_t firDecimator::process(const int16_t *in, size_t count, int16_t *out)
+{
+    int16_t *block = this->history + DSP_FIR_TAPS - 1;
+    size_t written = 0;
+
+    if (count > DSP_BLOCK)
+    {
+        count = DSP_BLOCK;
+    }
+
+    memcpy(block, in, count * sizeof(int16_t));
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (++this->phase < this->factor)
+        {
+            continue;
+        }
+
+        this->phase = 0;
+
+        out[written++] = dspDot16(this->taps, this->history + i, DSP_FIR_TAPS);
+    }
+
+    memmove(this->history, this->history + count, (DSP_FIR_TAPS - 1) * sizeof(int16_t));
+
+    return written;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// Decimation kernels for the sampling pipeline. Portable, no Arduino code, so
+// the same file builds natively to check the fast path against the reference.
+// Samples are Q15, a 3rd order CIC does the coarse decimation and a FIR
+// low-pass does the final stage.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifndef DSP_FIR_TAPS
+#define DSP_FIR_TAPS 32
+#endif
+
+#define DSP_CIC_ORDER 3
+#define DSP_BLOCK 64
+
+// Longest dot product the ESP32-S3 PIE kernel takes: 40 bit ACCX holds 2^9
+// full scale products, the copy buffers for unaligned operands are this long
+#ifndef DSP_PIE_MAX
+#define DSP_PIE_MAX 64
+#endif
+
+// Dot product of two Q15 vectors, rounded and saturated back to Q15.
+// dspDot16 is the fast path, a PIE kernel on the ESP32-S3 and an unrolled
+// scalar loop elsewhere, dspDot16Reference the plain scalar loop it has to
+// match bit for bit.
+int16_t dspDot16(const int16_t *a, const int16_t *b, int length);
+int16_t dspDot16Reference(const int16_t *a, const int16_t *b, int length);
+
+// Writes a windowed-sinc low-pass for the given decimation factor, Q15
+void dspLowPass(int16_t *taps, int count, int factor);
+
+class cicDecimator
+{
+
+public:
+    cicDecimator();
+
+    void begin(int factor, int inputBits);
+
+    // Returns the number of outputs written, at most count / factor + 1
+    size_t process(const int16_t *in, size_t count, int16_t *out);
+
+private:
+    int factor;
+    int phase;
+    int shift;
+    uint32_t integrator[DSP_CIC_ORDER];
+    uint32_t comb[DSP_CIC_ORDER];
+};
+
+class firDecimator
+{
+
+public:
+    firDecimator();
+
+    void begin(int factor);
+
+    // count must not be larger than DSP_BLOCK
+    size_t process(const int16_t *in, size_t count, int16_t *out);
+
+private:
+    int factor;
+    int phase;
+    int16_t taps[DSP_FIR_TAPS] __attribute__((aligned(16)));
+    int16_t history[DSP_FIR_TAPS - 1 + DSP_BLOCK] __attribute__((aligned(16)));
+};
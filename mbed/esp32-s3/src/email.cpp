@@ -1,5 +1,6 @@
 #include <Arduino.h>
 #include <ESP_Mail_Client.h>
+#include "dnsCache.h"
 
 #define SMTP_HOST "smtp.gmail.com"
 #define SMTP_PORT 465
@@ -25,6 +26,12 @@ void setEmail(String email)
 
 void smtpCallback(SMTP_Status status);
 
+/* SMTP host lookups go through the shared DNS cache */
+int esp_mail_host_by_name(const char *name, IPAddress &ip)
+{
+  return dnsLookup(name, ip) ? 1 : 0;
+}
+
 
 void sendEmailMac(void)
 {
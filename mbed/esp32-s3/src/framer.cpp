@@ -0,0 +1,125 @@
+#include <string.h>
+#include "framer.h"
+
+serialFramer::serialFramer()
+{
+    this->begin(0, 0);
+}
+
+void serialFramer::begin(uint32_t gap, uint32_t charTime)
+{
+    this->gap = gap;
+    this->charTime = charTime;
+    this->closed = 0;
+    this->used = 0;
+    this->frameCount = 0;
+    this->firstClosed = 0;
+    this->last = 0;
+    this->inFrame = false;
+    this->discarding = false;
+    this->dropped = 0;
+}
+
+void serialFramer::add(const uint8_t *data, const uint32_t *times, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        // Start to start, so one character time is not idle line
+        if (this->inFrame && times[i] - this->last >= this->gap + this->charTime)
+        {
+            this->close(this->last + this->charTime + this->gap);
+        }
+
+        this->last = times[i];
+
+        if (!this->inFrame)
+        {
+            this->inFrame = true;
+            this->discarding = false;
+            this->used = this->closed + FRAMER_HEADER;
+
+            if (this->used >= FRAMER_BATCH)
+            {
+                this->drop();
+            }
+        }
+
+        if (this->discarding)
+        {
+            continue;
+        }
+
+        if (this->used - this->closed - FRAMER_HEADER == FRAMER_MAX_FRAME || this->used == FRAMER_BATCH)
+        {
+            this->drop();
+            continue;
+        }
+
+        this->batch[this->used++] = data[i];
+    }
+}
+
+void serialFramer::poll(uint32_t now)
+{
+    if (this->inFrame && now - this->last >= this->gap + this->charTime)
+    {
+        this->close(now);
+    }
+}
+
+void serialFramer::discard(void)
+{
+    if (this->inFrame && !this->discarding)
+    {
+        this->drop();
+    }
+}
+
+void serialFramer::consume(void)
+{
+    size_t open = this->used - this->closed;
+
+    if (this->inFrame && !this->discarding)
+    {
+        memmove(this->batch, this->batch + this->closed, open);
+        this->used = open;
+    }
+    else
+    {
+        this->used = 0;
+    }
+
+    this->closed = 0;
+    this->frameCount = 0;
+}
+
+void serialFramer::close(uint32_t now)
+{
+    this->inFrame = false;
+
+    if (this->discarding)
+    {
+        this->discarding = false;
+        this->used = this->closed;
+        return;
+    }
+
+    size_t length = this->used - this->closed - FRAMER_HEADER;
+
+    this->batch[this->closed] = length >> 8;
+    this->batch[this->closed + 1] = length & 0xFF;
+    this->closed = this->used;
+
+    if (this->frameCount++ == 0)
+    {
+        this->firstClosed = now;
+    }
+}
+
+// The rest of the frame is skipped up to the next gap
+void serialFramer::drop(void)
+{
+    this->discarding = true;
+    this->used = this->closed;
+    this->dropped++;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+// Splits a serial byte stream into frames on idle gaps, the way Modbus RTU
+// does with its 3.5 character silence. Portable, no Arduino code.
+// Bytes come with the time their start bit began, a byte that starts more
+// than gap after the end of the previous one opens a new frame. Frames are
+// written straight into a batch as records of a two byte big endian length
+// followed by the frame bytes, the batch is published as is.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAMER_BATCH 1024
+#define FRAMER_MAX_FRAME 256
+#define FRAMER_HEADER 2
+
+class serialFramer
+{
+
+public:
+    uint32_t dropped;
+
+    serialFramer();
+
+    // Times in any unit that wraps around the full 32 bits, the bridge uses
+    // SoftwareSerial ticks. charTime is how long one character takes on the
+    // line
+    void begin(uint32_t gap, uint32_t charTime);
+
+    void add(const uint8_t *data, const uint32_t *times, size_t count);
+
+    // Closes the open frame once the line has been idle for gap
+    void poll(uint32_t now);
+
+    // Drops the open frame, e.g. after the receive buffer overflowed
+    void discard(void);
+
+    // Closed frames, ready to publish
+    const uint8_t *frames(void)
+    {
+        return this->batch;
+    }
+
+    size_t length(void)
+    {
+        return this->closed;
+    }
+
+    uint16_t count(void)
+    {
+        return this->frameCount;
+    }
+
+    // Time the oldest closed frame ended
+    uint32_t oldest(void)
+    {
+        return this->firstClosed;
+    }
+
+    // No room left for a frame of FRAMER_MAX_FRAME
+    bool full(void)
+    {
+        return FRAMER_BATCH - this->used < FRAMER_HEADER + FRAMER_MAX_FRAME;
+    }
+
+    // Removes the closed frames after they were published, an open frame
+    // is kept
+    void consume(void);
+
+private:
+    uint8_t batch[FRAMER_BATCH];
+    size_t closed;
+    size_t used;
+    uint16_t frameCount;
+    uint32_t firstClosed;
+
+    uint32_t gap;
+    uint32_t charTime;
+    uint32_t last;
+    bool inFrame;
+    bool discarding;
+
+    void close(uint32_t now);
+    void drop(void);
+};
@@ -0,0 +1,311 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <vector>
+#include "groups.h"
+#include "myMqtt.h"
+
+using namespace std;
+
+class pendingCommand
+{
+
+public:
+    String payload;
+    unsigned long received;
+    unsigned long wait;
+
+    bool used(void)
+    {
+        return this->payload != "";
+    }
+
+    pendingCommand()
+    {
+        this->received = 0;
+        this->wait = 0;
+    }
+};
+
+class pendingJoin
+{
+
+public:
+    uint16_t msgId;
+    String name;
+
+    pendingJoin()
+    {
+        this->msgId = 0;
+    }
+};
+
+vector<String> deviceGroups;
+
+pendingCommand pendingCommands[GROUP_PENDING];
+pendingJoin pendingJoins[GROUP_JOINS];
+
+bool saveGroups(void)
+{
+    fs::File file = LittleFS.open(GROUP_FILE, FILE_WRITE);
+
+    if (!file)
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < deviceGroups.size(); i++)
+    {
+        file.print(deviceGroups[i] + "\n");
+    }
+
+    file.close();
+
+    return true;
+}
+
+void groupsInit(void)
+{
+    // LittleFS is mounted by timeseriesInit(), begin() again is a no-op
+    if (!LittleFS.begin(true))
+    {
+        return;
+    }
+
+    fs::File file = LittleFS.open(GROUP_FILE, FILE_READ);
+
+    if (!file)
+    {
+        return;
+    }
+
+    while (file.available() && deviceGroups.size() < GROUP_MAX)
+    {
+        String name = file.readStringUntil('\n');
+
+        name.trim();
+
+        if (name != "")
+        {
+            deviceGroups.push_back(name);
+        }
+    }
+
+    file.close();
+}
+
+// Packed GROUP_SUBSCRIBE_BATCH topics to a SUBSCRIBE, so the reconnect does
+// not cost a packet per group
+void subscribeGroups(PubSubClient *client)
+{
+    String names[GROUP_MAX];
+    const char *topics[GROUP_SUBSCRIBE_BATCH];
+    uint8_t qos[GROUP_SUBSCRIBE_BATCH] = {0};
+    uint8_t count = 0;
+
+    topics[count++] = GROUP_TOPIC_ALL;
+
+    for (size_t i = 0; i < deviceGroups.size(); i++)
+    {
+        names[i] = String(GROUP_TOPIC_PREFIX) + deviceGroups[i];
+        topics[count++] = names[i].c_str();
+
+        if (count == GROUP_SUBSCRIBE_BATCH)
+        {
+            client->subscribe(topics, qos, count);
+            count = 0;
+        }
+    }
+
+    if (count > 0)
+    {
+        client->subscribe(topics, qos, count);
+    }
+}
+
+// The topic is not NUL terminated
+bool isGroupTopic(const char *topic, size_t length)
+{
+    size_t all = strlen(GROUP_TOPIC_ALL);
+    size_t prefix = strlen(GROUP_TOPIC_PREFIX);
+
+    return (length == all && memcmp(topic, GROUP_TOPIC_ALL, all) == 0) || (length >= prefix && memcmp(topic, GROUP_TOPIC_PREFIX, prefix) == 0);
+}
+
+void deferGroupCommand(byte *payload, unsigned int length)
+{
+    if (length >= REQUEST_MAX_LENGTH)
+    {
+        Serial.println("Group command dropped, too long");
+        return;
+    }
+
+    for (int i = 0; i < GROUP_PENDING; i++)
+    {
+        if (!pendingCommands[i].used())
+        {
+            uint64_t mac = ESP.getEfuseMac();
+
+            pendingCommands[i].payload = "";
+            pendingCommands[i].payload.reserve(length);
+
+            for (unsigned int j = 0; j < length; j++)
+            {
+                pendingCommands[i].payload += (char)payload[j];
+            }
+
+            pendingCommands[i].received = millis();
+            pendingCommands[i].wait = (unsigned long)((mac ^ (mac >> 32)) % GROUP_STAGGER_WINDOW) + random(GROUP_JITTER);
+
+            Serial.printf("Group command in %lu ms\n", pendingCommands[i].wait);
+
+            return;
+        }
+    }
+
+    Serial.println("Group command dropped, queue full");
+}
+
+// Hands one due command to MqttRequest when it is free, processLoop() runs it
+// like a direct command.
+void groupLoop(void)
+{
+    if (!MqttRequest.empty())
+    {
+        return;
+    }
+
+    for (int i = 0; i < GROUP_PENDING; i++)
+    {
+        if (pendingCommands[i].used() && millis() - pendingCommands[i].received >= pendingCommands[i].wait)
+        {
+            MqttRequest.payloadParser((const uint8_t *)pendingCommands[i].payload.c_str(), pendingCommands[i].payload.length());
+
+            pendingCommands[i].payload = "";
+
+            return;
+        }
+    }
+}
+
+bool isMember(const String &name)
+{
+    for (size_t i = 0; i < deviceGroups.size(); i++)
+    {
+        if (deviceGroups[i] == name)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// A group already joined is subscribed again, the SUBACK reports it like a
+// new one
+bool joinGroup(String name)
+{
+    if (name == "" || name.length() >= GROUP_NAME_LENGTH || name.indexOf('+') >= 0 || name.indexOf('#') >= 0)
+    {
+        return false;
+    }
+
+    pendingJoin *join = NULL;
+    size_t waiting = 0;
+
+    for (int i = 0; i < GROUP_JOINS; i++)
+    {
+        if (pendingJoins[i].msgId != 0)
+        {
+            waiting++;
+        }
+        else if (join == NULL)
+        {
+            join = &pendingJoins[i];
+        }
+    }
+
+    // Pending joins count against GROUP_MAX, so a granted one always fits
+    if (join == NULL || (!isMember(name) && deviceGroups.size() + waiting >= GROUP_MAX))
+    {
+        return false;
+    }
+
+    String topic = String(GROUP_TOPIC_PREFIX) + name;
+    const char *topics[1] = {topic.c_str()};
+    uint8_t qos[1] = {0};
+
+    join->msgId = mqttClient->subscribe(topics, qos, 1);
+
+    if (join->msgId == 0)
+    {
+        return false;
+    }
+
+    join->name = name;
+
+    return true;
+}
+
+// Called for every SUBACK, only the ones for a join are looked at. Codes are
+// NULL when none came before the timeout or the connection was lost
+void groupSubscribed(uint16_t msgId, uint8_t *codes, uint8_t count)
+{
+    for (int i = 0; i < GROUP_JOINS; i++)
+    {
+        pendingJoin &join = pendingJoins[i];
+
+        if (join.msgId == 0 || join.msgId != msgId)
+        {
+            continue;
+        }
+
+        bool granted = codes != NULL && count > 0 && codes[0] < 0x80;
+
+        if (granted && !isMember(join.name))
+        {
+            deviceGroups.push_back(join.name);
+            granted = saveGroups();
+        }
+
+        join.msgId = 0;
+        join.name = "";
+
+        MqttResponse.sendGroupInfo(granted ? groupList().c_str() : "FAIL");
+
+        return;
+    }
+}
+
+bool leaveGroup(String name)
+{
+    for (size_t i = 0; i < deviceGroups.size(); i++)
+    {
+        if (deviceGroups[i] == name)
+        {
+            deviceGroups.erase(deviceGroups.begin() + i);
+
+            mqttClient->unsubscribe((String(GROUP_TOPIC_PREFIX) + name).c_str());
+
+            return saveGroups();
+        }
+    }
+
+    return false;
+}
+
+String groupList(void)
+{
+    String list = "";
+
+    for (size_t i = 0; i < deviceGroups.size(); i++)
+    {
+        if (i > 0)
+        {
+            list += ",";
+        }
+
+        list += deviceGroups[i];
+    }
+
+    return list;
+}
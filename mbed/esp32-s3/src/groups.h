@@ -0,0 +1,36 @@
+#include <Arduino.h>
+#include <PubSubClient.h>
+
+// Fan-out topics: one publish on /gtsField1/all or /gtsField1/group/<name>
+// reaches every subscribed device instead of one publish per device.
+#define GROUP_TOPIC_ALL "/gtsField1/all"
+#define GROUP_TOPIC_PREFIX "/gtsField1/group/"
+#define GROUP_FILE "/groups"
+#define GROUP_MAX 8
+#define GROUP_NAME_LENGTH 24
+#define GROUP_PENDING 4
+// Topics per SUBSCRIBE packet, 4 of the longest fit the 256 byte buffer
+#define GROUP_SUBSCRIBE_BATCH 4
+// Joins waiting for their SUBACK, the client tracks no more than that
+#define GROUP_JOINS MQTT_MAX_PENDING
+
+// Fleet commands are spread over the window: each device takes a fixed slot
+// from its MAC plus a random jitter, so an OTA rollout does not hit the
+// server with every device at once.
+#ifndef GROUP_STAGGER_WINDOW
+#define GROUP_STAGGER_WINDOW 30000
+#endif
+
+#define GROUP_JITTER (GROUP_STAGGER_WINDOW / 10)
+
+void groupsInit(void);
+void subscribeGroups(PubSubClient *client);
+bool isGroupTopic(const char *topic, size_t length);
+void deferGroupCommand(byte *payload, unsigned int length);
+void groupLoop(void);
+// Sends the SUBSCRIBE, false when it could not be sent. The group is kept
+// and the list reported with CMD_GROUP once the SUBACK grants it
+bool joinGroup(String name);
+void groupSubscribed(uint16_t msgId, uint8_t *codes, uint8_t count);
+bool leaveGroup(String name);
+String groupList(void);
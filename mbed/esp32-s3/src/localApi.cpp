@@ -0,0 +1,368 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WebServer.h>
+#include <base64.h>
+#include "mbedtls/sha1.h"
+#include "localApi.h"
+#include "myMqtt.h"
+#include "process.h"
+#include "websocket.h"
+
+// LAN control without the cloud broker. Commands are queued for
+// processLoop() like one from MQTT; every response is mirrored to the WS
+// clients. Each request carries LOCAL_API_TOKEN, and one a browser sends
+// from a page the device did not serve is refused.
+//   HTTP  POST /cmd, body CMD_PING        -> 202 once queued, 503 while one waits
+//   HTTP  GET /telemetry                  -> one telemetry line
+//         both with X-Api-Token: <token>
+//   WS    ws://<ip>:81/?token=<token>     -> text frames in, responses and telemetry out
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+class wsClient
+{
+
+public:
+  WiFiClient client;
+  bool open;
+  char handshake[LOCAL_API_HANDSHAKE];
+  int handshakeLength;
+  uint8_t frame[LOCAL_API_WS_FRAME + WS_HEADER_MAX];
+  int frameLength;
+
+  void clear(void)
+  {
+    this->client.stop();
+    this->open = false;
+    this->handshakeLength = 0;
+    this->frameLength = 0;
+  }
+
+  wsClient()
+  {
+    this->open = false;
+    this->handshakeLength = 0;
+    this->frameLength = 0;
+  }
+};
+
+// Not the provisioning server, its form must not be reachable from the LAN
+WebServer httpServer(LOCAL_API_HTTP_PORT);
+WiFiServer wsServer(LOCAL_API_WS_PORT);
+wsClient wsClients[LOCAL_API_WS_CLIENTS];
+
+unsigned long lastTelemetry = 0;
+
+// Frames that fit the buffer go out with one write so the header and payload
+// share a segment, larger ones are written header first and then from data
+void wsSend(wsClient &ws, uint8_t opcode, const uint8_t *data, size_t length)
+{
+  uint8_t frame[LOCAL_API_WS_FRAME + WS_HEADER_MAX];
+  size_t header = wsHeader(frame, opcode, length);
+  bool sent;
+
+  if (length <= LOCAL_API_WS_FRAME)
+  {
+    memcpy(frame + header, data, length);
+    sent = ws.client.write(frame, header + length) == header + length;
+  }
+  else
+  {
+    sent = ws.client.write(frame, header) == header && ws.client.write(data, length) == length;
+  }
+
+  // A frame cut short leaves the stream unreadable
+  if (!sent)
+  {
+    ws.clear();
+  }
+}
+
+// Tells the client why before the connection is dropped
+void wsFail(wsClient &ws, uint16_t code)
+{
+  uint8_t frame[WS_HEADER_MAX + 2];
+
+  ws.client.write(frame, wsClose(frame, code));
+  ws.clear();
+}
+
+void localApiPublish(const char *data)
+{
+  size_t length = strlen(data);
+
+  for (int i = 0; i < LOCAL_API_WS_CLIENTS; i++)
+  {
+    if (wsClients[i].open)
+    {
+      wsSend(wsClients[i], WS_TEXT, (const uint8_t *)data, length);
+    }
+  }
+}
+
+// The command waits in MqttRequest for processLoop(), one arriving before
+// that ran is refused instead of replacing it. A request receiveCommand()
+// refuses is answered like one from MQTT.
+bool queueLocalCommand(const char *cmd, int length)
+{
+  if (!MqttRequest.empty())
+  {
+    return false;
+  }
+
+  receiveCommand((const uint8_t *)cmd, length);
+
+  return true;
+}
+
+String localHost(void)
+{
+  return WiFi.localIP().toString();
+}
+
+String telemetry(void)
+{
+  return String(MqttResponse.mac) + "/TELEMETRY/" + String(millis()) + "," + String(ESP.getFreeHeap()) + "," +
+         String(WiFi.RSSI()) + "," + String(PROCESS_FLAG ? "BUSY" : "NOT_BUSY");
+}
+
+// Answers the request itself when it is refused
+bool httpAuthorized(void)
+{
+  if (!originAllowed(httpServer.header("Origin").c_str(), localHost().c_str()))
+  {
+    httpServer.send(403, "text/plain", "ORIGIN");
+    return false;
+  }
+
+  if (!tokenMatches(httpServer.header("X-Api-Token").c_str(), LOCAL_API_TOKEN))
+  {
+    httpServer.send(401, "text/plain", "TOKEN");
+    return false;
+  }
+
+  return true;
+}
+
+// The replies come back over MQTT and the WebSocket, not in this response
+void handleCommand()
+{
+  if (!httpAuthorized())
+  {
+    return;
+  }
+
+  String cmd = httpServer.hasArg("plain") ? httpServer.arg("plain") : httpServer.arg("c");
+
+  cmd.trim();
+
+  if (cmd.length() == 0)
+  {
+    httpServer.send(400, "text/plain", "EMPTY");
+  }
+  else if (cmd.length() >= REQUEST_MAX_LENGTH)
+  {
+    httpServer.send(413, "text/plain", "TOO_LONG");
+  }
+  else if (!queueLocalCommand(cmd.c_str(), cmd.length()))
+  {
+    httpServer.send(503, "text/plain", "BUSY");
+  }
+  else
+  {
+    httpServer.send(202, "text/plain", "QUEUED");
+  }
+}
+
+void handleTelemetry()
+{
+  if (httpAuthorized())
+  {
+    httpServer.send(200, "text/plain", telemetry());
+  }
+}
+
+void wsHandshake(wsClient &ws)
+{
+  while (ws.client.available() && ws.handshakeLength < LOCAL_API_HANDSHAKE - 1)
+  {
+    ws.handshake[ws.handshakeLength++] = ws.client.read();
+  }
+
+  ws.handshake[ws.handshakeLength] = 0;
+
+  if (strstr(ws.handshake, "\r\n\r\n") == NULL)
+  {
+    if (ws.handshakeLength >= LOCAL_API_HANDSHAKE - 1)
+    {
+      ws.clear();
+    }
+    return;
+  }
+
+  char key[32];
+  char origin[64];
+  char token[LOCAL_API_TOKEN_LENGTH];
+  int keyLength = httpHeader(ws.handshake, "Sec-WebSocket-Key", key, sizeof(key));
+  int originLength = httpHeader(ws.handshake, "Origin", origin, sizeof(origin));
+  int tokenLength = httpQuery(ws.handshake, "token", token, sizeof(token));
+  const char *refused = NULL;
+
+  if (keyLength <= 0 || keyLength >= (int)sizeof(key))
+  {
+    refused = "400 Bad Request";
+  }
+  else if (originLength >= (int)sizeof(origin) || (originLength >= 0 && !originAllowed(origin, localHost().c_str())))
+  {
+    refused = "403 Forbidden";
+  }
+  else if (tokenLength < 0 || tokenLength >= (int)sizeof(token) || !tokenMatches(token, LOCAL_API_TOKEN))
+  {
+    refused = "401 Unauthorized";
+  }
+
+  if (refused != NULL)
+  {
+    ws.client.print(String("HTTP/1.1 ") + refused + "\r\n\r\n");
+    ws.clear();
+    return;
+  }
+
+  String accept = String(key) + WS_GUID;
+  uint8_t hash[20];
+
+  mbedtls_sha1_ret((const unsigned char *)accept.c_str(), accept.length(), hash);
+
+  ws.client.print(String("HTTP/1.1 101 Switching Protocols\r\n") +
+                  "Upgrade: websocket\r\n" +
+                  "Connection: Upgrade\r\n" +
+                  "Sec-WebSocket-Accept: " + base64::encode(hash, sizeof(hash)) + "\r\n\r\n");
+
+  ws.open = true;
+  ws.frameLength = 0;
+}
+
+// Frames are collected across loop() calls, nothing here blocks on the socket.
+// Fragmented, oversized or unmasked frames close the connection with the
+// reason instead of being dropped.
+void wsRead(wsClient &ws)
+{
+  while (ws.client.available() && ws.frameLength < (int)sizeof(ws.frame))
+  {
+    wsFrame frame;
+
+    ws.frame[ws.frameLength++] = ws.client.read();
+
+    int result = wsParse(ws.frame, ws.frameLength, LOCAL_API_WS_FRAME, &frame);
+
+    if (result == WS_MORE)
+    {
+      continue;
+    }
+
+    if (result != WS_COMPLETE)
+    {
+      wsFail(ws, result == WS_FRAGMENTED ? WS_CLOSE_UNSUPPORTED : result == WS_TOO_BIG ? WS_CLOSE_TOO_BIG : WS_CLOSE_PROTOCOL);
+      return;
+    }
+
+    ws.frameLength = 0;
+
+    if (frame.opcode == WS_TEXT)
+    {
+      if (!queueLocalCommand((const char *)frame.payload, frame.length))
+      {
+        wsSend(ws, WS_TEXT, (const uint8_t *)"BUSY", 4);
+      }
+    }
+    else if (frame.opcode == WS_PING)
+    {
+      wsSend(ws, WS_PONG, frame.payload, frame.length);
+    }
+    else if (frame.opcode == WS_CLOSE)
+    {
+      wsSend(ws, WS_CLOSE, frame.payload, frame.length);
+      ws.clear();
+      return;
+    }
+    else if (frame.opcode != WS_PONG)
+    {
+      wsFail(ws, WS_CLOSE_UNSUPPORTED);
+      return;
+    }
+  }
+}
+
+void localApiInit(void)
+{
+  const char *headers[] = {"Origin", "X-Api-Token"};
+
+  httpServer.collectHeaders(headers, 2);
+  httpServer.on("/cmd", HTTP_POST, handleCommand);
+  httpServer.on("/telemetry", HTTP_GET, handleTelemetry);
+  httpServer.begin();
+
+  wsServer.begin();
+  wsServer.setNoDelay(true);
+}
+
+void localApiLoop(void)
+{
+  httpServer.handleClient();
+
+  if (wsServer.hasClient())
+  {
+    WiFiClient client = wsServer.available();
+
+    for (int i = 0; i < LOCAL_API_WS_CLIENTS; i++)
+    {
+      if (!wsClients[i].client.connected())
+      {
+        wsClients[i].clear();
+        wsClients[i].client = client;
+        wsClients[i].client.setNoDelay(true);
+        client = WiFiClient();
+        break;
+      }
+    }
+
+    client.stop();
+  }
+
+  bool sendTelemetry = millis() - lastTelemetry >= LOCAL_API_TELEMETRY_PERIOD;
+
+  if (sendTelemetry)
+  {
+    lastTelemetry = millis();
+  }
+
+  for (int i = 0; i < LOCAL_API_WS_CLIENTS; i++)
+  {
+    wsClient &ws = wsClients[i];
+
+    if (!ws.client.connected())
+    {
+      if (ws.open || ws.handshakeLength > 0)
+      {
+        ws.clear();
+      }
+      continue;
+    }
+
+    if (!ws.open)
+    {
+      wsHandshake(ws);
+    }
+    else
+    {
+      wsRead(ws);
+
+      if (sendTelemetry && ws.open)
+      {
+        String data = telemetry();
+
+        wsSend(ws, WS_TEXT, (const uint8_t *)data.c_str(), data.length());
+      }
+    }
+  }
+}
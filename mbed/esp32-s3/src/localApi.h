@@ -0,0 +1,20 @@
+#include <Arduino.h>
+
+#define LOCAL_API_HTTP_PORT 80
+#define LOCAL_API_WS_PORT 81
+#define LOCAL_API_WS_CLIENTS 4
+#define LOCAL_API_WS_FRAME 256
+#define LOCAL_API_HANDSHAKE 512
+#define LOCAL_API_TELEMETRY_PERIOD 1000
+
+// Shared secret every local request has to present, the local API refuses
+// everything while it is empty. Set with -DLOCAL_API_TOKEN='"<secret>"'
+#ifndef LOCAL_API_TOKEN
+#define LOCAL_API_TOKEN ""
+#endif
+
+#define LOCAL_API_TOKEN_LENGTH 64
+
+void localApiInit(void);
+void localApiLoop(void);
+void localApiPublish(const char *data);
@@ -0,0 +1,253 @@
+#include <string.h>
+#include "lz.h"
+
+#define LZ_EMPTY INT32_MIN
+
+lzEncoder::lzEncoder()
+{
+    this->setDictionary(NULL, 0);
+}
+
+void lzEncoder::setDictionary(const uint8_t *dictionary, size_t length)
+{
+    this->dictionary = dictionary;
+    this->dictionaryLength = dictionary != NULL ? length : 0;
+    this->dictionaryId = dictionary != NULL ? lzDictionaryId(dictionary, length) : 0;
+}
+
+// Negative positions read from the end of the dictionary
+uint8_t lzEncoder::at(int32_t pos)
+{
+    return pos < 0 ? this->dictionary[(int32_t)this->dictionaryLength + pos] : this->data[pos];
+}
+
+uint32_t lzEncoder::hash(int32_t pos)
+{
+    uint32_t key = (uint32_t)this->at(pos) << 16 | (uint32_t)this->at(pos + 1) << 8 | this->at(pos + 2);
+
+    return (key * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+void lzEncoder::insert(int32_t pos)
+{
+    uint32_t slot = this->hash(pos);
+
+    this->prev[pos & (LZ_WINDOW - 1)] = this->head[slot];
+    this->head[slot] = pos;
+}
+
+void lzEncoder::emit(const uint8_t *bytes, size_t count, bool match)
+{
+    if (this->groupItems == 0)
+    {
+        this->group[0] = 0;
+        this->groupLength = 1;
+    }
+
+    if (match)
+    {
+        this->group[0] |= 1 << this->groupItems;
+    }
+
+    memcpy(this->group + this->groupLength, bytes, count);
+    this->groupLength += count;
+
+    if (++this->groupItems == 8)
+    {
+        this->flush();
+    }
+}
+
+void lzEncoder::flush(void)
+{
+    if (this->groupItems == 0)
+    {
+        return;
+    }
+
+    if (this->sink != NULL)
+    {
+        this->sink(this->group, this->groupLength, this->ctx);
+    }
+
+    this->written += this->groupLength;
+    this->groupItems = 0;
+}
+
+size_t lzEncoder::compress(const uint8_t *data, size_t length, lzSinkFn sink, void *ctx)
+{
+    uint8_t header[LZ_HEADER] = {LZ_MAGIC, this->dictionaryId};
+
+    this->data = data;
+    this->length = length;
+    this->sink = sink;
+    this->ctx = ctx;
+    this->groupItems = 0;
+    this->written = LZ_HEADER;
+
+    if (sink != NULL)
+    {
+        sink(header, LZ_HEADER, ctx);
+    }
+
+    for (int i = 0; i < (1 << LZ_HASH_BITS); i++)
+    {
+        this->head[i] = LZ_EMPTY;
+    }
+
+    // Only the last window of the dictionary can be referenced
+    int32_t start = this->dictionaryLength > LZ_WINDOW ? -LZ_WINDOW : -(int32_t)this->dictionaryLength;
+
+    for (int32_t pos = start; pos + LZ_MIN_MATCH <= 0; pos++)
+    {
+        this->insert(pos);
+    }
+
+    int32_t pos = 0;
+    int32_t end = (int32_t)length;
+
+    while (pos < end)
+    {
+        int32_t best = 0;
+        int32_t distance = 0;
+
+        if (pos + LZ_MIN_MATCH <= end)
+        {
+            int32_t candidate = this->head[this->hash(pos)];
+            int32_t limit = end - pos < LZ_MAX_MATCH ? end - pos : LZ_MAX_MATCH;
+
+            for (int chain = 0; chain < LZ_MAX_CHAIN && candidate != LZ_EMPTY && pos - candidate <= LZ_WINDOW; chain++)
+            {
+                int32_t match = 0;
+
+                // May run into the bytes being encoded, the decoder copies byte by byte
+                while (match < limit && this->at(candidate + match) == data[pos + match])
+                {
+                    match++;
+                }
+
+                if (match > best)
+                {
+                    best = match;
+                    distance = pos - candidate;
+
+                    if (match == limit)
+                    {
+                        break;
+                    }
+                }
+
+                int32_t next = this->prev[candidate & (LZ_WINDOW - 1)];
+
+                // A newer position took the slot, the rest of the chain is gone
+                if (next >= candidate)
+                {
+                    break;
+                }
+
+                candidate = next;
+            }
+        }
+
+        if (best >= LZ_MIN_MATCH)
+        {
+            uint16_t code = (uint16_t)((distance - 1) << 6 | (best - LZ_MIN_MATCH));
+            uint8_t bytes[2] = {(uint8_t)(code >> 8), (uint8_t)(code & 0xFF)};
+
+            this->emit(bytes, 2, true);
+        }
+        else
+        {
+            best = 1;
+
+            this->emit(&data[pos], 1, false);
+        }
+
+        for (int32_t i = 0; i < best; i++, pos++)
+        {
+            if (pos + LZ_MIN_MATCH <= end)
+            {
+                this->insert(pos);
+            }
+        }
+    }
+
+    this->flush();
+
+    return this->written;
+}
+
+uint8_t lzDictionaryId(const uint8_t *dictionary, size_t length)
+{
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        hash = (hash ^ dictionary[i]) * 16777619u;
+    }
+
+    uint8_t id = hash ^ (hash >> 8) ^ (hash >> 16) ^ (hash >> 24);
+
+    return id != 0 ? id : 1;
+}
+
+long lzDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity, const uint8_t *dictionary,
+                  size_t dictionaryLength)
+{
+    if (length < LZ_HEADER || in[0] != LZ_MAGIC)
+    {
+        return -1;
+    }
+
+    if (in[1] != (dictionary != NULL ? lzDictionaryId(dictionary, dictionaryLength) : 0))
+    {
+        return -1;
+    }
+
+    size_t i = LZ_HEADER;
+    size_t written = 0;
+
+    while (i < length)
+    {
+        uint8_t flags = in[i++];
+
+        for (int item = 0; item < 8 && i < length; item++)
+        {
+            if ((flags & (1 << item)) == 0)
+            {
+                if (written == capacity)
+                {
+                    return -1;
+                }
+
+                out[written++] = in[i++];
+                continue;
+            }
+
+            if (i + 2 > length)
+            {
+                return -1;
+            }
+
+            uint16_t code = (uint16_t)(in[i] << 8 | in[i + 1]);
+            long distance = (code >> 6) + 1;
+            int count = (code & 0x3F) + LZ_MIN_MATCH;
+
+            i += 2;
+
+            if (distance > (long)(written + dictionaryLength) || written + count > capacity)
+            {
+                return -1;
+            }
+
+            for (int k = 0; k < count; k++, written++)
+            {
+                long source = (long)written - distance;
+
+                out[written] = source >= 0 ? out[source] : dictionary[(long)dictionaryLength + source];
+            }
+        }
+    }
+
+    return (long)written;
+}
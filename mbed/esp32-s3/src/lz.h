@@ -0,0 +1,68 @@
+#pragma once
+
+// LZSS codec for MQTT payloads. Portable, no Arduino code.
+// Stream: [LZ_MAGIC][dictionary id] then groups of one flag byte and eight
+// items, bit n set means item n is a match, clear a literal byte. A match is
+// two bytes, big endian: distance - 1 in the top 10 bits, length - 3 in the
+// low 6. A shared dictionary is treated as output that came before the
+// payload, both sides have to load the same one. Its id is taken from its
+// bytes, so a decoder holding different bytes refuses the stream instead of
+// producing garbage.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LZ_MAGIC 0xC5
+#define LZ_HEADER 2
+#define LZ_WINDOW 1024
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 66
+#define LZ_HASH_BITS 10
+#define LZ_MAX_CHAIN 16
+
+typedef void (*lzSinkFn)(const uint8_t *data, size_t length, void *ctx);
+
+class lzEncoder
+{
+
+public:
+    lzEncoder();
+
+    // NULL removes the dictionary, id 0
+    void setDictionary(const uint8_t *dictionary, size_t length);
+
+    // Returns the compressed size, sink may be NULL to only count it
+    size_t compress(const uint8_t *data, size_t length, lzSinkFn sink, void *ctx);
+
+private:
+    int32_t head[1 << LZ_HASH_BITS];
+    int32_t prev[LZ_WINDOW];
+
+    const uint8_t *dictionary;
+    size_t dictionaryLength;
+    uint8_t dictionaryId;
+
+    const uint8_t *data;
+    size_t length;
+
+    uint8_t group[17];
+    size_t groupLength;
+    int groupItems;
+    size_t written;
+    lzSinkFn sink;
+    void *ctx;
+
+    uint8_t at(int32_t pos);
+    uint32_t hash(int32_t pos);
+    void insert(int32_t pos);
+    void emit(const uint8_t *bytes, size_t count, bool match);
+    void flush(void);
+};
+
+// FNV-1a of the dictionary folded to one byte, never 0
+uint8_t lzDictionaryId(const uint8_t *dictionary, size_t length);
+
+// Returns the decompressed size, or -1 on a corrupt stream, a full output or
+// a stream made with another dictionary
+long lzDecompress(const uint8_t *in, size_t length, uint8_t *out, size_t capacity, const uint8_t *dictionary,
+                  size_t dictionaryLength);
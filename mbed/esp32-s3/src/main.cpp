@@ -3,6 +3,14 @@
 #include "config.h"
 #include <process.h>
 #include "WiFi.h"
+#include "dnsCache.h"
+#include "localApi.h"
+#include "brokerMode.h"
+#include "timeseries.h"
+#include "sampling.h"
+#include "aggregation.h"
+#include "automation.h"
+#include "serialBridge.h"
 
 bool sendPing = false;
 
@@ -15,11 +23,30 @@ void setup()
 
 void loop()
 {
+  timeseriesLoop();
+  rulesLoop();
+  serialBridgeLoop();
+  wifiLoop();
+  dnsCacheLoop();
+
   if (WiFi.status() == WL_CONNECTED)
   {
-    if (!mqttClient.connected())
+    localApiLoop();
+    brokerLoop();
+
+    if (!mqttClient->connected())
     {
-      reconnect();
+      if (BROKER_MODE)
+      {
+        brokerReconnect();
+      }
+      else
+      {
+        reconnectTry();
+      }
+
+      // The failover target has to keep its own keepalive going meanwhile
+      standbyLoop();
       sendPing = false;
     }
     else
@@ -30,16 +57,16 @@ void loop()
         MqttResponse.sendPing(PROCESS_FLAG);
       }
 
-      mqttClient.loop();
-      processLoop();
+      mqttClient->loop();
+      standbyLoop();
+      samplingLoop();
+      aggregateLoop();
     }
-  }
-  else
-  {
-    WiFi.disconnect();
-    WiFi.reconnect();
 
-    while (!connectToWiFiAgain())
-      ;
+    // Also while the broker is down, commands from the local API wait here
+    processLoop();
+
+    // Sends what the loops above left corked
+    mqttClient->flush();
   }
 }
@@ -4,79 +4,229 @@
 #include <process.h>
 #include <vector>
 #include "myMqtt.h"
+#include "timeline.h"
+#include "dnsCache.h"
+#include "groups.h"
 
 using namespace std;
 
-WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
+mqttBroker mqttBrokers[] = {MQTT_BROKERS};
+const int mqttBrokerCount = sizeof(mqttBrokers) / sizeof(mqttBrokers[0]);
+
+brokerSession brokerSessions[2];
+brokerSession *activeSession = &brokerSessions[0];
+brokerSession *standbySession = &brokerSessions[1];
+
+PubSubClient *mqttClient = &activeSession->client;
 
 String _topicNameESP = "/gtsField1/" + String((uint64_t)ESP.getEfuseMac());
 
-char *mqttServer = "broker.hivemq.com";
 const char *topicNameESP = _topicNameESP.c_str();
 
 String clientId = "gtsField1-";
-int mqttPort = 1883;
 
-mqttRequest MqttRequest;
-mqttResponse MqttResponse;
+bool bootReported = false;
+
+// Replies go to the backend and to the local API clients
+void sendReply(const char *data, size_t length, void *ctx)
+{
+  publishReply(mqttClient, NODE_TOPIC, (const uint8_t *)data, length, MQTT_REPLY_QOS);
+
+  localApiPublish(data);
+}
 
-void callback(char *topic, byte *payload, unsigned int length)
+// Gets the message where it sits in the receive buffer, the topic is not
+// NUL terminated
+void onMessage(void *context, const MqttMessage &message)
 {
   static int Led = 1;
 
-  if (*topic == *topicNameESP && PROCESS_FLAG == false)
+  if (message.topicLength == _topicNameESP.length() && memcmp(message.topic, topicNameESP, message.topicLength) == 0)
   {
-    MqttRequest.payloadParser(payload, length);
+    receiveCommand(message.payload, message.length);
 
     Led = not Led;
 
     digitalWrite(2, Led);
   }
+  else if (isGroupTopic(message.topic, message.topicLength))
+  {
+    deferGroupCommand(message.payload, message.length);
+  }
   else
   {
     MqttResponse.sendPing(PROCESS_FLAG);
   }
 }
 
-void reconnect()
+// A refused subscription leaves the device deaf to those commands
+void subscribed(uint16_t msgId, uint8_t *codes, uint8_t count)
 {
+  groupSubscribed(msgId, codes, count);
 
-  Serial.println("Connecting to MQTT Broker...");
+  if (codes == NULL)
+  {
+    Serial.printf("Subscribe %u not acknowledged\n", msgId);
+    return;
+  }
 
-  while (!mqttClient.connected())
+  for (uint8_t i = 0; i < count; i++)
   {
+    if (codes[i] >= 0x80)
+    {
+      Serial.printf("Subscribe %u topic %u refused\n", msgId, i);
+    }
+  }
+}
 
-    Serial.println("Reconnecting to MQTT Broker..");
+// The broker name is resolved as soon as the station gets an address,
+// so the lookup runs while the rest of init and the loop carry on.
+void prefetchMqttServer(arduino_event_id_t event)
+{
+  bootMark("wifi");
 
-    String id = clientId + String(random(0xffff), HEX);
+  for (int i = 0; i < mqttBrokerCount; i++)
+  {
+    dnsPrefetch(mqttBrokers[i].host);
+  }
+}
 
-    if (mqttClient.connect(id.c_str()))
-    {
-      Serial.println("Server Connected.");
-      mqttClient.subscribe(topicNameESP);
-    }
+bool connectSession(brokerSession *session, int broker)
+{
+  char id[32];
+
+  snprintf(id, sizeof(id), "%s%lx", clientId.c_str(), (unsigned long)random(0xffff));
+
+  IPAddress mqttServerIP;
+
+  session->broker = broker;
+  session->lastAttempt = millis();
+
+  if (dnsLookup(mqttBrokers[broker].host, mqttServerIP))
+  {
+    session->client.setServer(mqttServerIP, mqttBrokers[broker].port);
+  }
+  else
+  {
+    session->client.setServer(mqttBrokers[broker].host, mqttBrokers[broker].port);
+  }
+
+  // Returns once CONNECT is sent, the session's loop() finishes the handshake
+  return session->client.connectAsync(id);
+}
+
+void activateSession(void)
+{
+  Serial.println("Server Connected.");
+
+  activeSession->client.setKeepAlive(MQTT_KEEPALIVE);
+  activeSession->client.subscribe(topicNameESP);
+  subscribeGroups(&activeSession->client);
+
+  if (bootReported == false)
+  {
+    bootReported = true;
+    bootMark("mqtt");
+    MqttResponse.sendBootTimeline(bootTimeline().c_str());
   }
 }
 
+bool connectMQTT()
+{
+  // Failover: the standby session is already connected, only SUBSCRIBE is left
+  if (standbySession->client.connected())
+  {
+    brokerSession *session = activeSession;
+
+    activeSession = standbySession;
+    standbySession = session;
+    mqttClient = &activeSession->client;
+
+    Serial.printf("Failover to %s\n", mqttBrokers[activeSession->broker].host);
+
+    activateSession();
+
+    return true;
+  }
+
+  int broker = (activeSession->broker + 1) % mqttBrokerCount;
+
+  // sessionConnected() activates it once the broker has answered
+  return connectSession(activeSession, broker);
+}
+
+void sessionConnected(brokerSession *session, int state)
+{
+  if (state != MQTT_CONNECTED)
+  {
+    Serial.printf("%s refused or timed out: %d\n", mqttBrokers[session->broker].host, state);
+  }
+  else if (session == activeSession)
+  {
+    activateSession();
+  }
+}
+
+// Called every loop() while the active session is down, one step at a time so
+// the rest of the loop keeps running through the outage. Moves a handshake in
+// progress on, or starts one
 void reconnectTry()
 {
+  if (mqttClient->state() == MQTT_CONNECTING)
+  {
+    mqttClient->loop();
+    return;
+  }
+
   Serial.println("Reconnecting to MQTT Broker..");
 
-  String id = clientId + String(random(0xffff), HEX);
+  connectMQTT();
+}
 
-  if (mqttClient.connect(id.c_str()))
+// Keeps the second session open with only keepalive traffic, it does not
+// subscribe until it is promoted by connectMQTT().
+void standbyLoop()
+{
+  if (MQTT_WARM_STANDBY == 0)
+  {
+    return;
+  }
+
+  if (standbySession->client.connected() || standbySession->client.state() == MQTT_CONNECTING)
+  {
+    standbySession->client.loop();
+  }
+  else if (millis() - standbySession->lastAttempt > MQTT_STANDBY_RETRY)
   {
-    Serial.println("Server Connected.");
-    mqttClient.subscribe(topicNameESP);
+    standbySession->client.setKeepAlive(MQTT_STANDBY_KEEPALIVE);
+
+    connectSession(standbySession, (activeSession->broker + 1) % mqttBrokerCount);
   }
 }
 
 void setupMQTT()
 {
-  mqttClient.setServer(mqttServer, mqttPort);
-  // set the callback function
-  mqttClient.setCallback(callback);
+  MqttResponse.begin(String((uint64_t)ESP.getEfuseMac()).c_str(), sendReply, NULL);
+
+  // Start from the first broker in the list
+  activeSession->broker = mqttBrokerCount - 1;
+
+  for (int i = 0; i < 2; i++)
+  {
+    brokerSessions[i].client.setMessageHandler(onMessage, NULL);
+    brokerSessions[i].client.setSubscribeCallback(subscribed);
+    brokerSessions[i].client.setCork(MQTT_CORK);
+
+    // Set once, a session that fell back to 3.1.1 stays there for every broker
+    brokerSessions[i].client.setProtocolVersion(MQTT_PROTOCOL);
+
+    // The callback is told which session finished its handshake
+    brokerSession *session = &brokerSessions[i];
+    session->client.setConnectCallback([session](int state)
+                                       { sessionConnected(session, state); });
+  }
+
+  WiFi.onEvent(prefetchMqttServer, ARDUINO_EVENT_WIFI_STA_GOT_IP);
 
   pinMode(2, OUTPUT);
 }
@@ -1,99 +1,75 @@
 #include <Arduino.h>
+#include <WiFi.h>
 #include <PubSubClient.h>
 #include <vector>
+#include "localApi.h"
+#include "compression.h"
+#include "commands.h"
 
 using namespace std;
 
-extern PubSubClient mqttClient;
-
-class mqttRequest
+// Broker list, tried in order. The next broker after the active one is kept
+// connected as a warm standby. A single entry keeps the standby session on
+// the same broker. Override with -DMQTT_BROKERS='{"10.0.0.2", 1883}, ...'
+#ifndef MQTT_BROKERS
+#define MQTT_BROKERS {"broker.hivemq.com", 1883}
+#endif
+
+#ifndef MQTT_WARM_STANDBY
+#define MQTT_WARM_STANDBY 1
+#endif
+
+// 1 publishes replies with QoS 1, kept by the client until the broker
+// acknowledges them and sent again after a reconnect
+#ifndef MQTT_REPLY_QOS
+#define MQTT_REPLY_QOS 0
+#endif
+
+// MQTT_VERSION_5 sends the topic once per connection and a two byte alias
+// after that, a broker without MQTT 5 moves the session to 3.1.1 for good
+#ifndef MQTT_PROTOCOL
+#define MQTT_PROTOCOL MQTT_VERSION_3_1_1
+#endif
+
+// Send buffer in bytes, what one pass of loop() publishes and acknowledges goes
+// out in as few segments as possible: command replies, sample batches and
+// summaries wait at most until the flush() at the end of the pass. One TCP
+// segment by default, 0 writes every packet on its own
+#ifndef MQTT_CORK
+#define MQTT_CORK 1460
+#endif
+
+#define MQTT_STANDBY_KEEPALIVE 60
+#define MQTT_STANDBY_RETRY 30000
+
+struct mqttBroker
 {
-
-public:
-    String cmd;
-    int priority;
-    vector<String> dataList;
-
-    void clear(void)
-    {
-        this->cmd = "";
-        this->priority = 0;
-        this->dataList.clear();
-    }
-
-    void payloadParser(byte *payload, int length)
-    {
-        this->dataList.clear();
-
-        String msg = "";
-
-        for (int i = 0; i < length; i++)
-        {
-            if ((char)payload[i] != '/')
-            {
-                msg += ((char)payload[i]);
-            }
-            else
-            {
-                this->dataList.push_back(msg);
-                msg = "";
-            }
-        }
-
-        this->dataList.push_back(msg);
-
-        this->cmd = this->dataList[0];
-
-        Serial.println(this->cmd);
-    }
-
-    mqttRequest()
-    {
-        this->clear();
-    }
+    const char *host;
+    int port;
 };
 
-extern mqttRequest MqttRequest;
-
-class mqttResponse
+class brokerSession
 {
 
 public:
-    String mac;
-    String topicNameNODE;
-
-    void sendMqttData(const char *data)
-    {
-        mqttClient.publish(this->topicNameNODE.c_str(), data);
-    }
+    WiFiClient wifiClient;
+    PubSubClient client;
+    int broker;
+    unsigned long lastAttempt;
 
-    void sendPing(bool processFlag)
+    brokerSession() : client(wifiClient)
     {
-        if (processFlag == true)
-        {
-            this->sendMqttData((mac + String("/CMD_PING/BUSY")).c_str());
-        }
-        else
-        {
-            this->sendMqttData((mac + String("/CMD_PING/NOT_BUSY")).c_str());
-        }
-    }
-
-    void sendUpdateInfo(String state)
-    {
-        this->sendMqttData((mac + String("/CMD_UPDATE_FIRMWARE/") + state).c_str());
-    }
-
-    mqttResponse()
-    {
-        this->mac = String((uint64_t)ESP.getEfuseMac());
-        this->topicNameNODE = "/gtsField1/NODEJS";
+        this->broker = 0;
+        this->lastAttempt = 0;
     }
 };
 
-extern mqttResponse MqttResponse;
+extern PubSubClient *mqttClient;
+
+#define NODE_TOPIC "/gtsField1/NODEJS"
 
-void callback(char *topic, byte *payload, unsigned int length);
+void onMessage(void *context, const MqttMessage &message);
 void setupMQTT();
-void reconnect();
-void reconnectTry();
\ No newline at end of file
+bool connectMQTT();
+void reconnectTry();
+void standbyLoop();
\ No newline at end of file
@@ -1,22 +1,16 @@
 #include <Arduino.h>
 #include <WiFi.h>
+#include "timeseries.h"
+#include "automation.h"
+#include "serialBridge.h"
 
-String SSID;
-String PWD;
+#define WIFI_CONNECT_TIMEOUT 50000
 
-bool connectToWiFi(const char *_SSID, const char *_PWD)
-{
-  // Set your Static IP address
-  IPAddress local_IP(192, 168, 1, 184);
-  // Set your Gateway IP address
-  IPAddress gateway(192, 168, 1, 1);
-
-  IPAddress subnet(255, 255, 0, 0);
-  IPAddress primaryDNS(8, 8, 8, 8);   // optional
-  IPAddress secondaryDNS(8, 8, 4, 4); // optional
-  
-  int time = 100;
+unsigned long wifiDownSince = 0;
+bool wifiUp = false;
 
+void beginWiFi(const char *_SSID, const char *_PWD)
+{
   Serial.print("Connectiog to ");
 
   WiFi.config(WiFi.localIP(), WiFi.gatewayIP(), WiFi.subnetMask(),
@@ -26,22 +20,33 @@ bool connectToWiFi(const char *_SSID, const char *_PWD)
 
   Serial.println(_SSID);
   Serial.println(_PWD);
+}
+
+bool waitForWiFi(void)
+{
+  unsigned long start = millis();
+  unsigned long dot = start;
 
-  while (WiFi.status() != WL_CONNECTED && time > 0)
+  while (WiFi.status() != WL_CONNECTED && millis() - start < WIFI_CONNECT_TIMEOUT)
   {
-    Serial.print(".");
-    delay(500);
-    time--;
+    if (millis() - dot >= 500)
+    {
+      Serial.print(".");
+      dot = millis();
+    }
+
+    timeseriesLoop();
+    rulesLoop();
+    serialBridgeLoop();
+
+    delay(10);
   }
 
-  if (time != 0)
+  if (WiFi.status() == WL_CONNECTED)
   {
     Serial.print("Connected.");
     digitalWrite(2, 1);
 
-    SSID = String(_SSID);
-    PWD = String(_PWD);
-
     return true;
   }
   else
@@ -52,7 +57,52 @@ bool connectToWiFi(const char *_SSID, const char *_PWD)
   }
 }
 
-bool connectToWiFiAgain(void)
+bool connectToWiFi(const char *_SSID, const char *_PWD)
+{
+  beginWiFi(_SSID, _PWD);
+
+  return waitForWiFi();
+}
+
+// Called every loop(), nothing here blocks. The Wi-Fi driver reconnects on
+// its own; after WIFI_CONNECT_TIMEOUT without a link the association is
+// started again, or the chip restarts when it never had one since boot.
+void wifiLoop(void)
 {
-  return connectToWiFi(SSID.c_str(), PWD.c_str());
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    if (wifiDownSince != 0 || !wifiUp)
+    {
+      Serial.println("Connected.");
+      digitalWrite(2, 1);
+    }
+
+    wifiDownSince = 0;
+    wifiUp = true;
+    return;
+  }
+
+  if (wifiDownSince == 0)
+  {
+    wifiDownSince = millis();
+    digitalWrite(2, 0);
+    return;
+  }
+
+  if (millis() - wifiDownSince < WIFI_CONNECT_TIMEOUT)
+  {
+    return;
+  }
+
+  if (!wifiUp)
+  {
+    esp_restart();
+  }
+
+  Serial.println("Reconnecting to WiFi..");
+
+  WiFi.disconnect();
+  WiFi.reconnect();
+
+  wifiDownSince = millis();
 }
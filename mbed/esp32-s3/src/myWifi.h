@@ -1,2 +1,4 @@
+void beginWiFi(const char* SSID, const char* PWD);
+bool waitForWiFi(void);
 bool connectToWiFi(const char* SSID, const char* PWD);
-bool connectToWiFiAgain(void);
+void wifiLoop(void);
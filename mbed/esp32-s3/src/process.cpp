@@ -8,124 +8,349 @@
 #include <string>
 #include "esp_ota_ops.h"
 #include <HTTPClient.h>
+#include "process.h"
+#include "timeseries.h"
+#include "groups.h"
+#include "aggregation.h"
+#include "automation.h"
 
-bool PROCESS_FLAG = false;
+#define FIRMWARE_URL "https://raw.githubusercontent.com/enesvardar/firmware/main/firmware.bin"
+#define FIRMWARE_READ_TIMEOUT 15000
+#define FIRMWARE_PROGRESS_BYTES 65536
 
 using namespace std;
 
-esp_err_t updateFirmware()
+class firmwareUpdate
 {
+
+public:
     HTTPClient http;
+    WiFiClient *stream;
+    const esp_partition_t *partition;
+    esp_ota_handle_t otaHandle;
+    bool otaStarted;
+    int totalBytes;
+    int writtenBytes;
+    unsigned long lastRead;
+
+    void clear(void)
+    {
+        this->stream = NULL;
+        this->partition = NULL;
+        this->otaStarted = false;
+        this->totalBytes = 0;
+        this->writtenBytes = 0;
+        this->lastRead = 0;
+    }
 
-    string url = "https://raw.githubusercontent.com/enesvardar/firmware/main/firmware.bin";
+    void fail(const char *state)
+    {
+        if (this->otaStarted)
+        {
+            esp_ota_abort(this->otaHandle);
+        }
 
-    http.begin(url.c_str()); // İndirilecek dosyanın URL'si
+        this->http.end();
+        this->clear();
 
-    int httpCode = http.GET();
+        MqttResponse.sendUpdateInfo(state);
+    }
 
-    if (httpCode == HTTP_CODE_OK)
+    firmwareUpdate()
     {
+        this->clear();
+    }
+};
 
-        String firmwareData = http.getString(&mqttClient);
+firmwareUpdate FirmwareUpdate;
 
-        const esp_partition_t *partition = esp_ota_get_next_update_partition(NULL);
+tsQuery TsQuery;
 
-        if (partition == NULL)
-        {
-            Serial.println("Failed to get OTA update partition");
-            return ESP_FAIL;
-        }
+// Firmware is streamed from HTTP into the OTA partition one chunk per slice,
+// so mqttClient.loop() and other commands keep running in between.
+int updateFirmware(commandTask *task)
+{
+    PT_BEGIN(&task->state);
 
-        Serial.printf("Writing firmware to partition '%s' at offset 0x%x\n", partition->label, partition->address);
+    FirmwareUpdate.clear();
 
-        esp_ota_handle_t otaHandle;
-        esp_err_t err = esp_ota_begin(partition, OTA_SIZE_UNKNOWN, &otaHandle);
-        if (err != ESP_OK)
+    // No chunked encoding, the body is read from the socket as it is. Without
+    // a Content-Length it ends when the server closes the connection
+    FirmwareUpdate.http.useHTTP10(true);
+    FirmwareUpdate.http.begin(FIRMWARE_URL);
+
+    if (FirmwareUpdate.http.GET() != HTTP_CODE_OK)
+    {
+        FirmwareUpdate.fail("FAIL");
+        PT_EXIT(&task->state);
+    }
+
+    // -1 when the server did not send the size
+    FirmwareUpdate.totalBytes = FirmwareUpdate.http.getSize();
+    FirmwareUpdate.stream = FirmwareUpdate.http.getStreamPtr();
+    FirmwareUpdate.partition = esp_ota_get_next_update_partition(NULL);
+
+    if (FirmwareUpdate.partition == NULL || FirmwareUpdate.totalBytes == 0)
+    {
+        Serial.println("Failed to get OTA update partition");
+        FirmwareUpdate.fail("FAIL");
+        PT_EXIT(&task->state);
+    }
+
+    Serial.printf("Writing firmware to partition '%s' at offset 0x%x\n", FirmwareUpdate.partition->label, FirmwareUpdate.partition->address);
+
+    if (esp_ota_begin(FirmwareUpdate.partition, OTA_SIZE_UNKNOWN, &FirmwareUpdate.otaHandle) != ESP_OK)
+    {
+        Serial.println("Failed to begin OTA update");
+        FirmwareUpdate.fail("FAIL");
+        PT_EXIT(&task->state);
+    }
+
+    FirmwareUpdate.otaStarted = true;
+    FirmwareUpdate.lastRead = millis();
+
+    while (FirmwareUpdate.totalBytes < 0 || FirmwareUpdate.writtenBytes < FirmwareUpdate.totalBytes)
+    {
+        PT_WAIT_UNTIL(&task->state, task->cancel || FirmwareUpdate.stream->available() > 0 || !FirmwareUpdate.http.connected() ||
+                                        millis() - FirmwareUpdate.lastRead > FIRMWARE_READ_TIMEOUT);
+
+        if (task->cancel)
         {
-            Serial.printf("Failed to begin OTA update, error code: %d\n", err);
-            return err;
+            FirmwareUpdate.fail("CANCELED");
+            PT_EXIT(&task->state);
         }
 
-        size_t writtenBytes = 0;
+        if (FirmwareUpdate.stream->available() <= 0)
+        {
+            // All of a body of unknown size is there once the server closes
+            if (FirmwareUpdate.totalBytes < 0 && !FirmwareUpdate.http.connected() && FirmwareUpdate.writtenBytes > 0)
+            {
+                break;
+            }
 
-        char buffer[1024];
-        int readBytes = 0;
-        int i = 0;
+            Serial.println("Firmware download timed out or was cut short");
+            FirmwareUpdate.fail("FAIL");
+            PT_EXIT(&task->state);
+        }
 
-        while (i < firmwareData.length())
         {
-            mqttClient.loop();
+            uint8_t buffer[1024];
+            int length = min((int)sizeof(buffer), FirmwareUpdate.stream->available());
 
-            if (!mqttClient.connected())
+            if (FirmwareUpdate.totalBytes > 0)
             {
-                reconnectTry();
+                length = min(length, FirmwareUpdate.totalBytes - FirmwareUpdate.writtenBytes);
             }
 
-            readBytes = ((firmwareData.length() - i) > sizeof(buffer)) ? sizeof(buffer) : (firmwareData.length() - i);
-            memcpy(buffer, &firmwareData[i], readBytes);
-            err = esp_ota_write(otaHandle, buffer, readBytes);
-            if (err != ESP_OK)
+            // Only what has arrived, readBytes() would wait out the stream timeout
+            int readBytes = FirmwareUpdate.stream->read(buffer, length);
+
+            if (readBytes <= 0 || esp_ota_write(FirmwareUpdate.otaHandle, buffer, readBytes) != ESP_OK)
             {
-                Serial.printf("Failed to write OTA data, error code: %d\n", err);
-                return err;
+                Serial.println("Failed to write OTA data");
+                FirmwareUpdate.fail("FAIL");
+                PT_EXIT(&task->state);
             }
 
-            i += readBytes;
-            writtenBytes += readBytes;
-            // Serial.printf("Written %d bytes to OTA partition...\n", writtenBytes);
+            FirmwareUpdate.writtenBytes += readBytes;
+            FirmwareUpdate.lastRead = millis();
 
-            int state = (int)((float)(i * 100) / (float)firmwareData.length());
-
-            Serial.printf("%d%\n", state);
-            MqttResponse.sendUpdateInfo(String(state));
+            // Bytes written, "<written>/<total>" when the size is known, every
+            // FIRMWARE_PROGRESS_BYTES and at the end
+            if (FirmwareUpdate.writtenBytes - task->progress >= FIRMWARE_PROGRESS_BYTES ||
+                FirmwareUpdate.writtenBytes == FirmwareUpdate.totalBytes)
+            {
+                task->progress = FirmwareUpdate.writtenBytes;
+                Serial.printf("%d bytes\n", FirmwareUpdate.writtenBytes);
+
+                if (FirmwareUpdate.totalBytes > 0)
+                {
+                    MqttResponse.sendf("CMD_UPDATE_FIRMWARE", "%d/%d", FirmwareUpdate.writtenBytes, FirmwareUpdate.totalBytes);
+                }
+                else
+                {
+                    MqttResponse.sendf("CMD_UPDATE_FIRMWARE", "%d", FirmwareUpdate.writtenBytes);
+                }
+            }
         }
 
-        err = esp_ota_end(otaHandle);
+        PT_YIELD(&task->state);
+    }
 
-        if (err != ESP_OK)
-        {
-            Serial.printf("Failed to end OTA update, error code: %d\n", err);
-            return err;
-        }
+    FirmwareUpdate.otaStarted = false;
+    FirmwareUpdate.http.end();
+
+    if (esp_ota_end(FirmwareUpdate.otaHandle) != ESP_OK || esp_ota_set_boot_partition(FirmwareUpdate.partition) != ESP_OK)
+    {
+        Serial.println("Failed to finish OTA update");
+        MqttResponse.sendUpdateInfo("FAIL");
+        PT_EXIT(&task->state);
+    }
 
-        err = esp_ota_set_boot_partition(partition);
+    Serial.println("Firmware update complete. Rebooting...");
+    esp_restart();
 
-        if (err != ESP_OK)
+    PT_END(&task->state);
+}
+
+// Streams the samples of one series in chunks of TS_QUERY_CHUNK, one chunk per slice.
+int queryTimeseries(commandTask *task)
+{
+    PT_BEGIN(&task->state);
+
+    while (!task->cancel)
+    {
         {
-            Serial.printf("Failed to set boot partition, error code: %d\n", err);
-            return err;
+            tsSample sample;
+            char chunk[RESPONSE_MAX_LENGTH];
+            char seq[12];
+            int length = 0;
+            int count = 0;
+
+            // <time>:<value> is at most 23 characters, TS_QUERY_CHUNK of them fit
+            while (count < TS_QUERY_CHUNK && TsQuery.next(sample))
+            {
+                length += snprintf(chunk + length, sizeof(chunk) - length, "%s%lu:%ld", count > 0 ? ";" : "",
+                                   (unsigned long)sample.time, (long)sample.value);
+                count++;
+            }
+
+            if (count > 0)
+            {
+                snprintf(seq, sizeof(seq), "%d", TsQuery.seq++);
+                MqttResponse.sendTimeseries(TsQuery.store->name, seq, chunk);
+            }
+
+            task->progress = TsQuery.count;
+
+            if (count < TS_QUERY_CHUNK)
+            {
+                break;
+            }
         }
 
-        Serial.println("Firmware update complete. Rebooting...");
-        esp_restart();
+        PT_YIELD(&task->state);
+    }
+
+    TsQuery.end();
+
+    // <samples sent>/<samples the store lost to failed writes>
+    MqttResponse.sendf("CMD_TS_QUERY", "%s/%s/%lu/%lu", TsQuery.store->name, task->cancel ? "CANCELED" : "END",
+                       (unsigned long)TsQuery.count, (unsigned long)TsQuery.store->lost);
 
-        return ESP_OK;
+    PT_END(&task->state);
+}
+
+bool commandUpdateFirmware(void)
+{
+    if (!startTask(MqttRequest.cmd, updateFirmware))
+    {
+        MqttResponse.sendUpdateInfo("BUSY");
+        return false;
     }
 
-    http.end();
+    return true;
 }
 
-void processLoop(void)
+// CMD_TS_QUERY/<series>/<from>/<to>, times in unix seconds
+bool commandTsQuery(void)
 {
-    if (MqttRequest.cmd != "")
+    tsStore *store = MqttRequest.dataCount > 3 ? findSeries(MqttRequest.field(1)) : NULL;
+
+    if (store == NULL)
     {
-        Serial.println(MqttRequest.cmd);
+        MqttResponse.sendTimeseries(MqttRequest.field(1), "FAIL", "");
+        return false;
+    }
+
+    if (!startTask(MqttRequest.cmd, queryTimeseries))
+    {
+        MqttResponse.sendTimeseries(store->name, "BUSY", "");
+        return false;
+    }
 
-        PROCESS_FLAG = true;
+    TsQuery.begin(store, strtoul(MqttRequest.field(2), NULL, 10), strtoul(MqttRequest.field(3), NULL, 10));
+    return true;
+}
 
-        if (MqttRequest.cmd == "CMD_UPDATE_FIRMWARE")
-        {
-            updateFirmware();
-        }
-        else if (MqttRequest.cmd == "CMD_PING")
-        {
-            MqttResponse.sendPing(PROCESS_FLAG);
-        }
+bool commandGroup(void)
+{
+    String name = MqttRequest.field(1);
+
+    // The list goes out once the broker has granted the subscription
+    if (MqttRequest.is("CMD_GROUP_JOIN") && joinGroup(name))
+    {
+        return true;
+    }
+
+    bool ok = MqttRequest.is("CMD_GROUP_LEAVE") && leaveGroup(name);
+
+    MqttResponse.sendGroupInfo(ok ? groupList().c_str() : "FAIL");
+    return ok;
+}
+
+bool commandGroupList(void)
+{
+    MqttResponse.sendGroupInfo(groupList().c_str());
+    return true;
+}
+
+// CMD_AGG/<series>/<length ms>[/<slide ms>]
+bool commandAggregate(void)
+{
+    bool ok = MqttRequest.dataCount > 2 &&
+              aggregateConfigure(MqttRequest.field(1), strtoul(MqttRequest.field(2), NULL, 10), strtoul(MqttRequest.field(3), NULL, 10));
+
+    MqttResponse.sendf("CMD_AGG", "%s/%s", MqttRequest.field(1), ok ? MqttRequest.field(2) : "FAIL");
+    return ok;
+}
+
+bool commandCompress(void)
+{
+    bool ok = setCompressMode(atoi(MqttRequest.field(1)));
+
+    MqttResponse.send("CMD_COMPRESS", ok ? MqttRequest.field(1) : "FAIL");
+    return ok;
+}
+
+// CMD_RULE/<id>/<rule>, without a rule the id is removed
+bool commandRule(void)
+{
+    const char *error;
+    bool ok = MqttRequest.dataCount > 1 && setRule(atoi(MqttRequest.field(1)), MqttRequest.field(2), &error);
 
-        PROCESS_FLAG = false;
+    MqttResponse.sendf("CMD_RULE", "%s/%s", MqttRequest.field(1), MqttRequest.dataCount > 1 ? error : "FAIL");
+    return ok;
+}
 
-        MqttRequest.clear();
+const commandHandler firmwareCommands[] = {
+    {"CMD_UPDATE_FIRMWARE", commandUpdateFirmware},
+    {"CMD_TS_QUERY", commandTsQuery},
+    {"CMD_GROUP_JOIN", commandGroup},
+    {"CMD_GROUP_LEAVE", commandGroup},
+    {"CMD_GROUP_LIST", commandGroupList},
+    {"CMD_AGG", commandAggregate},
+    {"CMD_COMPRESS", commandCompress},
+    {"CMD_RULE", commandRule},
+};
+
+void processInit(void)
+{
+    setCommands(firmwareCommands, sizeof(firmwareCommands) / sizeof(firmwareCommands[0]));
+}
+
+void processLoop(void)
+{
+    groupLoop();
+
+    if (!MqttRequest.empty())
+    {
+        Serial.println(MqttRequest.cmd);
     }
 
+    processCommand();
+
+    PROCESS_FLAG = runTasks();
+
     delay(1);
-}
\ No newline at end of file
+}
@@ -1,8 +1,10 @@
 #include <Arduino.h>
 #include <iostream>
 #include <vector>
+#include "tasks.h"
+#include "commands.h"
 using namespace std;
 
-extern bool PROCESS_FLAG;
-
+// Registers the firmware's commands
+void processInit(void);
 void processLoop(void);
@@ -0,0 +1,61 @@
+#pragma once
+
+// Stackless protothreads (local continuations on __LINE__).
+// The xtensa toolchain is GCC 8.4 so C++20 coroutines are not available;
+// these macros give the same cooperative model for long running commands.
+// Locals are not kept across a yield, keep state in the task object.
+
+#define PT_WAITING 0
+#define PT_YIELDED 1
+#define PT_EXITED 2
+#define PT_ENDED 3
+
+struct pt
+{
+    unsigned short lc;
+};
+
+#define PT_INIT(p) ((p)->lc = 0)
+
+#define PT_BEGIN(p)     \
+    {                   \
+        char ptYield = 1; \
+        (void)ptYield;  \
+        switch ((p)->lc) \
+        {               \
+        case 0:
+
+#define PT_END(p)     \
+    }                 \
+    ptYield = 0;      \
+    PT_INIT(p);       \
+    return PT_ENDED;  \
+    }
+
+#define PT_WAIT_UNTIL(p, condition) \
+    do                              \
+    {                               \
+        (p)->lc = __LINE__;         \
+    case __LINE__:                  \
+        if (!(condition))           \
+            return PT_WAITING;      \
+    } while (0)
+
+#define PT_YIELD(p)             \
+    do                          \
+    {                           \
+        ptYield = 0;            \
+        (p)->lc = __LINE__;     \
+    case __LINE__:              \
+        if (ptYield == 0)       \
+            return PT_YIELDED;  \
+    } while (0)
+
+#define PT_EXIT(p)       \
+    do                   \
+    {                    \
+        PT_INIT(p);      \
+        return PT_EXITED; \
+    } while (0)
+
+#define PT_ALIVE(state) ((state) < PT_EXITED)
@@ -0,0 +1,132 @@
+#pragma once
+
+// Command requests as they come from MQTT, the local API or a group
+// message. Portable, no Arduino code.
+
+#include <stdint.h>
+#include <string.h>
+
+#define BATCH_COMMAND "CMD_BATCH"
+#define BATCH_COMMAND_LENGTH 9
+#define BATCH_MAX_COMMANDS 16
+
+#define REQUEST_MAX_LENGTH 512
+#define REQUEST_MAX_FIELDS 8
+
+// The request is copied into a fixed buffer and split in place, so parsing a
+// command does not touch the heap.
+class mqttRequest
+{
+
+public:
+    char buffer[REQUEST_MAX_LENGTH];
+    const char *cmd;
+    int priority;
+    const char *dataList[REQUEST_MAX_FIELDS];
+    int dataCount;
+    const char *batch[BATCH_MAX_COMMANDS];
+    int batchCount;
+
+    void clear(void)
+    {
+        this->buffer[0] = 0;
+        this->cmd = this->buffer;
+        this->priority = 0;
+        this->dataCount = 0;
+        this->batchCount = 0;
+    }
+
+    bool empty(void)
+    {
+        return this->cmd[0] == 0;
+    }
+
+    bool is(const char *name)
+    {
+        return strcmp(this->cmd, name) == 0;
+    }
+
+    // Missing fields read as ""
+    const char *field(int index)
+    {
+        return index < this->dataCount ? this->dataList[index] : "";
+    }
+
+    // A payload longer than the buffer, or a batch of more than
+    // BATCH_MAX_COMMANDS lines, is refused and leaves the request empty: a
+    // cut command could run with the wrong arguments, a cut batch would leave
+    // its tail undone. Lines may end in CRLF, the \r goes with the \n.
+    bool payloadParser(const uint8_t *payload, int length)
+    {
+        if (length > REQUEST_MAX_LENGTH - 1)
+        {
+            this->clear();
+            return false;
+        }
+
+        memmove(this->buffer, payload, length);
+        this->buffer[length] = 0;
+
+        for (int i = 0; i < length; i++)
+        {
+            if (this->buffer[i] == '\r' && (this->buffer[i + 1] == '\n' || this->buffer[i + 1] == 0))
+            {
+                this->buffer[i] = '\n';
+            }
+        }
+
+        while (length > 0 && this->buffer[length - 1] == '\n')
+        {
+            this->buffer[--length] = 0;
+        }
+
+        this->dataCount = 0;
+        this->batchCount = 0;
+
+        // Batch envelope: the header line is parsed as usual, every following
+        // line is one command kept as is for processLoop()
+        if (length > BATCH_COMMAND_LENGTH && memcmp(this->buffer, BATCH_COMMAND, BATCH_COMMAND_LENGTH) == 0)
+        {
+            char *line = strchr(this->buffer, '\n');
+
+            while (line != NULL)
+            {
+                *line++ = 0;
+
+                char *end = strchr(line, '\n');
+
+                if (*line != 0 && *line != '\n')
+                {
+                    if (this->batchCount == BATCH_MAX_COMMANDS)
+                    {
+                        this->clear();
+                        return false;
+                    }
+
+                    this->batch[this->batchCount++] = line;
+                }
+
+                line = end;
+            }
+        }
+
+        char *field = this->buffer;
+
+        this->dataList[this->dataCount++] = field;
+
+        while ((field = strchr(field, '/')) != NULL && this->dataCount < REQUEST_MAX_FIELDS)
+        {
+            *field++ = 0;
+            this->dataList[this->dataCount++] = field;
+        }
+
+        this->cmd = this->dataList[0];
+
+        return true;
+    }
+
+    mqttRequest()
+    {
+        this->clear();
+    }
+};
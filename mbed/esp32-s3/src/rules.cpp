@@ -0,0 +1,617 @@
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include "rules.h"
+
+enum
+{
+    OP_END,
+    OP_CONST,
+    OP_VAR,
+    OP_NEG,
+    OP_NOT,
+    OP_OR,
+    OP_AND,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    // variable <cmp> constant, [op][variable][float]
+    OP_VAR_LT,
+    OP_VAR_LE,
+    OP_VAR_GT,
+    OP_VAR_GE,
+    OP_VAR_EQ,
+    OP_VAR_NE,
+};
+
+#define KIND_CONST 0
+#define KIND_VAR 1
+#define KIND_EXPR 2
+
+struct ruleOperand
+{
+    int kind;
+    float value;
+    uint8_t variable;
+    size_t start;
+};
+
+static float apply(int op, float a, float b)
+{
+    switch (op)
+    {
+    case OP_OR:
+        return a != 0 || b != 0;
+    case OP_AND:
+        return a != 0 && b != 0;
+    case OP_LT:
+        return a < b;
+    case OP_LE:
+        return a <= b;
+    case OP_GT:
+        return a > b;
+    case OP_GE:
+        return a >= b;
+    case OP_EQ:
+        return a == b;
+    case OP_NE:
+        return a != b;
+    case OP_ADD:
+        return a + b;
+    case OP_SUB:
+        return a - b;
+    default:
+        return a * b;
+    }
+}
+
+// Recursive descent over the precedence levels, emitting code as it goes
+class ruleCompiler
+{
+
+public:
+    const char *p;
+    uint8_t *code;
+    size_t length;
+    const char *error;
+    const char *const *names;
+    int nameCount;
+
+    void skip(void)
+    {
+        while (*this->p == ' ')
+        {
+            this->p++;
+        }
+    }
+
+    bool accept(const char *token)
+    {
+        this->skip();
+
+        size_t n = strlen(token);
+
+        if (strncmp(this->p, token, n) != 0)
+        {
+            return false;
+        }
+
+        this->p += n;
+        return true;
+    }
+
+    bool emit(const void *bytes, size_t count)
+    {
+        // One byte is kept for OP_END
+        if (this->length + count >= RULE_CODE_SIZE)
+        {
+            this->error = "too long";
+            return false;
+        }
+
+        memcpy(this->code + this->length, bytes, count);
+        this->length += count;
+        return true;
+    }
+
+    bool emitOp(uint8_t op)
+    {
+        return this->emit(&op, 1);
+    }
+
+    bool emitConst(float value, ruleOperand &operand)
+    {
+        operand.kind = KIND_CONST;
+        operand.value = value;
+        operand.start = this->length;
+
+        return this->emitOp(OP_CONST) && this->emit(&value, sizeof(value));
+    }
+
+    // Operator of the given level at the cursor, -1 when there is none
+    int binaryOperator(int level)
+    {
+        this->skip();
+
+        // "->" starts the action, it is not a minus
+        if (strncmp(this->p, "->", 2) == 0)
+        {
+            return -1;
+        }
+
+        switch (level)
+        {
+        case 0:
+            return this->accept("||") ? OP_OR : -1;
+        case 1:
+            return this->accept("&&") ? OP_AND : -1;
+        case 2:
+            if (this->accept("<="))
+                return OP_LE;
+            if (this->accept(">="))
+                return OP_GE;
+            if (this->accept("=="))
+                return OP_EQ;
+            if (this->accept("!="))
+                return OP_NE;
+            if (this->accept("<"))
+                return OP_LT;
+            if (this->accept(">"))
+                return OP_GT;
+            return -1;
+        case 3:
+            if (this->accept("+"))
+                return OP_ADD;
+            if (this->accept("-"))
+                return OP_SUB;
+            return -1;
+        default:
+            return this->accept("*") ? OP_MUL : -1;
+        }
+    }
+
+    bool primary(ruleOperand &operand)
+    {
+        this->skip();
+
+        if (this->accept("("))
+        {
+            if (!this->binary(0, operand))
+            {
+                return false;
+            }
+
+            if (!this->accept(")"))
+            {
+                this->error = "missing )";
+                return false;
+            }
+
+            return true;
+        }
+
+        if (isdigit((unsigned char)*this->p) || *this->p == '.')
+        {
+            char *end;
+            float value = strtof(this->p, &end);
+
+            this->p = end;
+
+            return this->emitConst(value, operand);
+        }
+
+        const char *name = this->p;
+
+        while (isalnum((unsigned char)*this->p) || *this->p == '_')
+        {
+            this->p++;
+        }
+
+        size_t n = this->p - name;
+
+        for (int i = 0; i < this->nameCount && n > 0; i++)
+        {
+            if (strlen(this->names[i]) == n && strncmp(this->names[i], name, n) == 0)
+            {
+                uint8_t bytes[2] = {OP_VAR, (uint8_t)i};
+
+                operand.kind = KIND_VAR;
+                operand.variable = i;
+                operand.start = this->length;
+
+                return this->emit(bytes, 2);
+            }
+        }
+
+        this->error = n > 0 ? "unknown variable" : "syntax";
+        return false;
+    }
+
+    bool unary(ruleOperand &operand)
+    {
+        int op = this->accept("!") ? OP_NOT : this->binaryOperator(3) == OP_SUB ? OP_NEG : -1;
+
+        if (op < 0)
+        {
+            return this->primary(operand);
+        }
+
+        size_t start = this->length;
+
+        if (!this->unary(operand))
+        {
+            return false;
+        }
+
+        if (operand.kind == KIND_CONST)
+        {
+            this->length = start;
+
+            return this->emitConst(op == OP_NOT ? operand.value == 0 : -operand.value, operand);
+        }
+
+        operand.kind = KIND_EXPR;
+        operand.start = start;
+
+        return this->emitOp(op);
+    }
+
+    bool binary(int level, ruleOperand &left)
+    {
+        if (level == 5)
+        {
+            return this->unary(left);
+        }
+
+        if (!this->binary(level + 1, left))
+        {
+            return false;
+        }
+
+        int op;
+
+        while ((op = this->binaryOperator(level)) >= 0)
+        {
+            ruleOperand right;
+
+            if (!this->binary(level + 1, right))
+            {
+                return false;
+            }
+
+            size_t start = left.start;
+
+            if (left.kind == KIND_CONST && right.kind == KIND_CONST)
+            {
+                this->length = start;
+
+                if (!this->emitConst(apply(op, left.value, right.value), left))
+                {
+                    return false;
+                }
+
+                continue;
+            }
+
+            if (level == 2 && left.kind == KIND_VAR && right.kind == KIND_CONST)
+            {
+                uint8_t bytes[2] = {(uint8_t)(OP_VAR_LT + op - OP_LT), left.variable};
+
+                this->length = start;
+
+                if (!this->emit(bytes, 2) || !this->emit(&right.value, sizeof(right.value)))
+                {
+                    return false;
+                }
+            }
+            else if (!this->emitOp(op))
+            {
+                return false;
+            }
+
+            left.kind = KIND_EXPR;
+            left.start = start;
+        }
+
+        return true;
+    }
+};
+
+// Walks the code once to check the stack never leaves [1, RULE_STACK]
+static bool checkStack(const uint8_t *code)
+{
+    int depth = 0;
+
+    while (*code != OP_END)
+    {
+        uint8_t op = *code;
+
+        if (op == OP_CONST || op >= OP_VAR_LT)
+        {
+            depth++;
+            code += op == OP_CONST ? 1 + sizeof(float) : 2 + sizeof(float);
+        }
+        else if (op == OP_VAR)
+        {
+            depth++;
+            code += 2;
+        }
+        else if (op == OP_NEG || op == OP_NOT)
+        {
+            code++;
+        }
+        else
+        {
+            depth--;
+            code++;
+        }
+
+        if (depth < 1 || depth > RULE_STACK)
+        {
+            return false;
+        }
+    }
+
+    return depth == 1;
+}
+
+ruleSet::ruleSet()
+{
+    this->error = NULL;
+    this->names = NULL;
+    this->nameCount = 0;
+    this->outputs = 0;
+
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        this->rules[i].used = false;
+    }
+}
+
+void ruleSet::setVariables(const char *const *names, int count)
+{
+    this->names = names;
+    this->nameCount = count < RULE_MAX_VARIABLES ? count : RULE_MAX_VARIABLES;
+}
+
+void ruleSet::setOutputs(uint64_t pins)
+{
+    this->outputs = pins;
+}
+
+bool ruleSet::compile(int id, const char *source)
+{
+    rule compiled;
+    ruleCompiler compiler;
+    ruleOperand result;
+
+    if (strlen(source) >= RULE_SOURCE_LENGTH)
+    {
+        this->error = "too long";
+        return false;
+    }
+
+    compiler.p = source;
+    compiler.code = compiled.code;
+    compiler.length = 0;
+    compiler.error = NULL;
+    compiler.names = this->names;
+    compiler.nameCount = this->nameCount;
+
+    if (!compiler.binary(0, result))
+    {
+        this->error = compiler.error;
+        return false;
+    }
+
+    if (!compiler.accept("->"))
+    {
+        this->error = "missing ->";
+        return false;
+    }
+
+    compiled.code[compiler.length] = OP_END;
+
+    if (!checkStack(compiled.code))
+    {
+        this->error = "too deep";
+        return false;
+    }
+
+    if (compiler.accept("publish"))
+    {
+        compiled.action = RULE_ACTION_PUBLISH;
+        compiled.pin = 0;
+    }
+    else if (compiler.accept("gpio"))
+    {
+        char *end;
+
+        long pin = strtol(compiler.p, &end, 10);
+
+        if (end == compiler.p || pin < 0 || pin > 63 || ((this->outputs >> pin) & 1) == 0)
+        {
+            this->error = "bad pin";
+            return false;
+        }
+
+        compiled.pin = (uint8_t)pin;
+        compiler.p = end;
+
+        if (compiler.accept("on"))
+        {
+            compiled.action = RULE_ACTION_GPIO_ON;
+        }
+        else if (compiler.accept("off"))
+        {
+            compiled.action = RULE_ACTION_GPIO_OFF;
+        }
+        else if (compiler.accept("toggle"))
+        {
+            compiled.action = RULE_ACTION_GPIO_TOGGLE;
+        }
+        else
+        {
+            this->error = "bad gpio action";
+            return false;
+        }
+    }
+    else
+    {
+        this->error = "unknown action";
+        return false;
+    }
+
+    compiler.skip();
+
+    if (*compiler.p != 0)
+    {
+        this->error = "trailing text";
+        return false;
+    }
+
+    compiled.used = true;
+    compiled.armed = true;
+    compiled.fired = false;
+    compiled.lastFire = 0;
+    compiled.id = id;
+    strcpy(compiled.source, source);
+
+    rule *slot = NULL;
+
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        if (this->rules[i].used && this->rules[i].id == id)
+        {
+            slot = &this->rules[i];
+            break;
+        }
+
+        if (!this->rules[i].used && slot == NULL)
+        {
+            slot = &this->rules[i];
+        }
+    }
+
+    if (slot == NULL)
+    {
+        this->error = "full";
+        return false;
+    }
+
+    *slot = compiled;
+
+    return true;
+}
+
+bool ruleSet::remove(int id)
+{
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        if (this->rules[i].used && this->rules[i].id == id)
+        {
+            this->rules[i].used = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+float ruleSet::run(const uint8_t *code, const float *variables)
+{
+    float stack[RULE_STACK];
+    float constant;
+    int sp = 0;
+
+    // The stack depth was checked at compile time
+    while (true)
+    {
+        switch (*code++)
+        {
+        case OP_END:
+            return stack[0];
+        case OP_CONST:
+            memcpy(&stack[sp++], code, sizeof(float));
+            code += sizeof(float);
+            break;
+        case OP_VAR:
+            stack[sp++] = variables[*code++];
+            break;
+        case OP_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case OP_NOT:
+            stack[sp - 1] = stack[sp - 1] == 0;
+            break;
+        case OP_VAR_LT:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] < constant;
+            code += 1 + sizeof(float);
+            break;
+        case OP_VAR_LE:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] <= constant;
+            code += 1 + sizeof(float);
+            break;
+        case OP_VAR_GT:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] > constant;
+            code += 1 + sizeof(float);
+            break;
+        case OP_VAR_GE:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] >= constant;
+            code += 1 + sizeof(float);
+            break;
+        case OP_VAR_EQ:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] == constant;
+            code += 1 + sizeof(float);
+            break;
+        case OP_VAR_NE:
+            memcpy(&constant, code + 1, sizeof(float));
+            stack[sp++] = variables[*code] != constant;
+            code += 1 + sizeof(float);
+            break;
+        default:
+            sp--;
+            stack[sp - 1] = apply(code[-1], stack[sp - 1], stack[sp]);
+            break;
+        }
+    }
+}
+
+void ruleSet::evaluate(const float *variables, unsigned long now, ruleFireFn fire, void *ctx)
+{
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        rule &current = this->rules[i];
+
+        if (!current.used)
+        {
+            continue;
+        }
+
+        if (run(current.code, variables) == 0)
+        {
+            current.armed = true;
+            continue;
+        }
+
+        if (current.armed && (!current.fired || now - current.lastFire >= RULE_MIN_INTERVAL))
+        {
+            current.armed = false;
+            current.fired = true;
+            current.lastFire = now;
+
+            fire(current, ctx);
+        }
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+// Rule engine for local actuation. Portable, no Arduino code.
+// A rule is "<condition> -> <action>", for example
+//   heap < 40000 && busy == 0 -> gpio 7 toggle
+// The condition is compiled into stack bytecode over float variables.
+// Constant subexpressions are folded and "variable <cmp> constant" becomes
+// a single instruction, so a threshold rule is one dispatch. Actions fire
+// when the condition turns true, at most once every RULE_MIN_INTERVAL: a
+// condition that turns true again sooner fires when the interval is over,
+// if it still holds.
+// Operators: || && < <= > >= == != + - * ! and parentheses.
+// Actions: gpio <pin> on|off|toggle, publish
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RULE_MAX 8
+#define RULE_CODE_SIZE 64
+#define RULE_SOURCE_LENGTH 96
+#define RULE_STACK 8
+#define RULE_MAX_VARIABLES 16
+
+#ifndef RULE_MIN_INTERVAL
+#define RULE_MIN_INTERVAL 1000
+#endif
+
+#define RULE_ACTION_PUBLISH 0
+#define RULE_ACTION_GPIO_ON 1
+#define RULE_ACTION_GPIO_OFF 2
+#define RULE_ACTION_GPIO_TOGGLE 3
+
+struct rule
+{
+    bool used;
+    // Cleared when the action fires, set again once the condition is false
+    bool armed;
+    bool fired;
+    unsigned long lastFire;
+    int id;
+    uint8_t action;
+    uint8_t pin;
+    uint8_t code[RULE_CODE_SIZE];
+    char source[RULE_SOURCE_LENGTH];
+};
+
+typedef void (*ruleFireFn)(const rule &fired, void *ctx);
+
+class ruleSet
+{
+
+public:
+    rule rules[RULE_MAX];
+
+    // Set when compile() fails
+    const char *error;
+
+    ruleSet();
+
+    // Names the compiler accepts, the index is the position in evaluate()'s array
+    void setVariables(const char *const *names, int count);
+
+    // GPIOs a rule may drive, bit n is pin n. None until set
+    void setOutputs(uint64_t pins);
+
+    // Adds or replaces the rule with this id
+    bool compile(int id, const char *source);
+    bool remove(int id);
+
+    void evaluate(const float *variables, unsigned long now, ruleFireFn fire, void *ctx);
+
+    static float run(const uint8_t *code, const float *variables);
+
+private:
+    const char *const *names;
+    int nameCount;
+    uint64_t outputs;
+};
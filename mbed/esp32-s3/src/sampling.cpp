@@ -0,0 +1,238 @@
+#include <Arduino.h>
+#include "driver/adc.h"
+#include "dsp.h"
+#include "sampling.h"
+#include "myMqtt.h"
+#include "aggregation.h"
+#include "automation.h"
+
+QueueHandle_t sampleFrames = NULL;
+
+volatile unsigned long droppedFrames = 0;
+volatile unsigned long overruns = 0;
+// Dropped by the loop when a publish failed, kept apart from droppedFrames
+// so each counter has one writer
+volatile unsigned long unsentFrames = 0;
+
+unsigned long lastSamplePublish = 0;
+
+String samplesTopic = "/gtsField1/" + String((uint64_t)ESP.getEfuseMac()) + "/SAMPLES";
+String lossTopic = samplesTopic + "/LOSS";
+
+// Tells the server samples were lost, "<overruns>/<dropped frames>". Runs in
+// the sampling task, where only enqueue() is safe to call; loop() sends it
+void reportLoss(void)
+{
+#if MQTT_QUEUE_SLOTS > 0
+    static unsigned long lastReport = 0;
+    char text[24];
+
+    if (lastReport != 0 && millis() - lastReport < SAMPLING_LOSS_PERIOD)
+    {
+        return;
+    }
+
+    int length = snprintf(text, sizeof(text), "%lu/%lu", overruns, droppedFrames + unsentFrames);
+
+    // A full queue reports on the next loss
+    if (mqttClient->enqueue(lossTopic.c_str(), (const uint8_t *)text, length, false))
+    {
+        lastReport = millis();
+    }
+#endif
+}
+
+// Runs on core 0 so the DMA buffer is drained even while the loop blocks.
+// Buffers are static to keep the task stack small.
+void samplingTask(void *arg)
+{
+    static uint8_t raw[DSP_BLOCK * SAMPLING_CIC_FACTOR * sizeof(adc_digi_output_data_t)];
+    static int16_t input[DSP_BLOCK * SAMPLING_CIC_FACTOR];
+    static int16_t coarse[DSP_BLOCK];
+    static int16_t fine[DSP_BLOCK];
+    static cicDecimator cic;
+    static firDecimator fir;
+    static sampleFrame frame;
+
+    cic.begin(SAMPLING_CIC_FACTOR, SOC_ADC_DIGI_MAX_BITWIDTH);
+    fir.begin(SAMPLING_FIR_FACTOR);
+
+    frame.seq = 0;
+    frame.rate = SAMPLING_RATE / (SAMPLING_CIC_FACTOR * SAMPLING_FIR_FACTOR);
+    frame.count = 0;
+
+    while (true)
+    {
+        uint32_t length = 0;
+        esp_err_t err = adc_digi_read_bytes(raw, sizeof(raw), &length, portMAX_DELAY);
+
+        // INVALID_STATE: the DMA ring overflowed, the data read is still valid
+        if (err == ESP_ERR_INVALID_STATE)
+        {
+            overruns++;
+            reportLoss();
+        }
+        else if (err != ESP_OK)
+        {
+            continue;
+        }
+
+        size_t count = 0;
+
+        for (uint32_t i = 0; i + sizeof(adc_digi_output_data_t) <= length; i += sizeof(adc_digi_output_data_t))
+        {
+            adc_digi_output_data_t *result = (adc_digi_output_data_t *)&raw[i];
+
+            if (result->type2.channel == SAMPLING_CHANNEL)
+            {
+                input[count++] = (int16_t)result->type2.data - (1 << (SOC_ADC_DIGI_MAX_BITWIDTH - 1));
+            }
+        }
+
+        size_t fineCount = fir.process(coarse, cic.process(input, count, coarse), fine);
+
+        for (size_t i = 0; i < fineCount; i++)
+        {
+            frame.samples[frame.count++] = fine[i];
+
+            if (frame.count == SAMPLING_FRAME)
+            {
+                if (xQueueSend(sampleFrames, &frame, 0) != pdTRUE)
+                {
+                    droppedFrames++;
+                    reportLoss();
+                }
+
+                frame.seq++;
+                frame.count = 0;
+            }
+        }
+    }
+}
+
+void samplingInit(void)
+{
+    if (SAMPLING_MODE == 0)
+    {
+        return;
+    }
+
+    adc_digi_init_config_t init = {};
+
+    init.max_store_buf_size = SAMPLING_DMA_BUFFER;
+    init.conv_num_each_intr = SAMPLING_DMA_FRAME;
+    init.adc1_chan_mask = BIT(SAMPLING_CHANNEL);
+    init.adc2_chan_mask = 0;
+
+    adc_digi_pattern_config_t pattern = {};
+
+    pattern.atten = ADC_ATTEN_DB_11;
+    pattern.channel = SAMPLING_CHANNEL;
+    pattern.unit = 0;
+    pattern.bit_width = SOC_ADC_DIGI_MAX_BITWIDTH;
+
+    adc_digi_configuration_t config = {};
+
+    config.conv_limit_en = false;
+    config.pattern_num = 1;
+    config.adc_pattern = &pattern;
+    config.sample_freq_hz = SAMPLING_RATE;
+    config.conv_mode = ADC_CONV_SINGLE_UNIT_1;
+    config.format = ADC_DIGI_OUTPUT_FORMAT_TYPE2;
+
+    sampleFrames = xQueueCreate(SAMPLING_QUEUE, sizeof(sampleFrame));
+
+    if (sampleFrames == NULL || adc_digi_initialize(&init) != ESP_OK || adc_digi_controller_configure(&config) != ESP_OK)
+    {
+        Serial.println("Sampling init failed");
+        return;
+    }
+
+    adc_digi_start();
+
+    xTaskCreatePinnedToCore(samplingTask, "sampling", 3072, NULL, 5, NULL, 0);
+}
+
+// Publishes up to SAMPLING_BATCH frames in one message, as soon as a full
+// batch is queued or SAMPLING_PUBLISH_PERIOD after the last publish.
+void samplingLoop(void)
+{
+    if (sampleFrames == NULL)
+    {
+        return;
+    }
+
+    // With a window on "samples" only its summaries are published
+    if (aggregateActive("samples"))
+    {
+        sampleFrame frame;
+
+        while (xQueueReceive(sampleFrames, &frame, 0) == pdTRUE)
+        {
+            for (int i = 0; i < frame.count; i++)
+            {
+                aggregateAdd("samples", frame.samples[i]);
+                rulesSample(frame.samples[i]);
+            }
+        }
+
+        return;
+    }
+
+    int waiting = uxQueueMessagesWaiting(sampleFrames);
+
+    if (waiting == 0 || (waiting < SAMPLING_BATCH && millis() - lastSamplePublish < SAMPLING_PUBLISH_PERIOD))
+    {
+        return;
+    }
+
+    if (waiting > SAMPLING_BATCH)
+    {
+        waiting = SAMPLING_BATCH;
+    }
+
+    // Not connected: the frames stay queued, once the queue is full the
+    // sampling task counts what it cannot add
+    if (!mqttClient->beginPublish(samplesTopic.c_str(), waiting * sizeof(sampleFrame), false))
+    {
+        return;
+    }
+
+    bool sent = true;
+
+    for (int i = 0; i < waiting; i++)
+    {
+        sampleFrame frame;
+
+        xQueueReceive(sampleFrames, &frame, 0);
+
+        for (int k = 0; k < frame.count; k++)
+        {
+            rulesSample(frame.samples[k]);
+        }
+
+        // Only full frames are queued. After a short write the rest of the
+        // batch is dequeued and counted as dropped
+        if (sent && mqttClient->write((const uint8_t *)&frame, sizeof(sampleFrame)) != sizeof(sampleFrame))
+        {
+            sent = false;
+        }
+
+        if (!sent)
+        {
+            unsentFrames++;
+        }
+    }
+
+    if (sent)
+    {
+        mqttClient->endPublish();
+    }
+    else
+    {
+        // The broker would read whatever comes next as the rest of this publish
+        mqttClient->disconnect();
+    }
+
+    lastSamplePublish = millis();
+}
@@ -0,0 +1,34 @@
+#include <Arduino.h>
+
+// High-rate sampling: ADC continuous mode fills DMA buffers, a task decimates
+// them (CIC then FIR) into frames and the loop publishes the frames in
+// batches on /gtsField1/<mac>/SAMPLES. Enable with -DSAMPLING_MODE=1
+#ifndef SAMPLING_MODE
+#define SAMPLING_MODE 0
+#endif
+
+// ADC1 channel 3 is GPIO4, GPIO1 is the AP button
+#define SAMPLING_CHANNEL 3
+#define SAMPLING_RATE 16000
+#define SAMPLING_CIC_FACTOR 16
+#define SAMPLING_FIR_FACTOR 4
+#define SAMPLING_DMA_BUFFER 8192
+#define SAMPLING_DMA_FRAME 256
+#define SAMPLING_FRAME 128
+#define SAMPLING_QUEUE 8
+#define SAMPLING_BATCH 4
+#define SAMPLING_PUBLISH_PERIOD 1000
+// At most one loss report on /gtsField1/<mac>/SAMPLES/LOSS per period
+#define SAMPLING_LOSS_PERIOD 5000
+
+// Published as is, little endian: 8 byte header then count samples
+struct sampleFrame
+{
+    uint32_t seq;
+    uint16_t rate;
+    uint16_t count;
+    int16_t samples[SAMPLING_FRAME];
+};
+
+void samplingInit(void);
+void samplingLoop(void);
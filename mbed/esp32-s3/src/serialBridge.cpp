@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include <SoftwareSerial.h>
+#include "framer.h"
+#include "serialBridge.h"
+#include "myMqtt.h"
+
+SoftwareSerial bridgeSerial;
+serialFramer Framer;
+
+bool bridgeActive = false;
+uint16_t bridgeSeq = 0;
+uint32_t reportedDrops = 0;
+
+unsigned long bridgeBackoff = 0;
+unsigned long lastBridgePublish = 0;
+
+String serialTopic = "/gtsField1/" + String((uint64_t)ESP.getEfuseMac()) + "/SERIAL";
+
+void serialBridgeInit(void)
+{
+    if (SERIAL_BRIDGE == 0)
+    {
+        return;
+    }
+
+    bridgeSerial.begin(SERIAL_BRIDGE_BAUD, SWSERIAL_8N1, SERIAL_BRIDGE_RX, SERIAL_BRIDGE_TX, false, SERIAL_BRIDGE_BUFFER);
+
+    if (!bridgeSerial)
+    {
+        Serial.println("Serial bridge init failed");
+        return;
+    }
+
+    bridgeSerial.enableRxTimestamps(true);
+
+    // 8N1 is ten bits per character, above 19200 baud Modbus fixes the gap
+    uint32_t charTime = 10000000UL / SERIAL_BRIDGE_BAUD;
+    uint32_t gap = SERIAL_BRIDGE_GAP;
+
+    if (gap == 0)
+    {
+        gap = SERIAL_BRIDGE_BAUD > 19200 ? 1750 : 35000000UL / SERIAL_BRIDGE_BAUD;
+    }
+
+    // The receive times are SoftwareSerial ticks, they wrap at 2^32 ticks
+    // while micros() >> 1 would wrap at 2^31. The framer works in ticks too.
+    Framer.begin(SoftwareSerial::microsToTicks(gap), SoftwareSerial::microsToTicks(charTime));
+
+    bridgeActive = true;
+}
+
+// The header and the framer batch go out as two segments of one publish, the
+// frames are not copied.
+bool publishFrames(void)
+{
+    uint32_t dropped = Framer.dropped - reportedDrops;
+
+    if (dropped > 0xFFFF)
+    {
+        dropped = 0xFFFF;
+    }
+
+    uint8_t header[4] = {(uint8_t)(bridgeSeq >> 8), (uint8_t)bridgeSeq, (uint8_t)(dropped >> 8), (uint8_t)dropped};
+    MqttSegment segments[2] = {{header, sizeof(header)}, {Framer.frames(), Framer.length()}};
+
+    return mqttClient->publish(serialTopic.c_str(), segments, 2, false);
+}
+
+// Drains the port on every call so the receive buffer never overflows, even
+// while MQTT is down. Closed frames linger up to SERIAL_BRIDGE_LINGER ms to
+// share a message. A publish that fails or takes longer than
+// SERIAL_BRIDGE_SLOW ms backs off, the frames then go out in fewer, larger
+// messages and once the batch is full new frames are dropped and counted
+// instead of blocking the loop.
+void serialBridgeLoop(void)
+{
+    if (!bridgeActive)
+    {
+        return;
+    }
+
+    uint8_t data[SERIAL_BRIDGE_CHUNK];
+    uint32_t times[SERIAL_BRIDGE_CHUNK];
+    int count;
+
+    while ((count = bridgeSerial.read(data, times, sizeof(data))) > 0)
+    {
+        Framer.add(data, times, count);
+    }
+
+    // Bytes were lost after the last buffered one
+    if (bridgeSerial.overflow())
+    {
+        Framer.discard();
+    }
+
+    uint32_t now = SoftwareSerial::microsToTicks(micros());
+
+    Framer.poll(now);
+
+    if (Framer.count() == 0 || !mqttClient->connected())
+    {
+        return;
+    }
+
+    if (!Framer.full() && now - Framer.oldest() < SoftwareSerial::microsToTicks(SERIAL_BRIDGE_LINGER * 1000UL))
+    {
+        return;
+    }
+
+    if (millis() - lastBridgePublish < bridgeBackoff)
+    {
+        return;
+    }
+
+    unsigned long start = millis();
+    bool sent = publishFrames();
+
+    lastBridgePublish = millis();
+
+    if (!sent || lastBridgePublish - start > SERIAL_BRIDGE_SLOW)
+    {
+        bridgeBackoff = bridgeBackoff == 0 ? SERIAL_BRIDGE_SLOW : min(bridgeBackoff * 2, (unsigned long)SERIAL_BRIDGE_MAX_BACKOFF);
+    }
+    else
+    {
+        bridgeBackoff /= 2;
+    }
+
+    if (sent)
+    {
+        reportedDrops = Framer.dropped;
+        bridgeSeq++;
+        Framer.consume();
+    }
+}
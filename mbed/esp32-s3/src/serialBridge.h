@@ -0,0 +1,35 @@
+#include <Arduino.h>
+
+// Serial to MQTT bridge: bytes from a software serial port are split into
+// frames on idle gaps (framer.h) and published in batches on
+// /gtsField1/<mac>/SERIAL. Payload: sequence and dropped frame count, both
+// two byte big endian, then the frame records. Enable with -DSERIAL_BRIDGE=1
+#ifndef SERIAL_BRIDGE
+#define SERIAL_BRIDGE 0
+#endif
+
+#ifndef SERIAL_BRIDGE_RX
+#define SERIAL_BRIDGE_RX 5
+#endif
+
+#ifndef SERIAL_BRIDGE_TX
+#define SERIAL_BRIDGE_TX 6
+#endif
+
+#ifndef SERIAL_BRIDGE_BAUD
+#define SERIAL_BRIDGE_BAUD 9600
+#endif
+
+// Inter-frame gap in micros, 0 is 3.5 characters as in Modbus RTU
+#ifndef SERIAL_BRIDGE_GAP
+#define SERIAL_BRIDGE_GAP 0
+#endif
+
+#define SERIAL_BRIDGE_BUFFER 512
+#define SERIAL_BRIDGE_CHUNK 64
+#define SERIAL_BRIDGE_LINGER 20
+#define SERIAL_BRIDGE_SLOW 100
+#define SERIAL_BRIDGE_MAX_BACKOFF 2000
+
+void serialBridgeInit(void);
+void serialBridgeLoop(void);
@@ -0,0 +1,78 @@
+#include <string.h>
+#include "tasks.h"
+
+commandTask commandTasks[MAX_COMMAND_TASKS];
+
+bool startTask(const char *cmd, int (*run)(commandTask *task))
+{
+    commandTask *freeTask = NULL;
+
+    if (strlen(cmd) >= TASK_NAME_LENGTH)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        if (commandTasks[i].active())
+        {
+            if (strcmp(commandTasks[i].cmd, cmd) == 0)
+            {
+                return false;
+            }
+        }
+        else if (freeTask == NULL)
+        {
+            freeTask = &commandTasks[i];
+        }
+    }
+
+    if (freeTask == NULL)
+    {
+        return false;
+    }
+
+    freeTask->clear();
+    strcpy(freeTask->cmd, cmd);
+    freeTask->run = run;
+
+    return true;
+}
+
+int cancelTasks(const char *cmd)
+{
+    int count = 0;
+
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        if (commandTasks[i].active() && (cmd[0] == 0 || strcmp(commandTasks[i].cmd, cmd) == 0))
+        {
+            commandTasks[i].cancel = true;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+bool runTasks(void)
+{
+    bool busy = false;
+
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        if (commandTasks[i].active())
+        {
+            if (!PT_ALIVE(commandTasks[i].run(&commandTasks[i])))
+            {
+                commandTasks[i].clear();
+            }
+            else
+            {
+                busy = true;
+            }
+        }
+    }
+
+    return busy;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+// Table of the long running commands, each a protothread stepped once per
+// runTasks() pass. Portable, no Arduino code, the commands themselves live
+// in process.cpp.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "protothread.h"
+
+#define MAX_COMMAND_TASKS 4
+#define TASK_NAME_LENGTH 24
+
+class commandTask
+{
+
+public:
+    char cmd[TASK_NAME_LENGTH];
+    struct pt state;
+    bool cancel;
+    int progress;
+    int (*run)(commandTask *task);
+
+    bool active(void)
+    {
+        return this->run != NULL;
+    }
+
+    void clear(void)
+    {
+        this->cmd[0] = 0;
+        this->cancel = false;
+        this->progress = 0;
+        this->run = NULL;
+        PT_INIT(&this->state);
+    }
+
+    commandTask()
+    {
+        this->clear();
+    }
+};
+
+extern commandTask commandTasks[MAX_COMMAND_TASKS];
+
+// False when the same command is already running or the table is full
+bool startTask(const char *cmd, int (*run)(commandTask *task));
+
+// Flags the tasks running cmd, all of them for "", and returns how many
+int cancelTasks(const char *cmd);
+
+// One step of every task, returns true while any is left running
+bool runTasks(void);
@@ -0,0 +1,58 @@
+#include <Arduino.h>
+#include "timeline.h"
+
+// Boot phases are recorded once, in order, with millis() since reset.
+// Marks may come from the Wi-Fi event task, so the slot is claimed first.
+
+struct bootPhase
+{
+    const char *name;
+    unsigned long time;
+};
+
+bootPhase bootPhases[MAX_BOOT_PHASES];
+volatile int bootPhaseCount = 0;
+
+portMUX_TYPE bootMux = portMUX_INITIALIZER_UNLOCKED;
+
+void bootMark(const char *phase)
+{
+    unsigned long now = millis();
+
+    portENTER_CRITICAL(&bootMux);
+
+    for (int i = 0; i < bootPhaseCount; i++)
+    {
+        if (strcmp(bootPhases[i].name, phase) == 0)
+        {
+            portEXIT_CRITICAL(&bootMux);
+            return;
+        }
+    }
+
+    if (bootPhaseCount < MAX_BOOT_PHASES)
+    {
+        bootPhases[bootPhaseCount].name = phase;
+        bootPhases[bootPhaseCount].time = now;
+        bootPhaseCount++;
+    }
+
+    portEXIT_CRITICAL(&bootMux);
+}
+
+String bootTimeline(void)
+{
+    String timeline = "";
+
+    for (int i = 0; i < bootPhaseCount; i++)
+    {
+        if (i > 0)
+        {
+            timeline += ",";
+        }
+
+        timeline += String(bootPhases[i].name) + ":" + String(bootPhases[i].time);
+    }
+
+    return timeline;
+}
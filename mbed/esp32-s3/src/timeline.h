@@ -0,0 +1,6 @@
+#include <Arduino.h>
+
+#define MAX_BOOT_PHASES 12
+
+void bootMark(const char *phase);
+String bootTimeline(void);
@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <LittleFS.h>
+#include "time.h"
+#include "timeseries.h"
+
+littleFsStorage Storage;
+
+tsStore heapSeries("heap", &Storage);
+tsStore rssiSeries("rssi", &Storage);
+
+tsStore *series[] = {&heapSeries, &rssiSeries};
+const int seriesCount = sizeof(series) / sizeof(series[0]);
+
+bool timeseriesReady = false;
+unsigned long lastSample = 0;
+unsigned long lastCompact = 0;
+
+int littleFsStorage::open(const char *path, bool write)
+{
+    for (int i = 0; i < TS_OPEN_FILES; i++)
+    {
+        if (!this->files[i])
+        {
+            this->files[i] = LittleFS.open(path, write ? FILE_APPEND : FILE_READ);
+
+            return this->files[i] ? i : -1;
+        }
+    }
+
+    return -1;
+}
+
+size_t littleFsStorage::read(int file, uint8_t *data, size_t length)
+{
+    return this->files[file].read(data, length);
+}
+
+size_t littleFsStorage::write(int file, const uint8_t *data, size_t length)
+{
+    return this->files[file].write(data, length);
+}
+
+bool littleFsStorage::seek(int file, uint32_t position)
+{
+    return this->files[file].seek(position);
+}
+
+uint32_t littleFsStorage::size(int file)
+{
+    return this->files[file].size();
+}
+
+void littleFsStorage::close(int file)
+{
+    this->files[file].close();
+}
+
+bool littleFsStorage::remove(const char *path)
+{
+    return LittleFS.remove(path);
+}
+
+bool littleFsStorage::mkdir(const char *path)
+{
+    return LittleFS.mkdir(path);
+}
+
+void littleFsStorage::list(const char *dir, void (*found)(const char *name, void *ctx), void *ctx)
+{
+    fs::File directory = LittleFS.open(dir);
+
+    if (!directory || !directory.isDirectory())
+    {
+        return;
+    }
+
+    for (fs::File file = directory.openNextFile(); file; file = directory.openNextFile())
+    {
+        found(file.name(), ctx);
+    }
+}
+
+tsStore *findSeries(const char *name)
+{
+    for (int i = 0; i < seriesCount; i++)
+    {
+        if (strcmp(series[i]->name, name) == 0)
+        {
+            return series[i];
+        }
+    }
+
+    return NULL;
+}
+
+void timeseriesInit(void)
+{
+    timeseriesReady = LittleFS.begin(true);
+
+    // Samples are stamped with wall clock time so history survives reboots
+    configTime(0, 0, "pool.ntp.org", "time.nist.gov");
+}
+
+void timeseriesLoop(void)
+{
+    time_t now = time(NULL);
+
+    if (!timeseriesReady || now < (time_t)TS_VALID_TIME)
+    {
+        return;
+    }
+
+    if (millis() - lastSample >= TS_SAMPLE_PERIOD)
+    {
+        lastSample = millis();
+
+        heapSeries.append(now, ESP.getFreeHeap());
+        rssiSeries.append(now, WiFi.RSSI());
+    }
+
+    if (millis() - lastCompact >= 3600000UL)
+    {
+        lastCompact = millis();
+
+        for (int i = 0; i < seriesCount; i++)
+        {
+            series[i]->compact(now);
+        }
+    }
+}
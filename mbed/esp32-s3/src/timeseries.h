@@ -0,0 +1,34 @@
+#include <Arduino.h>
+#include <FS.h>
+#include "tsStore.h"
+
+#define TS_SAMPLE_PERIOD 10000
+#define TS_QUERY_CHUNK 10
+#define TS_VALID_TIME 1600000000UL
+
+// Files open at once: a segment and its index while flushing, a segment
+// and its index while a query seeks
+#define TS_OPEN_FILES 4
+
+// tsFileSystem on LittleFS, handles index a table of open files
+class littleFsStorage : public tsFileSystem
+{
+
+public:
+    int open(const char *path, bool write);
+    size_t read(int file, uint8_t *data, size_t length);
+    size_t write(int file, const uint8_t *data, size_t length);
+    bool seek(int file, uint32_t position);
+    uint32_t size(int file);
+    void close(int file);
+    bool remove(const char *path);
+    bool mkdir(const char *path);
+    void list(const char *dir, void (*found)(const char *name, void *ctx), void *ctx);
+
+private:
+    fs::File files[TS_OPEN_FILES];
+};
+
+void timeseriesInit(void);
+void timeseriesLoop(void);
+tsStore *findSeries(const char *name);
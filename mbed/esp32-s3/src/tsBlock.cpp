@@ -0,0 +1,188 @@
+#include <string.h>
+#include "tsBlock.h"
+
+static size_t putVarint(uint8_t *buf, uint32_t value)
+{
+    size_t pos = 0;
+
+    while (value >= 0x80)
+    {
+        buf[pos++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+
+    buf[pos++] = value;
+
+    return pos;
+}
+
+static bool getVarint(const uint8_t *buf, size_t length, size_t *pos, uint32_t *value)
+{
+    uint32_t result = 0;
+
+    for (int shift = 0; shift < 35 && *pos < length; shift += 7)
+    {
+        uint8_t byte = buf[(*pos)++];
+
+        result |= (uint32_t)(byte & 0x7F) << shift;
+
+        if ((byte & 0x80) == 0)
+        {
+            *value = result;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void putUint32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = value >> 24;
+    buf[1] = value >> 16;
+    buf[2] = value >> 8;
+    buf[3] = value;
+}
+
+static uint32_t getUint32(const uint8_t *buf)
+{
+    return ((uint32_t)buf[0] << 24) | ((uint32_t)buf[1] << 16) | ((uint32_t)buf[2] << 8) | buf[3];
+}
+
+tsBlockEncoder::tsBlockEncoder()
+{
+    this->clear();
+}
+
+void tsBlockEncoder::clear(void)
+{
+    this->length = TS_BLOCK_HEADER;
+    this->count = 0;
+    this->firstTime = 0;
+    this->lastTime = 0;
+    this->lastValue = 0;
+}
+
+// Returns false when the block is full or the sample is older than the last one
+bool tsBlockEncoder::add(const tsSample &sample)
+{
+    if (this->count == 0)
+    {
+        this->data[0] = TS_BLOCK_MAGIC;
+        putUint32(this->data + 5, sample.time);
+        putUint32(this->data + 9, (uint32_t)sample.value);
+    }
+    else
+    {
+        if (sample.time < this->lastTime || this->length + 10 > TS_BLOCK_SIZE || this->count == 0xFFFF)
+        {
+            return false;
+        }
+
+        int32_t delta = (int32_t)((uint32_t)sample.value - (uint32_t)this->lastValue);
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+
+        this->length += putVarint(this->data + this->length, sample.time - this->lastTime);
+        this->length += putVarint(this->data + this->length, zigzag);
+    }
+
+    if (this->count == 0)
+    {
+        this->firstTime = sample.time;
+    }
+
+    this->count++;
+    this->lastTime = sample.time;
+    this->lastValue = sample.value;
+
+    return true;
+}
+
+size_t tsBlockEncoder::finish(void)
+{
+    this->data[1] = this->count >> 8;
+    this->data[2] = this->count & 0xFF;
+    this->data[3] = this->length >> 8;
+    this->data[4] = this->length & 0xFF;
+
+    return this->length;
+}
+
+tsBlockDecoder::tsBlockDecoder()
+{
+    this->data = NULL;
+    this->length = 0;
+    this->pos = 0;
+    this->remaining = 0;
+}
+
+bool tsBlockDecoder::header(const uint8_t *data, uint16_t *count, uint16_t *length, uint32_t *firstTime)
+{
+    if (data[0] != TS_BLOCK_MAGIC)
+    {
+        return false;
+    }
+
+    *count = (data[1] << 8) | data[2];
+    *length = (data[3] << 8) | data[4];
+    *firstTime = getUint32(data + 5);
+
+    return *length >= TS_BLOCK_HEADER && *length <= TS_BLOCK_SIZE && *count > 0;
+}
+
+bool tsBlockDecoder::begin(const uint8_t *data, size_t length)
+{
+    uint16_t count;
+    uint16_t blockLength;
+    uint32_t firstTime;
+
+    if (length < TS_BLOCK_HEADER || !header(data, &count, &blockLength, &firstTime) || blockLength > length)
+    {
+        this->remaining = 0;
+        return false;
+    }
+
+    this->data = data;
+    this->length = blockLength;
+    this->pos = 0;
+    this->remaining = count;
+
+    return true;
+}
+
+bool tsBlockDecoder::next(tsSample &sample)
+{
+    if (this->remaining == 0)
+    {
+        return false;
+    }
+
+    if (this->pos == 0)
+    {
+        this->last.time = getUint32(this->data + 5);
+        this->last.value = (int32_t)getUint32(this->data + 9);
+        this->pos = TS_BLOCK_HEADER;
+    }
+    else
+    {
+        uint32_t timeDelta;
+        uint32_t zigzag;
+
+        if (!getVarint(this->data, this->length, &this->pos, &timeDelta) ||
+            !getVarint(this->data, this->length, &this->pos, &zigzag))
+        {
+            this->remaining = 0;
+            return false;
+        }
+
+        int32_t delta = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+
+        this->last.time += timeDelta;
+        this->last.value = (int32_t)((uint32_t)this->last.value + (uint32_t)delta);
+    }
+
+    this->remaining--;
+    sample = this->last;
+
+    return true;
+}
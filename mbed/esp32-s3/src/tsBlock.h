@@ -0,0 +1,58 @@
+#pragma once
+
+// Block codec for the time-series store. Portable, no Arduino code.
+// A block is a 13 byte header followed by one varint time delta and one
+// zigzag varint value delta per sample after the first.
+//   [0] magic  [1..2] count  [3..4] length  [5..8] first time  [9..12] first value
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TS_BLOCK_SIZE 256
+#define TS_BLOCK_HEADER 13
+#define TS_BLOCK_MAGIC 0xB5
+
+struct tsSample
+{
+    uint32_t time;
+    int32_t value;
+};
+
+class tsBlockEncoder
+{
+
+public:
+    uint8_t data[TS_BLOCK_SIZE];
+    size_t length;
+    uint16_t count;
+    uint32_t firstTime;
+    uint32_t lastTime;
+
+    tsBlockEncoder();
+
+    void clear(void);
+    bool add(const tsSample &sample);
+    size_t finish(void);
+
+private:
+    int32_t lastValue;
+};
+
+class tsBlockDecoder
+{
+
+public:
+    tsBlockDecoder();
+
+    static bool header(const uint8_t *data, uint16_t *count, uint16_t *length, uint32_t *firstTime);
+
+    bool begin(const uint8_t *data, size_t length);
+    bool next(tsSample &sample);
+
+private:
+    const uint8_t *data;
+    size_t length;
+    size_t pos;
+    uint16_t remaining;
+    tsSample last;
+};
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "tsStore.h"
+
+using namespace std;
+
+tsStore::tsStore(const char *name, tsFileSystem *fs)
+{
+    snprintf(this->name, sizeof(this->name), "%s", name);
+    this->fs = fs;
+    this->segmentStart = 0;
+    this->segmentSize = 0;
+    this->lost = 0;
+}
+
+void tsStore::segmentPath(char *path, uint32_t start, const char *extension)
+{
+    snprintf(path, TS_PATH_LENGTH, "%s/%s/%08lx.%s", TS_ROOT, this->name, (unsigned long)start, extension);
+}
+
+// Names may come with the directory in front
+static void addSegment(const char *name, void *ctx)
+{
+    const char *slash = strrchr(name, '/');
+    const char *file = slash != NULL ? slash + 1 : name;
+    size_t length = strlen(file);
+
+    if (length > 4 && strcmp(file + length - 4, ".seg") == 0)
+    {
+        ((vector<uint32_t> *)ctx)->push_back(strtoul(file, NULL, 16));
+    }
+}
+
+void tsStore::segmentList(vector<uint32_t> &starts)
+{
+    char dir[TS_PATH_LENGTH];
+
+    snprintf(dir, sizeof(dir), "%s/%s", TS_ROOT, this->name);
+
+    this->fs->list(dir, addSegment, &starts);
+
+    // The directory is not in time order
+    sort(starts.begin(), starts.end());
+}
+
+// The newest TS_MAX_SEGMENTS in time order, compact() removes the rest
+int tsStore::segments(uint32_t *starts)
+{
+    vector<uint32_t> all;
+
+    this->segmentList(all);
+
+    int skip = all.size() > TS_MAX_SEGMENTS ? all.size() - TS_MAX_SEGMENTS : 0;
+
+    for (size_t i = skip; i < all.size(); i++)
+    {
+        starts[i - skip] = all[i];
+    }
+
+    return all.size() - skip;
+}
+
+bool tsStore::append(uint32_t time, int32_t value)
+{
+    tsSample sample = {time, value};
+
+    if (this->block.count > 0 && time < this->block.lastTime)
+    {
+        return false;
+    }
+
+    if (!this->block.add(sample))
+    {
+        // A failed flush empties the block as well, the sample starts the next one
+        this->flush();
+
+        if (!this->block.add(sample))
+        {
+            return false;
+        }
+    }
+
+    if (this->block.lastTime - this->block.firstTime >= TS_FLUSH_PERIOD)
+    {
+        this->flush();
+    }
+
+    return true;
+}
+
+// Writes the open block, a new segment is started once the current one is full
+bool tsStore::flush(void)
+{
+    char path[TS_PATH_LENGTH];
+
+    if (this->block.count == 0)
+    {
+        return true;
+    }
+
+    if (this->segmentStart == 0 || this->segmentSize >= TS_SEGMENT_SIZE)
+    {
+        snprintf(path, sizeof(path), "%s/%s", TS_ROOT, this->name);
+
+        this->fs->mkdir(TS_ROOT);
+        this->fs->mkdir(path);
+
+        this->segmentStart = this->block.firstTime;
+        this->segmentSize = 0;
+    }
+
+    size_t length = this->block.finish();
+
+    this->segmentPath(path, this->segmentStart, "seg");
+    int segment = this->fs->open(path, true);
+
+    this->segmentPath(path, this->segmentStart, "idx");
+    int index = this->fs->open(path, true);
+
+    bool ok = segment >= 0 && index >= 0;
+
+    if (ok)
+    {
+        uint32_t entry[2] = {this->block.firstTime, this->fs->size(segment)};
+
+        ok = this->fs->write(segment, this->block.data, length) == length &&
+             this->fs->write(index, (const uint8_t *)entry, sizeof(entry)) == sizeof(entry);
+    }
+
+    if (segment >= 0)
+    {
+        this->fs->close(segment);
+    }
+
+    if (index >= 0)
+    {
+        this->fs->close(index);
+    }
+
+    if (ok)
+    {
+        this->segmentSize += length;
+    }
+    else
+    {
+        // Not kept, a full block that cannot be written would stop the series
+        // for good. The segment may hold part of it, the next block starts a
+        // new segment. The count is reported with each CMD_TS_QUERY
+        this->lost += this->block.count;
+        this->segmentStart = 0;
+    }
+
+    this->block.clear();
+
+    return ok;
+}
+
+// Drops whole segments once the next segment already starts before the cutoff
+void tsStore::compact(uint32_t now)
+{
+    if (now < TS_RETENTION)
+    {
+        return;
+    }
+
+    vector<uint32_t> starts;
+    char path[TS_PATH_LENGTH];
+
+    this->segmentList(starts);
+
+    int count = starts.size();
+    uint32_t cutoff = now - TS_RETENTION;
+
+    for (int i = 0; i + 1 < count; i++)
+    {
+        // Also keep the segment count under TS_MAX_SEGMENTS
+        if (starts[i + 1] <= cutoff || count - i >= TS_MAX_SEGMENTS)
+        {
+            this->segmentPath(path, starts[i], "seg");
+            this->fs->remove(path);
+            this->segmentPath(path, starts[i], "idx");
+            this->fs->remove(path);
+        }
+    }
+}
+
+tsQuery::tsQuery()
+{
+    this->store = NULL;
+    this->file = -1;
+}
+
+void tsQuery::begin(tsStore *store, uint32_t from, uint32_t to)
+{
+    this->store = store;
+    this->from = from;
+    this->to = to;
+    this->count = 0;
+    this->seq = 0;
+    this->file = -1;
+
+    store->flush();
+
+    this->segmentCount = store->segments(this->starts);
+    this->segment = -1;
+
+    // First segment that can hold samples at or after from
+    for (int i = 0; i < this->segmentCount && this->starts[i] <= from; i++)
+    {
+        this->segment = i - 1;
+    }
+
+    this->decoder.begin(this->data, 0);
+}
+
+// Seeks with the sparse index to the last block that starts at or before from
+bool tsQuery::openSegment(void)
+{
+    tsFileSystem *fs = this->store->fs;
+    char path[TS_PATH_LENGTH];
+
+    this->end();
+
+    while (++this->segment < this->segmentCount)
+    {
+        if (this->starts[this->segment] > this->to)
+        {
+            return false;
+        }
+
+        this->store->segmentPath(path, this->starts[this->segment], "seg");
+        this->file = fs->open(path, false);
+
+        if (this->file < 0)
+        {
+            continue;
+        }
+
+        uint32_t offset = 0;
+
+        this->store->segmentPath(path, this->starts[this->segment], "idx");
+        int index = fs->open(path, false);
+
+        if (index >= 0)
+        {
+            int entries = fs->size(index) / 8;
+            int low = 0;
+            int high = entries - 1;
+
+            while (low <= high)
+            {
+                int middle = (low + high) / 2;
+                uint32_t entry[2];
+
+                fs->seek(index, middle * 8);
+                fs->read(index, (uint8_t *)entry, sizeof(entry));
+
+                if (entry[0] <= this->from)
+                {
+                    offset = entry[1];
+                    low = middle + 1;
+                }
+                else
+                {
+                    high = middle - 1;
+                }
+            }
+
+            fs->close(index);
+        }
+
+        fs->seek(this->file, offset);
+
+        return true;
+    }
+
+    return false;
+}
+
+bool tsQuery::readBlock(void)
+{
+    tsFileSystem *fs = this->store->fs;
+
+    while (true)
+    {
+        if (this->file >= 0 && fs->read(this->file, this->data, TS_BLOCK_HEADER) == TS_BLOCK_HEADER)
+        {
+            uint16_t count;
+            uint16_t length;
+            uint32_t firstTime;
+
+            if (tsBlockDecoder::header(this->data, &count, &length, &firstTime) &&
+                fs->read(this->file, this->data + TS_BLOCK_HEADER, length - TS_BLOCK_HEADER) == (size_t)(length - TS_BLOCK_HEADER))
+            {
+                if (firstTime > this->to)
+                {
+                    return false;
+                }
+
+                return this->decoder.begin(this->data, length);
+            }
+        }
+
+        if (!this->openSegment())
+        {
+            return false;
+        }
+    }
+}
+
+bool tsQuery::next(tsSample &sample)
+{
+    while (true)
+    {
+        while (this->decoder.next(sample))
+        {
+            if (sample.time > this->to)
+            {
+                return false;
+            }
+
+            if (sample.time >= this->from)
+            {
+                this->count++;
+                return true;
+            }
+        }
+
+        if (!this->readBlock())
+        {
+            return false;
+        }
+    }
+}
+
+void tsQuery::end(void)
+{
+    if (this->file >= 0)
+    {
+        this->store->fs->close(this->file);
+        this->file = -1;
+    }
+}
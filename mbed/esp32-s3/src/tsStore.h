@@ -0,0 +1,97 @@
+#pragma once
+
+// Segment files for the time-series store. Portable, no Arduino code: the
+// files are reached through tsFileSystem, LittleFS on the board and memory
+// in the native tests, and sample times are passed in.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "tsBlock.h"
+
+#define TS_ROOT "/ts"
+#define TS_SEGMENT_SIZE 32768
+#define TS_MAX_SEGMENTS 32
+#define TS_RETENTION (7UL * 24 * 3600)
+#define TS_FLUSH_PERIOD 60
+#define TS_NAME_LENGTH 16
+#define TS_PATH_LENGTH 48
+
+// Files are opened by path and used by handle, -1 when it could not be
+// opened. Write mode appends and creates the file.
+class tsFileSystem
+{
+
+public:
+    virtual ~tsFileSystem() {}
+
+    virtual int open(const char *path, bool write) = 0;
+    virtual size_t read(int file, uint8_t *data, size_t length) = 0;
+    virtual size_t write(int file, const uint8_t *data, size_t length) = 0;
+    virtual bool seek(int file, uint32_t position) = 0;
+    virtual uint32_t size(int file) = 0;
+    virtual void close(int file) = 0;
+    virtual bool remove(const char *path) = 0;
+    virtual bool mkdir(const char *path) = 0;
+
+    // Calls found with the name of each file in dir, a missing dir has none
+    virtual void list(const char *dir, void (*found)(const char *name, void *ctx), void *ctx) = 0;
+};
+
+// Append-only store for one series: <TS_ROOT>/<name>/<start>.seg holds
+// blocks, <start>.idx holds one (first time, offset) entry per block.
+class tsStore
+{
+
+public:
+    char name[TS_NAME_LENGTH];
+    tsFileSystem *fs;
+    // Samples dropped because their block could not be written
+    uint32_t lost;
+
+    tsStore(const char *name, tsFileSystem *fs);
+
+    // A block is written once full or TS_FLUSH_PERIOD seconds of samples old
+    bool append(uint32_t time, int32_t value);
+    bool flush(void);
+    void compact(uint32_t now);
+
+    int segments(uint32_t *starts);
+    void segmentPath(char *path, uint32_t start, const char *extension);
+
+private:
+    tsBlockEncoder block;
+    uint32_t segmentStart;
+    uint32_t segmentSize;
+
+    void segmentList(std::vector<uint32_t> &starts);
+};
+
+// Walks the samples of one series in [from, to], block by block.
+class tsQuery
+{
+
+public:
+    tsStore *store;
+    uint32_t from;
+    uint32_t to;
+    uint32_t count;
+    int seq;
+
+    tsQuery();
+
+    void begin(tsStore *store, uint32_t from, uint32_t to);
+    bool next(tsSample &sample);
+    void end(void);
+
+private:
+    uint32_t starts[TS_MAX_SEGMENTS];
+    int segmentCount;
+    int segment;
+    int file;
+    uint8_t data[TS_BLOCK_SIZE];
+    tsBlockDecoder decoder;
+
+    bool openSegment(void);
+    bool readBlock(void);
+};
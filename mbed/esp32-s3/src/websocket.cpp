@@ -0,0 +1,235 @@
+#include <string.h>
+#include <strings.h>
+#include "websocket.h"
+
+size_t wsHeader(uint8_t *header, uint8_t opcode, size_t length)
+{
+    header[0] = 0x80 | opcode;
+
+    if (length < 126)
+    {
+        header[1] = length;
+        return 2;
+    }
+
+    if (length <= 0xFFFF)
+    {
+        header[1] = 126;
+        header[2] = length >> 8;
+        header[3] = length & 0xFF;
+        return 4;
+    }
+
+    uint64_t extended = length;
+
+    header[1] = 127;
+
+    for (int i = 0; i < 8; i++)
+    {
+        header[2 + i] = extended >> (56 - 8 * i);
+    }
+
+    return WS_HEADER_MAX;
+}
+
+int wsParse(uint8_t *data, size_t length, size_t maxPayload, wsFrame *frame)
+{
+    if (length < 2)
+    {
+        return WS_MORE;
+    }
+
+    uint8_t opcode = data[0] & 0x0F;
+    size_t payloadLength = data[1] & 0x7F;
+    size_t header = 2;
+
+    if ((data[1] & 0x80) == 0)
+    {
+        return WS_UNMASKED;
+    }
+
+    // Continuation frames, or a first frame without FIN
+    if ((data[0] & 0x80) == 0 || opcode == 0)
+    {
+        return WS_FRAGMENTED;
+    }
+
+    if (payloadLength == 127)
+    {
+        return WS_TOO_BIG;
+    }
+
+    if (payloadLength == 126)
+    {
+        if (length < 4)
+        {
+            return WS_MORE;
+        }
+
+        payloadLength = (data[2] << 8) | data[3];
+        header = 4;
+    }
+
+    if (payloadLength > maxPayload)
+    {
+        return WS_TOO_BIG;
+    }
+
+    if (length < header + 4 + payloadLength)
+    {
+        return WS_MORE;
+    }
+
+    uint8_t *mask = data + header;
+    uint8_t *payload = mask + 4;
+
+    for (size_t i = 0; i < payloadLength; i++)
+    {
+        payload[i] ^= mask[i % 4];
+    }
+
+    frame->opcode = opcode;
+    frame->payload = payload;
+    frame->length = payloadLength;
+    frame->size = header + 4 + payloadLength;
+
+    return WS_COMPLETE;
+}
+
+size_t wsClose(uint8_t *out, uint16_t code)
+{
+    size_t header = wsHeader(out, WS_CLOSE, 2);
+
+    out[header] = code >> 8;
+    out[header + 1] = code & 0xFF;
+
+    return header + 2;
+}
+
+static int copyValue(const char *from, const char *end, char *value, size_t size)
+{
+    while (from < end && *from == ' ')
+    {
+        from++;
+    }
+
+    while (end > from && end[-1] == ' ')
+    {
+        end--;
+    }
+
+    if ((size_t)(end - from) >= size)
+    {
+        value[0] = 0;
+    }
+    else
+    {
+        memcpy(value, from, end - from);
+        value[end - from] = 0;
+    }
+
+    return end - from;
+}
+
+int httpHeader(const char *request, const char *name, char *value, size_t size)
+{
+    size_t nameLength = strlen(name);
+    const char *line = strstr(request, "\r\n");
+
+    while (line != NULL && line[2] != '\r' && line[2] != 0)
+    {
+        line += 2;
+
+        const char *end = strstr(line, "\r\n");
+
+        if (end == NULL)
+        {
+            end = line + strlen(line);
+        }
+
+        if (strncasecmp(line, name, nameLength) == 0 && line[nameLength] == ':')
+        {
+            return copyValue(line + nameLength + 1, end, value, size);
+        }
+
+        line = *end != 0 ? end : NULL;
+    }
+
+    return -1;
+}
+
+// The value is taken as is, not URL decoded
+int httpQuery(const char *request, const char *name, char *value, size_t size)
+{
+    size_t nameLength = strlen(name);
+    const char *target = strchr(request, ' ');
+    const char *end = target != NULL ? strpbrk(target + 1, " \r\n") : NULL;
+
+    if (end == NULL)
+    {
+        return -1;
+    }
+
+    const char *param = (const char *)memchr(target, '?', end - target);
+
+    while (param != NULL && param < end)
+    {
+        param++;
+
+        const char *next = (const char *)memchr(param, '&', end - param);
+
+        if (next == NULL)
+        {
+            next = end;
+        }
+
+        if (strncmp(param, name, nameLength) == 0 && param[nameLength] == '=')
+        {
+            return copyValue(param + nameLength + 1, next, value, size);
+        }
+
+        param = next;
+    }
+
+    return -1;
+}
+
+bool tokenMatches(const char *given, const char *token)
+{
+    size_t length = strlen(token);
+    size_t givenLength = strlen(given);
+    uint8_t diff = givenLength != length;
+
+    for (size_t i = 0; i < length; i++)
+    {
+        diff |= token[i] ^ (i < givenLength ? given[i] : 0);
+    }
+
+    return length > 0 && diff == 0;
+}
+
+bool originAllowed(const char *origin, const char *host)
+{
+    if (origin == NULL || origin[0] == 0)
+    {
+        return true;
+    }
+
+    if (strncmp(origin, "http://", 7) == 0)
+    {
+        origin += 7;
+    }
+    else if (strncmp(origin, "https://", 8) == 0)
+    {
+        origin += 8;
+    }
+    else
+    {
+        return false;
+    }
+
+    size_t length = strlen(host);
+
+    return length > 0 && strncmp(origin, host, length) == 0 &&
+           (origin[length] == 0 || origin[length] == ':' || origin[length] == '/');
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+// WebSocket framing and request checks for the local API. Portable, no
+// Arduino code. Only whole text and control frames are accepted, a
+// fragmented message is reported so the caller can close with an error.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// 2 byte header, 8 byte extended length
+#define WS_HEADER_MAX 10
+
+#define WS_TEXT 0x1
+#define WS_CLOSE 0x8
+#define WS_PING 0x9
+#define WS_PONG 0xA
+
+// Close codes sent back with the error
+#define WS_CLOSE_PROTOCOL 1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_POLICY 1008
+#define WS_CLOSE_TOO_BIG 1009
+
+// wsParse() results
+#define WS_MORE 0
+#define WS_COMPLETE 1
+#define WS_TOO_BIG -1
+#define WS_UNMASKED -2
+#define WS_FRAGMENTED -3
+
+struct wsFrame
+{
+    uint8_t opcode;
+    uint8_t *payload;
+    size_t length;
+    size_t size;
+};
+
+// Writes the header of an unmasked server frame carrying length bytes,
+// returns its size
+size_t wsHeader(uint8_t *header, uint8_t opcode, size_t length);
+
+// Looks at the client bytes collected so far. Once a whole frame is there
+// its payload is unmasked in place and WS_COMPLETE is returned, frame->size
+// is what it took of data.
+int wsParse(uint8_t *data, size_t length, size_t maxPayload, wsFrame *frame);
+
+// Writes a close frame with code to out, which needs WS_HEADER_MAX + 2 bytes
+size_t wsClose(uint8_t *out, uint16_t code);
+
+// Length of the value of header name in an HTTP request head, -1 when it is
+// missing. The name is matched without case, the value is copied to value
+// only when it fits in size, otherwise value is left empty.
+int httpHeader(const char *request, const char *name, char *value, size_t size);
+
+// Same for parameter name in the query of the request line
+int httpQuery(const char *request, const char *name, char *value, size_t size);
+
+// Compares the whole token whatever matched, so the time taken does not
+// tell how much of it was right. An empty token matches nothing.
+bool tokenMatches(const char *given, const char *token);
+
+// Browsers send Origin with every cross site request, other clients do not
+// send it. Only pages served by the device itself at host are allowed.
+bool originAllowed(const char *origin, const char *host);
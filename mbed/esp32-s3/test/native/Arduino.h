@@ -0,0 +1,42 @@
+#pragma once
+
+// Just enough of the Arduino core to build the portable modules and the
+// patched PubSubClient in the native test env. The clock is driven by the
+// tests through nativeMillis().
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define PROGMEM
+#define pgm_read_byte_near(p) (*(const uint8_t *)(p))
+
+inline unsigned long &nativeMillis(void)
+{
+    static unsigned long now = 1000;
+    return now;
+}
+
+inline unsigned long millis(void)
+{
+    return nativeMillis();
+}
+
+inline unsigned long micros(void)
+{
+    return nativeMillis() * 1000;
+}
+
+inline void delay(unsigned long ms)
+{
+    nativeMillis() += ms;
+}
+
+inline void yield(void)
+{
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "Stream.h"
+#include "IPAddress.h"
+
+class Client : public Stream
+{
+
+public:
+    virtual int connect(IPAddress ip, uint16_t port) = 0;
+    virtual int connect(const char *host, uint16_t port) = 0;
+    using Print::write;
+    virtual int read(uint8_t *data, size_t length) = 0;
+    using Stream::read;
+    virtual void stop(void) = 0;
+    virtual uint8_t connected(void) = 0;
+    virtual operator bool(void) = 0;
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Arduino.h"
+
+class Print
+{
+
+public:
+    virtual ~Print()
+    {
+    }
+
+    virtual size_t write(uint8_t data) = 0;
+
+    virtual size_t write(const uint8_t *data, size_t length)
+    {
+        size_t written = 0;
+
+        while (length-- > 0 && this->write(*data++) == 1)
+        {
+            written++;
+        }
+
+        return written;
+    }
+};
+
+class Stream : public Print
+{
+
+public:
+    virtual int available(void) = 0;
+    virtual int read(void) = 0;
+    virtual int peek(void) = 0;
+    virtual void flush(void) = 0;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+// Files for tsStore in the native tests, kept in memory. Reads are counted
+// per path so a test can see how a query reached its data, and writes can
+// be made to fail.
+
+#include <map>
+#include <set>
+#include <string>
+#include "tsStore.h"
+
+#define MEMORY_OPEN_FILES 8
+
+class memoryStorage : public tsFileSystem
+{
+
+public:
+    std::map<std::string, std::string> files;
+    std::set<std::string> dirs;
+    std::map<std::string, int> reads;
+    // Writes fail while set
+    bool failWrites;
+    int openFiles;
+
+    memoryStorage()
+    {
+        this->reset();
+    }
+
+    void reset(void)
+    {
+        this->files.clear();
+        this->dirs.clear();
+        this->reads.clear();
+        this->failWrites = false;
+        this->openFiles = 0;
+
+        for (int i = 0; i < MEMORY_OPEN_FILES; i++)
+        {
+            this->handles[i].used = false;
+        }
+    }
+
+    int open(const char *path, bool write)
+    {
+        if (!write && this->files.count(path) == 0)
+        {
+            return -1;
+        }
+
+        for (int i = 0; i < MEMORY_OPEN_FILES; i++)
+        {
+            if (!this->handles[i].used)
+            {
+                this->handles[i].used = true;
+                this->handles[i].path = path;
+                this->handles[i].position = 0;
+                this->files[path];
+                this->openFiles++;
+                return i;
+            }
+        }
+
+        return -1;
+    }
+
+    size_t read(int file, uint8_t *data, size_t length)
+    {
+        handle &h = this->handles[file];
+        const std::string &content = this->files[h.path];
+        size_t count = h.position < content.size() ? content.size() - h.position : 0;
+
+        count = count < length ? count : length;
+        memcpy(data, content.data() + h.position, count);
+        h.position += count;
+        this->reads[h.path]++;
+
+        return count;
+    }
+
+    size_t write(int file, const uint8_t *data, size_t length)
+    {
+        if (this->failWrites)
+        {
+            return 0;
+        }
+
+        this->files[this->handles[file].path].append((const char *)data, length);
+
+        return length;
+    }
+
+    bool seek(int file, uint32_t position)
+    {
+        this->handles[file].position = position;
+        return position <= this->files[this->handles[file].path].size();
+    }
+
+    uint32_t size(int file)
+    {
+        return this->files[this->handles[file].path].size();
+    }
+
+    void close(int file)
+    {
+        this->handles[file].used = false;
+        this->openFiles--;
+    }
+
+    bool remove(const char *path)
+    {
+        return this->files.erase(path) > 0;
+    }
+
+    bool mkdir(const char *path)
+    {
+        this->dirs.insert(path);
+        return true;
+    }
+
+    void list(const char *dir, void (*found)(const char *name, void *ctx), void *ctx)
+    {
+        std::string prefix = std::string(dir) + "/";
+
+        for (std::map<std::string, std::string>::iterator i = this->files.begin(); i != this->files.end(); ++i)
+        {
+            if (i->first.compare(0, prefix.size(), prefix) == 0 && i->first.find('/', prefix.size()) == std::string::npos)
+            {
+                found(i->first.c_str() + prefix.size(), ctx);
+            }
+        }
+    }
+
+private:
+    struct handle
+    {
+        bool used;
+        std::string path;
+        size_t position;
+    };
+
+    handle handles[MEMORY_OPEN_FILES];
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+// A socket for PubSubClient in the native tests: what the client writes is
+// kept in out, what the test feeds is read back from in. Fixed buffers, so
+// the client under test is the only thing that can allocate.
+
+#include "Client.h"
+
+#define MOCK_BUFFER 8192
+
+class mockClient : public Client
+{
+
+public:
+    uint8_t out[MOCK_BUFFER];
+    size_t outLength;
+    uint8_t in[MOCK_BUFFER];
+    size_t inLength;
+    size_t inPos;
+    bool up;
+    int writes;
+    long reads;
+    long availables;
+    // Bytes write() still takes before it fails, -1 for no limit
+    long writeLimit;
+    // Writes are counted but not kept, for benchmarks
+    bool discard;
+
+    mockClient()
+    {
+        this->reset();
+    }
+
+    void reset(void)
+    {
+        this->outLength = 0;
+        this->inLength = 0;
+        this->inPos = 0;
+        this->up = false;
+        this->writes = 0;
+        this->reads = 0;
+        this->availables = 0;
+        this->writeLimit = -1;
+        this->discard = false;
+    }
+
+    void feed(const uint8_t *data, size_t length)
+    {
+        if (this->inPos == this->inLength)
+        {
+            this->inPos = this->inLength = 0;
+        }
+
+        memcpy(this->in + this->inLength, data, length);
+        this->inLength += length;
+    }
+
+    int connect(IPAddress ip, uint16_t port)
+    {
+        this->up = true;
+        return 1;
+    }
+
+    int connect(const char *host, uint16_t port)
+    {
+        this->up = true;
+        return 1;
+    }
+
+    size_t write(uint8_t data)
+    {
+        return this->write(&data, 1);
+    }
+
+    size_t write(const uint8_t *data, size_t length)
+    {
+        if (this->up && this->discard)
+        {
+            this->writes++;
+            return length;
+        }
+
+        if (!this->up || this->outLength + length > MOCK_BUFFER)
+        {
+            return 0;
+        }
+
+        if (this->writeLimit >= 0 && (long)length > this->writeLimit)
+        {
+            length = this->writeLimit;
+        }
+
+        if (this->writeLimit >= 0)
+        {
+            this->writeLimit -= length;
+        }
+
+        memcpy(this->out + this->outLength, data, length);
+        this->outLength += length;
+        this->writes++;
+
+        return length;
+    }
+
+    int available(void)
+    {
+        this->availables++;
+        return this->inLength - this->inPos;
+    }
+
+    int read(void)
+    {
+        this->reads++;
+        return this->inPos < this->inLength ? this->in[this->inPos++] : -1;
+    }
+
+    int read(uint8_t *data, size_t length)
+    {
+        size_t count = 0;
+
+        this->reads++;
+
+        while (count < length && this->inPos < this->inLength)
+        {
+            data[count++] = this->in[this->inPos++];
+        }
+
+        return count > 0 ? (int)count : -1;
+    }
+
+    int peek(void)
+    {
+        return this->inPos < this->inLength ? this->in[this->inPos] : -1;
+    }
+
+    void flush(void)
+    {
+    }
+
+    void stop(void)
+    {
+        this->up = false;
+    }
+
+    uint8_t connected(void)
+    {
+        return this->up;
+    }
+
+    operator bool(void)
+    {
+        return this->up;
+    }
+};
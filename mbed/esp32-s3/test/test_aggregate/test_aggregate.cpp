@@ -0,0 +1,232 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "aggregate.h"
+
+#define MAX_SUMMARIES 64
+
+aggSummary summaries[MAX_SUMMARIES];
+int emitted;
+
+void collect(const aggSummary &summary, void *ctx)
+{
+    if (emitted < MAX_SUMMARIES)
+    {
+        summaries[emitted] = summary;
+    }
+
+    emitted++;
+}
+
+void setUp(void)
+{
+    emitted = 0;
+    srand(1);
+}
+
+void tearDown(void)
+{
+}
+
+// Sum of 12 uniforms, close enough to a normal with mean 50 and sd 10
+float normal(void)
+{
+    float x = 0;
+
+    for (int k = 0; k < 12; k++)
+    {
+        x += rand() / (float)RAND_MAX;
+    }
+
+    return (x - 6) * 10 + 50;
+}
+
+void test_stats_merge_matches_single_pass(void)
+{
+    aggStats all;
+    aggStats left;
+    aggStats right;
+
+    all.clear();
+    left.clear();
+    right.clear();
+
+    for (int i = 0; i < 1000; i++)
+    {
+        float value = normal();
+
+        all.add(value);
+        (i < 300 ? left : right).add(value);
+    }
+
+    left.merge(right);
+
+    TEST_ASSERT_EQUAL_UINT32(all.count, left.count);
+    TEST_ASSERT_EQUAL_FLOAT(all.min, left.min);
+    TEST_ASSERT_EQUAL_FLOAT(all.max, left.max);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, all.mean, left.mean);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, all.variance(), left.variance());
+    TEST_ASSERT_FLOAT_WITHIN(10.0f, 100.0f, all.variance());
+}
+
+// On 10000 samples the estimates fall within half a percent of rank of the
+// exact quantiles
+void test_digest_accuracy(void)
+{
+    aggDigest digest;
+    std::vector<float> values;
+    float quantiles[] = {0.01f, 0.5f, 0.9f, 0.99f};
+
+    for (int i = 0; i < 10000; i++)
+    {
+        float value = normal();
+
+        values.push_back(value);
+        digest.add(value, 1);
+    }
+
+    std::sort(values.begin(), values.end());
+
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+    {
+        float exact = values[(size_t)(quantiles[i] * (values.size() - 1))];
+        float estimate = digest.quantile(quantiles[i]);
+        float rank = (std::lower_bound(values.begin(), values.end(), estimate) - values.begin()) / (float)values.size();
+
+        printf("q %.2f exact %.3f digest %.3f rank %.4f\n", quantiles[i], exact, estimate, rank);
+        TEST_ASSERT_FLOAT_WITHIN(0.005f, quantiles[i], rank);
+    }
+}
+
+void test_configure(void)
+{
+    aggWindow window;
+
+    TEST_ASSERT_FALSE(window.active());
+    TEST_ASSERT_TRUE(window.configure(1000, 250));
+    TEST_ASSERT_TRUE(window.active());
+    TEST_ASSERT_FALSE(window.configure(1000, 300));
+    TEST_ASSERT_FALSE(window.configure(1000, 200));
+    TEST_ASSERT_TRUE(window.configure(1000, 0));
+    TEST_ASSERT_EQUAL(1000, window.slide);
+    TEST_ASSERT_TRUE(window.configure(0, 0));
+    TEST_ASSERT_FALSE(window.active());
+}
+
+void test_tumbling_window(void)
+{
+    aggWindow window;
+
+    window.configure(100, 0);
+
+    for (unsigned long now = 0; now < 350; now++)
+    {
+        window.roll(now, collect, NULL);
+        window.add(now % 100);
+    }
+
+    TEST_ASSERT_EQUAL(3, emitted);
+    TEST_ASSERT_EQUAL(100, summaries[0].end);
+    TEST_ASSERT_EQUAL_UINT32(100, summaries[0].stats.count);
+    TEST_ASSERT_EQUAL(200, summaries[1].end);
+    TEST_ASSERT_EQUAL_UINT32(100, summaries[1].stats.count);
+    TEST_ASSERT_EQUAL_FLOAT(0, summaries[1].stats.min);
+    TEST_ASSERT_EQUAL_FLOAT(99, summaries[1].stats.max);
+    TEST_ASSERT_FLOAT_WITHIN(0.001f, 49.5f, summaries[1].stats.mean);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 49.5f, summaries[1].p50);
+    TEST_ASSERT_FLOAT_WITHIN(2.0f, 89.5f, summaries[1].p90);
+}
+
+// A sliding window emits every slide and covers the last length
+void test_sliding_window(void)
+{
+    aggWindow window;
+
+    window.configure(1000, 250);
+
+    for (unsigned long now = 0; now < 3000; now++)
+    {
+        window.roll(now, collect, NULL);
+        window.add(1);
+    }
+
+    TEST_ASSERT_EQUAL(11, emitted);
+
+    for (int i = 0; i < emitted; i++)
+    {
+        TEST_ASSERT_EQUAL(250 * (i + 1), summaries[i].end);
+    }
+
+    // The first windows only have the panes seen so far
+    TEST_ASSERT_EQUAL_UINT32(250, summaries[0].stats.count);
+    TEST_ASSERT_EQUAL_UINT32(750, summaries[2].stats.count);
+    TEST_ASSERT_EQUAL_UINT32(1000, summaries[3].stats.count);
+    TEST_ASSERT_EQUAL_UINT32(1000, summaries[10].stats.count);
+}
+
+// Nothing is emitted for the empty windows of a gap
+void test_gap(void)
+{
+    aggWindow window;
+
+    window.configure(100, 0);
+    window.roll(0, collect, NULL);
+    window.add(1);
+    window.roll(100000, collect, NULL);
+
+    TEST_ASSERT_EQUAL(1, emitted);
+
+    window.add(2);
+    window.roll(100050, collect, NULL);
+    window.roll(100100, collect, NULL);
+
+    TEST_ASSERT_EQUAL(2, emitted);
+    TEST_ASSERT_EQUAL(100100, summaries[1].end);
+    TEST_ASSERT_EQUAL_FLOAT(2, summaries[1].stats.mean);
+}
+
+// Update cost per sample and memory per series
+void test_benchmark(void)
+{
+    aggWindow window;
+    unsigned long now = 0;
+    const int samples = 5000000;
+
+    window.configure(1000, 0);
+
+    clock_t start = clock();
+
+    for (int i = 0; i < samples; i++)
+    {
+        // One tick every 64 samples, a summary every 64000
+        if ((i & 63) == 0)
+        {
+            window.roll(++now, collect, NULL);
+        }
+
+        window.add((float)(rand() % 1000));
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("update %.1f ns/sample, window %u bytes, digest %u bytes\n",
+           seconds * 1e9 / samples, (unsigned)sizeof(aggWindow), (unsigned)sizeof(aggDigest));
+
+    TEST_ASSERT_EQUAL(samples / 64000, emitted);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_stats_merge_matches_single_pass);
+    RUN_TEST(test_digest_accuracy);
+    RUN_TEST(test_configure);
+    RUN_TEST(test_tumbling_window);
+    RUN_TEST(test_sliding_window);
+    RUN_TEST(test_gap);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,545 @@
+#include <unity.h>
+#include <stdio.h>
+#include <time.h>
+#include <PubSubClient.h>
+#include "mockClient.h"
+#include "commands.h"
+#include "compression.h"
+#include "lz.h"
+#include "tasks.h"
+#include "websocket.h"
+
+// Counts every heap allocation while armed. glibc's own entry points are
+// wrapped, operator new goes through malloc as well.
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+bool armed = false;
+int allocations = 0;
+
+extern "C" void *malloc(size_t size)
+{
+    allocations += armed;
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    allocations += armed;
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    allocations += armed;
+    return __libc_realloc(pointer, size);
+}
+
+#define DEVICE_TOPIC "/gtsField1/1234"
+#define NODE_TOPIC "/gtsField1/NODEJS"
+
+mockClient socket;
+PubSubClient client(socket);
+uint8_t replyQos = 0;
+int replies = 0;
+uint8_t wsOut[REPLY_MAX_LENGTH + WS_HEADER_MAX];
+size_t wsOutLength = 0;
+
+// What the firmware's sendReply() does, the local API's WebSocket clients
+// get the reply as one text frame
+void sendReply(const char *data, size_t length, void *ctx)
+{
+    if (publishReply(&client, NODE_TOPIC, (const uint8_t *)data, length, replyQos))
+    {
+        replies++;
+    }
+
+    size_t header = wsHeader(wsOut, WS_TEXT, length);
+
+    memcpy(wsOut + header, data, length);
+    wsOutLength = header + length;
+}
+
+// The device topic branch of the firmware's onMessage()
+void onMessage(void *context, const MqttMessage &message)
+{
+    receiveCommand(message.payload, message.length);
+}
+
+// CMD_ECHO/<text> answers <text>, CMD_FAIL is rejected
+bool commandEcho(void)
+{
+    MqttResponse.send("CMD_ECHO", MqttRequest.field(1));
+    return true;
+}
+
+bool commandFail(void)
+{
+    MqttResponse.send("CMD_FAIL", "FAIL");
+    return false;
+}
+
+const commandHandler testCommands[] = {
+    {"CMD_ECHO", commandEcho},
+    {"CMD_FAIL", commandFail},
+};
+
+int waitTask(commandTask *task)
+{
+    PT_BEGIN(&task->state);
+    PT_WAIT_UNTIL(&task->state, task->cancel);
+    PT_END(&task->state);
+}
+
+void feedPublish(const char *payload)
+{
+    uint8_t packet[600];
+    size_t topicLength = strlen(DEVICE_TOPIC);
+    size_t length = strlen(payload);
+    size_t remaining = 2 + topicLength + length;
+    size_t pos = 0;
+
+    packet[pos++] = 0x30;
+
+    do
+    {
+        uint8_t digit = remaining & 127;
+        remaining >>= 7;
+        packet[pos++] = remaining > 0 ? digit | 0x80 : digit;
+    } while (remaining > 0);
+
+    packet[pos++] = topicLength >> 8;
+    packet[pos++] = topicLength & 0xFF;
+    memcpy(packet + pos, DEVICE_TOPIC, topicLength);
+    pos += topicLength;
+    memcpy(packet + pos, payload, length);
+
+    socket.feed(packet, pos + length);
+}
+
+// The payload of the last PUBLISH written, NUL terminated in payload.
+// QoS 1 replies get one PUBACK each, so the window never fills.
+size_t takeReplies(char *payload, size_t capacity)
+{
+    size_t length = 0;
+
+    payload[0] = 0;
+
+    for (size_t i = 0; i + 1 < socket.outLength;)
+    {
+        uint8_t type = socket.out[i];
+        size_t remaining = 0;
+        size_t header = 1;
+        int shift = 0;
+
+        while (socket.out[i + header] & 0x80)
+        {
+            remaining |= (socket.out[i + header++] & 0x7F) << shift;
+            shift += 7;
+        }
+
+        remaining |= socket.out[i + header++] << shift;
+
+        if ((type & 0xF0) == 0x30)
+        {
+            size_t topicLength = (socket.out[i + header] << 8) | socket.out[i + header + 1];
+            size_t start = header + 2 + topicLength;
+
+            if (type & 0x06)
+            {
+                const uint8_t *id = socket.out + i + start;
+                uint8_t ack[4] = {0x40, 2, id[0], id[1]};
+
+                socket.feed(ack, 4);
+                start += 2;
+            }
+
+            length = header + remaining - start;
+            length = length < capacity - 1 ? length : capacity - 1;
+            memcpy(payload, socket.out + i + start, length);
+            payload[length] = 0;
+        }
+
+        i += header + remaining;
+    }
+
+    socket.outLength = 0;
+    return length;
+}
+
+char lastReply[REPLY_MAX_LENGTH];
+size_t lastLength;
+
+// One pass of the firmware: the request arrives in client.loop(), runs in
+// processLoop() and its reply is acknowledged on the next pass
+void roundTrip(const char *command)
+{
+    feedPublish(command);
+    client.loop();
+    processCommand();
+    lastLength = takeReplies(lastReply, sizeof(lastReply));
+    client.loop();
+}
+
+// The local API's path without the sockets: a masked text frame from the
+// LAN client is parsed, queued as queueLocalCommand() does and answered
+void localRoundTrip(const char *command)
+{
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    uint8_t frame[8 + REQUEST_MAX_LENGTH];
+    size_t length = strlen(command);
+    size_t header = 2;
+    wsFrame parsed;
+
+    frame[0] = 0x80 | WS_TEXT;
+
+    if (length < 126)
+    {
+        frame[1] = 0x80 | length;
+    }
+    else
+    {
+        frame[1] = 0x80 | 126;
+        frame[2] = length >> 8;
+        frame[3] = length & 0xFF;
+        header = 4;
+    }
+
+    memcpy(frame + header, mask, 4);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        frame[header + 4 + i] = command[i] ^ mask[i % 4];
+    }
+
+    TEST_ASSERT_EQUAL(WS_COMPLETE, wsParse(frame, header + 4 + length, REQUEST_MAX_LENGTH, &parsed));
+    TEST_ASSERT_TRUE(MqttRequest.empty());
+
+    receiveCommand(parsed.payload, parsed.length);
+
+    processCommand();
+    lastLength = takeReplies(lastReply, sizeof(lastReply));
+    client.loop();
+}
+
+void setUp(void)
+{
+    const uint8_t connack[4] = {0x20, 2, 0, 0};
+    const uint8_t suback[5] = {0x90, 3, 0, 1, 0};
+
+    socket.reset();
+    socket.feed(connack, 4);
+
+    MqttResponse.begin("1234", sendReply, NULL);
+    setCommands(testCommands, sizeof(testCommands) / sizeof(testCommands[0]));
+    setCompressMode(0);
+
+    client.setMessageHandler(onMessage, NULL);
+    TEST_ASSERT_TRUE(client.connect("gtsField1-test"));
+
+    socket.feed(suback, 5);
+    TEST_ASSERT_TRUE(client.subscribe(DEVICE_TOPIC));
+    client.loop();
+
+    socket.outLength = 0;
+    replyQos = 0;
+    replies = 0;
+    wsOutLength = 0;
+    allocations = 0;
+}
+
+void tearDown(void)
+{
+    armed = false;
+    cancelTasks("");
+    runTasks();
+    client.disconnect();
+}
+
+void test_ping_round_trip(void)
+{
+    roundTrip("CMD_PING");
+
+    armed = true;
+
+    for (int i = 0; i < 100; i++)
+    {
+        roundTrip("CMD_PING");
+    }
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(101, replies);
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_PING/NOT_BUSY", lastReply);
+}
+
+// The retransmit pool is allocated by the first QoS 1 publish and reused
+void test_ping_round_trip_qos1(void)
+{
+    replyQos = 1;
+
+    roundTrip("CMD_PING");
+
+    armed = true;
+
+    for (int i = 0; i < 100; i++)
+    {
+        roundTrip("CMD_PING");
+    }
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(101, replies);
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_PING/NOT_BUSY", lastReply);
+}
+
+void test_device_command(void)
+{
+    armed = true;
+
+    roundTrip("CMD_ECHO/hello");
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_ECHO/hello", lastReply);
+
+    roundTrip("CMD_UNKNOWN");
+
+    TEST_ASSERT_EQUAL(1, replies);
+    TEST_ASSERT_TRUE(MqttRequest.empty());
+}
+
+void test_status(void)
+{
+    TEST_ASSERT_TRUE(startTask("CMD_WAIT", waitTask));
+
+    armed = true;
+
+    roundTrip("CMD_STATUS");
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_STATUS/CMD_WAIT:0", lastReply);
+
+    armed = true;
+
+    roundTrip("CMD_CANCEL/CMD_WAIT");
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_CANCEL/1", lastReply);
+}
+
+// Each line runs through executeCommand(), the replies are collected and
+// sent as one
+void test_batch_dispatch(void)
+{
+    armed = true;
+
+    roundTrip("CMD_BATCH/STOP\r\nCMD_PING\r\nCMD_ECHO/x\r\nCMD_FAIL\r\nCMD_PING\r\n");
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL(1, replies);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_BATCH/2/4\n0/OK/CMD_PING/NOT_BUSY\n1/OK/CMD_ECHO/x\n2/FAIL/CMD_FAIL/FAIL\n3/SKIP/",
+                             lastReply);
+}
+
+// A batch of more lines than BATCH_MAX_COMMANDS is refused whole with
+// CMD_REQUEST/TOO_MANY, none of its commands run
+void test_batch_too_many(void)
+{
+    char payload[REQUEST_MAX_LENGTH] = "CMD_BATCH";
+
+    for (int i = 0; i < BATCH_MAX_COMMANDS; i++)
+    {
+        strcat(payload, "\nCMD_PING");
+    }
+
+    roundTrip(payload);
+
+    TEST_ASSERT_EQUAL(1, replies);
+    TEST_ASSERT_EQUAL_STRING_LEN("1234/CMD_BATCH/16/16\n", lastReply, 21);
+
+    strcat(payload, "\nCMD_ECHO/x");
+
+    armed = true;
+
+    roundTrip(payload);
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL(2, replies);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_REQUEST/TOO_MANY", lastReply);
+    TEST_ASSERT_TRUE(MqttRequest.empty());
+
+    // Empty lines do not count
+    strcpy(payload + strlen(payload) - strlen("\nCMD_ECHO/x"), "\n\n\r\n");
+
+    roundTrip(payload);
+
+    TEST_ASSERT_EQUAL(3, replies);
+    TEST_ASSERT_EQUAL_STRING_LEN("1234/CMD_BATCH/16/16\n", lastReply, 21);
+}
+
+// A reply over COMPRESS_MIN_LENGTH is streamed through the encoder
+void test_compressed_reply(void)
+{
+    const char *batch = "CMD_BATCH\nCMD_PING\nCMD_STATUS\nCMD_PING\nCMD_STATUS\nCMD_PING\nCMD_STATUS\nCMD_PING";
+
+    TEST_ASSERT_TRUE(setCompressMode(2));
+
+    roundTrip(batch);
+
+    for (int qos = 0; qos < 2; qos++)
+    {
+        replyQos = qos;
+        allocations = 0;
+        armed = true;
+
+        roundTrip(batch);
+
+        armed = false;
+
+        TEST_ASSERT_EQUAL(0, allocations);
+        TEST_ASSERT_EQUAL_HEX8(LZ_MAGIC, (uint8_t)lastReply[0]);
+    }
+
+    TEST_ASSERT_EQUAL(3, replies);
+}
+
+// A write cut short part way through the compressed stream drops the
+// connection, the broker would take the next packet for the rest of it
+void test_compressed_write_failure(void)
+{
+    char reply[REPLY_MAX_LENGTH] = "1234/CMD_BATCH/8/8";
+
+    for (int i = 0; i < 8; i++)
+    {
+        snprintf(reply + strlen(reply), sizeof(reply) - strlen(reply), "\n%d/OK/CMD_STATUS/IDLE", i);
+    }
+
+    TEST_ASSERT_TRUE(setCompressMode(1));
+
+    socket.writeLimit = 32;
+
+    TEST_ASSERT_FALSE(publishReply(&client, NODE_TOPIC, (const uint8_t *)reply, strlen(reply), 0));
+    TEST_ASSERT_FALSE(client.connected());
+    TEST_ASSERT_EQUAL(32, socket.outLength);
+}
+
+void test_crlf_stripped(void)
+{
+    const char *payload = "CMD_BATCH\r\nCMD_AGG/heap/60000\r\nCMD_RULE/1/x\r\n";
+
+    TEST_ASSERT_TRUE(MqttRequest.payloadParser((const uint8_t *)payload, strlen(payload)));
+    TEST_ASSERT_EQUAL_STRING("CMD_BATCH", MqttRequest.cmd);
+    TEST_ASSERT_EQUAL(2, MqttRequest.batchCount);
+    TEST_ASSERT_EQUAL_STRING("CMD_AGG/heap/60000", MqttRequest.batch[0]);
+    TEST_ASSERT_EQUAL_STRING("CMD_RULE/1/x", MqttRequest.batch[1]);
+
+    payload = "CMD_AGG/heap/60000\r\n";
+
+    TEST_ASSERT_TRUE(MqttRequest.payloadParser((const uint8_t *)payload, strlen(payload)));
+    TEST_ASSERT_EQUAL(3, MqttRequest.dataCount);
+    TEST_ASSERT_EQUAL_STRING("60000", MqttRequest.field(2));
+
+    MqttRequest.clear();
+}
+
+// Answered with CMD_REQUEST/TOO_LONG, nothing runs
+void test_oversized_refused(void)
+{
+    char payload[REQUEST_MAX_LENGTH + 1];
+
+    memset(payload, 'a', REQUEST_MAX_LENGTH);
+    payload[REQUEST_MAX_LENGTH] = 0;
+    memcpy(payload, "CMD_ECHO/", 9);
+
+    armed = true;
+
+    roundTrip(payload);
+
+    armed = false;
+
+    TEST_ASSERT_EQUAL(0, allocations);
+    TEST_ASSERT_EQUAL(1, replies);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_REQUEST/TOO_LONG", lastReply);
+    TEST_ASSERT_TRUE(MqttRequest.empty());
+
+    payload[REQUEST_MAX_LENGTH - 1] = 0;
+
+    roundTrip(payload);
+
+    TEST_ASSERT_EQUAL(2, replies);
+    TEST_ASSERT_EQUAL(strlen("1234/CMD_ECHO/") + REQUEST_MAX_LENGTH - 1 - 9, lastLength);
+}
+
+// Time on the device from a request arriving to its reply being written,
+// over MQTT and over the local WebSocket. The network is not in it: over
+// the LAN that adds one hop each way instead of two trips through the
+// cloud broker
+void test_latency_benchmark(void)
+{
+    const char *commands[] = {"CMD_PING", "CMD_STATUS", "CMD_ECHO/hello"};
+    const int count = 20000;
+
+    for (int c = 0; c < 3; c++)
+    {
+        clock_t start = clock();
+
+        for (int i = 0; i < count; i++)
+        {
+            roundTrip(commands[c]);
+        }
+
+        double mqtt = (double)(clock() - start) / CLOCKS_PER_SEC / count;
+
+        start = clock();
+
+        for (int i = 0; i < count; i++)
+        {
+            localRoundTrip(commands[c]);
+        }
+
+        double local = (double)(clock() - start) / CLOCKS_PER_SEC / count;
+
+        printf("%-15s %6.2f us over MQTT, %6.2f us over the WebSocket\n", commands[c], mqtt * 1e6, local * 1e6);
+    }
+
+    TEST_ASSERT_EQUAL(6 * count, replies);
+    TEST_ASSERT_EQUAL_STRING("1234/CMD_ECHO/hello", lastReply);
+
+    // The frame the WebSocket clients got
+    TEST_ASSERT_EQUAL(2 + lastLength, wsOutLength);
+    TEST_ASSERT_EQUAL_HEX8(0x80 | WS_TEXT, wsOut[0]);
+    TEST_ASSERT_EQUAL_MEMORY(lastReply, wsOut + 2, lastLength);
+}
+
+int main(int argc, char **argv)
+{
+    // Room for a request of REQUEST_MAX_LENGTH and more
+    client.setBufferSize(REQUEST_MAX_LENGTH + 64);
+
+    UNITY_BEGIN();
+    RUN_TEST(test_ping_round_trip);
+    RUN_TEST(test_ping_round_trip_qos1);
+    RUN_TEST(test_device_command);
+    RUN_TEST(test_status);
+    RUN_TEST(test_batch_dispatch);
+    RUN_TEST(test_batch_too_many);
+    RUN_TEST(test_compressed_reply);
+    RUN_TEST(test_compressed_write_failure);
+    RUN_TEST(test_crlf_stripped);
+    RUN_TEST(test_oversized_refused);
+    RUN_TEST(test_latency_benchmark);
+    return UNITY_END();
+}
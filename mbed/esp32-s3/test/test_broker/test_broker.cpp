@@ -0,0 +1,386 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "broker.h"
+
+// Simulated clients: what the broker sends to each connection is kept, and
+// broker side closes are counted
+std::vector<std::string> sent[BROKER_MAX_CLIENTS];
+int closes[BROKER_MAX_CLIENTS];
+
+miniBroker broker;
+
+void sendPacket(int conn, const uint8_t *data, size_t length, void *ctx)
+{
+    sent[conn].push_back(std::string((const char *)data, length));
+}
+
+void closeConnection(int conn, void *ctx)
+{
+    closes[conn]++;
+}
+
+std::string field(const char *text)
+{
+    size_t length = strlen(text);
+
+    return std::string(1, (char)(length >> 8)) + (char)(length & 0xFF) + text;
+}
+
+std::string packet(uint8_t type, const std::string &body)
+{
+    std::string result(1, (char)type);
+    size_t length = body.size();
+
+    do
+    {
+        uint8_t digit = length & 127;
+        length >>= 7;
+        result += (char)(length > 0 ? digit | 0x80 : digit);
+    } while (length > 0);
+
+    return result + body;
+}
+
+void feed(int conn, const std::string &data, unsigned long now)
+{
+    broker.received(conn, (const uint8_t *)data.data(), data.size(), now);
+}
+
+// clean is the CONNECT clean session flag
+int connect(const char *id, bool clean, unsigned long now)
+{
+    int conn = broker.open(now);
+
+    feed(conn, packet(0x10, field("MQTT") + (char)4 + (char)(clean ? 0x02 : 0) + (char)0 + (char)60 + field(id)), now);
+
+    return conn;
+}
+
+void subscribe(int conn, const char *filter, uint8_t qos)
+{
+    feed(conn, packet(0x82, std::string("\x00\x01", 2) + field(filter) + (char)qos), 0);
+}
+
+void publish(int conn, const char *topic, const char *payload, uint8_t qos)
+{
+    std::string body = field(topic);
+
+    if (qos == 1)
+    {
+        body += std::string("\x00\x07", 2);
+    }
+
+    feed(conn, packet(0x30 | (qos << 1), body + payload), 0);
+}
+
+void setUp(void)
+{
+    broker = miniBroker();
+    broker.setTransport(sendPacket, closeConnection, NULL);
+
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++)
+    {
+        sent[i].clear();
+        closes[i] = 0;
+    }
+}
+
+void tearDown(void)
+{
+}
+
+void test_connect_and_route(void)
+{
+    int a = connect("a", true, 0);
+    int b = connect("b", true, 0);
+    int c = connect("c", true, 0);
+
+    TEST_ASSERT_TRUE(sent[a].back() == std::string("\x20\x02\x00\x00", 4));
+    TEST_ASSERT_EQUAL(3, broker.clients());
+
+    // Byte by byte, the way a slow socket hands it over
+    std::string request = packet(0x82, std::string("\x00\x01", 2) + field("a/+/c") + (char)1 + field("a/#") + (char)0);
+
+    for (size_t i = 0; i < request.size(); i++)
+    {
+        feed(a, request.substr(i, 1), 0);
+    }
+
+    TEST_ASSERT_TRUE(sent[a].back() == std::string("\x90\x04\x00\x01\x01\x00", 6));
+
+    subscribe(b, "x/#", 0);
+    publish(c, "a/b/c", "hello", 1);
+
+    // PUBACK to the publisher, one delivery at the highest matching QoS and
+    // nothing for b, which only has its CONNACK and SUBACK
+    TEST_ASSERT_TRUE(sent[c].back() == std::string("\x40\x02\x00\x07", 4));
+    TEST_ASSERT_EQUAL(3, sent[a].size());
+    TEST_ASSERT_EQUAL_HEX8(0x32, sent[a].back()[0]);
+    TEST_ASSERT_EQUAL(2, sent[b].size());
+
+    // "a/#" also matches "a"
+    publish(c, "a", "y", 0);
+    TEST_ASSERT_EQUAL(4, sent[a].size());
+}
+
+void test_qos1_retransmit(void)
+{
+    int a = connect("a", true, 0);
+    int b = connect("b", true, 0);
+
+    subscribe(a, "t", 1);
+    publish(b, "t", "x", 1);
+
+    size_t before = sent[a].size();
+
+    broker.tick(BROKER_RETRY_TIMEOUT + 1);
+
+    TEST_ASSERT_EQUAL(before + 1, sent[a].size());
+    TEST_ASSERT_EQUAL_HEX8(0x3A, sent[a].back()[0]);
+
+    // Acknowledged, nothing more is sent
+    feed(a, std::string("\x40\x02\x00\x01", 4), BROKER_RETRY_TIMEOUT + 1);
+    broker.tick(3 * BROKER_RETRY_TIMEOUT);
+
+    TEST_ASSERT_EQUAL(before + 1, sent[a].size());
+}
+
+// The gateway closes the slot once the socket is gone, then it is free
+void test_closed_frees_slot(void)
+{
+    int conns[BROKER_MAX_CLIENTS];
+
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++)
+    {
+        conns[i] = broker.open(0);
+        TEST_ASSERT_TRUE(broker.used(conns[i]));
+    }
+
+    TEST_ASSERT_EQUAL(-1, broker.open(0));
+
+    broker.closed(conns[3]);
+
+    TEST_ASSERT_FALSE(broker.used(conns[3]));
+    TEST_ASSERT_EQUAL(conns[3], broker.open(0));
+    TEST_ASSERT_FALSE(broker.used(-1));
+    TEST_ASSERT_FALSE(broker.used(BROKER_MAX_CLIENTS));
+}
+
+void test_duplicate_id_clean_session(void)
+{
+    int first = connect("sensor", true, 0);
+    int other = connect("other", true, 0);
+
+    subscribe(first, "t", 0);
+
+    int second = connect("sensor", true, 10);
+
+    TEST_ASSERT_EQUAL(1, closes[first]);
+    TEST_ASSERT_FALSE(broker.used(first));
+    TEST_ASSERT_TRUE(sent[second].back() == std::string("\x20\x02\x00\x00", 4));
+    TEST_ASSERT_EQUAL(2, broker.clients());
+
+    // The old subscription went with the old connection
+    publish(other, "t", "x", 0);
+    TEST_ASSERT_EQUAL(1, sent[second].size());
+}
+
+void test_duplicate_id_takes_session_over(void)
+{
+    int first = connect("sensor", false, 0);
+    int other = connect("other", true, 0);
+
+    subscribe(first, "t", 1);
+    publish(other, "t", "x", 1);
+
+    int second = connect("sensor", false, 10);
+
+    TEST_ASSERT_EQUAL(1, closes[first]);
+    TEST_ASSERT_TRUE(sent[second].back() == std::string("\x20\x02\x01\x00", 4));
+
+    // The unacknowledged delivery is sent again on the new connection
+    broker.tick(10);
+    TEST_ASSERT_EQUAL(2, sent[second].size());
+    TEST_ASSERT_EQUAL_HEX8(0x3A, sent[second].back()[0]);
+
+    // And the subscription came along
+    publish(other, "t", "y", 0);
+    TEST_ASSERT_EQUAL(3, sent[second].size());
+    TEST_ASSERT_EQUAL_HEX8(0x30, sent[second].back()[0]);
+}
+
+void test_bridge_keeps_batch_until_flushed(void)
+{
+    static int accept = 0;
+    static int calls = 0;
+    brokerBridge bridge;
+
+    bridge.setFlush([](const uint8_t *batch, size_t length, uint16_t count, void *ctx)
+                    { calls++; return accept != 0; },
+                    NULL);
+
+    TEST_ASSERT_TRUE(bridge.add("t", 1, (const uint8_t *)"x", 1, 0));
+
+    bridge.tick(BRIDGE_BATCH_INTERVAL);
+    TEST_ASSERT_EQUAL(1, calls);
+    TEST_ASSERT_EQUAL(0, bridge.batches);
+
+    accept = 1;
+    bridge.tick(BRIDGE_BATCH_INTERVAL + 1);
+    TEST_ASSERT_EQUAL(2, calls);
+    TEST_ASSERT_EQUAL(1, bridge.batches);
+}
+
+void test_routing_rate(void)
+{
+    for (int i = 0; i < BROKER_MAX_CLIENTS; i++)
+    {
+        char id[8];
+        char filter[16];
+
+        snprintf(id, sizeof(id), "c%d", i);
+        snprintf(filter, sizeof(filter), "site/%d/#", i % 16);
+
+        subscribe(connect(id, true, 0), filter, 0);
+    }
+
+    broker.setTransport([](int conn, const uint8_t *data, size_t length, void *ctx) {}, closeConnection, NULL);
+
+    std::string message = packet(0x30, field("site/3/temp") + "21.5");
+    clock_t start = clock();
+
+    for (int i = 0; i < 100000; i++)
+    {
+        feed(i % BROKER_MAX_CLIENTS, message, 0);
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("100000 publishes routed in %.3f s, %lu delivered\n", seconds, broker.messagesOut);
+
+    TEST_ASSERT_EQUAL(100000, broker.messagesIn);
+}
+
+// QoS 1 deliveries the fan-out benchmark still has to acknowledge
+struct pendingAck
+{
+    int conn;
+    uint8_t id[2];
+};
+
+std::vector<pendingAck> pendingAcks;
+
+void collectAcks(int conn, const uint8_t *data, size_t length, void *ctx)
+{
+    if ((data[0] & 0xF6) == 0x32)
+    {
+        size_t header = 1;
+
+        while (data[header++] & 0x80)
+        {
+        }
+
+        size_t topicLength = (data[header] << 8) | data[header + 1];
+        pendingAck ack = {conn, {data[header + 2 + topicLength], data[header + 3 + topicLength]}};
+
+        pendingAcks.push_back(ack);
+    }
+}
+
+// Every client holds a site filter, half of them a "+" filter at QoS 1 and
+// every eighth a "#", so each publish matches many overlapping subscriptions
+// with mixed QoS. Build with -DBROKER_MAX_CLIENTS=256 (pio test -e
+// native-broker) for a full site
+void test_fanout_rate(void)
+{
+    const int rounds = 20000;
+    std::string puback = std::string("\x40\x02", 2);
+    std::string messages[16];
+    int matches[16] = {0};
+    int clients = BROKER_MAX_CLIENTS;
+
+    for (int i = 0; i < clients; i++)
+    {
+        char id[8];
+        char filter[16];
+        int conn;
+
+        snprintf(id, sizeof(id), "c%d", i);
+        snprintf(filter, sizeof(filter), "site/%d/#", i % 16);
+
+        conn = connect(id, true, 0);
+        subscribe(conn, filter, 0);
+
+        if (i % 2 == 0)
+        {
+            subscribe(conn, "site/+/temp", 1);
+        }
+
+        if (i % 8 == 0)
+        {
+            subscribe(conn, "#", 0);
+        }
+
+        for (int k = 0; k < 16; k++)
+        {
+            matches[k] += i % 16 == k || i % 2 == 0;
+        }
+    }
+
+    for (int k = 0; k < 16; k++)
+    {
+        char topic[16];
+
+        snprintf(topic, sizeof(topic), "site/%d/temp", k);
+        messages[k] = packet(0x32, field(topic) + std::string("\x00\x07", 2) + "21.5");
+    }
+
+    broker.setTransport(collectAcks, closeConnection, NULL);
+
+    unsigned long expected = 0;
+    unsigned long before = broker.messagesOut;
+    clock_t start = clock();
+
+    for (int i = 0; i < rounds; i++)
+    {
+        feed(i % clients, messages[i % 16], 0);
+        expected += matches[i % 16];
+
+        for (size_t k = 0; k < pendingAcks.size(); k++)
+        {
+            feed(pendingAcks[k].conn, puback + (char)pendingAcks[k].id[0] + (char)pendingAcks[k].id[1], 0);
+        }
+
+        pendingAcks.clear();
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    unsigned long routed = broker.messagesOut - before;
+
+    printf("%d clients: %.0f publishes/s, %.0f deliveries/s, %.1f deliveries per publish\n", clients, rounds / seconds,
+           routed / seconds, (double)routed / rounds);
+
+    // Every matching client gets the message once at its highest QoS, none
+    // is dropped for a full in-flight table
+    TEST_ASSERT_EQUAL(0, broker.dropped);
+    TEST_ASSERT_EQUAL(rounds, broker.messagesIn);
+    TEST_ASSERT_EQUAL(expected, routed);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_connect_and_route);
+    RUN_TEST(test_qos1_retransmit);
+    RUN_TEST(test_closed_frees_slot);
+    RUN_TEST(test_duplicate_id_clean_session);
+    RUN_TEST(test_duplicate_id_takes_session_over);
+    RUN_TEST(test_bridge_keeps_batch_until_flushed);
+    RUN_TEST(test_routing_rate);
+    RUN_TEST(test_fanout_rate);
+    return UNITY_END();
+}
@@ -0,0 +1,221 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "dsp.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define NOW_US() micros()
+#else
+#include <time.h>
+#define NOW_US() ((unsigned long)(clock() * (1000000.0 / CLOCKS_PER_SEC)))
+#endif
+
+// Runs natively and on the board, where dspDot16 has to match too
+void setUp(void)
+{
+    srand(1);
+}
+
+void tearDown(void)
+{
+}
+
+int16_t random16(void)
+{
+    return (int16_t)(rand() % 65536 - 32768);
+}
+
+void test_dot_matches_reference(void)
+{
+    int16_t a[DSP_FIR_TAPS + 5];
+    int16_t b[DSP_FIR_TAPS + 5];
+    int lengths[] = {0, 1, 3, 4, 5, DSP_FIR_TAPS, DSP_FIR_TAPS + 5};
+
+    for (int round = 0; round < 2000; round++)
+    {
+        for (int i = 0; i < DSP_FIR_TAPS + 5; i++)
+        {
+            a[i] = random16();
+            b[i] = random16();
+        }
+
+        for (size_t k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++)
+        {
+            TEST_ASSERT_EQUAL_INT16(dspDot16Reference(a, b, lengths[k]), dspDot16(a, b, lengths[k]));
+        }
+    }
+}
+
+// On the ESP32-S3 whole blocks of 8 go through the PIE, operands that are
+// not 16 byte aligned are copied first and lengths over DSP_PIE_MAX stay
+// scalar
+void test_dot_alignments(void)
+{
+    int16_t a[DSP_PIE_MAX + 16] __attribute__((aligned(16)));
+    int16_t b[DSP_PIE_MAX + 16] __attribute__((aligned(16)));
+    int lengths[] = {8, 12, 16, 32, 40, DSP_PIE_MAX, DSP_PIE_MAX + 8};
+
+    for (int i = 0; i < DSP_PIE_MAX + 16; i++)
+    {
+        a[i] = random16();
+        b[i] = random16();
+    }
+
+    for (int offsetA = 0; offsetA < 8; offsetA++)
+    {
+        for (int offsetB = 0; offsetB < 8; offsetB++)
+        {
+            for (size_t k = 0; k < sizeof(lengths) / sizeof(lengths[0]); k++)
+            {
+                TEST_ASSERT_EQUAL_INT16(dspDot16Reference(a + offsetA, b + offsetB, lengths[k]),
+                                        dspDot16(a + offsetA, b + offsetB, lengths[k]));
+            }
+        }
+    }
+}
+
+// Full scale inputs overflow a 32 bit sum and have to saturate, not wrap
+void test_dot_saturates(void)
+{
+    int16_t a[DSP_FIR_TAPS];
+    int16_t b[DSP_FIR_TAPS];
+
+    for (int i = 0; i < DSP_FIR_TAPS; i++)
+    {
+        a[i] = -32768;
+        b[i] = -32768;
+    }
+
+    TEST_ASSERT_EQUAL_INT16(32767, dspDot16Reference(a, b, DSP_FIR_TAPS));
+    TEST_ASSERT_EQUAL_INT16(32767, dspDot16(a, b, DSP_FIR_TAPS));
+
+    for (int i = 0; i < DSP_FIR_TAPS; i++)
+    {
+        b[i] = 32767;
+    }
+
+    TEST_ASSERT_EQUAL_INT16(-32768, dspDot16Reference(a, b, DSP_FIR_TAPS));
+    TEST_ASSERT_EQUAL_INT16(-32768, dspDot16(a, b, DSP_FIR_TAPS));
+}
+
+// 0.5 * 0.5 rounds to nearest in Q15
+void test_dot_rounding(void)
+{
+    int16_t a[1] = {16384};
+    int16_t b[1] = {16384};
+    int16_t c[1] = {1};
+
+    TEST_ASSERT_EQUAL_INT16(8192, dspDot16(a, b, 1));
+    TEST_ASSERT_EQUAL_INT16(1, dspDot16(a, c, 1));
+    TEST_ASSERT_EQUAL_INT16(dspDot16Reference(a, c, 1), dspDot16(a, c, 1));
+}
+
+// 12 bit ADC at 16 kHz, CIC by 16 and FIR by 4 down to 250 Hz
+float peak(float frequency)
+{
+    cicDecimator cic;
+    firDecimator fir;
+    int16_t in[DSP_BLOCK * 16];
+    int16_t middle[DSP_BLOCK];
+    int16_t out[DSP_BLOCK];
+    float largest = 0;
+    long n = 0;
+
+    cic.begin(16, 12);
+    fir.begin(4);
+
+    for (int block = 0; block < 100; block++)
+    {
+        for (int i = 0; i < DSP_BLOCK * 16; i++, n++)
+        {
+            in[i] = (int16_t)(1500 * sin(2 * M_PI * frequency * n / 16000));
+        }
+
+        size_t count = fir.process(middle, cic.process(in, DSP_BLOCK * 16, middle), out);
+
+        for (size_t i = 0; block > 20 && i < count; i++)
+        {
+            largest = fmaxf(largest, fabsf(out[i]));
+        }
+    }
+
+    return largest;
+}
+
+void test_pipeline_response(void)
+{
+    float full = 1500.0f / 2048 * 32768;
+    float pass = peak(20);
+    float stop = peak(400);
+
+    printf("20 Hz %.0f, 400 Hz %.0f of %.0f\n", pass, stop, full);
+
+    TEST_ASSERT_FLOAT_WITHIN(full * 0.05f, full, pass);
+    TEST_ASSERT_LESS_THAN(full * 0.01f, stop);
+}
+
+void test_dot_timing(void)
+{
+    int16_t a[DSP_FIR_TAPS];
+    int16_t b[DSP_FIR_TAPS];
+    volatile int32_t sink = 0;
+    const int rounds = 20000;
+
+    for (int i = 0; i < DSP_FIR_TAPS; i++)
+    {
+        a[i] = random16();
+        b[i] = random16();
+    }
+
+    unsigned long start = NOW_US();
+
+    for (int i = 0; i < rounds; i++)
+    {
+        sink += dspDot16(a, b, DSP_FIR_TAPS);
+    }
+
+    unsigned long fast = NOW_US() - start;
+
+    start = NOW_US();
+
+    for (int i = 0; i < rounds; i++)
+    {
+        sink += dspDot16Reference(a, b, DSP_FIR_TAPS);
+    }
+
+    unsigned long reference = NOW_US() - start;
+
+    printf("%d taps: dspDot16 %.3f us, reference %.3f us\n", DSP_FIR_TAPS, (float)fast / rounds, (float)reference / rounds);
+}
+
+int runTests(void)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_dot_matches_reference);
+    RUN_TEST(test_dot_alignments);
+    RUN_TEST(test_dot_saturates);
+    RUN_TEST(test_dot_rounding);
+    RUN_TEST(test_pipeline_response);
+    RUN_TEST(test_dot_timing);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    // Time for the monitor to attach
+    delay(2000);
+    runTests();
+}
+
+void loop()
+{
+}
+#else
+int main(int argc, char **argv)
+{
+    return runTests();
+}
+#endif
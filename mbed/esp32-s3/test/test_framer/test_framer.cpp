@@ -0,0 +1,193 @@
+#include <unity.h>
+#include <stdio.h>
+#include <time.h>
+#include "framer.h"
+
+// 9600 baud 8N1 in SoftwareSerial ticks, two per micro
+#define CHAR_TIME (2 * 1042)
+#define GAP (2 * 3646)
+
+serialFramer framer;
+uint8_t data[512];
+uint32_t times[512];
+uint32_t now;
+
+void setUp(void)
+{
+    framer.begin(GAP, CHAR_TIME);
+    now = 1000;
+}
+
+void tearDown(void)
+{
+}
+
+// count bytes from first, space apart from start to start
+void send(uint8_t first, int count, uint32_t space)
+{
+    for (int i = 0; i < count; i++)
+    {
+        data[i] = first + i;
+        times[i] = now;
+        now += space;
+    }
+
+    framer.add(data, times, count);
+}
+
+// Length of record n of the batch, -1 when there is none
+int record(int n, const uint8_t **bytes)
+{
+    const uint8_t *p = framer.frames();
+
+    for (int i = 0; i < framer.count(); i++)
+    {
+        int length = p[0] << 8 | p[1];
+
+        if (i == n)
+        {
+            *bytes = p + FRAMER_HEADER;
+            return length;
+        }
+
+        p += FRAMER_HEADER + length;
+    }
+
+    return -1;
+}
+
+void test_split_on_gap(void)
+{
+    const uint8_t *bytes;
+
+    send(0, 8, CHAR_TIME);
+    now += 2 * 5000;
+
+    // 1.5 characters of silence inside a frame are not a gap
+    send(0x10, 5, CHAR_TIME + 2 * 1500);
+
+    TEST_ASSERT_EQUAL(1, framer.count());
+
+    framer.poll(now);
+    TEST_ASSERT_EQUAL(1, framer.count());
+
+    framer.poll(now + GAP);
+    TEST_ASSERT_EQUAL(2, framer.count());
+    TEST_ASSERT_EQUAL(FRAMER_HEADER + 8 + FRAMER_HEADER + 5, framer.length());
+    TEST_ASSERT_EQUAL(8, record(0, &bytes));
+    TEST_ASSERT_EQUAL(0, bytes[0]);
+    TEST_ASSERT_EQUAL(7, bytes[7]);
+    TEST_ASSERT_EQUAL(5, record(1, &bytes));
+    TEST_ASSERT_EQUAL(0x10, bytes[0]);
+}
+
+void test_oversized_frame_dropped(void)
+{
+    send(0, FRAMER_MAX_FRAME + 10, CHAR_TIME);
+    framer.poll(now + 2 * GAP);
+
+    TEST_ASSERT_EQUAL(0, framer.count());
+    TEST_ASSERT_EQUAL_UINT32(1, framer.dropped);
+}
+
+// Consuming after a publish keeps the frame still coming in
+void test_open_frame_survives_consume(void)
+{
+    const uint8_t *bytes;
+
+    send(0xA0, 3, CHAR_TIME);
+    framer.consume();
+
+    TEST_ASSERT_EQUAL(0, framer.length());
+
+    send(0xA3, 1, CHAR_TIME);
+    framer.poll(now + 2 * GAP);
+
+    TEST_ASSERT_EQUAL(1, framer.count());
+    TEST_ASSERT_EQUAL(4, record(0, &bytes));
+    TEST_ASSERT_EQUAL(0xA0, bytes[0]);
+    TEST_ASSERT_EQUAL(0xA3, bytes[3]);
+}
+
+void test_full_batch_drops(void)
+{
+    for (int k = 0; k < 10; k++)
+    {
+        now += 4 * GAP;
+        send(0, 200, CHAR_TIME);
+        framer.poll(now + 2 * GAP);
+    }
+
+    TEST_ASSERT_TRUE(framer.full());
+    TEST_ASSERT_EQUAL(FRAMER_BATCH / (FRAMER_HEADER + 200), framer.count());
+    TEST_ASSERT_EQUAL_UINT32(10 - framer.count(), framer.dropped);
+}
+
+void test_discard(void)
+{
+    send(0, 5, CHAR_TIME);
+    framer.discard();
+    framer.poll(now + 2 * GAP);
+
+    TEST_ASSERT_EQUAL(0, framer.count());
+    TEST_ASSERT_EQUAL_UINT32(1, framer.dropped);
+}
+
+// Ticks wrap at 2^32, a frame across the wrap stays whole and the linger
+// time measured against oldest() is small
+void test_wraparound(void)
+{
+    const uint8_t *bytes;
+
+    now = 0xFFFFFFFFu - 3 * CHAR_TIME;
+    send(0, 6, CHAR_TIME);
+    framer.poll(now);
+
+    TEST_ASSERT_EQUAL(0, framer.count());
+
+    framer.poll(now + GAP);
+
+    TEST_ASSERT_EQUAL(1, framer.count());
+    TEST_ASSERT_EQUAL(6, record(0, &bytes));
+    TEST_ASSERT_LESS_OR_EQUAL(GAP + CHAR_TIME, now + GAP - framer.oldest());
+}
+
+// Framing cost per byte, for frames of 32 bytes
+void test_benchmark(void)
+{
+    const int rounds = 200000;
+    long bytes = 0;
+
+    clock_t start = clock();
+
+    for (int i = 0; i < rounds; i++)
+    {
+        now += 4 * GAP;
+        send(0, 32, CHAR_TIME);
+        bytes += 32;
+
+        if (framer.full())
+        {
+            framer.consume();
+        }
+    }
+
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%.1f ns per byte, %u bytes of state\n", seconds * 1e9 / bytes, (unsigned)sizeof(serialFramer));
+
+    TEST_ASSERT_EQUAL_UINT32(0, framer.dropped);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_split_on_gap);
+    RUN_TEST(test_oversized_frame_dropped);
+    RUN_TEST(test_open_frame_survives_consume);
+    RUN_TEST(test_full_batch_drops);
+    RUN_TEST(test_discard);
+    RUN_TEST(test_wraparound);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
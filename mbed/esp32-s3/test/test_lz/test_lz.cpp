@@ -0,0 +1,193 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "lz.h"
+
+const char dictionary[] = "/CMD_PING/NOT_BUSY/CMD_STATUS/IDLE/CMD_TS_QUERY/heap/rssi/END/";
+
+lzEncoder encoder;
+std::vector<uint8_t> output;
+
+void collect(const uint8_t *data, size_t length, void *ctx)
+{
+    output.insert(output.end(), data, data + length);
+}
+
+void setUp(void)
+{
+    output.clear();
+    encoder.setDictionary(NULL, 0);
+    srand(1);
+}
+
+void tearDown(void)
+{
+}
+
+void useDictionary(bool use)
+{
+    if (use)
+    {
+        encoder.setDictionary((const uint8_t *)dictionary, strlen(dictionary));
+    }
+    else
+    {
+        encoder.setDictionary(NULL, 0);
+    }
+}
+
+long decompress(std::vector<uint8_t> &out, bool use)
+{
+    return lzDecompress(output.data(), output.size(), out.data(), out.size(), use ? (const uint8_t *)dictionary : NULL,
+                        use ? strlen(dictionary) : 0);
+}
+
+// Random bytes, two letters, one letter and a repeated token, with and
+// without the dictionary
+void test_round_trip(void)
+{
+    for (int round = 0; round < 2000; round++)
+    {
+        std::string data;
+        int kind = round % 4;
+        size_t length = rand() % 3000;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            data += kind == 0 ? (char)(rand() % 256) : kind == 1 ? "ab"[rand() % 2] : kind == 2 ? 'x' : "CMD_PING/"[i % 9];
+        }
+
+        for (int use = 0; use < 2; use++)
+        {
+            useDictionary(use);
+            output.clear();
+
+            size_t size = encoder.compress((const uint8_t *)data.data(), data.size(), collect, NULL);
+            std::vector<uint8_t> decoded(data.size() + 1);
+
+            TEST_ASSERT_EQUAL(size, output.size());
+            TEST_ASSERT_EQUAL(size, encoder.compress((const uint8_t *)data.data(), data.size(), NULL, NULL));
+            TEST_ASSERT_EQUAL((long)data.size(), decompress(decoded, use));
+            TEST_ASSERT_EQUAL_MEMORY(data.data(), decoded.data(), data.size());
+        }
+    }
+}
+
+void test_header(void)
+{
+    uint8_t data[] = "CMD_PING/CMD_PING/CMD_PING";
+
+    encoder.compress(data, sizeof(data) - 1, collect, NULL);
+
+    TEST_ASSERT_EQUAL_HEX8(LZ_MAGIC, output[0]);
+    TEST_ASSERT_EQUAL_HEX8(0, output[1]);
+
+    output.clear();
+    useDictionary(true);
+    encoder.compress(data, sizeof(data) - 1, collect, NULL);
+
+    TEST_ASSERT_EQUAL_HEX8(LZ_MAGIC, output[0]);
+    TEST_ASSERT_EQUAL_HEX8(lzDictionaryId((const uint8_t *)dictionary, strlen(dictionary)), output[1]);
+    TEST_ASSERT_NOT_EQUAL(0, output[1]);
+}
+
+// The id follows the bytes, a decoder with another dictionary refuses
+void test_dictionary_mismatch(void)
+{
+    uint8_t data[] = "CMD_STATUS/IDLE/CMD_TS_QUERY/heap/END";
+    char other[sizeof(dictionary)];
+    std::vector<uint8_t> decoded(sizeof(data));
+
+    strcpy(other, dictionary);
+    other[1] = 'X';
+
+    TEST_ASSERT_NOT_EQUAL(lzDictionaryId((const uint8_t *)dictionary, strlen(dictionary)),
+                          lzDictionaryId((const uint8_t *)other, strlen(other)));
+
+    useDictionary(true);
+    encoder.compress(data, sizeof(data) - 1, collect, NULL);
+
+    TEST_ASSERT_EQUAL(sizeof(data) - 1, decompress(decoded, true));
+    TEST_ASSERT_EQUAL(-1, lzDecompress(output.data(), output.size(), decoded.data(), decoded.size(),
+                                       (const uint8_t *)other, strlen(other)));
+    TEST_ASSERT_EQUAL(-1, lzDecompress(output.data(), output.size(), decoded.data(), decoded.size(), NULL, 0));
+}
+
+void test_corrupt_stream(void)
+{
+    uint8_t data[] = "CMD_PING/CMD_PING/CMD_PING/CMD_PING";
+    std::vector<uint8_t> decoded(sizeof(data));
+
+    encoder.compress(data, sizeof(data) - 1, collect, NULL);
+
+    // Too small an output
+    TEST_ASSERT_EQUAL(-1, lzDecompress(output.data(), output.size(), decoded.data(), 10, NULL, 0));
+
+    // A match cut in half
+    TEST_ASSERT_EQUAL(-1, lzDecompress(output.data(), output.size() - 1, decoded.data(), decoded.size(), NULL, 0));
+
+    output[0] = 0;
+    TEST_ASSERT_EQUAL(-1, decompress(decoded, false));
+}
+
+// Ratio and cost on a time series chunk and a batch reply
+void test_benchmark(void)
+{
+    std::string series = "123456789012/CMD_TS_QUERY/heap/3/";
+    std::string batch = "123456789012/CMD_BATCH/5/5";
+    const int rounds = 20000;
+
+    for (int i = 0; i < 10; i++)
+    {
+        series += std::to_string(1700000000 + i * 10) + ":" + std::to_string(180000 + rand() % 500) + ";";
+    }
+
+    for (int i = 0; i < 5; i++)
+    {
+        batch += "\n" + std::to_string(i) + "/OK/CMD_GROUP/a,b,c";
+    }
+
+    const std::string *payloads[] = {&series, &batch};
+
+    for (int p = 0; p < 2; p++)
+    {
+        const std::string &data = *payloads[p];
+
+        for (int use = 0; use < 2; use++)
+        {
+            useDictionary(use);
+
+            size_t size = encoder.compress((const uint8_t *)data.data(), data.size(), NULL, NULL);
+            clock_t start = clock();
+
+            for (int i = 0; i < rounds; i++)
+            {
+                encoder.compress((const uint8_t *)data.data(), data.size(), NULL, NULL);
+            }
+
+            double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+            printf("%u bytes, dictionary %d: %u bytes (%.0f%%) in %.2f us\n", (unsigned)data.size(), use,
+                   (unsigned)size, 100.0 * size / data.size(), seconds * 1e6 / rounds);
+
+            TEST_ASSERT_LESS_THAN(data.size(), size);
+        }
+    }
+
+    printf("encoder %u bytes\n", (unsigned)sizeof(lzEncoder));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_header);
+    RUN_TEST(test_dictionary_mismatch);
+    RUN_TEST(test_corrupt_stream);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,1677 @@
+#include <unity.h>
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <PubSubClient.h>
+#include "mockClient.h"
+
+// The patched PubSubClient against a mock socket
+
+class sink : public Stream
+{
+
+public:
+    std::string data;
+
+    size_t write(uint8_t byte)
+    {
+        this->data += (char)byte;
+        return 1;
+    }
+
+    size_t write(const uint8_t *bytes, size_t length)
+    {
+        this->data.append((const char *)bytes, length);
+        return length;
+    }
+
+    int available(void)
+    {
+        return 0;
+    }
+
+    int read(void)
+    {
+        return -1;
+    }
+
+    int peek(void)
+    {
+        return -1;
+    }
+
+    void flush(void)
+    {
+    }
+};
+
+mockClient socket;
+PubSubClient client(socket);
+int messages;
+std::string lastTopic;
+std::string lastPayload;
+
+void callback(char *topic, uint8_t *payload, unsigned int length)
+{
+    messages++;
+    lastTopic = topic;
+    lastPayload.assign((const char *)payload, length);
+}
+
+uint32_t chunkTotal;
+uint32_t chunkBytes;
+int chunkResult;
+
+void chunkBegin(char *topic, uint32_t length)
+{
+    chunkTotal = length;
+    chunkBytes = 0;
+    chunkResult = -1;
+}
+
+void chunkData(uint8_t *data, unsigned int length)
+{
+    chunkBytes += length;
+}
+
+void chunkEnd(boolean complete)
+{
+    chunkResult = complete;
+}
+
+int deliveries;
+uint16_t deliveredId;
+boolean deliveredOk;
+
+void delivered(uint16_t msgId, boolean ok)
+{
+    deliveries++;
+    deliveredId = msgId;
+    deliveredOk = ok;
+}
+
+int handled;
+void *handledContext;
+MqttMessage handledMessage;
+std::string handledTopic;
+std::string handledPayload;
+
+// Copies what it needs, the message is only valid during the call
+void handleMessage(void *context, const MqttMessage &message)
+{
+    handled++;
+    handledContext = context;
+    handledMessage = message;
+    handledTopic.assign(message.topic, message.topicLength);
+    handledPayload.assign((const char *)message.payload, message.length);
+}
+
+class messageCounter
+{
+
+public:
+    int count;
+    std::string lastTopic;
+
+    messageCounter()
+    {
+        this->count = 0;
+    }
+
+    void onMessage(const MqttMessage &message)
+    {
+        this->count++;
+        this->lastTopic.assign(message.topic, message.topicLength);
+    }
+};
+
+int connects;
+int connectState;
+
+void connectDone(int state)
+{
+    connects++;
+    connectState = state;
+}
+
+int subacks;
+uint16_t subackId;
+uint8_t subackCodes[8];
+// -1 when the request expired without codes
+int subackCount;
+
+void subscribed(uint16_t msgId, uint8_t *codes, uint8_t count)
+{
+    subacks++;
+    subackId = msgId;
+    subackCount = codes != NULL ? count : -1;
+
+    if (codes != NULL)
+    {
+        memcpy(subackCodes, codes, count);
+    }
+}
+
+// Builds a PUBLISH, the packet id is only there for QoS 1
+size_t publishPacket(uint8_t *packet, const char *topic, const std::string &payload, int qos, uint16_t id)
+{
+    size_t topicLength = strlen(topic);
+    size_t remaining = 2 + topicLength + (qos > 0 ? 2 : 0) + payload.size();
+    size_t pos = 0;
+
+    packet[pos++] = 0x30 | qos << 1;
+
+    do
+    {
+        uint8_t digit = remaining & 127;
+        remaining >>= 7;
+        packet[pos++] = remaining > 0 ? digit | 0x80 : digit;
+    } while (remaining > 0);
+
+    packet[pos++] = topicLength >> 8;
+    packet[pos++] = topicLength & 0xFF;
+    memcpy(packet + pos, topic, topicLength);
+    pos += topicLength;
+
+    if (qos > 0)
+    {
+        packet[pos++] = id >> 8;
+        packet[pos++] = id & 0xFF;
+    }
+
+    memcpy(packet + pos, payload.data(), payload.size());
+
+    return pos + payload.size();
+}
+
+void feedPublish(const char *topic, const std::string &payload, int qos = 0, uint16_t id = 0)
+{
+    uint8_t packet[MOCK_BUFFER];
+
+    socket.feed(packet, publishPacket(packet, topic, payload, qos, id));
+}
+
+void connect(PubSubClient &which)
+{
+    const uint8_t connack[4] = {0x20, 2, 0, 0};
+
+    socket.reset();
+    socket.feed(connack, 4);
+
+    TEST_ASSERT_TRUE(which.connect("test"));
+
+    socket.outLength = 0;
+    socket.writes = 0;
+}
+
+void setUp(void)
+{
+    client.setServer("broker", 1883);
+    client.setCallback(callback);
+    client.setChunkCallback(NULL, NULL, NULL);
+    client.setProtocolVersion(MQTT_VERSION_3_1_1);
+    client.setCork(0);
+    client.setPublishCallback(delivered);
+    client.setRetryTimeout(MQTT_RETRY_TIMEOUT);
+    client.setSubscribeCallback(NULL);
+    client.setConnectCallback(NULL);
+    client.setMessageHandler(NULL, NULL);
+    connect(client);
+    messages = 0;
+    deliveries = 0;
+    subacks = 0;
+    connects = 0;
+    handled = 0;
+}
+
+void tearDown(void)
+{
+    client.disconnect();
+}
+
+// A packet arriving a byte per loop() is parsed once whole, publishes made
+// in between do not disturb it
+void test_partial_packet(void)
+{
+    uint8_t packet[64];
+    uint8_t payload[1] = {9};
+    size_t length = publishPacket(packet, "a/b", "hello", 1, 0x1234);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        socket.feed(packet + i, 1);
+        client.loop();
+        TEST_ASSERT_EQUAL(i + 1 == length, messages);
+        TEST_ASSERT_TRUE(client.publish("x", payload, 1));
+    }
+
+    TEST_ASSERT_EQUAL_STRING("a/b", lastTopic.c_str());
+    TEST_ASSERT_EQUAL_STRING("hello", lastPayload.c_str());
+
+    // The PUBACK went out between the last two publishes
+    const uint8_t *puback = socket.out + socket.outLength - 6 - 4;
+
+    TEST_ASSERT_EQUAL_HEX8(0x40, puback[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x12, puback[2]);
+    TEST_ASSERT_EQUAL_HEX8(0x34, puback[3]);
+}
+
+// Only the first of two packets in one read is handled per loop()
+void test_back_to_back(void)
+{
+    feedPublish("t", "1");
+    feedPublish("u", "22");
+
+    client.loop();
+    TEST_ASSERT_EQUAL(1, messages);
+
+    client.loop();
+    TEST_ASSERT_EQUAL(2, messages);
+    TEST_ASSERT_EQUAL_STRING("u", lastTopic.c_str());
+    TEST_ASSERT_EQUAL_STRING("22", lastPayload.c_str());
+}
+
+// A packet larger than the buffer is skipped, the next one is still parsed
+void test_oversized_skipped(void)
+{
+    feedPublish("big", std::string(1000, 'z'));
+    feedPublish("t", "after");
+
+    for (int i = 0; i < 5; i++)
+    {
+        client.loop();
+    }
+
+    TEST_ASSERT_EQUAL(1, messages);
+    TEST_ASSERT_EQUAL_STRING("after", lastPayload.c_str());
+    TEST_ASSERT_TRUE(client.connected());
+}
+
+// With a stream set, the payload past the buffer goes to it
+void test_oversized_streamed(void)
+{
+    sink stream;
+    PubSubClient streaming(socket);
+    std::string big(1000, 'z');
+
+    streaming.setServer("broker", 1883);
+    streaming.setCallback(callback);
+    streaming.setStream(stream);
+    connect(streaming);
+
+    feedPublish("s", big, 1, 1);
+
+    for (int i = 0; i < 5; i++)
+    {
+        streaming.loop();
+    }
+
+    TEST_ASSERT_TRUE(stream.data == big);
+    streaming.disconnect();
+}
+
+// loop() never waits for the rest of a packet, a packet that stops coming
+// closes the connection after the socket timeout
+void test_stall(void)
+{
+    const uint8_t partial[3] = {0x30, 10, 0};
+
+    socket.feed(partial, 3);
+
+    unsigned long start = millis();
+
+    client.loop();
+
+    TEST_ASSERT_EQUAL(start, millis());
+    TEST_ASSERT_TRUE(client.connected());
+
+    nativeMillis() += MQTT_SOCKET_TIMEOUT * 1000UL - 1;
+    client.loop();
+    TEST_ASSERT_TRUE(client.connected());
+
+    nativeMillis() += 2;
+    client.loop();
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+// Sends the first part of a large publish, the rest is fed by the test
+size_t feedLargeStart(uint8_t *packet, size_t payloadLength, size_t first)
+{
+    size_t length = publishPacket(packet, "dev/file", std::string(payloadLength, 'f'), 0, 0);
+
+    client.setChunkCallback(chunkBegin, chunkData, chunkEnd);
+    socket.feed(packet, first);
+    client.loop();
+
+    return length;
+}
+
+// A chunked publish that takes several keepalives to arrive keeps the
+// connection, the PINGRESP behind it is read at the end
+void test_long_chunked_transfer(void)
+{
+    static uint8_t packet[MOCK_BUFFER];
+    const uint8_t pingresp[2] = {0xD0, 0};
+    size_t length = feedLargeStart(packet, 5000, 100);
+    int pings = 0;
+
+    for (size_t pos = 100; pos < length; pos += 100)
+    {
+        size_t outLength = socket.outLength;
+
+        nativeMillis() += 5000;
+        socket.feed(packet + pos, length - pos < 100 ? length - pos : 100);
+        client.loop();
+
+        TEST_ASSERT_TRUE(client.connected());
+        pings += socket.outLength > outLength && socket.out[outLength] == 0xC0;
+    }
+
+    TEST_ASSERT_EQUAL(1, chunkResult);
+    TEST_ASSERT_EQUAL_UINT32(5000, chunkBytes);
+    TEST_ASSERT_GREATER_THAN(3, pings);
+
+    socket.feed(pingresp, 2);
+    client.loop();
+    nativeMillis() += MQTT_KEEPALIVE * 1000UL - 1;
+    client.loop();
+
+    TEST_ASSERT_TRUE(client.connected());
+}
+
+// A chunked publish that stops coming times out like any other packet
+void test_chunked_stall(void)
+{
+    static uint8_t packet[MOCK_BUFFER];
+    size_t length = feedLargeStart(packet, 5000, 1000);
+
+    TEST_ASSERT_GREATER_THAN(0, chunkBytes);
+
+    // Keepalive replies keep the socket busy but do not complete the packet
+    nativeMillis() += MQTT_SOCKET_TIMEOUT * 1000UL + 1;
+    client.loop();
+
+    TEST_ASSERT_FALSE(client.connected());
+    TEST_ASSERT_EQUAL(0, chunkResult);
+    TEST_ASSERT_LESS_THAN(length, 1000 + chunkBytes);
+}
+
+// A broker that goes quiet after a PINGREQ is still detected
+void test_ping_timeout(void)
+{
+    nativeMillis() += MQTT_KEEPALIVE * 1000UL + 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL_HEX8(0xC0, socket.out[0]);
+    TEST_ASSERT_TRUE(client.connected());
+
+    nativeMillis() += MQTT_KEEPALIVE * 1000UL + 1;
+    client.loop();
+
+    TEST_ASSERT_FALSE(client.connected());
+}
+
+// MQTT 5 connect, the CONNACK carries these properties
+void connect5(const uint8_t *properties, uint8_t length)
+{
+    uint8_t connack[64] = {0x20, (uint8_t)(3 + length), 0, 0, length};
+
+    memcpy(connack + 5, properties, length);
+    client.setProtocolVersion(MQTT_VERSION_5);
+    socket.reset();
+    socket.feed(connack, 5 + length);
+
+    TEST_ASSERT_TRUE(client.connect("test"));
+
+    socket.outLength = 0;
+    socket.writes = 0;
+}
+
+// Server Keep Alive 5, Maximum Packet Size 40 and Maximum QoS 0
+void connectLimited(void)
+{
+    const uint8_t properties[] = {0x13, 0, 5, 0x27, 0, 0, 0, 40, 0x24, 0};
+
+    connect5(properties, sizeof(properties));
+}
+
+// Topic Alias Maximum 4 and Maximum Packet Size 60
+void connectAliased(void)
+{
+    const uint8_t properties[] = {0x22, 0, 4, 0x27, 0, 0, 0, 60};
+
+    connect5(properties, sizeof(properties));
+}
+
+void test_server_keepalive(void)
+{
+    connectLimited();
+
+    nativeMillis() += 5 * 1000UL + 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL_HEX8(0xC0, socket.out[0]);
+
+    // Back to ours on a 3.1.1 connection
+    client.setProtocolVersion(MQTT_VERSION_3_1_1);
+    connect(client);
+    nativeMillis() += 5 * 1000UL + 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+}
+
+// 2 + 2 + 1 + 1 + 34 is the largest that fits
+void test_maximum_packet_size(void)
+{
+    connectLimited();
+
+    TEST_ASSERT_TRUE(client.publish("t", std::string(34, 'p').c_str()));
+    TEST_ASSERT_EQUAL(40, socket.outLength);
+
+    socket.outLength = 0;
+
+    TEST_ASSERT_FALSE(client.publish("t", std::string(35, 'p').c_str()));
+    TEST_ASSERT_FALSE(client.beginPublish("t", 35, false));
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+    TEST_ASSERT_TRUE(client.connected());
+}
+
+void test_maximum_qos(void)
+{
+    connectLimited();
+
+    TEST_ASSERT_TRUE(client.publish("t", (const uint8_t *)"p", 1, false, 1));
+    TEST_ASSERT_EQUAL_HEX8(0x30, socket.out[0]);
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+}
+
+// The first publish on a topic carries it with a new alias, later ones only
+// the alias
+void test_alias_assigned_and_reused(void)
+{
+    const uint8_t first[] = {0x30, 14, 0, 7, 'd', 'e', 'v', '/', 'a', '/', 't', 3, 0x23, 0, 1, 'x'};
+    const uint8_t again[] = {0x30, 7, 0, 0, 3, 0x23, 0, 1, 'y'};
+    const uint8_t other[] = {0x30, 14, 0, 7, 'd', 'e', 'v', '/', 'b', '/', 't', 3, 0x23, 0, 2, 'z'};
+
+    connectAliased();
+
+    TEST_ASSERT_TRUE(client.publish("dev/a/t", "x"));
+    TEST_ASSERT_EQUAL(sizeof(first), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(first, socket.out, sizeof(first));
+
+    socket.outLength = 0;
+
+    TEST_ASSERT_TRUE(client.publish("dev/a/t", "y"));
+    TEST_ASSERT_EQUAL(sizeof(again), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(again, socket.out, sizeof(again));
+
+    socket.outLength = 0;
+
+    TEST_ASSERT_TRUE(client.publish("dev/b/t", "z"));
+    TEST_ASSERT_EQUAL_MEMORY(other, socket.out, sizeof(other));
+}
+
+// A refused publish does not use up the alias, the next one still sends the
+// topic
+void test_alias_refused_packet(void)
+{
+    const uint8_t first[] = {0x30, 14, 0, 7, 'd', 'e', 'v', '/', 'a', '/', 't', 3, 0x23, 0, 1, 'x'};
+
+    connectAliased();
+
+    TEST_ASSERT_FALSE(client.publish("dev/a/t", std::string(100, 'p').c_str()));
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+
+    TEST_ASSERT_TRUE(client.publish("dev/a/t", "x"));
+    TEST_ASSERT_EQUAL(sizeof(first), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(first, socket.out, sizeof(first));
+}
+
+// The broker's aliases are remembered and resolved before the callback
+void test_alias_inbound(void)
+{
+    const uint8_t first[] = {0x30, 15, 0, 7, 'd', 'e', 'v', '/', 'c', 'm', 'd', 3, 0x23, 0, 2, 'o', 'n'};
+    const uint8_t again[] = {0x30, 9, 0, 0, 3, 0x23, 0, 2, 'o', 'f', 'f'};
+
+    connectAliased();
+
+    socket.feed(first, sizeof(first));
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, messages);
+    TEST_ASSERT_EQUAL_STRING("dev/cmd", lastTopic.c_str());
+
+    socket.feed(again, sizeof(again));
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, messages);
+    TEST_ASSERT_EQUAL_STRING("dev/cmd", lastTopic.c_str());
+    TEST_ASSERT_EQUAL_STRING("off", lastPayload.c_str());
+}
+
+// Bytes per telemetry publish with 3.1.1 and with an MQTT 5 alias
+void test_alias_savings(void)
+{
+    const char *topic = "/gtsField1/123456789012/NODE";
+    std::string payload(20, 'v');
+    size_t bytes[2];
+
+    for (int k = 0; k < 2; k++)
+    {
+        if (k)
+        {
+            const uint8_t properties[] = {0x22, 0, 4};
+
+            connect5(properties, sizeof(properties));
+        }
+
+        bytes[k] = 0;
+
+        for (int i = 0; i < 100; i++)
+        {
+            client.publish(topic, payload.c_str());
+            bytes[k] += socket.outLength;
+            socket.outLength = 0;
+        }
+    }
+
+    printf("%u B payload: %.1f bytes per publish with 3.1.1, %.1f with an alias\n", (unsigned)payload.size(),
+           bytes[0] / 100.0, bytes[1] / 100.0);
+
+    TEST_ASSERT_LESS_THAN(bytes[0] - 20 * 100, bytes[1]);
+}
+
+void puback(uint16_t msgId)
+{
+    const uint8_t ack[4] = {0x40, 2, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+
+    socket.feed(ack, 4);
+    client.loop();
+}
+
+// The PUBACK frees the slot and reports the message, an id that is not in
+// flight is ignored
+void test_puback_releases_slot(void)
+{
+    TEST_ASSERT_TRUE(client.setInflightWindow(2));
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"a", 1, false, 1));
+    uint16_t first = client.getLastMsgId();
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"b", 1, false, 1));
+    uint16_t second = client.getLastMsgId();
+
+    TEST_ASSERT_NOT_EQUAL(first, second);
+    TEST_ASSERT_EQUAL(2, client.getInflight());
+    TEST_ASSERT_FALSE(client.publish("dev/t", (const uint8_t *)"c", 1, false, 1));
+    TEST_ASSERT_FALSE(client.setInflightWindow(4));
+
+    puback(second + 1);
+
+    TEST_ASSERT_EQUAL(2, client.getInflight());
+    TEST_ASSERT_EQUAL(0, deliveries);
+
+    puback(first);
+
+    TEST_ASSERT_EQUAL(1, client.getInflight());
+    TEST_ASSERT_EQUAL(1, deliveries);
+    TEST_ASSERT_EQUAL(first, deliveredId);
+    TEST_ASSERT_TRUE(deliveredOk);
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"c", 1, false, 1));
+
+    puback(second);
+    puback(client.getLastMsgId());
+
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+    TEST_ASSERT_EQUAL(3, deliveries);
+    TEST_ASSERT_TRUE(client.setInflightWindow(MQTT_MAX_INFLIGHT));
+}
+
+// Without a PUBACK the same packet goes out again with DUP set once the
+// retry timeout has passed, and again after each further timeout
+void test_retransmit_dup(void)
+{
+    uint8_t packet[32];
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"x", 1, false, 1));
+    TEST_ASSERT_EQUAL(12, socket.outLength);
+    memcpy(packet, socket.out, socket.outLength);
+    packet[0] |= MQTTDUP;
+    socket.outLength = 0;
+
+    nativeMillis() += MQTT_RETRY_TIMEOUT * 1000UL - 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+
+    nativeMillis() += 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(12, socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(packet, socket.out, 12);
+
+    // After the keepalive's PINGREQ
+    socket.outLength = 0;
+    nativeMillis() += MQTT_RETRY_TIMEOUT * 1000UL;
+    client.loop();
+
+    TEST_ASSERT_EQUAL_MEMORY(packet, socket.out + socket.outLength - 12, 12);
+    TEST_ASSERT_EQUAL(0, deliveries);
+
+    puback(client.getLastMsgId());
+
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+}
+
+// After MQTT_MAX_RETRIES retransmissions the next timeout gives the message
+// up and reports it as not delivered
+void test_max_retries(void)
+{
+    client.setRetryTimeout(1);
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"x", 1, false, 1));
+    uint16_t msgId = client.getLastMsgId();
+
+    for (int i = 0; i < MQTT_MAX_RETRIES; i++)
+    {
+        socket.outLength = 0;
+        nativeMillis() += 1000;
+        client.loop();
+
+        TEST_ASSERT_EQUAL_HEX8(0x3A, socket.out[0]);
+        TEST_ASSERT_EQUAL(1, client.getInflight());
+    }
+
+    socket.outLength = 0;
+    nativeMillis() += 1000;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+    TEST_ASSERT_EQUAL(1, deliveries);
+    TEST_ASSERT_EQUAL(msgId, deliveredId);
+    TEST_ASSERT_FALSE(deliveredOk);
+    TEST_ASSERT_TRUE(client.connected());
+}
+
+// A message kept with an MQTT 5 property block is written as 3.1.1 when the
+// reconnect falls back, with DUP set
+void test_reencode_after_fallback(void)
+{
+    const uint8_t refused[4] = {0x20, 2, 0, MQTT_CONNECT_BAD_PROTOCOL};
+    const uint8_t accepted[4] = {0x20, 2, 0, 0};
+
+    connect5(NULL, 0);
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"x", 1, false, 1));
+    uint16_t msgId = client.getLastMsgId();
+    const uint8_t sent[] = {0x32, 11, 0, 5, 'd', 'e', 'v', '/', 't', (uint8_t)(msgId >> 8), (uint8_t)msgId, 0, 'x'};
+    const uint8_t again[] = {0x3A, 10, 0, 5, 'd', 'e', 'v', '/', 't', (uint8_t)(msgId >> 8), (uint8_t)msgId, 'x'};
+
+    TEST_ASSERT_EQUAL_MEMORY(sent, socket.out, sizeof(sent));
+
+    // The connection drops, the broker now refuses MQTT 5
+    socket.reset();
+    socket.feed(refused, 4);
+    socket.feed(accepted, 4);
+
+    TEST_ASSERT_TRUE(client.connect("test"));
+    TEST_ASSERT_EQUAL(MQTT_VERSION_3_1_1, client.getProtocolVersion());
+    TEST_ASSERT_EQUAL(1, client.getInflight());
+    TEST_ASSERT_EQUAL_MEMORY(again, socket.out + socket.outLength - sizeof(again), sizeof(again));
+
+    puback(msgId);
+
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+    TEST_ASSERT_TRUE(deliveredOk);
+}
+
+// An MQTT 5 PUBACK with a reason code of 0x80 and above reports the message
+// as not delivered, it is not sent again
+void test_delivery_callback(void)
+{
+    connect5(NULL, 0);
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"x", 1, false, 1));
+    puback(client.getLastMsgId());
+
+    TEST_ASSERT_EQUAL(1, deliveries);
+    TEST_ASSERT_TRUE(deliveredOk);
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", (const uint8_t *)"y", 1, false, 1));
+    uint16_t msgId = client.getLastMsgId();
+    const uint8_t refused[5] = {0x40, 3, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF), 0x87};
+
+    socket.feed(refused, 5);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, deliveries);
+    TEST_ASSERT_EQUAL(msgId, deliveredId);
+    TEST_ASSERT_FALSE(deliveredOk);
+    TEST_ASSERT_EQUAL(0, client.getInflight());
+
+    // QoS 0 is never reported
+    TEST_ASSERT_TRUE(client.publish("dev/t", "z"));
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, deliveries);
+}
+
+// Every filter in one SUBSCRIBE, each followed by its QoS. UNSUBSCRIBE has
+// no QoS bytes and MQTT 5 adds an empty property block
+void test_subscribe_topics(void)
+{
+    const char *topics[] = {"a/b", "c/#"};
+    const uint8_t qos[] = {0, 1};
+    const uint8_t refused[] = {0, 2};
+
+    uint16_t msgId = client.subscribe(topics, qos, 2);
+    const uint8_t subscribe[] = {0x82, 14, (uint8_t)(msgId >> 8), (uint8_t)msgId,
+                                 0, 3, 'a', '/', 'b', 0, 0, 3, 'c', '/', '#', 1};
+
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_EQUAL(sizeof(subscribe), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(subscribe, socket.out, sizeof(subscribe));
+
+    socket.outLength = 0;
+    msgId = client.unsubscribe(topics, 2);
+    const uint8_t unsubscribe[] = {0xA2, 12, (uint8_t)(msgId >> 8), (uint8_t)msgId,
+                                   0, 3, 'a', '/', 'b', 0, 3, 'c', '/', '#'};
+
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+    TEST_ASSERT_EQUAL(sizeof(unsubscribe), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(unsubscribe, socket.out, sizeof(unsubscribe));
+
+    // QoS 2 is not supported, nothing is sent
+    socket.outLength = 0;
+
+    TEST_ASSERT_EQUAL(0, client.subscribe(topics, refused, 2));
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+
+    connect5(NULL, 0);
+    msgId = client.subscribe(topics, qos, 2);
+    const uint8_t subscribe5[] = {0x82, 15, (uint8_t)(msgId >> 8), (uint8_t)msgId, 0,
+                                  0, 3, 'a', '/', 'b', 0, 0, 3, 'c', '/', '#', 1};
+
+    TEST_ASSERT_EQUAL(sizeof(subscribe5), socket.outLength);
+    TEST_ASSERT_EQUAL_MEMORY(subscribe5, socket.out, sizeof(subscribe5));
+}
+
+// The SUBACK settles the request with its packet id, whatever the order.
+// Unknown ids and an UNSUBACK for a SUBSCRIBE are ignored
+void test_suback_matched_by_id(void)
+{
+    const char *topic = "a/b";
+    const uint8_t qos = 1;
+
+    client.setSubscribeCallback(subscribed);
+
+    uint16_t first = client.subscribe(&topic, &qos, 1);
+    uint16_t second = client.subscribe(&topic, &qos, 1);
+    const uint8_t ackSecond[5] = {0x90, 3, (uint8_t)(second >> 8), (uint8_t)second, 1};
+    const uint8_t unsuback[4] = {0xB0, 2, (uint8_t)(first >> 8), (uint8_t)first};
+    const uint8_t ackFirst[5] = {0x90, 3, (uint8_t)(first >> 8), (uint8_t)first, 0};
+
+    TEST_ASSERT_NOT_EQUAL(first, second);
+
+    socket.feed(ackSecond, 5);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+    TEST_ASSERT_EQUAL(second, subackId);
+    TEST_ASSERT_EQUAL(1, subackCount);
+    TEST_ASSERT_EQUAL(1, subackCodes[0]);
+
+    // Already settled
+    socket.feed(ackSecond, 5);
+    client.loop();
+    socket.feed(unsuback, 4);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+
+    socket.feed(ackFirst, 5);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, subacks);
+    TEST_ASSERT_EQUAL(first, subackId);
+    TEST_ASSERT_EQUAL(0, subackCodes[0]);
+}
+
+// A code per filter in the order sent, 0x80 and above for a refused one.
+// With MQTT 5 the codes follow the properties
+void test_suback_failure_codes(void)
+{
+    const char *topics[] = {"a/b", "$SYS/#"};
+    const uint8_t qos[] = {1, 1};
+
+    client.setSubscribeCallback(subscribed);
+
+    uint16_t msgId = client.subscribe(topics, qos, 2);
+    const uint8_t suback[6] = {0x90, 4, (uint8_t)(msgId >> 8), (uint8_t)msgId, 1, 0x80};
+
+    socket.feed(suback, 6);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+    TEST_ASSERT_EQUAL(2, subackCount);
+    TEST_ASSERT_EQUAL_HEX8(1, subackCodes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x80, subackCodes[1]);
+
+    connect5(NULL, 0);
+    msgId = client.subscribe(topics, qos, 2);
+    const uint8_t suback5[7] = {0x90, 5, (uint8_t)(msgId >> 8), (uint8_t)msgId, 0, 0, 0x87};
+
+    socket.feed(suback5, 7);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, subacks);
+    TEST_ASSERT_EQUAL(msgId, subackId);
+    TEST_ASSERT_EQUAL(2, subackCount);
+    TEST_ASSERT_EQUAL_HEX8(0, subackCodes[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x87, subackCodes[1]);
+}
+
+// With a subscribe callback at most MQTT_MAX_PENDING requests wait for their
+// acknowledgement, the next one is refused until one settles
+void test_max_pending(void)
+{
+    const char *topic = "a/b";
+    const uint8_t qos = 0;
+    uint16_t ids[MQTT_MAX_PENDING];
+
+    client.setSubscribeCallback(subscribed);
+
+    for (int i = 0; i < MQTT_MAX_PENDING; i++)
+    {
+        ids[i] = client.subscribe(&topic, &qos, 1);
+        TEST_ASSERT_NOT_EQUAL(0, ids[i]);
+    }
+
+    socket.outLength = 0;
+
+    TEST_ASSERT_EQUAL(0, client.subscribe(&topic, &qos, 1));
+    TEST_ASSERT_EQUAL(0, client.unsubscribe(&topic, 1));
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+
+    const uint8_t suback[5] = {0x90, 3, (uint8_t)(ids[0] >> 8), (uint8_t)ids[0], 0};
+
+    socket.feed(suback, 5);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+
+    uint16_t msgId = client.subscribe(&topic, &qos, 1);
+
+    TEST_ASSERT_NOT_EQUAL(0, msgId);
+
+    // Ids still waiting are not reused
+    for (int i = 1; i < MQTT_MAX_PENDING; i++)
+    {
+        TEST_ASSERT_NOT_EQUAL(ids[i], msgId);
+    }
+
+    // Nothing is tracked without a callback
+    client.setSubscribeCallback(NULL);
+
+    TEST_ASSERT_NOT_EQUAL(0, client.subscribe(&topic, &qos, 1));
+}
+
+// Requests without an acknowledgement within the socket timeout are reported
+// with no codes, a late SUBACK is then ignored
+void test_pending_expired(void)
+{
+    const char *topic = "a/b";
+    const uint8_t qos = 0;
+
+    client.setSubscribeCallback(subscribed);
+
+    uint16_t msgId = client.subscribe(&topic, &qos, 1);
+    const uint8_t suback[5] = {0x90, 3, (uint8_t)(msgId >> 8), (uint8_t)msgId, 0};
+
+    nativeMillis() += MQTT_SOCKET_TIMEOUT * 1000UL - 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(0, subacks);
+
+    nativeMillis() += 1;
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+    TEST_ASSERT_EQUAL(msgId, subackId);
+    TEST_ASSERT_EQUAL(-1, subackCount);
+
+    socket.feed(suback, 5);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, subacks);
+
+    // And when the connection is lost
+    client.subscribe(&topic, &qos, 1);
+    connect(client);
+
+    TEST_ASSERT_EQUAL(2, subacks);
+    TEST_ASSERT_EQUAL(-1, subackCount);
+}
+
+// Starts a connectAsync() on a fresh socket, the CONNECT is sent at once
+void connectAsync(void)
+{
+    client.disconnect();
+    socket.reset();
+    client.setConnectCallback(connectDone);
+
+    TEST_ASSERT_TRUE(client.connectAsync("test"));
+    TEST_ASSERT_EQUAL(MQTT_CONNECTING, client.state());
+    TEST_ASSERT_EQUAL_HEX8(0x10, socket.out[0]);
+}
+
+// A CONNACK arriving a byte per loop() leaves the client connecting until it
+// is whole, then the callback gets MQTT_CONNECTED once
+void test_connect_async_partial(void)
+{
+    const uint8_t connack[4] = {0x20, 2, 0, 0};
+
+    connectAsync();
+
+    size_t sent = socket.outLength;
+
+    for (int i = 0; i < 3; i++)
+    {
+        socket.feed(connack + i, 1);
+
+        TEST_ASSERT_FALSE(client.loop());
+        TEST_ASSERT_EQUAL(MQTT_CONNECTING, client.state());
+    }
+
+    // Already under way, nothing is sent again
+    TEST_ASSERT_TRUE(client.connectAsync("test"));
+    TEST_ASSERT_EQUAL(sent, socket.outLength);
+    TEST_ASSERT_EQUAL(0, connects);
+
+    socket.feed(connack + 3, 1);
+
+    TEST_ASSERT_TRUE(client.loop());
+    TEST_ASSERT_EQUAL(MQTT_CONNECTED, client.state());
+    TEST_ASSERT_EQUAL(1, connects);
+    TEST_ASSERT_EQUAL(MQTT_CONNECTED, connectState);
+
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, connects);
+    TEST_ASSERT_TRUE(client.publish("dev/t", "x"));
+}
+
+// A refused CONNACK is reported with its return code
+void test_connect_async_refused(void)
+{
+    const uint8_t refused[4] = {0x20, 2, 0, MQTT_CONNECT_BAD_CREDENTIALS};
+
+    connectAsync();
+    socket.feed(refused, 4);
+
+    TEST_ASSERT_FALSE(client.loop());
+    TEST_ASSERT_EQUAL(1, connects);
+    TEST_ASSERT_EQUAL(MQTT_CONNECT_BAD_CREDENTIALS, connectState);
+    TEST_ASSERT_FALSE(socket.connected());
+}
+
+// No CONNACK within the socket timeout closes the connection
+void test_connect_async_timeout(void)
+{
+    connectAsync();
+
+    nativeMillis() += MQTT_SOCKET_TIMEOUT * 1000UL - 1;
+
+    TEST_ASSERT_FALSE(client.loop());
+    TEST_ASSERT_EQUAL(MQTT_CONNECTING, client.state());
+    TEST_ASSERT_EQUAL(0, connects);
+
+    nativeMillis() += 1;
+
+    TEST_ASSERT_FALSE(client.loop());
+    TEST_ASSERT_EQUAL(MQTT_CONNECTION_TIMEOUT, client.state());
+    TEST_ASSERT_EQUAL(1, connects);
+    TEST_ASSERT_EQUAL(MQTT_CONNECTION_TIMEOUT, connectState);
+    TEST_ASSERT_FALSE(socket.connected());
+}
+
+// An MQTT 5 CONNECT refused as an unsupported version: the next attempt is
+// a 3.1.1 CONNECT, protocol level 4 instead of 5
+void test_connect_async_fallback(void)
+{
+    const uint8_t refused[5] = {0x20, 3, 0, MQTT_REASON_UNSUPPORTED_VERSION, 0};
+    const uint8_t accepted[4] = {0x20, 2, 0, 0};
+
+    client.setProtocolVersion(MQTT_VERSION_5);
+    connectAsync();
+
+    TEST_ASSERT_EQUAL(MQTT_VERSION_5, socket.out[8]);
+
+    socket.feed(refused, 5);
+
+    TEST_ASSERT_FALSE(client.loop());
+    TEST_ASSERT_EQUAL(1, connects);
+    TEST_ASSERT_EQUAL(MQTT_REASON_UNSUPPORTED_VERSION, connectState);
+    TEST_ASSERT_EQUAL(MQTT_VERSION_3_1_1, client.getProtocolVersion());
+
+    socket.reset();
+
+    TEST_ASSERT_TRUE(client.connectAsync("test"));
+    TEST_ASSERT_EQUAL(MQTT_VERSION_3_1_1, socket.out[8]);
+
+    socket.feed(accepted, 4);
+
+    TEST_ASSERT_TRUE(client.loop());
+    TEST_ASSERT_EQUAL(2, connects);
+    TEST_ASSERT_EQUAL(MQTT_CONNECTED, connectState);
+}
+
+// The handler gets the message where it sits in the receive buffer, with its
+// flags and packet id, and the old callback is not called
+void test_message_handler_fields(void)
+{
+    uint8_t packet[64];
+    int context;
+
+    client.setMessageHandler(handleMessage, &context);
+
+    feedPublish("dev/t", "hello");
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, handled);
+    TEST_ASSERT_TRUE(handledContext == &context);
+    TEST_ASSERT_EQUAL(5, handledMessage.topicLength);
+    TEST_ASSERT_EQUAL_STRING("dev/t", handledTopic.c_str());
+    TEST_ASSERT_EQUAL(5, handledMessage.length);
+    TEST_ASSERT_EQUAL_STRING("hello", handledPayload.c_str());
+    TEST_ASSERT_EQUAL(0, handledMessage.qos);
+    TEST_ASSERT_FALSE(handledMessage.retain);
+    TEST_ASSERT_FALSE(handledMessage.dup);
+    TEST_ASSERT_EQUAL(0, handledMessage.msgId);
+    TEST_ASSERT_EQUAL(0, messages);
+
+    // A retained QoS 1 message sent again
+    size_t length = publishPacket(packet, "dev/u", "again", 1, 0x1234);
+    const uint8_t ack[4] = {0x40, 2, 0x12, 0x34};
+
+    packet[0] |= MQTTDUP | 1;
+    socket.feed(packet, length);
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, handled);
+    TEST_ASSERT_EQUAL_STRING("dev/u", handledTopic.c_str());
+    TEST_ASSERT_EQUAL_STRING("again", handledPayload.c_str());
+    TEST_ASSERT_EQUAL(1, handledMessage.qos);
+    TEST_ASSERT_TRUE(handledMessage.retain);
+    TEST_ASSERT_TRUE(handledMessage.dup);
+    TEST_ASSERT_EQUAL(0x1234, handledMessage.msgId);
+    TEST_ASSERT_EQUAL_MEMORY(ack, socket.out, 4);
+
+    // The topic is not NUL terminated, the packet id follows it
+    TEST_ASSERT_EQUAL_HEX8(0x12, handledMessage.topic[5]);
+
+    TEST_ASSERT_EQUAL(0, messages);
+}
+
+// setMessageHandler<T, &T::method>(object) calls the member on that object
+void test_message_handler_member(void)
+{
+    messageCounter first;
+    messageCounter second;
+
+    client.setMessageHandler<messageCounter, &messageCounter::onMessage>(&first);
+
+    feedPublish("dev/a", "1");
+    client.loop();
+    feedPublish("dev/b", "2");
+    client.loop();
+
+    client.setMessageHandler<messageCounter, &messageCounter::onMessage>(&second);
+
+    feedPublish("dev/c", "3");
+    client.loop();
+
+    TEST_ASSERT_EQUAL(2, first.count);
+    TEST_ASSERT_EQUAL_STRING("dev/b", first.lastTopic.c_str());
+    TEST_ASSERT_EQUAL(1, second.count);
+    TEST_ASSERT_EQUAL_STRING("dev/c", second.lastTopic.c_str());
+    TEST_ASSERT_EQUAL(0, messages);
+
+    // Without a handler the callback gets messages again
+    client.setMessageHandler(NULL, NULL);
+
+    feedPublish("dev/d", "4");
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, messages);
+    TEST_ASSERT_EQUAL_STRING("dev/d", lastTopic.c_str());
+}
+
+// Delivered messages per second over a link with a 50 ms round trip, the
+// broker acknowledging each one after a full round trip. A window of 1 is
+// stop-and-wait
+void test_window_benchmark(void)
+{
+    const unsigned long rtt = 50;
+    const unsigned long duration = 10000;
+    uint8_t windows[] = {1, 2, 4, 8};
+    double rates[4];
+    int total = 0;
+    std::string payload(40, 'x');
+
+    socket.discard = true;
+
+    for (size_t k = 0; k < sizeof(windows) / sizeof(windows[0]); k++)
+    {
+        uint16_t ids[MQTT_MAX_INFLIGHT];
+        unsigned long sentAt[MQTT_MAX_INFLIGHT];
+        int head = 0;
+        int count = 0;
+        int acknowledged = 0;
+
+        TEST_ASSERT_TRUE(client.setInflightWindow(windows[k]));
+
+        unsigned long start = millis();
+
+        while (millis() - start < duration)
+        {
+            while (client.publish("dev/1234/data", (const uint8_t *)payload.data(), payload.size(), false, 1))
+            {
+                int slot = (head + count++) % MQTT_MAX_INFLIGHT;
+
+                ids[slot] = client.getLastMsgId();
+                sentAt[slot] = millis();
+            }
+
+            nativeMillis() += 1;
+
+            while (count > 0 && millis() - sentAt[head] >= rtt)
+            {
+                puback(ids[head]);
+                head = (head + 1) % MQTT_MAX_INFLIGHT;
+                count--;
+                acknowledged++;
+            }
+        }
+
+        total += acknowledged + count;
+
+        while (count > 0)
+        {
+            puback(ids[head]);
+            head = (head + 1) % MQTT_MAX_INFLIGHT;
+            count--;
+        }
+
+        rates[k] = acknowledged * 1000.0 / duration;
+
+        printf("window %u: %5.0f messages/s over a %lu ms round trip\n", windows[k], rates[k], rtt);
+
+        TEST_ASSERT_EQUAL(0, client.getInflight());
+    }
+
+    TEST_ASSERT_EQUAL(total, deliveries);
+    TEST_ASSERT_GREATER_THAN(rates[0] * 6, rates[3]);
+    TEST_ASSERT_TRUE(client.setInflightWindow(MQTT_MAX_INFLIGHT));
+}
+
+// Parsing throughput with 200 byte publishes, and the socket calls each
+// packet costs
+void test_parse_benchmark(void)
+{
+    uint8_t packet[256];
+    size_t length = publishPacket(packet, "dev/cmd", std::string(200, 'p'), 0, 0);
+    const int burst = MOCK_BUFFER / length;
+    int fed = 0;
+    double seconds = 0;
+
+    socket.reads = 0;
+    socket.availables = 0;
+
+    while (fed < 20000)
+    {
+        for (int k = 0; k < burst; k++, fed++)
+        {
+            socket.feed(packet, length);
+        }
+
+        clock_t start = clock();
+
+        while (socket.inPos < socket.inLength)
+        {
+            client.loop();
+        }
+
+        seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+    }
+
+    printf("%d packets, %.0f MB/s, %.2f reads and %.2f available calls per packet\n", messages,
+           messages * length / seconds / 1e6, (double)socket.reads / messages, (double)socket.availables / messages);
+
+    TEST_ASSERT_EQUAL(fed, messages);
+}
+
+// Builds what a publish of payload to topic at QoS 0 has to put on the wire
+std::string expectedPublish(const char *topic, const std::string &payload)
+{
+    uint8_t packet[MOCK_BUFFER];
+
+    return std::string((const char *)packet, publishPacket(packet, topic, payload, 0, 0));
+}
+
+// A packet that fits the buffer is copied and written once
+void test_small_publish_one_write(void)
+{
+    std::string payload(32, 'x');
+
+    TEST_ASSERT_TRUE(client.publish("dev/data", (const uint8_t *)payload.data(), payload.size()));
+    TEST_ASSERT_EQUAL(1, socket.writes);
+    TEST_ASSERT_TRUE(std::string((const char *)socket.out, socket.outLength) == expectedPublish("dev/data", payload));
+}
+
+// Larger than the buffer: the header, then the payload from the caller's
+// memory
+void test_large_publish_gathered(void)
+{
+    std::string payload(4000, 'y');
+
+    payload[0] = 'a';
+    payload[3999] = 'b';
+
+    TEST_ASSERT_LESS_THAN(payload.size(), client.getBufferSize());
+    TEST_ASSERT_TRUE(client.publish("dev/data", (const uint8_t *)payload.data(), payload.size()));
+    TEST_ASSERT_EQUAL(2, socket.writes);
+    TEST_ASSERT_TRUE(std::string((const char *)socket.out, socket.outLength) == expectedPublish("dev/data", payload));
+}
+
+void test_segments(void)
+{
+    std::string head = "0123";
+    std::string body(2000, 'z');
+    MqttSegment segments[2] = {{(const uint8_t *)head.data(), head.size()}, {(const uint8_t *)body.data(), body.size()}};
+
+    TEST_ASSERT_TRUE(client.publish("dev/serial", segments, 2, false));
+    TEST_ASSERT_EQUAL(3, socket.writes);
+    TEST_ASSERT_TRUE(std::string((const char *)socket.out, socket.outLength) == expectedPublish("dev/serial", head + body));
+
+    // Small enough to be copied together
+    socket.outLength = 0;
+    socket.writes = 0;
+    segments[1].length = 10;
+
+    TEST_ASSERT_TRUE(client.publish("dev/serial", segments, 2, false));
+    TEST_ASSERT_EQUAL(1, socket.writes);
+    TEST_ASSERT_TRUE(std::string((const char *)socket.out, socket.outLength) ==
+                     expectedPublish("dev/serial", head + body.substr(0, 10)));
+}
+
+// Cost per publish and writes per message for small and large payloads
+void test_publish_benchmark(void)
+{
+    size_t sizes[] = {32, 200, 4096, 65536};
+
+    socket.discard = true;
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+    {
+        std::string payload(sizes[k], 'x');
+        int rounds = sizes[k] > 1000 ? 20000 : 200000;
+        int sent = 0;
+
+        socket.writes = 0;
+
+        clock_t start = clock();
+
+        for (int i = 0; i < rounds; i++)
+        {
+            sent += client.publish("dev/1234/data", (const uint8_t *)payload.data(), payload.size());
+        }
+
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        printf("%6u B: %6.0f ns per publish, %.1f writes\n", (unsigned)sizes[k], seconds * 1e9 / rounds,
+               (double)socket.writes / rounds);
+
+        TEST_ASSERT_EQUAL(rounds, sent);
+    }
+}
+
+// Calls found for each PUBLISH in out, with the topic and payload, and
+// empties it
+template <typename F>
+int takePublishes(F found)
+{
+    size_t pos = 0;
+    int count = 0;
+
+    while (pos < socket.outLength)
+    {
+        uint8_t header = socket.out[pos++];
+        uint32_t length = 0;
+        int shift = 0;
+        uint8_t digit;
+
+        do
+        {
+            digit = socket.out[pos++];
+            length |= (uint32_t)(digit & 127) << shift;
+            shift += 7;
+        } while (digit & 128);
+
+        if ((header & 0xF0) == 0x30)
+        {
+            uint16_t topicLength = socket.out[pos] << 8 | socket.out[pos + 1];
+            std::string topic((const char *)socket.out + pos + 2, topicLength);
+            std::string payload((const char *)socket.out + pos + 2 + topicLength, length - 2 - topicLength);
+
+            found(topic, payload);
+            count++;
+        }
+
+        pos += length;
+    }
+
+    socket.outLength = 0;
+
+    return count;
+}
+
+// What other tasks queue goes out from loop(), packed into one write
+void test_queue_packed(void)
+{
+    std::string payloads;
+
+    for (int i = 0; i < MQTT_QUEUE_SLOTS; i++)
+    {
+        char payload[8];
+        int length = snprintf(payload, sizeof(payload), "m%d", i);
+
+        TEST_ASSERT_TRUE(client.enqueue("dev/q", (const uint8_t *)payload, length, false));
+    }
+
+    TEST_ASSERT_FALSE(client.enqueue("dev/q", (const uint8_t *)"x", 1, false));
+    TEST_ASSERT_FALSE(client.enqueue("dev/q", (const uint8_t *)std::string(MQTT_QUEUE_SLOT_SIZE, 'x').data(),
+                                     MQTT_QUEUE_SLOT_SIZE, false));
+
+    client.loop();
+
+    TEST_ASSERT_EQUAL(1, socket.writes);
+    TEST_ASSERT_EQUAL(MQTT_QUEUE_SLOTS, takePublishes([&](const std::string &topic, const std::string &payload)
+                                                      { payloads += payload; }));
+    TEST_ASSERT_EQUAL_STRING("m0m1m2m3m4m5m6m7", payloads.c_str());
+}
+
+// A failed write keeps the messages queued for the next loop(), corked too:
+// there a slot is not freed when its message only reached the cork buffer
+void test_queue_kept_on_failure(void)
+{
+    uint16_t corks[] = {0, 1460};
+
+    for (int k = 0; k < 2; k++)
+    {
+        connect(client);
+        client.setCork(corks[k]);
+
+        for (int i = 0; i < 3; i++)
+        {
+            TEST_ASSERT_TRUE(client.enqueue("dev/q", (const uint8_t *)"m", 1, false));
+        }
+
+        socket.writeLimit = 0;
+        client.loop();
+
+        TEST_ASSERT_EQUAL(0, socket.outLength);
+
+        // The three still hold their slots
+        for (int i = 3; i < MQTT_QUEUE_SLOTS; i++)
+        {
+            TEST_ASSERT_TRUE(client.enqueue("dev/q", (const uint8_t *)"m", 1, false));
+        }
+
+        TEST_ASSERT_FALSE(client.enqueue("dev/q", (const uint8_t *)"m", 1, false));
+
+        socket.writeLimit = -1;
+        client.loop();
+
+        TEST_ASSERT_EQUAL(MQTT_QUEUE_SLOTS,
+                          takePublishes([](const std::string &topic, const std::string &payload) {}));
+    }
+}
+
+// Producers on four threads against loop() on this one: nothing lost or
+// reordered per producer, and the rate and packing that gives
+void test_queue_producers(void)
+{
+    const int producers = 4;
+    const uint32_t count = 20000;
+    std::atomic<int> done(0);
+    std::atomic<long> full(0);
+    uint32_t next[producers] = {0, 0, 0, 0};
+    long received = 0;
+    bool ordered = true;
+    std::thread threads[producers];
+
+    socket.writes = 0;
+
+    // Wall time, clock() would add up the threads
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    for (int p = 0; p < producers; p++)
+    {
+        threads[p] = std::thread([&, p]()
+                                 {
+                                     char topic[8];
+
+                                     snprintf(topic, sizeof(topic), "p/%d", p);
+
+                                     for (uint32_t i = 0; i < count;)
+                                     {
+                                         if (client.enqueue(topic, (const uint8_t *)&i, 4, false))
+                                         {
+                                             i++;
+                                         }
+                                         else
+                                         {
+                                             full++;
+                                             std::this_thread::yield();
+                                         }
+                                     }
+
+                                     done++; });
+    }
+
+    auto check = [&](const std::string &topic, const std::string &payload)
+    {
+        uint32_t value;
+        int p = topic[2] - '0';
+
+        memcpy(&value, payload.data(), 4);
+        ordered = ordered && value == next[p];
+        next[p]++;
+    };
+
+    while (done < producers || received < (long)producers * count)
+    {
+        client.loop();
+        received += takePublishes(check);
+        std::this_thread::yield();
+    }
+
+    for (int p = 0; p < producers; p++)
+    {
+        threads[p].join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d producers: %.2f M messages/s, %.1f messages per write, %ld retries on a full queue\n", producers,
+           producers * count / seconds / 1e6, (double)received / socket.writes, (long)full);
+
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL(producers * count, received);
+}
+
+// Corked, a pass of loop() with its publishes and acknowledgements goes out
+// in one write, and the bytes are the same
+void test_cork(void)
+{
+    std::string sent[2];
+    int writes[2];
+
+    for (int k = 0; k < 2; k++)
+    {
+        connect(client);
+        client.setCork(k ? 1460 : 0);
+
+        for (int i = 0; i < 8; i++)
+        {
+            client.publish("dev/t", std::string(40, 's').c_str());
+        }
+
+        TEST_ASSERT_EQUAL(k ? 0 : 8, socket.writes);
+
+        feedPublish("dev/cmd", "ping", 1, 100);
+        client.loop();
+
+        writes[k] = socket.writes;
+        sent[k].assign((const char *)socket.out, socket.outLength);
+    }
+
+    TEST_ASSERT_EQUAL(2, messages);
+    TEST_ASSERT_EQUAL(9, writes[0]);
+    TEST_ASSERT_EQUAL(1, writes[1]);
+    TEST_ASSERT_TRUE(sent[0] == sent[1]);
+
+    // flush() sends a publish that must not wait for the end of the pass
+    client.publish("dev/t", "now");
+    client.flush();
+
+    TEST_ASSERT_EQUAL(2, socket.writes);
+}
+
+// A cork write that fails drops the connection instead of going on after a
+// cut packet, the QoS 1 publish in it goes again after the reconnect
+void test_cork_write_failure(void)
+{
+    const uint8_t connack[4] = {0x20, 2, 0, 0};
+
+    client.setCork(1460);
+
+    TEST_ASSERT_TRUE(client.publish("dev/t", "a"));
+    TEST_ASSERT_TRUE(client.publish("dev/q", (const uint8_t *)"b", 1, false, 1));
+    TEST_ASSERT_EQUAL(0, socket.outLength);
+
+    socket.writeLimit = 3;
+    client.flush();
+
+    TEST_ASSERT_FALSE(client.connected());
+    TEST_ASSERT_EQUAL(MQTT_CONNECTION_LOST, client.state());
+
+    socket.reset();
+    socket.feed(connack, 4);
+
+    TEST_ASSERT_TRUE(client.connect("test"));
+
+    client.loop();
+
+    // CONNECT, then the publish again with DUP set
+    size_t connect = 2 + socket.out[1];
+
+    TEST_ASSERT_EQUAL_HEX8(0x10, socket.out[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x3A, socket.out[connect]);
+    TEST_ASSERT_EQUAL(1, client.getInflight());
+}
+
+// Writes and cost per message with 8 publishes and one PUBACK per loop(),
+// uncorked and corked
+void test_cork_benchmark(void)
+{
+    uint16_t sizes[] = {0, 512, 1460};
+    std::string payload(40, 'x');
+    uint8_t packet[64];
+    size_t length = publishPacket(packet, "dev/cmd", "ping", 1, 1);
+    const int rounds = 200000;
+
+    socket.discard = true;
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+    {
+        int sent = 0;
+
+        client.setCork(sizes[k]);
+        socket.writes = 0;
+
+        clock_t start = clock();
+
+        for (int i = 0; i < rounds; i++)
+        {
+            sent += client.publish("dev/1234/data", (const uint8_t *)payload.data(), payload.size());
+
+            if (i % 8 == 7)
+            {
+                socket.feed(packet, length);
+                client.loop();
+            }
+        }
+
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        printf("cork %4u: %5.0f ns per publish, %.3f writes\n", sizes[k], seconds * 1e9 / rounds,
+               (double)socket.writes / rounds);
+
+        TEST_ASSERT_EQUAL(rounds, sent);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_partial_packet);
+    RUN_TEST(test_back_to_back);
+    RUN_TEST(test_oversized_skipped);
+    RUN_TEST(test_oversized_streamed);
+    RUN_TEST(test_stall);
+    RUN_TEST(test_long_chunked_transfer);
+    RUN_TEST(test_chunked_stall);
+    RUN_TEST(test_ping_timeout);
+    RUN_TEST(test_server_keepalive);
+    RUN_TEST(test_maximum_packet_size);
+    RUN_TEST(test_maximum_qos);
+    RUN_TEST(test_alias_assigned_and_reused);
+    RUN_TEST(test_alias_refused_packet);
+    RUN_TEST(test_alias_inbound);
+    RUN_TEST(test_alias_savings);
+    RUN_TEST(test_puback_releases_slot);
+    RUN_TEST(test_retransmit_dup);
+    RUN_TEST(test_max_retries);
+    RUN_TEST(test_reencode_after_fallback);
+    RUN_TEST(test_delivery_callback);
+    RUN_TEST(test_subscribe_topics);
+    RUN_TEST(test_suback_matched_by_id);
+    RUN_TEST(test_suback_failure_codes);
+    RUN_TEST(test_max_pending);
+    RUN_TEST(test_pending_expired);
+    RUN_TEST(test_connect_async_partial);
+    RUN_TEST(test_connect_async_refused);
+    RUN_TEST(test_connect_async_timeout);
+    RUN_TEST(test_connect_async_fallback);
+    RUN_TEST(test_message_handler_fields);
+    RUN_TEST(test_message_handler_member);
+    RUN_TEST(test_window_benchmark);
+    RUN_TEST(test_parse_benchmark);
+    RUN_TEST(test_small_publish_one_write);
+    RUN_TEST(test_large_publish_gathered);
+    RUN_TEST(test_segments);
+    RUN_TEST(test_publish_benchmark);
+    RUN_TEST(test_queue_packed);
+    RUN_TEST(test_queue_kept_on_failure);
+    RUN_TEST(test_queue_producers);
+    RUN_TEST(test_cork);
+    RUN_TEST(test_cork_write_failure);
+    RUN_TEST(test_cork_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,243 @@
+#include <unity.h>
+#include <stdio.h>
+#include <time.h>
+#include "rules.h"
+
+const char *const names[] = {"heap", "rssi", "uptime", "busy", "sample"};
+
+// Same set as the default RULE_OUTPUT_PINS in automation.h
+const uint64_t outputs = 0x7FF80ULL | 1ULL << 21 | 0x1FULL << 38 | 3ULL << 47;
+
+ruleSet *rules;
+int fired;
+int lastId;
+
+void fire(const rule &which, void *ctx)
+{
+    fired++;
+    lastId = which.id;
+}
+
+void setUp(void)
+{
+    static ruleSet set;
+
+    set = ruleSet();
+    set.setVariables(names, 5);
+    set.setOutputs(outputs);
+    rules = &set;
+    fired = 0;
+    lastId = -1;
+}
+
+void tearDown(void)
+{
+}
+
+const rule *find(int id)
+{
+    for (int i = 0; i < RULE_MAX; i++)
+    {
+        if (rules->rules[i].used && rules->rules[i].id == id)
+        {
+            return &rules->rules[i];
+        }
+    }
+
+    return NULL;
+}
+
+float result(const char *condition)
+{
+    char source[RULE_SOURCE_LENGTH];
+    float variables[5] = {50000, -80, 10, 0, 3};
+
+    snprintf(source, sizeof(source), "%s -> publish", condition);
+
+    TEST_ASSERT_TRUE_MESSAGE(rules->compile(0, source), condition);
+
+    return ruleSet::run(find(0)->code, variables);
+}
+
+void test_expressions(void)
+{
+    TEST_ASSERT_EQUAL_FLOAT(0, result("heap < 40000"));
+    TEST_ASSERT_EQUAL_FLOAT(1, result("rssi < -70 - 5 && busy == 0"));
+    TEST_ASSERT_EQUAL_FLOAT(1, result("(heap * 2 + 10) >= 3 * (1 + 1)"));
+    TEST_ASSERT_EQUAL_FLOAT(1, result("!(sample > 1000)"));
+    TEST_ASSERT_EQUAL_FLOAT(1, result("busy != 0 || uptime <= 10"));
+    TEST_ASSERT_EQUAL_FLOAT(26, result("sample * 2 + uptime * 2"));
+    TEST_ASSERT_EQUAL_FLOAT(-3, result("-sample"));
+}
+
+void test_errors(void)
+{
+    const char *sources[][2] = {
+        {"heap < -> publish", "syntax"},
+        {"foo > 1 -> publish", "unknown variable"},
+        {"heap > 1", "missing ->"},
+        {"heap > 1 -> gpio 7 blink", "bad gpio action"},
+        {"heap > 1 -> reboot", "unknown action"},
+        {"(heap > 1 -> publish", "missing )"},
+        {"heap > 1 -> publish now", "trailing text"},
+    };
+
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++)
+    {
+        TEST_ASSERT_FALSE_MESSAGE(rules->compile(1, sources[i][0]), sources[i][0]);
+        TEST_ASSERT_EQUAL_STRING(sources[i][1], rules->error);
+    }
+}
+
+// Flash, PSRAM, USB, UART0, the strapping pins and the missing 22-25 are
+// refused, so a saved rule cannot take them over at boot
+void test_output_pins(void)
+{
+    int refused[] = {0, 1, 2, 3, 4, 5, 6, 19, 20, 22, 25, 26, 30, 37, 43, 44, 45, 46, 49, 63, 64, 1000, -1};
+    int allowed[] = {7, 18, 21, 38, 42, 47, 48};
+    char source[RULE_SOURCE_LENGTH];
+
+    for (size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++)
+    {
+        snprintf(source, sizeof(source), "heap > 1 -> gpio %d on", refused[i]);
+
+        TEST_ASSERT_FALSE_MESSAGE(rules->compile(1, source), source);
+        TEST_ASSERT_EQUAL_STRING("bad pin", rules->error);
+    }
+
+    for (size_t i = 0; i < sizeof(allowed) / sizeof(allowed[0]); i++)
+    {
+        snprintf(source, sizeof(source), "heap > 1 -> gpio %d toggle", allowed[i]);
+
+        TEST_ASSERT_TRUE_MESSAGE(rules->compile(1, source), source);
+        TEST_ASSERT_EQUAL(allowed[i], find(1)->pin);
+        TEST_ASSERT_EQUAL(RULE_ACTION_GPIO_TOGGLE, find(1)->action);
+    }
+
+    // No pin at all until the firmware sets them
+    ruleSet fresh;
+
+    fresh.setVariables(names, 5);
+
+    TEST_ASSERT_FALSE(fresh.compile(1, "heap > 1 -> gpio 7 on"));
+}
+
+void test_replace_and_remove(void)
+{
+    for (int id = 0; id < RULE_MAX; id++)
+    {
+        TEST_ASSERT_TRUE(rules->compile(id, "heap > 1 -> publish"));
+    }
+
+    TEST_ASSERT_FALSE(rules->compile(RULE_MAX, "heap > 1 -> publish"));
+    TEST_ASSERT_EQUAL_STRING("full", rules->error);
+    TEST_ASSERT_TRUE(rules->compile(3, "heap > 2 -> gpio 8 off"));
+    TEST_ASSERT_EQUAL_STRING("heap > 2 -> gpio 8 off", find(3)->source);
+    TEST_ASSERT_TRUE(rules->remove(3));
+    TEST_ASSERT_FALSE(rules->remove(3));
+    TEST_ASSERT_TRUE(rules->compile(RULE_MAX, "heap > 1 -> publish"));
+}
+
+// Fires on the rising edge only
+void test_edge(void)
+{
+    float variables[5] = {50000, 0, 0, 0, 0};
+    unsigned long now = 0;
+
+    rules->compile(5, "heap < 40000 -> gpio 7 toggle");
+
+    rules->evaluate(variables, now += 2000, fire, NULL);
+    TEST_ASSERT_EQUAL(0, fired);
+
+    variables[0] = 30000;
+    rules->evaluate(variables, now += 2000, fire, NULL);
+    rules->evaluate(variables, now += 2000, fire, NULL);
+    TEST_ASSERT_EQUAL(1, fired);
+    TEST_ASSERT_EQUAL(5, lastId);
+
+    variables[0] = 50000;
+    rules->evaluate(variables, now += 2000, fire, NULL);
+    variables[0] = 30000;
+    rules->evaluate(variables, now += 2000, fire, NULL);
+    TEST_ASSERT_EQUAL(2, fired);
+}
+
+// A sample crossing the threshold at 250 Hz fires once per interval, and an
+// edge inside the interval still fires once it is over
+void test_min_interval(void)
+{
+    float variables[5] = {0, 0, 0, 0, 0};
+    unsigned long now = 1000000;
+
+    rules->compile(1, "sample > 100 -> publish");
+
+    for (int i = 0; i < 2500; i++)
+    {
+        variables[4] = i % 2 ? 200 : 0;
+        rules->evaluate(variables, now += 4, fire, NULL);
+    }
+
+    TEST_ASSERT_EQUAL(10000 / RULE_MIN_INTERVAL, fired);
+
+    // Turns true 10 ms after firing and stays true
+    fired = 0;
+    variables[4] = 0;
+    rules->evaluate(variables, now += RULE_MIN_INTERVAL, fire, NULL);
+    variables[4] = 200;
+    rules->evaluate(variables, now, fire, NULL);
+    variables[4] = 0;
+    rules->evaluate(variables, now += 5, fire, NULL);
+    variables[4] = 200;
+    rules->evaluate(variables, now += 5, fire, NULL);
+    TEST_ASSERT_EQUAL(1, fired);
+
+    rules->evaluate(variables, now += RULE_MIN_INTERVAL - 20, fire, NULL);
+    TEST_ASSERT_EQUAL(1, fired);
+
+    rules->evaluate(variables, now += 10, fire, NULL);
+    TEST_ASSERT_EQUAL(2, fired);
+
+    rules->evaluate(variables, now += 10 * RULE_MIN_INTERVAL, fire, NULL);
+    TEST_ASSERT_EQUAL(2, fired);
+}
+
+// Cost of one threshold rule and of the deepest one
+void test_benchmark(void)
+{
+    float variables[5] = {0, 0, 0, 0, 0};
+    volatile float sink = 0;
+    const int rounds = 20000000;
+    const char *sources[] = {"heap < 40000 -> gpio 7 toggle",
+                             "((((((((heap+1)+1)+1)+1)+1)+1)+1)+1) > 0 -> publish"};
+
+    for (int k = 0; k < 2; k++)
+    {
+        rules->compile(k, sources[k]);
+
+        const uint8_t *code = find(k)->code;
+        clock_t start = clock();
+
+        for (int i = 0; i < rounds; i++)
+        {
+            variables[0] = (float)(i & 65535);
+            sink += ruleSet::run(code, variables);
+        }
+
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+        printf("%s: %.1f ns\n", sources[k], seconds * 1e9 / rounds);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_expressions);
+    RUN_TEST(test_errors);
+    RUN_TEST(test_output_pins);
+    RUN_TEST(test_replace_and_remove);
+    RUN_TEST(test_edge);
+    RUN_TEST(test_min_interval);
+    RUN_TEST(test_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,139 @@
+#include <unity.h>
+#include <string.h>
+#include "tasks.h"
+
+// Each fake command logs its steps, so the order across tasks shows
+char steps[64];
+int stepCount;
+bool ready;
+
+int countTo3(commandTask *task)
+{
+    PT_BEGIN(&task->state);
+
+    while (task->progress < 3)
+    {
+        if (task->cancel)
+        {
+            PT_EXIT(&task->state);
+        }
+
+        steps[stepCount++] = task->cmd[0];
+        task->progress++;
+
+        PT_YIELD(&task->state);
+    }
+
+    PT_END(&task->state);
+}
+
+int waitReady(commandTask *task)
+{
+    PT_BEGIN(&task->state);
+
+    PT_WAIT_UNTIL(&task->state, ready || task->cancel);
+
+    steps[stepCount++] = task->cancel ? 'x' : 'w';
+
+    PT_END(&task->state);
+}
+
+void setUp(void)
+{
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        commandTasks[i].clear();
+    }
+
+    memset(steps, 0, sizeof(steps));
+    stepCount = 0;
+    ready = false;
+}
+
+void tearDown(void)
+{
+}
+
+void test_tasks_interleave(void)
+{
+    TEST_ASSERT_TRUE(startTask("a", countTo3));
+    TEST_ASSERT_TRUE(startTask("b", countTo3));
+
+    while (runTasks())
+    {
+    }
+
+    TEST_ASSERT_EQUAL_STRING("ababab", steps);
+}
+
+void test_waiting_task_does_not_block_others(void)
+{
+    TEST_ASSERT_TRUE(startTask("wait", waitReady));
+    TEST_ASSERT_TRUE(startTask("a", countTo3));
+
+    for (int i = 0; i < 5; i++)
+    {
+        TEST_ASSERT_TRUE(runTasks());
+    }
+
+    TEST_ASSERT_EQUAL_STRING("aaa", steps);
+
+    ready = true;
+
+    TEST_ASSERT_FALSE(runTasks());
+    TEST_ASSERT_EQUAL_STRING("aaaw", steps);
+}
+
+void test_same_command_runs_once(void)
+{
+    TEST_ASSERT_TRUE(startTask("a", countTo3));
+    TEST_ASSERT_FALSE(startTask("a", countTo3));
+
+    while (runTasks())
+    {
+    }
+
+    TEST_ASSERT_TRUE(startTask("a", countTo3));
+}
+
+void test_table_full(void)
+{
+    const char *names[] = {"a", "b", "c", "d"};
+
+    for (int i = 0; i < MAX_COMMAND_TASKS; i++)
+    {
+        TEST_ASSERT_TRUE(startTask(names[i], countTo3));
+    }
+
+    TEST_ASSERT_FALSE(startTask("e", countTo3));
+    TEST_ASSERT_FALSE(startTask("a name longer than the task table keeps", countTo3));
+}
+
+void test_cancel(void)
+{
+    TEST_ASSERT_TRUE(startTask("wait", waitReady));
+    TEST_ASSERT_TRUE(startTask("a", countTo3));
+
+    runTasks();
+
+    TEST_ASSERT_EQUAL_INT(1, cancelTasks("wait"));
+    TEST_ASSERT_EQUAL_INT(0, cancelTasks("missing"));
+
+    runTasks();
+
+    // The cancelled wait ends, the counter goes on
+    TEST_ASSERT_EQUAL_STRING("axa", steps);
+    TEST_ASSERT_EQUAL_INT(1, cancelTasks(""));
+    TEST_ASSERT_FALSE(runTasks());
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_tasks_interleave);
+    RUN_TEST(test_waiting_task_does_not_block_others);
+    RUN_TEST(test_same_command_runs_once);
+    RUN_TEST(test_table_full);
+    RUN_TEST(test_cancel);
+    return UNITY_END();
+}
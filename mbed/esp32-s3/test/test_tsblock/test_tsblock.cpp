@@ -0,0 +1,423 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "tsBlock.h"
+#include "tsStore.h"
+#include "memoryStorage.h"
+
+#define TEST_SAMPLES 1000
+#define TEST_START 1700000000UL
+#define TEST_STEP 10
+
+tsBlockEncoder encoder;
+tsSample samples[TEST_SAMPLES];
+
+memoryStorage storage;
+tsStore store("heap", &storage);
+tsQuery query;
+
+// Fills the encoder until it refuses a sample, returns how many it took
+int fill(uint32_t step, int32_t jitter)
+{
+    uint32_t time = 1700000000;
+    int32_t value = -50;
+    int count = 0;
+
+    while (count < TEST_SAMPLES)
+    {
+        tsSample sample = {time, value};
+
+        if (!encoder.add(sample))
+        {
+            break;
+        }
+
+        samples[count++] = sample;
+        time += step;
+        value += jitter > 0 ? (rand() % (2 * jitter + 1)) - jitter : 0;
+    }
+
+    return count;
+}
+
+void setUp(void)
+{
+    encoder.clear();
+    srand(1);
+
+    storage.reset();
+    store = tsStore("heap", &storage);
+}
+
+void tearDown(void)
+{
+}
+
+void test_round_trip(void)
+{
+    int count = fill(10, 5);
+    size_t length = encoder.finish();
+    tsBlockDecoder decoder;
+    tsSample sample;
+    int decoded = 0;
+
+    printf("%d samples in %u bytes\n", count, (unsigned)length);
+
+    TEST_ASSERT_TRUE(decoder.begin(encoder.data, length));
+
+    while (decoder.next(sample))
+    {
+        TEST_ASSERT_EQUAL_UINT32(samples[decoded].time, sample.time);
+        TEST_ASSERT_EQUAL_INT32(samples[decoded].value, sample.value);
+        decoded++;
+    }
+
+    TEST_ASSERT_EQUAL(count, decoded);
+
+    // Regular samples with small changes take two bytes each
+    TEST_ASSERT_GREATER_THAN(100, count);
+}
+
+void test_extreme_values(void)
+{
+    tsSample in[] = {{1, 0}, {2, -2147483647 - 1}, {3, 2147483647}, {3, 0}, {0xFFFFFFFF, -1}};
+    int count = sizeof(in) / sizeof(in[0]);
+    tsBlockDecoder decoder;
+    tsSample sample;
+
+    for (int i = 0; i < count; i++)
+    {
+        TEST_ASSERT_TRUE(encoder.add(in[i]));
+    }
+
+    TEST_ASSERT_TRUE(decoder.begin(encoder.data, encoder.finish()));
+
+    for (int i = 0; i < count; i++)
+    {
+        TEST_ASSERT_TRUE(decoder.next(sample));
+        TEST_ASSERT_EQUAL_UINT32(in[i].time, sample.time);
+        TEST_ASSERT_EQUAL_INT32(in[i].value, sample.value);
+    }
+
+    TEST_ASSERT_FALSE(decoder.next(sample));
+}
+
+void test_older_sample_refused(void)
+{
+    tsSample first = {100, 1};
+    tsSample older = {99, 1};
+
+    TEST_ASSERT_TRUE(encoder.add(first));
+    TEST_ASSERT_FALSE(encoder.add(older));
+    TEST_ASSERT_EQUAL(1, encoder.count);
+}
+
+// A full block takes nothing more until it is cleared, the store clears it
+// after a flush whether the write worked or not
+void test_full_block(void)
+{
+    int count = fill(1000000, 100000);
+    tsSample next = {0xFFFFFFF0, 0};
+
+    TEST_ASSERT_LESS_THAN(TEST_SAMPLES, count);
+    TEST_ASSERT_FALSE(encoder.add(next));
+    TEST_ASSERT_LESS_OR_EQUAL(TS_BLOCK_SIZE, encoder.length);
+
+    encoder.clear();
+
+    TEST_ASSERT_TRUE(encoder.add(next));
+    TEST_ASSERT_EQUAL(1, encoder.count);
+}
+
+void test_header(void)
+{
+    uint16_t count;
+    uint16_t length;
+    uint32_t firstTime;
+
+    fill(10, 5);
+
+    size_t size = encoder.finish();
+
+    TEST_ASSERT_TRUE(tsBlockDecoder::header(encoder.data, &count, &length, &firstTime));
+    TEST_ASSERT_EQUAL(encoder.count, count);
+    TEST_ASSERT_EQUAL(size, length);
+    TEST_ASSERT_EQUAL_UINT32(1700000000, firstTime);
+
+    encoder.data[0] = 0;
+    TEST_ASSERT_FALSE(tsBlockDecoder::header(encoder.data, &count, &length, &firstTime));
+}
+
+// Sample i of the store tests, every TEST_STEP seconds
+int32_t valueAt(uint32_t i)
+{
+    return (int32_t)((i * 7919) % 200) - 100;
+}
+
+uint32_t timeAt(uint32_t i)
+{
+    return TEST_START + i * TEST_STEP;
+}
+
+void appendSamples(uint32_t first, uint32_t count)
+{
+    for (uint32_t i = first; i < first + count; i++)
+    {
+        TEST_ASSERT_TRUE(store.append(timeAt(i), valueAt(i)));
+    }
+}
+
+// Queries [from, to] in sample numbers and checks every sample comes back
+// once, in order
+void checkQuery(uint32_t from, uint32_t to)
+{
+    tsSample sample;
+    uint32_t i = from;
+
+    query.begin(&store, timeAt(from), timeAt(to));
+
+    while (query.next(sample))
+    {
+        TEST_ASSERT_EQUAL_UINT32(timeAt(i), sample.time);
+        TEST_ASSERT_EQUAL_INT32(valueAt(i), sample.value);
+        i++;
+    }
+
+    query.end();
+
+    TEST_ASSERT_EQUAL_UINT32(to + 1, i);
+    TEST_ASSERT_EQUAL_UINT32(to - from + 1, query.count);
+    TEST_ASSERT_EQUAL(0, storage.openFiles);
+}
+
+std::string path(uint32_t start, const char *extension)
+{
+    char name[TS_PATH_LENGTH];
+
+    store.segmentPath(name, start, extension);
+
+    return name;
+}
+
+void test_store_round_trip(void)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+
+    appendSamples(0, 1000);
+
+    checkQuery(0, 999);
+    checkQuery(500, 500);
+
+    TEST_ASSERT_EQUAL(1, store.segments(starts));
+    TEST_ASSERT_EQUAL_UINT32(TEST_START, starts[0]);
+
+    // Nothing before the first or after the last sample
+    tsSample sample;
+
+    query.begin(&store, 0, TEST_START - 1);
+    TEST_ASSERT_FALSE(query.next(sample));
+    query.end();
+
+    query.begin(&store, timeAt(1000), timeAt(2000));
+    TEST_ASSERT_FALSE(query.next(sample));
+    query.end();
+}
+
+// The query binary searches the index, so it reads a handful of entries and
+// only the blocks from the one holding from
+void test_index_binary_search(void)
+{
+    appendSamples(0, 5000);
+    checkQuery(4000, 4010);
+
+    int entries = storage.files[path(TEST_START, "idx")].size() / 8;
+    int indexReads = storage.reads[path(TEST_START, "idx")];
+    int segmentReads = storage.reads[path(TEST_START, "seg")];
+    int steps = 0;
+
+    while ((1 << steps) <= entries)
+    {
+        steps++;
+    }
+
+    printf("%d blocks, %d index reads, %d segment reads\n", entries, indexReads, segmentReads);
+
+    TEST_ASSERT_GREATER_THAN(100, entries);
+    TEST_ASSERT_LESS_OR_EQUAL(steps, indexReads);
+    // Header and body of the three or four blocks the 11 samples span
+    TEST_ASSERT_LESS_OR_EQUAL(10, segmentReads);
+
+    // The first and the last block of the segment
+    checkQuery(1, 2);
+    checkQuery(4999, 4999);
+}
+
+// A segment is closed once TS_SEGMENT_SIZE is reached, the next one is
+// named after its first sample
+int fillSegments(int count)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+    uint32_t i = 0;
+
+    while (store.segments(starts) < count)
+    {
+        appendSamples(i, 1000);
+        i += 1000;
+    }
+
+    TEST_ASSERT_TRUE(store.flush());
+
+    return i;
+}
+
+void test_segment_roll(void)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+    int total = fillSegments(3);
+    int count = store.segments(starts);
+
+    TEST_ASSERT_EQUAL(3, count);
+    TEST_ASSERT_EQUAL_UINT32(TEST_START, starts[0]);
+
+    for (int i = 0; i < count; i++)
+    {
+        // Each starts on a sample, full ones are at least TS_SEGMENT_SIZE
+        TEST_ASSERT_EQUAL(0, (starts[i] - TEST_START) % TEST_STEP);
+        TEST_ASSERT_TRUE(storage.files.count(path(starts[i], "idx")) == 1);
+
+        if (i + 1 < count)
+        {
+            TEST_ASSERT_GREATER_OR_EQUAL(TS_SEGMENT_SIZE, storage.files[path(starts[i], "seg")].size());
+            TEST_ASSERT_LESS_THAN(TS_SEGMENT_SIZE + TS_BLOCK_SIZE, storage.files[path(starts[i], "seg")].size());
+        }
+    }
+
+    checkQuery(0, total - 1);
+}
+
+// Around each boundary, starting in one segment and ending in the next, and
+// from inside the first segment to the last
+void test_query_across_segments(void)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+    int total = fillSegments(3);
+
+    store.segments(starts);
+
+    for (int k = 1; k < 3; k++)
+    {
+        uint32_t boundary = (starts[k] - TEST_START) / TEST_STEP;
+
+        checkQuery(boundary - 1, boundary);
+        checkQuery(boundary - 50, boundary + 50);
+        checkQuery(boundary, boundary + 3);
+    }
+
+    checkQuery(100, total - 100);
+}
+
+// Segments are dropped once the next one starts before the retention
+// cutoff, the one holding the cutoff stays
+void test_compaction(void)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+    int total = fillSegments(4);
+
+    store.segments(starts);
+
+    uint32_t now = starts[2] + TS_RETENTION + TEST_STEP;
+
+    store.compact(now);
+
+    uint32_t kept[TS_MAX_SEGMENTS];
+
+    TEST_ASSERT_EQUAL(2, store.segments(kept));
+    TEST_ASSERT_EQUAL_UINT32(starts[2], kept[0]);
+    TEST_ASSERT_EQUAL_UINT32(starts[3], kept[1]);
+    TEST_ASSERT_TRUE(storage.files.count(path(starts[1], "idx")) == 0);
+
+    checkQuery((starts[2] - TEST_START) / TEST_STEP, total - 1);
+
+    // Not before the retention has passed
+    store.compact(TS_RETENTION - 1);
+
+    TEST_ASSERT_EQUAL(2, store.segments(kept));
+}
+
+// A block that cannot be written is counted as lost and the next one starts
+// a new segment
+void test_failed_write(void)
+{
+    uint32_t starts[TS_MAX_SEGMENTS];
+
+    appendSamples(0, 100);
+    TEST_ASSERT_TRUE(store.flush());
+
+    storage.failWrites = true;
+    appendSamples(100, 3);
+
+    TEST_ASSERT_FALSE(store.flush());
+    TEST_ASSERT_EQUAL_UINT32(3, store.lost);
+
+    storage.failWrites = false;
+    appendSamples(103, 100);
+
+    TEST_ASSERT_TRUE(store.flush());
+    TEST_ASSERT_EQUAL(2, store.segments(starts));
+    TEST_ASSERT_EQUAL_UINT32(timeAt(103), starts[1]);
+    TEST_ASSERT_EQUAL_UINT32(3, store.lost);
+
+    checkQuery(103, 202);
+}
+
+void test_store_benchmark(void)
+{
+    const uint32_t count = 200000;
+    tsSample sample;
+    uint32_t read = 0;
+
+    clock_t start = clock();
+
+    appendSamples(0, count);
+    store.flush();
+
+    double appendSeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+
+    query.begin(&store, timeAt(0), timeAt(count));
+
+    while (query.next(sample))
+    {
+        read++;
+    }
+
+    query.end();
+
+    double querySeconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    uint32_t starts[TS_MAX_SEGMENTS];
+
+    printf("%lu samples in %d segments: append %.0f ns, tsQuery::next %.0f ns per sample\n", (unsigned long)count,
+           store.segments(starts), appendSeconds * 1e9 / count, querySeconds * 1e9 / count);
+
+    TEST_ASSERT_EQUAL_UINT32(count, read);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_extreme_values);
+    RUN_TEST(test_older_sample_refused);
+    RUN_TEST(test_full_block);
+    RUN_TEST(test_header);
+    RUN_TEST(test_store_round_trip);
+    RUN_TEST(test_index_binary_search);
+    RUN_TEST(test_segment_roll);
+    RUN_TEST(test_query_across_segments);
+    RUN_TEST(test_compaction);
+    RUN_TEST(test_failed_write);
+    RUN_TEST(test_store_benchmark);
+    return UNITY_END();
+}
@@ -0,0 +1,178 @@
+#include <unity.h>
+#include <string.h>
+#include "websocket.h"
+
+// A client frame as a browser sends it: FIN, masked
+size_t clientFrame(uint8_t *out, uint8_t first, const char *text)
+{
+    const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    size_t length = strlen(text);
+    size_t header = 2;
+
+    out[0] = first;
+
+    if (length < 126)
+    {
+        out[1] = 0x80 | length;
+    }
+    else
+    {
+        out[1] = 0x80 | 126;
+        out[2] = length >> 8;
+        out[3] = length & 0xFF;
+        header = 4;
+    }
+
+    memcpy(out + header, mask, 4);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        out[header + 4 + i] = text[i] ^ mask[i % 4];
+    }
+
+    return header + 4 + length;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+void test_header_lengths(void)
+{
+    uint8_t header[WS_HEADER_MAX];
+
+    TEST_ASSERT_EQUAL(2, wsHeader(header, WS_TEXT, 125));
+    TEST_ASSERT_EQUAL_HEX8(0x81, header[0]);
+    TEST_ASSERT_EQUAL(125, header[1]);
+
+    // A reply larger than the receive frame is sent whole
+    TEST_ASSERT_EQUAL(4, wsHeader(header, WS_TEXT, 1000));
+    TEST_ASSERT_EQUAL(126, header[1]);
+    TEST_ASSERT_EQUAL(1000, (header[2] << 8) | header[3]);
+
+    TEST_ASSERT_EQUAL(WS_HEADER_MAX, wsHeader(header, WS_TEXT, 70000));
+    TEST_ASSERT_EQUAL(127, header[1]);
+    TEST_ASSERT_EQUAL(0x01, header[7]);
+    TEST_ASSERT_EQUAL(0x11, header[8]);
+    TEST_ASSERT_EQUAL(0x70, header[9]);
+}
+
+void test_parse_byte_by_byte(void)
+{
+    uint8_t data[64];
+    wsFrame frame;
+    size_t length = clientFrame(data, 0x80 | WS_TEXT, "CMD_PING");
+
+    for (size_t i = 1; i < length; i++)
+    {
+        TEST_ASSERT_EQUAL(WS_MORE, wsParse(data, i, 256, &frame));
+    }
+
+    TEST_ASSERT_EQUAL(WS_COMPLETE, wsParse(data, length, 256, &frame));
+    TEST_ASSERT_EQUAL(WS_TEXT, frame.opcode);
+    TEST_ASSERT_EQUAL(8, frame.length);
+    TEST_ASSERT_EQUAL(length, frame.size);
+    TEST_ASSERT_EQUAL_MEMORY("CMD_PING", frame.payload, 8);
+}
+
+void test_parse_errors(void)
+{
+    uint8_t data[512];
+    char text[300];
+    wsFrame frame;
+
+    // First part of a fragmented message, then a continuation
+    TEST_ASSERT_EQUAL(WS_FRAGMENTED, wsParse(data, clientFrame(data, WS_TEXT, "CMD_"), 256, &frame));
+    TEST_ASSERT_EQUAL(WS_FRAGMENTED, wsParse(data, clientFrame(data, 0x80, "PING"), 256, &frame));
+
+    memset(text, 'a', sizeof(text) - 1);
+    text[sizeof(text) - 1] = 0;
+    clientFrame(data, 0x80 | WS_TEXT, text);
+
+    // Refused as soon as the length is in, not after the payload
+    TEST_ASSERT_EQUAL(WS_TOO_BIG, wsParse(data, 4, 256, &frame));
+
+    data[0] = 0x81;
+    data[1] = 0x02;
+    TEST_ASSERT_EQUAL(WS_UNMASKED, wsParse(data, 2, 256, &frame));
+}
+
+void test_close_frame(void)
+{
+    uint8_t frame[WS_HEADER_MAX + 2];
+
+    TEST_ASSERT_EQUAL(4, wsClose(frame, WS_CLOSE_UNSUPPORTED));
+    TEST_ASSERT_EQUAL_HEX8(0x88, frame[0]);
+    TEST_ASSERT_EQUAL(2, frame[1]);
+    TEST_ASSERT_EQUAL(1003, (frame[2] << 8) | frame[3]);
+}
+
+void test_request_fields(void)
+{
+    const char *request = "GET /?x=1&token=s3cret HTTP/1.1\r\n"
+                          "Host: 192.168.1.20:81\r\n"
+                          "origin: http://192.168.1.20\r\n"
+                          "Sec-WebSocket-Key:  dGhlIHNhbXBsZSBub25jZQ== \r\n"
+                          "\r\n";
+    char value[32];
+    char small[8];
+
+    TEST_ASSERT_EQUAL(24, httpHeader(request, "Sec-WebSocket-Key", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("dGhlIHNhbXBsZSBub25jZQ==", value);
+
+    TEST_ASSERT_EQUAL(19, httpHeader(request, "Origin", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("http://192.168.1.20", value);
+
+    // Too long for the buffer: the length says so and nothing is copied
+    TEST_ASSERT_EQUAL(19, httpHeader(request, "Origin", small, sizeof(small)));
+    TEST_ASSERT_EQUAL_STRING("", small);
+
+    TEST_ASSERT_EQUAL(-1, httpHeader(request, "X-Api-Token", value, sizeof(value)));
+    TEST_ASSERT_EQUAL(-1, httpHeader(request, "GET /?x", value, sizeof(value)));
+
+    TEST_ASSERT_EQUAL(6, httpQuery(request, "token", value, sizeof(value)));
+    TEST_ASSERT_EQUAL_STRING("s3cret", value);
+    TEST_ASSERT_EQUAL(-1, httpQuery(request, "tok", value, sizeof(value)));
+    TEST_ASSERT_EQUAL(-1, httpQuery("GET / HTTP/1.1\r\n\r\n", "token", value, sizeof(value)));
+}
+
+void test_token(void)
+{
+    TEST_ASSERT_TRUE(tokenMatches("s3cret", "s3cret"));
+    TEST_ASSERT_FALSE(tokenMatches("s3cre", "s3cret"));
+    TEST_ASSERT_FALSE(tokenMatches("s3cretx", "s3cret"));
+    TEST_ASSERT_FALSE(tokenMatches("S3cret", "s3cret"));
+
+    // Without a configured token nothing gets in
+    TEST_ASSERT_FALSE(tokenMatches("", ""));
+}
+
+void test_origin(void)
+{
+    TEST_ASSERT_TRUE(originAllowed("", "192.168.1.20"));
+    TEST_ASSERT_TRUE(originAllowed(NULL, "192.168.1.20"));
+    TEST_ASSERT_TRUE(originAllowed("http://192.168.1.20", "192.168.1.20"));
+    TEST_ASSERT_TRUE(originAllowed("http://192.168.1.20:81", "192.168.1.20"));
+
+    TEST_ASSERT_FALSE(originAllowed("http://192.168.1.200", "192.168.1.20"));
+    TEST_ASSERT_FALSE(originAllowed("http://192.168.1.20.evil.example", "192.168.1.20"));
+    TEST_ASSERT_FALSE(originAllowed("https://evil.example", "192.168.1.20"));
+    TEST_ASSERT_FALSE(originAllowed("null", "192.168.1.20"));
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_header_lengths);
+    RUN_TEST(test_parse_byte_by_byte);
+    RUN_TEST(test_parse_errors);
+    RUN_TEST(test_close_frame);
+    RUN_TEST(test_request_fields);
+    RUN_TEST(test_token);
+    RUN_TEST(test_origin);
+    return UNITY_END();
+}
@@ -4,6 +4,7 @@ import { Server as SocketIOServer } from 'socket.io';
 import http from 'http';
 import socketIO from './protocols/socketIO';
 import mqttClient from './protocols/mqtt';
+import { LZ_MAGIC, lzDecompress } from './protocols/lz';
 
 const server = http.createServer();
 
@@ -22,7 +23,15 @@ io.on('connection', socketIO);
 
 mqttClient.on('message', function (topic: string, message: Buffer) {
   if (topic === process.env.MQTT_TOPIC_NODE) {
-    const arr: string[] = message.toString().split('/');
+    // Compressed replies start with LZ_MAGIC, plain ones with the MAC
+    const payload = message[0] === LZ_MAGIC ? lzDecompress(message) : message;
+
+    if (payload === null) {
+      console.log('dropped a reply that does not decompress');
+      return;
+    }
+
+    const arr: string[] = payload.toString().split('/');
     const mac: string = arr[0];
 
     const cmd: string = arr[1];
@@ -0,0 +1,82 @@
+// Decoder for the LZSS replies of the firmware (mbed/esp32-s3/src/lz.cpp).
+// A compressed payload starts with LZ_MAGIC then the id of the dictionary it
+// was made with, the id is derived from the dictionary bytes.
+
+export const LZ_MAGIC = 0xc5;
+
+const LZ_HEADER = 2;
+const LZ_MIN_MATCH = 3;
+
+// Same bytes as compressDictionary in mbed/esp32-s3/src/compression.cpp
+const dictionary = Buffer.from(
+  'CMD_UPDATE_FIRMWARE/CMD_BOOT/init:0,config:wifi_begin:wifi:mqtt:CMD_GROUP/CMD_AGG/samples/CMD_CANCEL/CMD_BATCH/' +
+    '/OK/CMD_STATUS/FAIL/SKIP/BUSY/IDLE/CMD_TS_QUERY/heap/rssi/END/CMD_PING/NOT_BUSY/',
+  'latin1'
+);
+
+// FNV-1a folded to one byte, never 0
+export const dictionaryId = (bytes: Buffer): number => {
+  let hash = 2166136261;
+
+  for (let i = 0; i < bytes.length; i++) {
+    hash = Math.imul(hash ^ bytes[i], 16777619) >>> 0;
+  }
+
+  const id = (hash ^ (hash >>> 8) ^ (hash >>> 16) ^ (hash >>> 24)) & 0xff;
+
+  return id !== 0 ? id : 1;
+};
+
+const dictionaries: { [id: number]: Buffer } = {
+  0: Buffer.alloc(0),
+  [dictionaryId(dictionary)]: dictionary,
+};
+
+// Returns null for a corrupt stream or an unknown dictionary
+export const lzDecompress = (message: Buffer): Buffer | null => {
+  if (message.length < LZ_HEADER || message[0] !== LZ_MAGIC) {
+    return null;
+  }
+
+  const dict = dictionaries[message[1]];
+
+  if (dict === undefined) {
+    return null;
+  }
+
+  const out: number[] = [];
+  let i = LZ_HEADER;
+
+  while (i < message.length) {
+    const flags = message[i++];
+
+    for (let item = 0; item < 8 && i < message.length; item++) {
+      if ((flags & (1 << item)) === 0) {
+        out.push(message[i++]);
+        continue;
+      }
+
+      if (i + 2 > message.length) {
+        return null;
+      }
+
+      const code = (message[i] << 8) | message[i + 1];
+      const distance = (code >> 6) + 1;
+      const count = (code & 0x3f) + LZ_MIN_MATCH;
+
+      i += 2;
+
+      if (distance > out.length + dict.length) {
+        return null;
+      }
+
+      for (let k = 0; k < count; k++) {
+        const source = out.length - distance;
+
+        out.push(source >= 0 ? out[source] : dict[dict.length + source]);
+      }
+    }
+  }
+
+  return Buffer.from(out);
+};